@@ -7,7 +7,21 @@
 // Default data folder path. Can be changed with -data-dir command line option.
 static std::string  g_data_dir = "./../data";
 
+static thread_local int error_exception_scope_depth = 0;
+
+Error_Exception_Scope::Error_Exception_Scope() {
+    error_exception_scope_depth++;
+}
+
+Error_Exception_Scope::~Error_Exception_Scope() {
+    ASSERT(error_exception_scope_depth > 0);
+    error_exception_scope_depth--;
+}
+
 void error(const std::string& message) {
+    if (error_exception_scope_depth > 0)
+        throw Error_Exception{ message };
+
     printf("\nError: %s\n", message.c_str());
 #ifdef _WIN32
     __debugbreak();
@@ -16,9 +30,18 @@ void error(const std::string& message) {
 }
 
 void error(const char* format, ...) {
-    printf("\nError: ");
     va_list args;
     va_start(args, format);
+    if (error_exception_scope_depth > 0) {
+        va_list args_copy;
+        va_copy(args_copy, args);
+        std::string message(std::max(vsnprintf(nullptr, 0, format, args_copy), 0), '\0');
+        va_end(args_copy);
+        vsnprintf(message.data(), message.size() + 1, format, args);
+        va_end(args);
+        throw Error_Exception{ message };
+    }
+    printf("\nError: ");
     vprintf(format, args);
     va_end(args);
 #ifdef _WIN32
@@ -82,6 +105,11 @@ std::string get_project_unique_name(const std::string& scene_path) {
     return oss.str();
 }
 
+uint64_t get_data_hash(const void* data, size_t size) {
+    meow_u128 hash_128 = MeowHash(MeowDefaultSeed, size, const_cast<void*>(data));
+    return MeowU64From(hash_128, 0);
+}
+
 std::string get_spirv_file(const char* spirv_base_name)
 {
     return (get_data_directory() / "spirv" / (std::string(spirv_base_name) + ".spv")).string();
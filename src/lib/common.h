@@ -4,6 +4,7 @@
 #define ENABLE_PROFILING 1
 #define ENABLE_INVALID_FP_EXCEPTION 1
 #define ENABLE_PREFETCH 1
+#define ENABLE_RAY_STATS 1
 
 #if ENABLE_ASSERT
 #define ASSERT(expression) if (expression) {} else __debugbreak()
@@ -14,6 +15,17 @@
 void error(const std::string& message);
 void error(const char* format, ...);
 
+// By default error() prints the message and terminates the application. Inside Error_Exception_Scope
+// error() throws Error_Exception instead. It is used when invalid input should not stop the application
+// (render server). The scope affects only the current thread.
+struct Error_Exception {
+    std::string message;
+};
+struct Error_Exception_Scope {
+    Error_Exception_Scope();
+    ~Error_Exception_Scope();
+};
+
 namespace fs = std::filesystem;
 bool fs_exists(const fs::path& path);
 bool fs_create_directories(const fs::path& path);
@@ -35,6 +47,9 @@ fs::path get_data_directory();
 // scene's additional data between multiple projects.
 std::string get_project_unique_name(const std::string & scene_path);
 
+// Fast non-cryptographic 64-bit hash of the data. Can be used to detect corrupted data.
+uint64_t get_data_hash(const void* data, size_t size);
+
 std::vector<uint8_t> read_binary_file(const std::string& file_path);
 std::string read_text_file(const std::string& file_path);
 
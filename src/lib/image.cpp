@@ -162,45 +162,51 @@ bool Image::write_tga(const std::string& file_path) const {
 
 bool Image::write_exr(const std::string& file_path, bool compress_image, const std::vector<EXRAttribute>& custom_attributes) const
 {
-    std::vector<float> channels[3];
-    channels[0].resize(width * height);
-    channels[1].resize(width * height);
-    channels[2].resize(width * height);
+    struct Channel {
+        std::string name;
+        const float* data = nullptr;
+        int output_type = TINYEXR_PIXELTYPE_HALF;
+    };
+
+    std::vector<float> rgb_channels[3];
+    for (int c = 0; c < 3; c++)
+        rgb_channels[c].resize(width * height);
     for (int i = 0; i < width * height; i++) {
-        channels[0][i] = data[i].r;
-        channels[1][i] = data[i].g;
-        channels[2][i] = data[i].b;
+        rgb_channels[0][i] = data[i].r;
+        rgb_channels[1][i] = data[i].g;
+        rgb_channels[2][i] = data[i].b;
     }
 
-    float* channel_pointers_in_BGR_order[3] = {
-        channels[2].data(), // B
-        channels[1].data(), // G
-        channels[0].data()  // R
-    };
+    std::vector<Channel> channels;
+    channels.push_back(Channel{ "R", rgb_channels[0].data(), TINYEXR_PIXELTYPE_HALF });
+    channels.push_back(Channel{ "G", rgb_channels[1].data(), TINYEXR_PIXELTYPE_HALF });
+    channels.push_back(Channel{ "B", rgb_channels[2].data(), TINYEXR_PIXELTYPE_HALF });
+    for (const Image_Channel& extra_channel : extra_channels) {
+        ASSERT(extra_channel.data.size() == size_t(width * height));
+        ASSERT(extra_channel.name.size() < 256);
+        channels.push_back(Channel{ extra_channel.name, extra_channel.data.data(), TINYEXR_PIXELTYPE_FLOAT });
+    }
+    // OpenEXR stores the channels sorted by name.
+    std::sort(channels.begin(), channels.end(), [](const Channel& a, const Channel& b) { return a.name < b.name; });
+
+    const int channel_count = (int)channels.size();
+    std::vector<const float*> channel_pointers(channel_count);
+    std::vector<EXRChannelInfo> channel_infos(channel_count);
+    std::vector<int> input_component_types(channel_count, TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<int> output_component_types(channel_count);
+    for (int i = 0; i < channel_count; i++) {
+        channel_pointers[i] = channels[i].data;
+        memset(&channel_infos[i], 0, sizeof(EXRChannelInfo));
+        strcpy(channel_infos[i].name, channels[i].name.c_str());
+        output_component_types[i] = channels[i].output_type;
+    }
 
     EXRImage exr_image;
     InitEXRImage(&exr_image);
-    exr_image.images = (unsigned char**)channel_pointers_in_BGR_order;
+    exr_image.images = (unsigned char**)channel_pointers.data();
     exr_image.width = width;
     exr_image.height = height;
-    exr_image.num_channels = 3;
-
-    EXRChannelInfo channel_infos[3];
-    memset(channel_infos, 0, sizeof(channel_infos));
-    channel_infos[0].name[0] = 'B';
-    channel_infos[1].name[0] = 'G';
-    channel_infos[2].name[0] = 'R';
-
-    int input_component_types[3] = {
-        TINYEXR_PIXELTYPE_FLOAT,
-        TINYEXR_PIXELTYPE_FLOAT,
-        TINYEXR_PIXELTYPE_FLOAT
-    };
-    int output_component_types[3] = {
-        TINYEXR_PIXELTYPE_HALF,
-        TINYEXR_PIXELTYPE_HALF,
-        TINYEXR_PIXELTYPE_HALF
-    };
+    exr_image.num_channels = channel_count;
 
     EXRHeader exr_header;
     InitEXRHeader(&exr_header);
@@ -208,11 +214,11 @@ bool Image::write_exr(const std::string& file_path, bool compress_image, const s
         exr_header.num_custom_attributes = (int)custom_attributes.size();
         exr_header.custom_attributes = const_cast<EXRAttribute*>(custom_attributes.data());
     }
-    exr_header.channels = channel_infos;
-    exr_header.pixel_types = input_component_types;
-    exr_header.num_channels = 3;
+    exr_header.channels = channel_infos.data();
+    exr_header.pixel_types = input_component_types.data();
+    exr_header.num_channels = channel_count;
     exr_header.compression_type = compress_image ? TINYEXR_COMPRESSIONTYPE_ZIP : TINYEXR_COMPRESSIONTYPE_NONE;
-    exr_header.requested_pixel_types = output_component_types;
+    exr_header.requested_pixel_types = output_component_types.data();
 
     const char* err = nullptr;
     int result = SaveEXRImageToFile(&exr_image, &exr_header, file_path.c_str(), &err);
@@ -224,33 +230,220 @@ bool Image::write_exr(const std::string& file_path, bool compress_image, const s
     return result == TINYEXR_SUCCESS;
 }
 
-void Image::extend_to_region(Vector2i size, Vector2i offset) {
-    ASSERT(offset.x + width <= size.x);
-    ASSERT(offset.y + height <= size.y);
-
-    const ColorRGB* src_pixel = data.data();
-    std::vector<ColorRGB> film_pixels(size.x * size.y, Color_Black);
-    ColorRGB* dst_pixel = &film_pixels[offset.y * size.x + offset.x];
+template <typename T>
+static void extend_pixels_to_region(std::vector<T>& pixels, int width, int height, Vector2i size, Vector2i offset, T fill_value)
+{
+    const T* src_pixel = pixels.data();
+    std::vector<T> film_pixels(size.x * size.y, fill_value);
+    T* dst_pixel = &film_pixels[offset.y * size.x + offset.x];
 
     for (int y = 0; y < height; y++) {
-        memcpy(dst_pixel, src_pixel, width * sizeof(ColorRGB));
+        memcpy(dst_pixel, src_pixel, width * sizeof(T));
         src_pixel += width;
         dst_pixel += size.x;
     }
-    data.swap(film_pixels);
-    width = size.x;
-    height = size.y;
+    pixels.swap(film_pixels);
 }
 
-void Image::flip_horizontally()
+template <typename T>
+static void flip_pixels_horizontally(std::vector<T>& pixels, int width, int height)
 {
-    ColorRGB* row = data.data();
+    T* row = pixels.data();
     for (int y = 0; y < height; y++) {
-        ColorRGB* here = row;
-        ColorRGB* there = row + width - 1;
+        T* here = row;
+        T* there = row + width - 1;
         while (here < there) {
             std::swap(*here++, *there--);
         }
         row += width;
     }
 }
+
+void Image::extend_to_region(Vector2i size, Vector2i offset) {
+    ASSERT(offset.x + width <= size.x);
+    ASSERT(offset.y + height <= size.y);
+
+    extend_pixels_to_region(data, width, height, size, offset, Color_Black);
+    for (Image_Channel& channel : extra_channels)
+        extend_pixels_to_region(channel.data, width, height, size, offset, 0.f);
+
+    width = size.x;
+    height = size.y;
+}
+
+void Image::flip_horizontally()
+{
+    flip_pixels_horizontally(data, width, height);
+    for (Image_Channel& channel : extra_channels)
+        flip_pixels_horizontally(channel.data, width, height);
+}
+
+const Image_Channel* Image::find_extra_channel(const std::string& name) const
+{
+    for (const Image_Channel& channel : extra_channels) {
+        if (channel.name == name)
+            return &channel;
+    }
+    return nullptr;
+}
+
+//
+// EXR_Scanline_Writer
+//
+EXR_Scanline_Writer::~EXR_Scanline_Writer()
+{
+    if (file.is_open()) {
+        close();
+    }
+}
+
+static void write_exr_attribute(std::ofstream& file, const char* name, const char* type, const void* value, int size)
+{
+    file.write(name, strlen(name) + 1);
+    file.write(type, strlen(type) + 1);
+    file.write(reinterpret_cast<const char*>(&size), sizeof(int));
+    file.write(reinterpret_cast<const char*>(value), size);
+}
+
+bool EXR_Scanline_Writer::open(const std::string& file_path, int width, int height, bool compress_image,
+    const std::vector<EXRAttribute>& custom_attributes)
+{
+    ASSERT(width > 0 && height > 0);
+    file.open(file_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!file)
+        return false;
+
+    this->width = width;
+    this->height = height;
+    this->compress_image = compress_image;
+    // The number of scanlines per chunk is defined by the compression method.
+    lines_per_chunk = compress_image ? 16 : 1;
+    chunk_data.resize(size_t(lines_per_chunk) * width * 3);
+
+    const uint8_t magic_and_version[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+    file.write(reinterpret_cast<const char*>(magic_and_version), sizeof(magic_and_version));
+
+    // Channels are stored in alphabetical order.
+    std::vector<char> channels;
+    for (char channel_name : { 'B', 'G', 'R' }) {
+        const int32_t pixel_type = 1; // HALF
+        const uint8_t linear_and_reserved[4] = { 0, 0, 0, 0 };
+        const int32_t sampling[2] = { 1, 1 };
+        channels.push_back(channel_name);
+        channels.push_back('\0');
+        channels.insert(channels.end(), reinterpret_cast<const char*>(&pixel_type), reinterpret_cast<const char*>(&pixel_type + 1));
+        channels.insert(channels.end(), linear_and_reserved, linear_and_reserved + 4);
+        channels.insert(channels.end(), reinterpret_cast<const char*>(sampling), reinterpret_cast<const char*>(sampling + 2));
+    }
+    channels.push_back('\0');
+
+    const uint8_t compression = compress_image ? 3 : 0; // ZIP_COMPRESSION : NO_COMPRESSION
+    const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+    const uint8_t line_order = 0; // INCREASING_Y
+    const float pixel_aspect_ratio = 1.f;
+    const float screen_window_center[2] = { 0.f, 0.f };
+    const float screen_window_width = 1.f;
+
+    write_exr_attribute(file, "channels", "chlist", channels.data(), (int)channels.size());
+    write_exr_attribute(file, "compression", "compression", &compression, sizeof(compression));
+    write_exr_attribute(file, "dataWindow", "box2i", window, sizeof(window));
+    write_exr_attribute(file, "displayWindow", "box2i", window, sizeof(window));
+    write_exr_attribute(file, "lineOrder", "lineOrder", &line_order, sizeof(line_order));
+    write_exr_attribute(file, "pixelAspectRatio", "float", &pixel_aspect_ratio, sizeof(float));
+    write_exr_attribute(file, "screenWindowCenter", "v2f", screen_window_center, sizeof(screen_window_center));
+    write_exr_attribute(file, "screenWindowWidth", "float", &screen_window_width, sizeof(float));
+
+    for (const EXRAttribute& attribute : custom_attributes) {
+        std::streamoff value_position = std::streamoff(file.tellp()) +
+            strlen(attribute.name) + 1 + strlen(attribute.type) + 1 + sizeof(int);
+        attribute_positions.push_back({ attribute.name, value_position });
+        write_exr_attribute(file, attribute.name, attribute.type, attribute.value, attribute.size);
+    }
+    file.put('\0'); // end of header
+
+    // Offset table is filled when the file is closed.
+    const int chunk_count = (height + lines_per_chunk - 1) / lines_per_chunk;
+    offset_table_position = file.tellp();
+    std::vector<uint64_t> zero_offsets(chunk_count, 0);
+    file.write(reinterpret_cast<const char*>(zero_offsets.data()), chunk_count * sizeof(uint64_t));
+    chunk_offsets.reserve(chunk_count);
+
+    return !file.fail();
+}
+
+bool EXR_Scanline_Writer::write_rows(const ColorRGB* pixels, int row_count)
+{
+    ASSERT(written_row_count + row_count <= height);
+    for (int y = 0; y < row_count; y++) {
+        uint16_t* row_data = &chunk_data[size_t(chunk_row_count) * width * 3];
+        const ColorRGB* row_pixels = pixels + size_t(y) * width;
+        for (int x = 0; x < width; x++) {
+            tinyexr::FP32 r, g, b;
+            r.f = row_pixels[x].r;
+            g.f = row_pixels[x].g;
+            b.f = row_pixels[x].b;
+            row_data[x] = tinyexr::float_to_half_full(b).u;
+            row_data[width + x] = tinyexr::float_to_half_full(g).u;
+            row_data[2 * width + x] = tinyexr::float_to_half_full(r).u;
+        }
+        chunk_row_count++;
+        written_row_count++;
+
+        if (chunk_row_count == lines_per_chunk || written_row_count == height) {
+            if (!flush_chunk())
+                return false;
+        }
+    }
+    return true;
+}
+
+bool EXR_Scanline_Writer::flush_chunk()
+{
+    ASSERT(chunk_row_count > 0);
+    const int32_t chunk_y = written_row_count - chunk_row_count;
+    const size_t data_size = size_t(chunk_row_count) * width * 3 * sizeof(uint16_t);
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(chunk_data.data());
+
+    std::vector<unsigned char> compressed_data;
+    int32_t stored_size = (int32_t)data_size;
+    if (compress_image) {
+        // CompressZip stores uncompressed data when compression does not reduce the size.
+        compressed_data.resize(data_size + data_size / 2 + 1024);
+        tinyexr::tinyexr_uint64 compressed_size = 0;
+        tinyexr::CompressZip(compressed_data.data(), compressed_size, data, (unsigned long)data_size);
+        data = compressed_data.data();
+        stored_size = (int32_t)compressed_size;
+    }
+
+    chunk_offsets.push_back(uint64_t(std::streamoff(file.tellp())));
+    file.write(reinterpret_cast<const char*>(&chunk_y), sizeof(int32_t));
+    file.write(reinterpret_cast<const char*>(&stored_size), sizeof(int32_t));
+    file.write(reinterpret_cast<const char*>(data), stored_size);
+
+    chunk_row_count = 0;
+    return !file.fail();
+}
+
+bool EXR_Scanline_Writer::update_attribute(const char* name, const void* value, int size)
+{
+    for (const auto& [attribute_name, position] : attribute_positions) {
+        if (attribute_name == name) {
+            std::streampos current_position = file.tellp();
+            file.seekp(position);
+            file.write(reinterpret_cast<const char*>(value), size);
+            file.seekp(current_position);
+            return !file.fail();
+        }
+    }
+    return false;
+}
+
+bool EXR_Scanline_Writer::close()
+{
+    ASSERT(written_row_count == height);
+    file.seekp(offset_table_position);
+    file.write(reinterpret_cast<const char*>(chunk_offsets.data()), chunk_offsets.size() * sizeof(uint64_t));
+    bool success = !file.fail();
+    file.close();
+    return success;
+}
@@ -4,10 +4,18 @@
 
 struct _EXRAttribute; // from tinyexr library
 
+// Additional single-channel layer of the image (for example, depth or a normal component).
+// It has the same dimensions as the color data and is stored as 32-bit float in OpenEXR file.
+struct Image_Channel {
+    std::string name;
+    std::vector<float> data;
+};
+
 struct Image {
     int width = 0;
     int height = 0;
     std::vector<ColorRGB> data;
+    std::vector<Image_Channel> extra_channels;
 
     Image() = default;
     Image(int width, int height);
@@ -19,4 +27,42 @@ struct Image {
 
     void extend_to_region(Vector2i size, Vector2i offset);
     void flip_horizontally();
+
+    // Returns null if the image does not have the channel with the given name.
+    const Image_Channel* find_extra_channel(const std::string& name) const;
+};
+
+// Writes OpenEXR scanline image incrementally, so the entire image does not have to be
+// kept in memory. The rows are written from top to bottom. Pixels are stored as half floats.
+struct EXR_Scanline_Writer {
+    ~EXR_Scanline_Writer();
+
+    bool open(const std::string& file_path, int width, int height, bool compress_image,
+        const std::vector<_EXRAttribute>& custom_attributes);
+
+    // 'pixels' contains row_count * width pixels.
+    bool write_rows(const ColorRGB* pixels, int row_count);
+
+    // Custom attribute value can be updated until the file is closed. The size of the value can't change.
+    bool update_attribute(const char* name, const void* value, int size);
+
+    // Should be called after all rows are written.
+    bool close();
+
+private:
+    bool flush_chunk();
+
+    std::ofstream file;
+    int width = 0;
+    int height = 0;
+    bool compress_image = false;
+    int lines_per_chunk = 0;
+    int written_row_count = 0;
+
+    std::vector<uint16_t> chunk_data; // half float channels (B, G, R) for each row of the chunk
+    int chunk_row_count = 0;
+
+    std::streamoff offset_table_position = 0;
+    std::vector<uint64_t> chunk_offsets;
+    std::vector<std::pair<std::string, std::streamoff>> attribute_positions; // attribute name -> value offset
 };
@@ -0,0 +1,171 @@
+#include "std.h"
+#include "common.h"
+#include "job_system.h"
+
+namespace {
+struct Job {
+    std::function<void()> func;
+    Job_Group* group = nullptr;
+};
+
+struct Job_Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+struct Job_System {
+    // Queue 0 is shared by the threads that are not job system workers.
+    // Queue i (i > 0) belongs to the worker thread i.
+    std::vector<std::unique_ptr<Job_Queue>> queues;
+    std::vector<std::jthread> workers;
+
+    std::mutex wake_mutex;
+    std::condition_variable wake_condition;
+    std::atomic_int queued_job_count{ 0 };
+    bool shutdown_requested = false;
+
+    ~Job_System() {
+        shutdown_job_system();
+    }
+};
+}
+
+static Job_System job_system;
+static thread_local int current_queue_index = 0;
+
+static bool get_job(int queue_index, Job* job)
+{
+    const int queue_count = (int)job_system.queues.size();
+
+    // Take the most recent job from our own queue.
+    {
+        Job_Queue& queue = *job_system.queues[queue_index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            *job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            job_system.queued_job_count--;
+            return true;
+        }
+    }
+    // Steal the oldest job from other queues.
+    for (int i = 1; i < queue_count; i++) {
+        Job_Queue& queue = *job_system.queues[(queue_index + i) % queue_count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            *job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            job_system.queued_job_count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_job(Job& job)
+{
+    job.func();
+    if (job.group->unfinished_job_count.fetch_sub(1) == 1) {
+        // Wake up the threads that wait for this group.
+        std::lock_guard<std::mutex> lock(job_system.wake_mutex);
+        job_system.wake_condition.notify_all();
+    }
+}
+
+static void worker_thread_func(int queue_index)
+{
+    initialize_fp_state();
+    current_queue_index = queue_index;
+
+    while (true) {
+        Job job;
+        if (get_job(queue_index, &job)) {
+            run_job(job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(job_system.wake_mutex);
+        job_system.wake_condition.wait(lock, [] {
+            return job_system.shutdown_requested || job_system.queued_job_count > 0;
+        });
+        if (job_system.shutdown_requested && job_system.queued_job_count == 0)
+            break;
+    }
+}
+
+void initialize_job_system(int thread_count)
+{
+    ASSERT(thread_count > 0);
+    if (thread_count == get_job_system_thread_count())
+        return;
+
+    shutdown_job_system();
+
+    job_system.queues.resize(thread_count);
+    for (std::unique_ptr<Job_Queue>& queue : job_system.queues)
+        queue = std::make_unique<Job_Queue>();
+
+    job_system.shutdown_requested = false;
+    job_system.workers.reserve(thread_count - 1);
+    for (int i = 1; i < thread_count; i++)
+        job_system.workers.push_back(std::jthread(worker_thread_func, i));
+}
+
+void shutdown_job_system()
+{
+    if (job_system.queues.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(job_system.wake_mutex);
+        job_system.shutdown_requested = true;
+    }
+    job_system.wake_condition.notify_all();
+    job_system.workers.clear(); // joins worker threads
+    job_system.queues.clear();
+}
+
+int get_job_system_thread_count()
+{
+    return (int)job_system.queues.size();
+}
+
+void submit_job(Job_Group* group, std::function<void()> job)
+{
+    ASSERT(!job_system.queues.empty());
+    group->unfinished_job_count++;
+    {
+        Job_Queue& queue = *job_system.queues[current_queue_index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(Job{ std::move(job), group });
+        job_system.queued_job_count++;
+    }
+    // Synchronize with the threads that are about to sleep, otherwise the notification can be lost.
+    {
+        std::lock_guard<std::mutex> lock(job_system.wake_mutex);
+    }
+    job_system.wake_condition.notify_one();
+}
+
+void wait_for_job_group(Job_Group* group)
+{
+    while (group->unfinished_job_count > 0) {
+        Job job;
+        if (get_job(current_queue_index, &job)) {
+            run_job(job);
+            continue;
+        }
+        // The remaining jobs from the group are being executed by other threads.
+        std::unique_lock<std::mutex> lock(job_system.wake_mutex);
+        job_system.wake_condition.wait(lock, [group] {
+            return group->unfinished_job_count == 0 || job_system.queued_job_count > 0;
+        });
+    }
+}
+
+void parallel_for(int count, const std::function<void(int index)>& job_func)
+{
+    Job_Group group;
+    for (int i = 0; i < count; i++) {
+        submit_job(&group, [&job_func, i] { job_func(i); });
+    }
+    wait_for_job_group(&group);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Job system that is shared by all parallel stages of the program (texture loading,
+// kdtree building, rendering). The worker threads are created once and persist
+// between the stages, so we don't pay thread creation cost each time and the configured
+// thread count is respected everywhere.
+//
+// Each worker has its own job queue. The jobs submitted from the worker thread are added
+// to the worker's queue, the jobs submitted from other threads are added to the shared queue.
+// The worker takes the most recent job from its own queue and when the queue is empty
+// it steals the oldest job from other queues.
+//
+// The thread that waits for the job group also executes the jobs, so the job system
+// creates (thread_count - 1) worker threads.
+
+struct Job_Group {
+    std::atomic_int unfinished_job_count{ 0 };
+};
+
+// Starts worker threads. If the job system is already initialized with
+// a different thread count then the workers are restarted.
+void initialize_job_system(int thread_count);
+void shutdown_job_system();
+int get_job_system_thread_count();
+
+void submit_job(Job_Group* group, std::function<void()> job);
+
+// Executes pending jobs until all the jobs from the group are finished.
+void wait_for_job_group(Job_Group* group);
+
+// Runs job_func(index) for each index from [0, count) range and waits for completion.
+void parallel_for(int count, const std::function<void(int index)>& job_func);
@@ -42,3 +42,36 @@ void Lights::update_total_light_count() {
         (int)diffuse_triangle_mesh_lights.size() +
         has_environment_light;
 }
+
+Light_Handle Lights::get_light_handle(int light_index) const {
+    ASSERT(light_index >= 0 && light_index < total_light_count);
+
+    if (light_index < point_lights.size())
+        return Light_Handle{ Light_Type::point, light_index };
+    light_index -= (int)point_lights.size();
+
+    if (light_index < spot_lights.size())
+        return Light_Handle{ Light_Type::spot, light_index };
+    light_index -= (int)spot_lights.size();
+
+    if (light_index < directional_lights.size())
+        return Light_Handle{ Light_Type::directional, light_index };
+    light_index -= (int)directional_lights.size();
+
+    if (light_index < diffuse_rectangular_lights.size())
+        return Light_Handle{ Light_Type::diffuse_rectangular, light_index };
+    light_index -= (int)diffuse_rectangular_lights.size();
+
+    if (light_index < diffuse_sphere_lights.size())
+        return Light_Handle{ Light_Type::diffuse_sphere, light_index };
+    light_index -= (int)diffuse_sphere_lights.size();
+
+    if (light_index < diffuse_triangle_mesh_lights.size())
+        return Light_Handle{ Light_Type::diffuse_triangle_mesh, light_index };
+    light_index -= (int)diffuse_triangle_mesh_lights.size();
+
+    // the only light left is environment light
+    ASSERT(light_index == 0);
+    ASSERT(has_environment_light);
+    return Light_Handle{ Light_Type::environment_map, 0 };
+}
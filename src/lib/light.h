@@ -110,5 +110,9 @@ struct Lights {
     bool has_lights() const;
     void update_total_light_count();
 
+    // Returns the light with the given index in the list of all lights. The lights
+    // are enumerated by type in the order of Light_Type declaration.
+    Light_Handle get_light_handle(int light_index) const;
+
     int total_light_count = 0;
 };
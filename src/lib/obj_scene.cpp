@@ -30,7 +30,7 @@ void load_obj_scene(const YAR_Project& project, Scene& scene) {
         }
     }
 
-    scene.geometries.triangle_meshes.resize(obj_data.meshes.size());
+    scene.geometries.triangle_meshes.reserve(obj_data.meshes.size() + project.diffuse_rectangular_lights.size());
     // We can have more elements in case of instancing.
     scene.objects.reserve(obj_data.meshes.size()); 
 
@@ -40,7 +40,8 @@ void load_obj_scene(const YAR_Project& project, Scene& scene) {
 
     bool add_default_material = false;
     for (int i = 0; i < (int)obj_data.meshes.size(); i++) {
-        scene.geometries.triangle_meshes[i] = obj_data.meshes[i].mesh;
+        int mesh_index = add_scene_triangle_mesh(std::move(obj_data.meshes[i].mesh), &scene);
+        ASSERT(mesh_index == i);
 
         Material_Handle material;
         if (obj_data.meshes[i].material_index == -1) {
@@ -738,8 +738,8 @@ static Geometry_Handle import_pbrt_triangle_mesh(const pbrt::TriangleMesh::SP pb
         mesh.visibility = Visibility::visible_no_shadows;
     }
 
-    scene->geometries.triangle_meshes.emplace_back(mesh);
-    return Geometry_Handle{ Geometry_Type::triangle_mesh, (int)scene->geometries.triangle_meshes.size() - 1 };
+    int mesh_index = add_scene_triangle_mesh(std::move(mesh), scene);
+    return Geometry_Handle{ Geometry_Type::triangle_mesh, mesh_index };
 }
 
 static Geometry_Handle import_pbrt_sphere(const pbrt::Sphere::SP pbrt_sphere, Matrix3x4* sphere_transform, Scene* scene) {
@@ -751,8 +751,8 @@ static Geometry_Handle import_pbrt_sphere(const pbrt::Sphere::SP pbrt_sphere, Ma
     }
 
     Triangle_Mesh sphere = create_sphere_mesh(pbrt_sphere->radius, 6, true);
-    scene->geometries.triangle_meshes.push_back(std::move(sphere));
-    Geometry_Handle sphere_geometry_handle = { Geometry_Type::triangle_mesh, int(scene->geometries.triangle_meshes.size() - 1) };
+    int mesh_index = add_scene_triangle_mesh(std::move(sphere), scene);
+    Geometry_Handle sphere_geometry_handle = { Geometry_Type::triangle_mesh, mesh_index };
     scene->radius_to_sphere_geometry.insert(std::make_pair(pbrt_sphere->radius, sphere_geometry_handle));
     return sphere_geometry_handle;
 }
@@ -1051,6 +1051,14 @@ void load_pbrt_scene(const YAR_Project& project, Scene& scene) {
     pbrt::Scene::SP pbrt_scene = pbrt::importPBRT(scene.path);
     pbrt_scene->makeSingleLevel();
 
+    // Each pbrt shape produces at most one triangle mesh. Reserve space for all meshes including
+    // the ones from the yar project, so the meshes are not moved in memory while the scene is loaded.
+    size_t shape_count = 0;
+    for (pbrt::Instance::SP instance : pbrt_scene->world->instances) {
+        shape_count += instance->object->shapes.size();
+    }
+    scene.geometries.triangle_meshes.reserve(shape_count + project.diffuse_rectangular_lights.size());
+
     // TODO: re-work pbrt-parser to decouple material from shape to be able to use
     // the same shape with different materials. In current design shape data is
     // duplicated for each new material. pbrt-parser have to introduce primitive
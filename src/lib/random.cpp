@@ -0,0 +1,100 @@
+#include "std.h"
+#include "common.h"
+#include "random.h"
+
+void RNG_8x::init(uint64_t init_state, uint64_t stream_id)
+{
+    for (int i = 0; i < 8; i++) {
+        pcg32_random_t pcg_state;
+        pcg32_srandom_r(&pcg_state, init_state, get_lane_stream_id(stream_id, i));
+        state[i] = pcg_state.state;
+        inc[i] = pcg_state.inc;
+    }
+}
+
+// Lower 64 bits of the product of 64-bit integers (AVX2 does not have 64-bit multiplication).
+static __m256i mul_epi64(__m256i a, __m256i b)
+{
+    __m256i lo_lo = _mm256_mul_epu32(a, b);
+    __m256i hi_lo = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+    __m256i lo_hi = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+    return _mm256_add_epi64(lo_lo, _mm256_slli_epi64(_mm256_add_epi64(hi_lo, lo_hi), 32));
+}
+
+// Computes pcg32 output for 4 states. The results are in the lower 32 bits of 64-bit lanes.
+static __m256i pcg32_output(__m256i state)
+{
+    __m256i xorshifted = _mm256_srli_epi64(_mm256_xor_si256(_mm256_srli_epi64(state, 18), state), 27);
+    xorshifted = _mm256_and_si256(xorshifted, _mm256_set1_epi64x(0xffffffff)); // uint32_t cast
+    __m256i rot = _mm256_srli_epi64(state, 59);
+
+    // 32-bit rotation. The bits that are shifted to the upper half of the 64-bit lane are ignored.
+    __m256i rot_left = _mm256_sub_epi64(_mm256_set1_epi64x(32), rot);
+    return _mm256_or_si256(_mm256_srlv_epi64(xorshifted, rot), _mm256_sllv_epi64(xorshifted, rot_left));
+}
+
+// Generates 8 random numbers, one for each lane.
+static __m256i pcg32_random_8x(__m256i& state_0123, __m256i& state_4567, __m256i inc_0123, __m256i inc_4567)
+{
+    const __m256i multiplier = _mm256_set1_epi64x(6364136223846793005ULL);
+
+    __m256i result_0123 = pcg32_output(state_0123);
+    __m256i result_4567 = pcg32_output(state_4567);
+    state_0123 = _mm256_add_epi64(mul_epi64(state_0123, multiplier), inc_0123);
+    state_4567 = _mm256_add_epi64(mul_epi64(state_4567, multiplier), inc_4567);
+
+    // Pack the lower 32 bits of 64-bit lanes.
+    const __m256i pack_indices = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    result_0123 = _mm256_permutevar8x32_epi32(result_0123, pack_indices);
+    result_4567 = _mm256_permutevar8x32_epi32(result_4567, pack_indices);
+    return _mm256_permute2x128_si256(result_0123, result_4567, 0x20);
+}
+
+template <typename Store_Function>
+static void generate_8x(uint64_t state[8], const uint64_t inc[8], int n, const Store_Function& store)
+{
+    __m256i state_0123 = _mm256_load_si256((const __m256i*)&state[0]);
+    __m256i state_4567 = _mm256_load_si256((const __m256i*)&state[4]);
+    const __m256i inc_0123 = _mm256_load_si256((const __m256i*)&inc[0]);
+    const __m256i inc_4567 = _mm256_load_si256((const __m256i*)&inc[4]);
+
+    for (int i = 0; i < n; i += 8) {
+        __m256i values = pcg32_random_8x(state_0123, state_4567, inc_0123, inc_4567);
+        store(i, values);
+    }
+    _mm256_store_si256((__m256i*)&state[0], state_0123);
+    _mm256_store_si256((__m256i*)&state[4], state_4567);
+}
+
+void RNG_8x::get_uints(uint32_t* result, int n)
+{
+    generate_8x(state, inc, n, [result, n](int i, __m256i values) {
+        if (i + 8 <= n) {
+            _mm256_storeu_si256((__m256i*)&result[i], values);
+        }
+        else {
+            alignas(32) uint32_t temp[8];
+            _mm256_store_si256((__m256i*)temp, values);
+            for (int k = 0; i + k < n; k++)
+                result[i + k] = temp[k];
+        }
+    });
+}
+
+void RNG_8x::get_floats(float* result, int n)
+{
+    generate_8x(state, inc, n, [result, n](int i, __m256i values) {
+        // The same conversion as in RNG::get_float.
+        __m256i bits = _mm256_or_si256(_mm256_srli_epi32(values, 9), _mm256_set1_epi32(0x3f800000));
+        __m256 f = _mm256_sub_ps(_mm256_castsi256_ps(bits), _mm256_set1_ps(1.f));
+        if (i + 8 <= n) {
+            _mm256_storeu_ps(&result[i], f);
+        }
+        else {
+            alignas(32) float temp[8];
+            _mm256_store_ps(temp, f);
+            for (int k = 0; i + k < n; k++)
+                result[i + k] = temp[k];
+        }
+    });
+}
@@ -71,4 +71,38 @@ struct RNG {
         float y = get_float();
         return {x, y};
     }
+
+    // Fills the array with [0, 1) values. The values are the same as from the sequence of get_float() calls.
+    void get_floats(float* result, int n) {
+        for (int i = 0; i < n; i++)
+            result[i] = get_float();
+    }
+};
+
+// 8 PCG streams that are advanced together using AVX2 instructions. It is used to generate
+// large arrays of random numbers, the lane 'i' generates every 8th element starting from 'i'.
+// The lane 'i' produces the same sequence as RNG initialized with (init_state, get_lane_stream_id(stream_id, i)).
+// The lane streams are above 2^40, so they do not overlap the scalar streams (stream_id < 2^37).
+struct RNG_8x {
+    alignas(32) uint64_t state[8];
+    alignas(32) uint64_t inc[8];
+
+    static uint64_t get_lane_stream_id(uint64_t stream_id, int lane)
+    {
+        ASSERT(stream_id < (1ull << 37));
+        return (1ull << 40) | (stream_id << 3) | uint64_t(lane);
+    }
+
+    RNG_8x()
+    {
+        init(0, 0);
+    }
+
+    void init(uint64_t init_state, uint64_t stream_id);
+
+    // Fills the array with uniformly distributed 32-bit numbers.
+    void get_uints(uint32_t* result, int n);
+
+    // Fills the array with [0, 1) values.
+    void get_floats(float* result, int n);
 };
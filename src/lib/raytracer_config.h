@@ -32,6 +32,26 @@ struct Raytracer_Config {
     // a useful representation of the pixel footprint.
     int max_differential_ray_specular_bounces = 4;
 
+    // Defines how the path tracer selects the light for the direct lighting estimate.
+    // The direct lighting algorithm does not select the lights, it samples all of them.
+    enum class Light_Selection {
+        uniform, // all lights are selected with the same probability
+        power, // probability is proportional to the light power
+        light_tree // probability is proportional to the light importance (power, distance and orientation)
+    };
+    Light_Selection light_selection = Light_Selection::uniform;
+
+    // When positive, the path tracer selects the light sample with resampled importance sampling (RIS)
+    // from this number of candidates generated by the light selection strategy. The candidates are
+    // weighted by their unshadowed contribution and only the selected one is tested for visibility.
+    int light_resampling_candidate_count = 0;
+
+    // When positive, the path tracer samples the continuation direction from the learned distribution of
+    // the incident radiance combined with the BSDF sampling (path guiding). The distribution is trained
+    // during this number of passes before the final rendering, the pass i renders 2^i samples per pixel.
+    int path_guiding_training_pass_count = 0;
+    int path_guiding_memory_budget = 64; // megabytes
+
     enum class Pixel_Filter_Type {
         box,
         gaussian,
@@ -41,9 +61,42 @@ struct Raytracer_Config {
     float pixel_filter_radius = 0.5f;
     float pixel_filter_alpha = 2.f; // used by gaussian filter
 
+    // Distribute image plane samples according to the pixel filter instead of
+    // splatting each sample to all pixels under the filter footprint.
+    bool filter_importance_sampling = false;
+
+    enum class Pixel_Sampler_Type {
+        stratified, // jittered samples on x_pixel_sample_count * y_pixel_sample_count grid
+        sobol // Owen-scrambled Sobol sequence, supports any sample count and any number of dimensions
+    };
+    // The direct lighting algorithm always uses the stratified sampler since it needs the sample arrays.
+    Pixel_Sampler_Type pixel_sampler_type = Pixel_Sampler_Type::stratified;
+
+    // The number of pixel samples is x_pixel_sample_count * y_pixel_sample_count.
+    // Only the stratified sampler depends on how the samples are split between x and y.
     int x_pixel_sample_count = 1;
     int y_pixel_sample_count = 1;
 
+    // The sampler that is used by the rendering algorithm.
+    Pixel_Sampler_Type get_pixel_sampler_type() const {
+        return (rendering_algorithm == Rendering_Algorithm::path_tracer) ? pixel_sampler_type : Pixel_Sampler_Type::stratified;
+    }
+
+    // Sets the pixel sample counts for the given number of samples per pixel. The stratified sampler
+    // uses the square grid, so its sample count is rounded up to the square number. Should be called
+    // after the rendering algorithm and the sampler type are set.
+    void set_samples_per_pixel(int samples_per_pixel) {
+        if (get_pixel_sampler_type() == Pixel_Sampler_Type::sobol) {
+            x_pixel_sample_count = samples_per_pixel;
+            y_pixel_sample_count = 1;
+        }
+        else {
+            int k = (int)std::ceil(std::sqrt(samples_per_pixel));
+            x_pixel_sample_count = k;
+            y_pixel_sample_count = k;
+        }
+    }
+
     float film_radiance_scale = 1.f;
     float max_rgb_component_value_of_film_sample = Infinity;
 };
@@ -7,6 +7,8 @@
 #include "raytracer_config.h"
 #include "scene_object.h"
 
+struct Scene_Load_Callbacks;
+
 enum class Scene_Type
 {
     none, // not initialize scene
@@ -62,6 +64,9 @@ struct Scene
     Lights lights;
     std::vector<Scene_Object> objects;
 
+    // Set only while the scene is being loaded.
+    const Scene_Load_Callbacks* load_callbacks = nullptr;
+
     std::string get_resource_absolute_path(const std::string& resource_relative_path) const
     {
         return (fs::path(path).parent_path() / resource_relative_path).string();
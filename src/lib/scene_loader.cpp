@@ -42,11 +42,11 @@ static void add_light_sources_from_yar_project(Scene& scene, const YAR_Project&
 
     for (const Diffuse_Rectangular_Light& light : project.diffuse_rectangular_lights) {
         scene.lights.diffuse_rectangular_lights.push_back(light);
-        scene.geometries.triangle_meshes.emplace_back(light.get_geometry());
+        int mesh_index = add_scene_triangle_mesh(light.get_geometry(), &scene);
 
         Scene_Object scene_object;
         scene_object.area_light = {Light_Type::diffuse_rectangular, (int)scene.lights.diffuse_rectangular_lights.size()-1};
-        scene_object.geometry = {Geometry_Type::triangle_mesh, (int)scene.geometries.triangle_meshes.size()-1};
+        scene_object.geometry = {Geometry_Type::triangle_mesh, mesh_index};
         scene_object.object_to_world_transform = Matrix3x4::identity;
         scene_object.world_to_object_transform = Matrix3x4::identity;
         scene.objects.push_back(scene_object);
@@ -71,20 +71,23 @@ static void finalize_scene(Scene& scene) {
     scene.lights.update_total_light_count();
 }
 
-Scene load_scene(const std::string& input_file) {
+Scene load_scene(const std::string& input_file, const Scene_Load_Callbacks* callbacks) {
     YAR_Project project = create_yar_project(input_file);
 
     Scene scene;
     scene.type = project.scene_type;
     scene.path = project.scene_path.string();
+    scene.load_callbacks = callbacks;
 
     if (project.scene_type == Scene_Type::pbrt) {
-        load_pbrt_scene(project, scene);
-
         // In pbrt texture coordinate space has(0, 0) at the lower left corner.
         // Workaround with flipping texture coordinates instead is not robust
         // enough because it doesn't handle procedural texturing case.
+        // NOTE: this should be set before loading because load callbacks might
+        // start texture decoding while the scene is being loaded.
         stbi_set_flip_vertically_on_load(true);
+
+        load_pbrt_scene(project, scene);
     }
     else {
         ASSERT(project.scene_type == Scene_Type::obj);
@@ -121,6 +124,7 @@ Scene load_scene(const std::string& input_file) {
         scene.camera_fov_y = 45.f;
 
     finalize_scene(scene);
+    scene.load_callbacks = nullptr;
 
     ASSERT(scene.film_resolution != Vector2i{});
 
@@ -139,7 +143,12 @@ int add_scene_texture(const Texture_Descriptor& texture_desc, Scene* scene)
             return (int)i;
     }
     scene->texture_descriptors.push_back(texture_desc);
-    return (int)scene->texture_descriptors.size() - 1;
+    int texture_index = (int)scene->texture_descriptors.size() - 1;
+
+    if (scene->load_callbacks && scene->load_callbacks->texture_added) {
+        scene->load_callbacks->texture_added(*scene, texture_index);
+    }
+    return texture_index;
 }
 
 int add_scene_texture(const std::string& file_name, Scene* scene)
@@ -148,6 +157,22 @@ int add_scene_texture(const std::string& file_name, Scene* scene)
     return add_scene_texture(Texture_Descriptor{ .file_name = file_name }, scene);
 }
 
+int add_scene_triangle_mesh(Triangle_Mesh&& mesh, Scene* scene)
+{
+    std::vector<Triangle_Mesh>& meshes = scene->geometries.triangle_meshes;
+
+    // Check that previously reported meshes are not moved in memory.
+    ASSERT(scene->load_callbacks == nullptr || meshes.size() < meshes.capacity());
+
+    meshes.push_back(std::move(mesh));
+    int mesh_index = (int)meshes.size() - 1;
+
+    if (scene->load_callbacks && scene->load_callbacks->triangle_mesh_added) {
+        scene->load_callbacks->triangle_mesh_added(*scene, mesh_index);
+    }
+    return mesh_index;
+}
+
 int add_scene_material_parameter(const Parameter& parameter, Scene* scene)
 {
     scene->material_parameters.push_back(parameter);
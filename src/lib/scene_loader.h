@@ -2,10 +2,23 @@
 
 #include "scene.h"
 
+// Optional callbacks that are called from the loading thread when new scene resources
+// are added. They allow to start processing of the resources (texture decoding, kdtree
+// building) while the rest of the scene is still being loaded.
+struct Scene_Load_Callbacks {
+    std::function<void(const Scene& scene, int texture_index)> texture_added;
+
+    // The mesh won't be modified or moved in memory after this call.
+    std::function<void(const Scene& scene, int triangle_mesh_index)> triangle_mesh_added;
+};
+
 // Supported file formats: yar, pbrt, obj
-Scene load_scene(const std::string& input_file);
+Scene load_scene(const std::string& input_file, const Scene_Load_Callbacks* callbacks = nullptr);
 
 // Scene loader utilities
 int add_scene_texture(const Texture_Descriptor& texture_desc, Scene* scene);
 int add_scene_texture(const std::string& file_name, Scene* scene);
+// The loader should reserve space for all meshes in advance, so the meshes that were
+// reported to the load callbacks are not moved in memory.
+int add_scene_triangle_mesh(Triangle_Mesh&& mesh, Scene* scene);
 int add_scene_material_parameter(const Parameter& parameter, Scene* scene);
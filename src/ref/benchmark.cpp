@@ -0,0 +1,202 @@
+#include "std.h"
+#include "lib/common.h"
+#include "benchmark.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+uint64_t get_peak_memory_usage()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return uint64_t(usage.ru_maxrss); // bytes
+#else
+    return uint64_t(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+}
+
+namespace {
+struct Benchmark_Scene_Summary {
+    std::string scene;
+    int run_count = 0;
+    float min_total_time = 0.f;
+    float median_total_time = 0.f;
+    float max_total_time = 0.f;
+    float median_load_time = 0.f;
+    float median_render_time = 0.f;
+    double median_rays_per_second = 0.0;
+};
+}
+
+static double get_rays_per_second(const Benchmark_Run& run)
+{
+    return run.render_time > 0.f ? double(run.ray_count) / run.render_time : 0.0;
+}
+
+template <typename T>
+static T get_median(std::vector<T> values)
+{
+    ASSERT(!values.empty());
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    return (n % 2) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / T(2);
+}
+
+// The scenes are returned in the order of their first run.
+static std::vector<Benchmark_Scene_Summary> get_scene_summaries(const std::vector<Benchmark_Run>& runs)
+{
+    std::vector<Benchmark_Scene_Summary> summaries;
+    std::vector<std::string> scenes;
+    for (const Benchmark_Run& run : runs) {
+        if (std::find(scenes.begin(), scenes.end(), run.scene) == scenes.end())
+            scenes.push_back(run.scene);
+    }
+    for (const std::string& scene : scenes) {
+        std::vector<float> total_times, load_times, render_times;
+        std::vector<double> rays_per_second;
+        for (const Benchmark_Run& run : runs) {
+            if (run.scene != scene)
+                continue;
+            total_times.push_back(run.total_time);
+            load_times.push_back(run.load_time);
+            render_times.push_back(run.render_time);
+            rays_per_second.push_back(get_rays_per_second(run));
+        }
+        Benchmark_Scene_Summary& summary = summaries.emplace_back();
+        summary.scene = scene;
+        summary.run_count = (int)total_times.size();
+        summary.min_total_time = *std::min_element(total_times.begin(), total_times.end());
+        summary.median_total_time = get_median(total_times);
+        summary.max_total_time = *std::max_element(total_times.begin(), total_times.end());
+        summary.median_load_time = get_median(load_times);
+        summary.median_render_time = get_median(render_times);
+        summary.median_rays_per_second = get_median(rays_per_second);
+    }
+    return summaries;
+}
+
+void print_benchmark_summary(const std::vector<Benchmark_Run>& runs)
+{
+    printf("Benchmark summary (total time: min/median/max, load and render time: median):\n");
+    for (const Benchmark_Scene_Summary& summary : get_scene_summaries(runs)) {
+        printf("  %s\n", summary.scene.c_str());
+        printf("    %d runs, total %.3f/%.3f/%.3f seconds, load %.3f seconds, render %.3f seconds",
+            summary.run_count, summary.min_total_time, summary.median_total_time, summary.max_total_time,
+            summary.median_load_time, summary.median_render_time);
+        if (summary.median_rays_per_second > 0.0)
+            printf(", %.3f M rays/sec", summary.median_rays_per_second / 1e6);
+        printf("\n");
+    }
+}
+
+static std::string get_json_string(const std::string& s)
+{
+    std::string result = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char)c);
+            result += buffer;
+        }
+        else {
+            result += c;
+        }
+    }
+    result += '"';
+    return result;
+}
+
+static std::string get_csv_string(const std::string& s)
+{
+    std::string result = "\"";
+    for (char c : s) {
+        if (c == '"')
+            result += '"';
+        result += c;
+    }
+    result += '"';
+    return result;
+}
+
+static void write_json(FILE* file, const std::vector<Benchmark_Run>& runs)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"ray_stats_enabled\": %s,\n", ENABLE_RAY_STATS ? "true" : "false");
+    fprintf(file, "  \"runs\": [\n");
+    for (size_t i = 0; i < runs.size(); i++) {
+        const Benchmark_Run& run = runs[i];
+        fprintf(file, "    {\"scene\": %s, \"run\": %d, \"load_time\": %.6f, \"kdtree_time\": %.6f, "
+            "\"texture_time\": %.6f, \"render_time\": %.6f, \"total_time\": %.6f, \"ray_count\": %" PRIu64 ", "
+            "\"rays_per_second\": %.1f, \"peak_memory_usage\": %" PRIu64 "}%s\n",
+            get_json_string(run.scene).c_str(), run.run_index, run.load_time, run.kdtree_time,
+            run.texture_time, run.render_time, run.total_time, run.ray_count,
+            get_rays_per_second(run), run.peak_memory_usage, (i + 1 < runs.size()) ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+
+    const std::vector<Benchmark_Scene_Summary> summaries = get_scene_summaries(runs);
+    fprintf(file, "  \"scenes\": [\n");
+    for (size_t i = 0; i < summaries.size(); i++) {
+        const Benchmark_Scene_Summary& summary = summaries[i];
+        fprintf(file, "    {\"scene\": %s, \"run_count\": %d, \"min_total_time\": %.6f, \"median_total_time\": %.6f, "
+            "\"max_total_time\": %.6f, \"median_load_time\": %.6f, \"median_render_time\": %.6f, "
+            "\"median_rays_per_second\": %.1f}%s\n",
+            get_json_string(summary.scene).c_str(), summary.run_count, summary.min_total_time,
+            summary.median_total_time, summary.max_total_time, summary.median_load_time,
+            summary.median_render_time, summary.median_rays_per_second, (i + 1 < summaries.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+}
+
+static void write_csv(FILE* file, const std::vector<Benchmark_Run>& runs)
+{
+    fprintf(file, "scene,run,load_time,kdtree_time,texture_time,render_time,total_time,ray_count,rays_per_second,peak_memory_usage\n");
+    for (const Benchmark_Run& run : runs) {
+        fprintf(file, "%s,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%" PRIu64 ",%.1f,%" PRIu64 "\n",
+            get_csv_string(run.scene).c_str(), run.run_index, run.load_time, run.kdtree_time,
+            run.texture_time, run.render_time, run.total_time, run.ray_count,
+            get_rays_per_second(run), run.peak_memory_usage);
+    }
+}
+
+void write_benchmark_results(const std::string& file_path, const std::vector<Benchmark_Run>& runs)
+{
+    const std::string extension = get_extension(file_path);
+    if (extension != ".json" && extension != ".csv")
+        error("write_benchmark_results: unsupported file extension %s, use .json or .csv", extension.c_str());
+
+    FILE* file = fopen(file_path.c_str(), "w");
+    if (!file)
+        error("write_benchmark_results: failed to open file for writing: %s", file_path.c_str());
+
+    if (extension == ".json")
+        write_json(file, runs);
+    else
+        write_csv(file, runs);
+
+    if (fclose(file) != 0)
+        error("write_benchmark_results: failed to write file: %s", file_path.c_str());
+}
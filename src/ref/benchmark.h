@@ -0,0 +1,29 @@
+#pragma once
+
+// Scene-level benchmark (--benchmark command line option). Each input scene is loaded and
+// rendered several times and the timings of each run are written in machine-readable form
+// (JSON or CSV), so the results of different builds can be compared.
+
+struct Benchmark_Run {
+    std::string scene;
+    int run_index = 0;
+
+    // Times in seconds.
+    float load_time = 0.f; // scene parsing and initialization of scene resources
+    float kdtree_time = 0.f; // part of the load time: waiting for mesh kdtrees and scene kdtree build
+    float texture_time = 0.f; // texture decoding and tile loading, summed over all threads
+    float render_time = 0.f;
+    float total_time = 0.f;
+
+    uint64_t ray_count = 0; // 0 when ray stats are disabled (ENABLE_RAY_STATS)
+    uint64_t peak_memory_usage = 0; // peak resident set size of the process in bytes
+};
+
+// Returns peak resident set size of the process in bytes.
+uint64_t get_peak_memory_usage();
+
+// Prints min/median/max times of each scene.
+void print_benchmark_summary(const std::vector<Benchmark_Run>& runs);
+
+// The output format is selected by the file extension: .json or .csv.
+void write_benchmark_results(const std::string& file_path, const std::vector<Benchmark_Run>& runs);
@@ -0,0 +1,413 @@
+#include "std.h"
+#include "lib/common.h"
+#include "checkpoint.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+constexpr uint32_t Journal_Magic = 0x4a524159; // "YARJ"
+constexpr uint32_t Journal_Version = 2;
+constexpr uint32_t Record_Magic = 0x454c4954; // "TILE"
+constexpr uint32_t Record_Flag_Compressed = 1;
+
+// The journal data is synchronized with the storage device when either of the limits is reached.
+constexpr int Sync_Record_Count = 64;
+constexpr float Sync_Interval_Seconds = 5.f;
+
+namespace {
+struct Journal_Header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct Record_Header {
+    uint32_t magic;
+    int32_t tile_index;
+    float render_time;
+    uint32_t flags;
+    int32_t samples_per_pixel;
+    uint32_t padding;
+    double tile_variance_accumulator;
+    Bounds2i pixel_bounds;
+    uint64_t payload_size;
+    uint64_t checksum; // hash of the payload and all previous header fields
+};
+}
+
+// just to check we don't have padded bytes inside the structures and
+// we can serialize entire structure with a single write.
+static_assert(sizeof(Bounds2i) == 16);
+static_assert(sizeof(Film_Pixel) == 16);
+static_assert(sizeof(Record_Header) == 64);
+
+static fs::path get_journal_path(const std::string& checkpoint_directory)
+{
+    return fs::path(checkpoint_directory) / "tiles.journal";
+}
+
+static uint64_t compute_record_checksum(const Record_Header& header, const uint8_t* payload)
+{
+    uint64_t header_hash = get_data_hash(&header, offsetof(Record_Header, checksum));
+    uint64_t payload_hash = get_data_hash(payload, header.payload_size);
+    return header_hash ^ (payload_hash * 0x9e3779b97f4a7c15ull);
+}
+
+//
+// Film pixel compression. Each float is XOR-ed with the same channel of the previous pixel,
+// so the high bytes become zeros for similar neighbor values. Then the bytes are reordered
+// into byte planes and the runs of zero bytes are encoded with a single token byte.
+//
+// Token byte t: t < 128 - the next (t + 1) bytes are literals, t >= 128 - (t - 127) zero bytes.
+//
+static bool compress_film_pixels(const std::vector<Film_Pixel>& pixels, std::vector<uint8_t>* compressed)
+{
+    const size_t word_count = pixels.size() * 4;
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(pixels.data());
+
+    std::vector<uint8_t> planes(word_count * 4);
+    for (size_t i = 0; i < word_count; i++) {
+        uint32_t w = (i < 4) ? words[i] : words[i] ^ words[i - 4];
+        planes[i] = uint8_t(w >> 24);
+        planes[word_count + i] = uint8_t(w >> 16);
+        planes[2 * word_count + i] = uint8_t(w >> 8);
+        planes[3 * word_count + i] = uint8_t(w);
+    }
+
+    const size_t size = planes.size();
+    compressed->clear();
+    compressed->reserve(size);
+
+    size_t i = 0;
+    while (i < size) {
+        size_t zero_count = 0;
+        while (i + zero_count < size && zero_count < 128 && planes[i + zero_count] == 0)
+            zero_count++;
+
+        if (zero_count >= 2) {
+            compressed->push_back(uint8_t(127 + zero_count));
+            i += zero_count;
+            continue;
+        }
+        // Literal run ends before the next run of zeros.
+        size_t literal_count = 0;
+        while (i + literal_count < size && literal_count < 128) {
+            size_t k = i + literal_count;
+            if (planes[k] == 0 && k + 1 < size && planes[k + 1] == 0)
+                break;
+            literal_count++;
+        }
+        compressed->push_back(uint8_t(literal_count - 1));
+        compressed->insert(compressed->end(), &planes[i], &planes[i] + literal_count);
+        i += literal_count;
+
+        if (compressed->size() >= size)
+            return false; // compression does not reduce the size
+    }
+    return compressed->size() < size;
+}
+
+static bool decompress_film_pixels(const uint8_t* data, size_t data_size, std::vector<Film_Pixel>* pixels)
+{
+    const size_t word_count = pixels->size() * 4;
+    std::vector<uint8_t> planes(word_count * 4);
+
+    size_t pos = 0;
+    size_t i = 0;
+    while (pos < data_size) {
+        uint8_t t = data[pos++];
+        if (t >= 128) {
+            size_t zero_count = t - 127;
+            if (i + zero_count > planes.size())
+                return false;
+            memset(&planes[i], 0, zero_count);
+            i += zero_count;
+        }
+        else {
+            size_t literal_count = t + 1;
+            if (i + literal_count > planes.size() || pos + literal_count > data_size)
+                return false;
+            memcpy(&planes[i], data + pos, literal_count);
+            i += literal_count;
+            pos += literal_count;
+        }
+    }
+    if (i != planes.size())
+        return false;
+
+    uint32_t* words = reinterpret_cast<uint32_t*>(pixels->data());
+    for (size_t k = 0; k < word_count; k++) {
+        uint32_t w = (uint32_t(planes[k]) << 24) | (uint32_t(planes[word_count + k]) << 16) |
+            (uint32_t(planes[2 * word_count + k]) << 8) | uint32_t(planes[3 * word_count + k]);
+        words[k] = (k < 4) ? w : w ^ words[k - 4];
+    }
+    return true;
+}
+
+static int checkpoint_str_to_int(const std::string& s)
+{
+    int result = 0;
+    auto conv_result = std::from_chars(&*s.begin(), &*s.end(), result);
+    ASSERT(conv_result.ptr == &*s.end());
+    return result;
+}
+
+Checkpoint_Info read_checkpoint_info(const std::string& checkpoint_directory)
+{
+    const char* func_name = "read_checkpoint_info";
+    fs::path metadata_file_path = fs::path(checkpoint_directory) / "checkpoint";
+
+    if (!fs_exists(metadata_file_path))
+        error("%s: %s is not a checkpoint directory: 'checkpoint' file is missing",
+            func_name, checkpoint_directory.c_str());
+
+    std::ifstream metadata_file(metadata_file_path);
+    if (!metadata_file)
+        error("%s: failed to open checkpoint metadata file: %s",
+            func_name, metadata_file_path.string().c_str());
+
+    std::string tag_name;
+    std::string total_tile_count_str;
+    std::string samples_per_pixel_str;
+    Checkpoint_Info info;
+
+    metadata_file >> tag_name; metadata_file >> info.input_filename;
+    metadata_file >> tag_name; metadata_file >> total_tile_count_str;
+    metadata_file >> tag_name; metadata_file >> samples_per_pixel_str;
+    metadata_file >> tag_name; metadata_file >> info.sample_region_area;
+
+    if (!metadata_file)
+        error("%s: failed to read all the required fields from the metadata file: %s",
+            func_name, metadata_file_path.string().c_str());
+
+    info.total_tile_count = checkpoint_str_to_int(total_tile_count_str);
+    info.samples_per_pixel = checkpoint_str_to_int(samples_per_pixel_str);
+    return info;
+}
+
+Checkpoint read_checkpoint_tiles(const std::string& checkpoint_directory)
+{
+    const char* func_name = "read_checkpoint_tiles";
+    Checkpoint checkpoint;
+
+    fs::path journal_path = get_journal_path(checkpoint_directory);
+    if (!fs_exists(journal_path))
+        return checkpoint;
+
+    std::ifstream journal(journal_path, std::ios_base::in | std::ios_base::binary);
+    if (!journal)
+        error("%s: failed to open checkpoint journal: %s", func_name, journal_path.string().c_str());
+
+    journal.seekg(0, std::ios_base::end);
+    checkpoint.journal_file_size = (uint64_t)journal.tellg();
+    journal.seekg(0, std::ios_base::beg);
+
+    Journal_Header journal_header;
+    journal.read(reinterpret_cast<char*>(&journal_header), sizeof(Journal_Header));
+    if (!journal) // the journal was created but the header was not written
+        return checkpoint;
+
+    if (journal_header.magic != Journal_Magic || journal_header.version != Journal_Version)
+        error("%s: unsupported checkpoint journal format: %s", func_name, journal_path.string().c_str());
+
+    checkpoint.valid_journal_size = sizeof(Journal_Header);
+
+    // Read records until the end of file or until the damaged record.
+    std::vector<uint8_t> payload;
+    while (true) {
+        Record_Header header;
+        journal.read(reinterpret_cast<char*>(&header), sizeof(Record_Header));
+        if (!journal || header.magic != Record_Magic)
+            break;
+
+        // The size of the damaged record can be anything, so check it before allocation.
+        if (header.payload_size > checkpoint.journal_file_size - checkpoint.valid_journal_size - sizeof(Record_Header))
+            break;
+
+        payload.resize(header.payload_size);
+        journal.read(reinterpret_cast<char*>(payload.data()), header.payload_size);
+        if (!journal || compute_record_checksum(header, payload.data()) != header.checksum)
+            break;
+
+        Checkpoint_Tile_Data& tile_data = checkpoint.finished_tiles[header.tile_index];
+        tile_data.tile_variance_accumulator = header.tile_variance_accumulator;
+        tile_data.samples_per_pixel = header.samples_per_pixel;
+        tile_data.tile.pixel_bounds = header.pixel_bounds;
+        tile_data.tile.pixels.resize(header.pixel_bounds.area());
+
+        if (header.flags & Record_Flag_Compressed) {
+            if (!decompress_film_pixels(payload.data(), payload.size(), &tile_data.tile.pixels))
+                error("%s: failed to decompress tile %d: %s", func_name, header.tile_index, journal_path.string().c_str());
+        }
+        else {
+            if (payload.size() != tile_data.tile.pixels.size() * sizeof(Film_Pixel))
+                error("%s: invalid size of tile %d: %s", func_name, header.tile_index, journal_path.string().c_str());
+            memcpy(tile_data.tile.pixels.data(), payload.data(), payload.size());
+        }
+
+        checkpoint.previous_sessions_time = std::max(checkpoint.previous_sessions_time, header.render_time);
+        checkpoint.valid_journal_size += sizeof(Record_Header) + header.payload_size;
+    }
+    return checkpoint;
+}
+
+static void write_checkpoint_info(const fs::path& metadata_file_path, const Checkpoint_Info& info)
+{
+    std::ofstream metadata_file(metadata_file_path, std::ofstream::out);
+    if (!metadata_file)
+        error("write_checkpoint_info: failed to create checkpoint file: %s", metadata_file_path.string().c_str());
+
+    metadata_file << "input_filename " << info.input_filename << "\n";
+    metadata_file << "total_tile_count " << info.total_tile_count << "\n";
+    metadata_file << "samples_per_pixer " << info.samples_per_pixel << "\n";
+    metadata_file << "sample_region_area " << info.sample_region_area << "\n";
+}
+
+Checkpoint start_or_resume_checkpoint(const std::string& checkpoint_directory, const Checkpoint_Info& info)
+{
+    const char* func_name = "start_or_resume_from_checkpoint_directory";
+    fs::path metadata_file_path = fs::path(checkpoint_directory) / "checkpoint";
+
+    // If checkpoint directory does not exist or it is an empty directory then perform
+    // initialization of the checkpoint by creating checkpoint metadata file.
+    if (!fs_exists(checkpoint_directory)) {
+        if (!fs_create_directories(checkpoint_directory))
+            error("%s: failed to create checkpoint directory: %s",
+                func_name, checkpoint_directory.c_str());
+    }
+    if (fs_is_empty(checkpoint_directory)) {
+        write_checkpoint_info(metadata_file_path, info);
+        // default checkpoint object describes that no tiles were finished yet
+        return Checkpoint{};
+    }
+
+    // Check that we have a valid checkpoint and that metadata matches current project settings.
+    Checkpoint_Info stored_info = read_checkpoint_info(checkpoint_directory);
+
+    if (stored_info.input_filename != info.input_filename)
+        error("%s: can not resume rendering because input_filename is changed.\n"
+            "Checkpoint: %s, current project: %s",
+            func_name, stored_info.input_filename.c_str(), info.input_filename.c_str());
+
+    if (stored_info.total_tile_count != info.total_tile_count)
+        error("%s: can not resume rendering because total_tile_count is changed.\n"
+            "Checkpoint: %d, current project: %d",
+            func_name, stored_info.total_tile_count, info.total_tile_count);
+
+    if (stored_info.samples_per_pixel > info.samples_per_pixel)
+        error("%s: can not resume rendering because samples_per_pixer is decreased.\n"
+            "Checkpoint: %d, current project: %d",
+            func_name, stored_info.samples_per_pixel, info.samples_per_pixel);
+
+    Checkpoint checkpoint = read_checkpoint_tiles(checkpoint_directory);
+
+    if (stored_info.samples_per_pixel < info.samples_per_pixel) {
+        printf("Increasing samples per pixel of the checkpoint from %d to %d\n",
+            stored_info.samples_per_pixel, info.samples_per_pixel);
+        stored_info.samples_per_pixel = info.samples_per_pixel;
+        write_checkpoint_info(metadata_file_path, stored_info);
+    }
+
+    // Remove the damaged record, so the next records are appended after the last valid record.
+    if (checkpoint.valid_journal_size < checkpoint.journal_file_size) {
+        fs::path journal_path = get_journal_path(checkpoint_directory);
+        printf("Discarding %llu bytes of incomplete data at the end of the checkpoint journal\n",
+            (unsigned long long)(checkpoint.journal_file_size - checkpoint.valid_journal_size));
+
+        std::error_code ec;
+        fs::resize_file(journal_path, checkpoint.valid_journal_size, ec);
+        if (ec)
+            error("%s: failed to truncate checkpoint journal: %s", func_name, journal_path.string().c_str());
+        checkpoint.journal_file_size = checkpoint.valid_journal_size;
+    }
+    return checkpoint;
+}
+
+//
+// Checkpoint_Journal
+//
+static void sync_file(FILE* file)
+{
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+Checkpoint_Journal::~Checkpoint_Journal()
+{
+    if (file) {
+        close();
+    }
+}
+
+void Checkpoint_Journal::open(const std::string& checkpoint_directory, bool compress_tiles)
+{
+    ASSERT(file == nullptr);
+    file_path = get_journal_path(checkpoint_directory).string();
+    this->compress_tiles = compress_tiles;
+
+    file = fopen(file_path.c_str(), "ab");
+    if (!file)
+        error("Checkpoint_Journal: failed to open file: %s", file_path.c_str());
+
+    // New journal starts with the header. Existing journal contains at least the header
+    // after start_or_resume_checkpoint (the damaged header is truncated to zero size).
+    std::error_code ec;
+    if (fs::file_size(file_path, ec) == 0 && !ec) {
+        Journal_Header header{ Journal_Magic, Journal_Version };
+        if (fwrite(&header, sizeof(Journal_Header), 1, file) != 1 || fflush(file) != 0)
+            error("Checkpoint_Journal: failed to write to file: %s", file_path.c_str());
+    }
+    unsynced_record_count = 0;
+    last_sync_timestamp = Timestamp();
+}
+
+void Checkpoint_Journal::write_tile(int tile_index, const Film_Tile& tile, int samples_per_pixel,
+    float current_render_time, double tile_variance_accumulator)
+{
+    // Compression and checksum computation are done by the calling thread without locking.
+    std::vector<uint8_t> compressed_pixels;
+    bool compressed = compress_tiles && compress_film_pixels(tile.pixels, &compressed_pixels);
+
+    const uint8_t* payload = compressed ? compressed_pixels.data() : reinterpret_cast<const uint8_t*>(tile.pixels.data());
+
+    Record_Header header;
+    header.magic = Record_Magic;
+    header.tile_index = tile_index;
+    header.render_time = current_render_time;
+    header.flags = compressed ? Record_Flag_Compressed : 0;
+    header.samples_per_pixel = samples_per_pixel;
+    header.padding = 0;
+    header.tile_variance_accumulator = tile_variance_accumulator;
+    header.pixel_bounds = tile.pixel_bounds;
+    header.payload_size = compressed ? compressed_pixels.size() : tile.pixels.size() * sizeof(Film_Pixel);
+    header.checksum = compute_record_checksum(header, payload);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT(file);
+    if (fwrite(&header, sizeof(Record_Header), 1, file) != 1 ||
+        fwrite(payload, 1, header.payload_size, file) != header.payload_size ||
+        fflush(file) != 0)
+    {
+        error("Checkpoint_Journal: failed to write to file: %s", file_path.c_str());
+    }
+
+    unsynced_record_count++;
+    if (unsynced_record_count >= Sync_Record_Count || elapsed_seconds(last_sync_timestamp) >= Sync_Interval_Seconds) {
+        sync_file(file);
+        unsynced_record_count = 0;
+        last_sync_timestamp = Timestamp();
+    }
+}
+
+void Checkpoint_Journal::close()
+{
+    ASSERT(file);
+    sync_file(file);
+    fclose(file);
+    file = nullptr;
+}
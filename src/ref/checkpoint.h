@@ -0,0 +1,73 @@
+#pragma once
+
+#include "film.h"
+
+// ---- Checkpoint directory layout ----
+//
+// 'checkpoint' - text file with the rendering settings that should match when the rendering is resumed.
+// 'tiles.journal' - append-only file with the finished tiles. Each finished tile is appended as a
+// single record that has a checksum. If the program terminates during write operation then only
+// the last record can be damaged, such record is detected by the checksum and is discarded.
+//
+// ---- Increasing samples per pixel ----
+//
+// Each tile record stores the number of samples per pixel accumulated in the tile. If the rendering
+// is resumed with higher samples per pixel value then the finished tiles are not rendered from
+// scratch, only the missing samples are rendered and added to the stored pixel sums. The tile
+// with more samples is appended to the journal, the last record of the tile overrides the previous ones.
+
+struct Checkpoint_Info {
+    std::string input_filename;
+    int total_tile_count = 0;
+    int samples_per_pixel = 0; // the number of samples per pixel of the finished tile
+    int64_t sample_region_area = 0; // used to compute variance estimate of the entire image
+};
+
+struct Checkpoint_Tile_Data {
+    Film_Tile tile;
+    double tile_variance_accumulator = 0.0;
+    int samples_per_pixel = 0;
+};
+
+struct Checkpoint {
+    std::map<int, Checkpoint_Tile_Data> finished_tiles; // tile_index -> tile
+    float previous_sessions_time = 0.f;
+
+    // The size of the journal part that contains valid records.
+    // It's less than the file size if the last record was not fully written.
+    uint64_t valid_journal_size = 0;
+    uint64_t journal_file_size = 0;
+};
+
+Checkpoint_Info read_checkpoint_info(const std::string& checkpoint_directory);
+
+// Scans tile journal of the checkpoint directory for finished tiles.
+Checkpoint read_checkpoint_tiles(const std::string& checkpoint_directory);
+
+// Creates new checkpoint or checks that existing checkpoint matches current settings and reads finished tiles.
+// The damaged record at the end of the journal is removed, so new records can be appended.
+// Samples per pixel value can be increased, in this case the checkpoint metadata is updated.
+Checkpoint start_or_resume_checkpoint(const std::string& checkpoint_directory, const Checkpoint_Info& info);
+
+// Appends finished tiles to the journal of the checkpoint directory.
+// The records are flushed to the OS after each tile. The data is synchronized
+// with the storage device periodically (fsync) to reduce the cost of disk flushes.
+struct Checkpoint_Journal {
+    ~Checkpoint_Journal();
+
+    void open(const std::string& checkpoint_directory, bool compress_tiles);
+
+    // Thread-safe.
+    void write_tile(int tile_index, const Film_Tile& tile, int samples_per_pixel,
+        float current_render_time, double tile_variance_accumulator);
+
+    void close();
+
+private:
+    std::mutex mutex;
+    FILE* file = nullptr;
+    std::string file_path;
+    bool compress_tiles = false;
+    int unsynced_record_count = 0;
+    Timestamp last_sync_timestamp;
+};
@@ -0,0 +1,162 @@
+#include "std.h"
+#include "lib/common.h"
+#include "denoiser.h"
+
+#include "lib/job_system.h"
+#include "lib/vector.h"
+
+namespace {
+struct Pixel_Features {
+    Vector3 normal; // zero vector if there is no surface hit
+    ColorRGB albedo;
+    float depth = 0.f;
+};
+
+struct Filter_Pixel {
+    ColorRGB color; // color divided by albedo
+    float luminance = 0.f; // cached color.luminance()
+    float variance = 0.f; // variance of the luminance
+};
+}
+
+static const float B3_Spline_Kernel[5] = { 1.f/16.f, 1.f/4.f, 3.f/8.f, 1.f/4.f, 1.f/16.f };
+
+static const Image_Channel& get_channel(const Image& image, const char* name)
+{
+    const Image_Channel* channel = image.find_extra_channel(name);
+    if (!channel)
+        error("denoise_image: image does not have %s channel, AOVs should be enabled", name);
+    return *channel;
+}
+
+static float get_normal_weight(const Vector3& n1, const Vector3& n2, float exponent)
+{
+    const bool hit1 = n1 != Vector3_Zero;
+    const bool hit2 = n2 != Vector3_Zero;
+    if (hit1 != hit2)
+        return 0.f;
+    if (!hit1)
+        return 1.f; // both pixels see the background
+    return std::pow(std::max(0.f, dot(n1, n2)), exponent);
+}
+
+static void filter_rows(const std::vector<Filter_Pixel>& src, std::vector<Filter_Pixel>& dst,
+    const std::vector<Pixel_Features>& features, int width, int height,
+    int first_row, int end_row, int step, const Denoiser_Settings& settings)
+{
+    for (int y = first_row; y < end_row; y++) {
+        for (int x = 0; x < width; x++) {
+            const int i = y * width + x;
+            const Filter_Pixel& p = src[i];
+            const Pixel_Features& f = features[i];
+            const float luminance_scale = 1.f / (settings.luminance_sigma * std::sqrt(p.variance) + 1e-4f);
+            const float depth_scale = 1.f / (settings.relative_depth_sigma * std::max(f.depth, 1e-4f));
+            const float albedo_scale = 1.f / (settings.albedo_sigma * settings.albedo_sigma);
+
+            ColorRGB color_sum;
+            float variance_sum = 0.f;
+            float weight_sum = 0.f;
+
+            for (int dy = -2; dy <= 2; dy++) {
+                const int y2 = y + dy * step;
+                if (y2 < 0 || y2 >= height)
+                    continue;
+
+                for (int dx = -2; dx <= 2; dx++) {
+                    const int x2 = x + dx * step;
+                    if (x2 < 0 || x2 >= width)
+                        continue;
+
+                    const int k = y2 * width + x2;
+                    const Filter_Pixel& q = src[k];
+                    const Pixel_Features& g = features[k];
+
+                    float w = B3_Spline_Kernel[dx + 2] * B3_Spline_Kernel[dy + 2];
+                    if (k != i) {
+                        w *= get_normal_weight(f.normal, g.normal, settings.normal_exponent);
+                        if (w == 0.f)
+                            continue;
+
+                        ColorRGB albedo_delta = f.albedo - g.albedo;
+                        float albedo_distance_sq = albedo_delta.r * albedo_delta.r +
+                            albedo_delta.g * albedo_delta.g + albedo_delta.b * albedo_delta.b;
+
+                        w *= std::exp(
+                            -std::abs(q.luminance - p.luminance) * luminance_scale
+                            -std::abs(g.depth - f.depth) * depth_scale
+                            -albedo_distance_sq * albedo_scale
+                        );
+                    }
+                    color_sum += w * q.color;
+                    variance_sum += w * w * q.variance;
+                    weight_sum += w;
+                }
+            }
+            // The weight of the center pixel is not zero, so weight_sum > 0.
+            dst[i].color = color_sum / weight_sum;
+            dst[i].luminance = dst[i].color.luminance();
+            dst[i].variance = variance_sum / (weight_sum * weight_sum);
+        }
+    }
+}
+
+Image denoise_image(const Image& image, const Denoiser_Settings& settings)
+{
+    const int width = image.width;
+    const int height = image.height;
+    const int pixel_count = width * height;
+
+    const Image_Channel& normal_x = get_channel(image, "N.X");
+    const Image_Channel& normal_y = get_channel(image, "N.Y");
+    const Image_Channel& normal_z = get_channel(image, "N.Z");
+    const Image_Channel& albedo_r = get_channel(image, "albedo.R");
+    const Image_Channel& albedo_g = get_channel(image, "albedo.G");
+    const Image_Channel& albedo_b = get_channel(image, "albedo.B");
+    const Image_Channel& depth = get_channel(image, "Z");
+    const Image_Channel& variance = get_channel(image, "variance");
+
+    // Albedo demodulation. The albedo components that are close to zero are not
+    // divided out, otherwise the noise would be amplified.
+    auto demodulation_factor = [](float albedo) { return albedo < 0.01f ? 1.f : albedo; };
+
+    std::vector<Pixel_Features> features(pixel_count);
+    std::vector<ColorRGB> demodulation(pixel_count);
+    std::vector<Filter_Pixel> pixels(pixel_count);
+
+    for (int i = 0; i < pixel_count; i++) {
+        Pixel_Features& f = features[i];
+        f.normal = Vector3(normal_x.data[i], normal_y.data[i], normal_z.data[i]);
+        f.albedo = ColorRGB(albedo_r.data[i], albedo_g.data[i], albedo_b.data[i]);
+        f.depth = depth.data[i];
+
+        demodulation[i] = ColorRGB(
+            demodulation_factor(f.albedo.r),
+            demodulation_factor(f.albedo.g),
+            demodulation_factor(f.albedo.b)
+        );
+        float luminance_scale = demodulation[i].luminance();
+        pixels[i].color = image.data[i] / demodulation[i];
+        pixels[i].luminance = pixels[i].color.luminance();
+        pixels[i].variance = variance.data[i] / (luminance_scale * luminance_scale);
+    }
+
+    // Each iteration is split into row blocks that are processed in parallel.
+    const int rows_per_job = 16;
+    const int job_count = (height + rows_per_job - 1) / rows_per_job;
+
+    std::vector<Filter_Pixel> filtered_pixels(pixel_count);
+    for (int iteration = 0; iteration < settings.iteration_count; iteration++) {
+        const int step = 1 << iteration;
+        parallel_for(job_count, [&](int job_index) {
+            const int first_row = job_index * rows_per_job;
+            const int end_row = std::min(first_row + rows_per_job, height);
+            filter_rows(pixels, filtered_pixels, features, width, height, first_row, end_row, step, settings);
+        });
+        pixels.swap(filtered_pixels);
+    }
+
+    Image denoised_image(width, height);
+    for (int i = 0; i < pixel_count; i++)
+        denoised_image.data[i] = pixels[i].color * demodulation[i];
+    return denoised_image;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "lib/image.h"
+
+// Feature-guided denoiser based on edge-avoiding a-trous wavelet transform:
+// "Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination Filtering", Dammertz et al. 2010.
+//
+// The filter is guided by the AOV channels of the image (normal, albedo, depth). The luminance
+// edge-stopping function is scaled by the per-pixel variance estimate, the variance is filtered
+// together with the color as in "Spatiotemporal Variance-Guided Filtering", Schied et al. 2017.
+// The color is divided by albedo before filtering, so texture details are not blurred.
+struct Denoiser_Settings {
+    int iteration_count = 5; // the filter footprint is doubled on each iteration
+    float luminance_sigma = 4.f; // in units of the standard deviation of pixel's luminance
+    float normal_exponent = 128.f;
+    float relative_depth_sigma = 0.1f;
+    float albedo_sigma = 0.1f;
+};
+
+// The image should contain AOV channels (see Film::get_image). Returns the denoised image without AOV channels.
+Image denoise_image(const Image& image, const Denoiser_Settings& settings = Denoiser_Settings{});
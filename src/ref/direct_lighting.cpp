@@ -23,8 +23,20 @@ inline float mis_power_heuristic(float pdf1, float pdf2) {
     return pdf1*pdf1 / (pdf1*pdf1 + pdf2*pdf2);
 }
 
-static ColorRGB direct_lighting_from_point_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
-    const Point_Light& light)
+// Light sampling part of the direct lighting estimate before the visibility test.
+struct Light_Sample {
+    ColorRGB L; // includes MIS weight, does not include light selection probability
+    Ray shadow_ray;
+    float shadow_ray_length = Infinity;
+};
+
+static bool is_light_sample_occluded(const Scene_Context& scene_ctx, const Light_Sample& sample)
+{
+    RAY_STATS(shadow_ray_count++);
+    return scene_ctx.kdtree_data.scene_kdtree.intersect_any(sample.shadow_ray, sample.shadow_ray_length);
+}
+
+static bool sample_point_light(const Shading_Context& shading_ctx, const Point_Light& light, Light_Sample* sample)
 {
     Vector3 position = shading_ctx.get_ray_origin_using_control_point(light.position);
 
@@ -34,20 +46,19 @@ static ColorRGB direct_lighting_from_point_light(const Scene_Context& scene_ctx,
 
     float n_dot_l = dot(shading_ctx.normal, light_dir);
     if (n_dot_l <= 0.f)
-        return Color_Black;
-
-    Ray light_visibility_ray{position, light_dir};
-    bool occluded = scene_ctx.kdtree_data.scene_kdtree.intersect_any(light_visibility_ray, light_dist * (1.f - 1e-5f));
-    if (occluded)
-        return Color_Black;
+        return false;
 
     ColorRGB bsdf = shading_ctx.bsdf->evaluate(shading_ctx.wo, light_dir);
-    ColorRGB L = (light.intensity * bsdf)  * (n_dot_l / (light_dist * light_dist));
-    return L;
+    if (bsdf.is_black())
+        return false;
+
+    sample->L = (light.intensity * bsdf)  * (n_dot_l / (light_dist * light_dist));
+    sample->shadow_ray = Ray{position, light_dir};
+    sample->shadow_ray_length = light_dist * (1.f - 1e-5f);
+    return true;
 }
 
-static ColorRGB direct_lighting_from_spot_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
-    const Spot_Light& light)
+static bool sample_spot_light(const Shading_Context& shading_ctx, const Spot_Light& light, Light_Sample* sample)
 {
     Vector3 position = shading_ctx.get_ray_origin_using_control_point(light.position);
     Vector3 vector_to_light = light.position - position;
@@ -58,7 +69,7 @@ static ColorRGB direct_lighting_from_spot_light(const Scene_Context& scene_ctx,
     float cone_cos = std::cos(light.cone_angle);
     float wi_cos = dot(-wi, light.direction);
     if (wi_cos < cone_cos)
-        return Color_Black; // outside of light cone
+        return false; // outside of light cone
 
     float penumbra_attenuation = 1.f;
     float penumbra_cos = std::cos(std::max(0.f, light.cone_angle - light.penumbra_angle));
@@ -73,37 +84,192 @@ static ColorRGB direct_lighting_from_spot_light(const Scene_Context& scene_ctx,
         n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
         n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
     if (!scattering_possible)
-        return Color_Black;
+        return false;
 
     ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
     if (f.is_black())
-        return Color_Black;
-
-    Ray light_visibility_ray{ position, wi };
-    bool occluded = scene_ctx.kdtree_data.scene_kdtree.intersect_any(light_visibility_ray, distance_to_light * (1.f - 1e-5f));
-    if (occluded)
-        return Color_Black;
+        return false;
 
-    ColorRGB L = (light.intensity * f) * (penumbra_attenuation * std::abs(n_dot_wi) / (distance_to_light * distance_to_light));
-    return L;
+    sample->L = (light.intensity * f) * (penumbra_attenuation * std::abs(n_dot_wi) / (distance_to_light * distance_to_light));
+    sample->shadow_ray = Ray{position, wi};
+    sample->shadow_ray_length = distance_to_light * (1.f - 1e-5f);
+    return true;
 }
 
-static ColorRGB direct_lighting_from_directional_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
-    const Directional_Light& light)
+static bool sample_directional_light(const Shading_Context& shading_ctx, const Directional_Light& light, Light_Sample* sample)
 {
     float n_dot_l = dot(shading_ctx.normal, light.direction);
     if (n_dot_l <= 0.f)
-        return Color_Black;
+        return false;
+
+    ColorRGB bsdf = shading_ctx.bsdf->evaluate(shading_ctx.wo, light.direction);
+    if (bsdf.is_black())
+        return false;
 
     Vector3 position = shading_ctx.get_ray_origin_using_control_direction(light.direction);
-    Ray light_visibility_ray{position, light.direction};
-    bool occluded = scene_ctx.kdtree_data.scene_kdtree.intersect_any(light_visibility_ray, Infinity);
-    if (occluded)
+    sample->L = (light.irradiance * bsdf) * n_dot_l;
+    sample->shadow_ray = Ray{position, light.direction};
+    sample->shadow_ray_length = Infinity;
+    return true;
+}
+
+static bool sample_rectangular_light(const Shading_Context& shading_ctx, const Diffuse_Rectangular_Light& light,
+    Vector2 u_light, Light_Sample* sample)
+{
+    const Vector3 light_n = light.light_to_world_transform.get_column(2);
+
+    Vector3 local_light_point = Vector3{ light.size * (u_light - Vector2(0.5f)), 0.0f };
+    Vector3 light_point = transform_point(light.light_to_world_transform, local_light_point);
+    Vector3 position = shading_ctx.get_ray_origin_using_control_point(light_point);
+
+    const Vector3 light_vec = light_point - position;
+    float distance_to_sample = light_vec.length();
+    Vector3 wi = light_vec / distance_to_sample;
+
+    float light_n_dot_wi = dot(light_n, -wi);
+
+    // Compare against small positive constant (instead of 0). This ensures we don't have tiny pdfs.
+    // 1e-4f corresponds to ~89.994 degrees angle. We assume that added bias is small.
+    if (light_n_dot_wi <= 1e-4f)
+        return false;
+
+    float n_dot_wi = dot(shading_ctx.normal, wi);
+
+    bool scattering_possible =
+        n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
+        n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
+    if (!scattering_possible)
+        return false;
+
+    ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
+    if (f.is_black())
+        return false;
+
+    float light_pdf = (distance_to_sample * distance_to_sample) / (light.size.x * light.size.y * light_n_dot_wi);
+    float bsdf_pdf = shading_ctx.bsdf->pdf(shading_ctx.wo, wi);
+    float mis_weight = mis_power_heuristic(light_pdf, bsdf_pdf);
+
+    sample->L = (light.emitted_radiance * f) * (mis_weight * std::abs(n_dot_wi) / light_pdf);
+    sample->shadow_ray = Ray{position, wi};
+    sample->shadow_ray_length = distance_to_sample * (1.f - 1e-5f);
+    return true;
+}
+
+static bool sample_sphere_light(const Shading_Context& shading_ctx, const Diffuse_Sphere_Light_Sampler& light_sampler,
+    Vector2 u_light, Light_Sample* sample)
+{
+    Vector3 light_point = light_sampler.sample(u_light);
+    Vector3 position = shading_ctx.get_ray_origin_using_control_point(light_point);
+
+    const Vector3 light_vec = light_point - position;
+    float distance_to_sample = light_vec.length();
+    Vector3 wi = light_vec / distance_to_sample;
+
+    float n_dot_wi = dot(shading_ctx.normal, wi);
+    bool scattering_possible = n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
+                               n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
+    if (!scattering_possible)
+        return false;
+
+    ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
+    if (f.is_black())
+        return false;
+
+    float light_pdf = light_sampler.cone_sampling_pdf;
+    float bsdf_pdf = shading_ctx.bsdf->pdf(shading_ctx.wo, wi);
+    float mis_weight = mis_power_heuristic(light_pdf, bsdf_pdf);
+
+    sample->L = (light_sampler.light.emitted_radiance * f) * (mis_weight * std::abs(n_dot_wi) / light_pdf);
+    sample->shadow_ray = Ray{position, wi};
+    sample->shadow_ray_length = distance_to_sample * (1.f - 1e-5f);
+    return true;
+}
+
+static bool sample_triangle_mesh_light(const Shading_Context& shading_ctx, const Diffuse_Triangle_Mesh_Light_Sampler& sampler,
+    Vector2 u_light, Light_Sample* sample)
+{
+    float light_pdf;
+    Vector3 light_point = sampler.sample(u_light, shading_ctx.position, &light_pdf);
+    if (light_pdf == 0.f)
+        return false;
+
+    Vector3 position = shading_ctx.get_ray_origin_using_control_point(light_point);
+
+    const Vector3 light_vec = light_point - position;
+    float distance_to_sample = light_vec.length();
+    Vector3 wi = light_vec / distance_to_sample;
+
+    float n_dot_wi = dot(shading_ctx.normal, wi);
+    bool scattering_possible = n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
+        n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
+    if (!scattering_possible)
+        return false;
+
+    ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
+    if (f.is_black())
+        return false;
+
+    float bsdf_pdf = shading_ctx.bsdf->pdf(shading_ctx.wo, wi);
+    float mis_weight = mis_power_heuristic(light_pdf, bsdf_pdf);
+
+    sample->L = (sampler.light->emitted_radiance * f) * (mis_weight * std::abs(n_dot_wi) / light_pdf);
+    sample->shadow_ray = Ray{position, wi};
+    sample->shadow_ray_length = distance_to_sample * (1.f - 1e-5f);
+    return true;
+}
+
+static bool sample_environment_light(const Shading_Context& shading_ctx, const Environment_Light_Sampler& light_sampler,
+    Vector2 u_light, Light_Sample* sample)
+{
+    Vector3 wi;
+    float light_pdf;
+    ColorRGB Le = light_sampler.sample(u_light, &wi, &light_pdf);
+
+    float n_dot_wi = dot(shading_ctx.normal, wi);
+    bool scattering_possible = n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
+                               n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
+    if (!scattering_possible)
+        return false;
+
+    ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
+    if (f.is_black())
+        return false;
+
+    float bsdf_pdf = shading_ctx.bsdf->pdf(shading_ctx.wo, wi);
+    float mis_weight = mis_power_heuristic(light_pdf, bsdf_pdf);
+
+    Vector3 position = shading_ctx.get_ray_origin_using_control_direction(wi);
+    sample->L = (Le * f) * (mis_weight * std::abs(n_dot_wi) / light_pdf);
+    sample->shadow_ray = Ray{position, wi};
+    sample->shadow_ray_length = Infinity;
+    return true;
+}
+
+static ColorRGB direct_lighting_from_point_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
+    const Point_Light& light)
+{
+    Light_Sample sample;
+    if (!sample_point_light(shading_ctx, light, &sample) || is_light_sample_occluded(scene_ctx, sample))
         return Color_Black;
+    return sample.L;
+}
 
-    ColorRGB bsdf = shading_ctx.bsdf->evaluate(shading_ctx.wo, light.direction);
-    ColorRGB L = (light.irradiance * bsdf) * n_dot_l;
-    return L;
+static ColorRGB direct_lighting_from_spot_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
+    const Spot_Light& light)
+{
+    Light_Sample sample;
+    if (!sample_spot_light(shading_ctx, light, &sample) || is_light_sample_occluded(scene_ctx, sample))
+        return Color_Black;
+    return sample.L;
+}
+
+static ColorRGB direct_lighting_from_directional_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
+    const Directional_Light& light)
+{
+    Light_Sample sample;
+    if (!sample_directional_light(shading_ctx, light, &sample) || is_light_sample_occluded(scene_ctx, sample))
+        return Color_Black;
+    return sample.L;
 }
 
 static ColorRGB direct_lighting_from_rectangular_light(
@@ -112,49 +278,14 @@ static ColorRGB direct_lighting_from_rectangular_light(
     Vector2 u_light, Vector2 u_bsdf, float u_scattering_type)
 {
     ASSERT(light_handle.type == Light_Type::diffuse_rectangular);
-
     const Vector3 light_n = light.light_to_world_transform.get_column(2);
-    const Vector3 light_center = light.light_to_world_transform.get_column(3);
 
     ColorRGB L;
     // Light sampling part of MIS.
     {
-        Vector3 local_light_point = Vector3{ light.size * (u_light - Vector2(0.5f)), 0.0f };
-        Vector3 light_point = transform_point(light.light_to_world_transform, local_light_point);
-        Vector3 position = shading_ctx.get_ray_origin_using_control_point(light_point);
-
-        const Vector3 light_vec = light_point - position;
-        float distance_to_sample = light_vec.length();
-        Vector3 wi = light_vec / distance_to_sample;
-
-        float light_n_dot_wi = dot(light_n, -wi);
-
-        // Compare against small positive constant (instead of 0). This ensures we don't have tiny pdfs.
-        // 1e-4f corresponds to ~89.994 degrees angle. We assume that added bias is small.
-        if (light_n_dot_wi > 1e-4f) {
-            float n_dot_wi = dot(shading_ctx.normal, wi);
-
-            bool scattering_possible =
-                n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
-                n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
-
-            if (scattering_possible) {
-                ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
-
-                if (!f.is_black()) {
-                    Ray light_visibility_ray{ position, wi };
-                    bool occluded = scene_ctx.kdtree_data.scene_kdtree.intersect_any(light_visibility_ray, distance_to_sample * (1.f - 1e-5f));
-
-                    if (!occluded) {
-                        float light_pdf = (distance_to_sample * distance_to_sample) / (light.size.x * light.size.y * light_n_dot_wi);
-                        float bsdf_pdf = shading_ctx.bsdf->pdf(shading_ctx.wo, wi);
-                        float mis_weight = mis_power_heuristic(light_pdf, bsdf_pdf);
-
-                        L += (light.emitted_radiance * f) * (mis_weight * std::abs(n_dot_wi) / light_pdf);
-                    }
-                }
-            }
-        }
+        Light_Sample sample;
+        if (sample_rectangular_light(shading_ctx, light, u_light, &sample) && !is_light_sample_occluded(scene_ctx, sample))
+            L += sample.L;
     }
     // BSDF sampling part of MIS.
     {
@@ -173,6 +304,7 @@ static ColorRGB direct_lighting_from_rectangular_light(
                 Ray light_visibility_ray{ position, wi };
 
                 Intersection isect;
+                RAY_STATS(shadow_ray_count++);
                 bool found_isect = scene_ctx.kdtree_data.scene_kdtree.intersect(light_visibility_ray, isect);
 
                 if (found_isect && isect.scene_object->area_light == light_handle) {
@@ -203,33 +335,9 @@ static ColorRGB direct_lighting_from_sphere_light(
     ColorRGB L;
     // Light sampling part of MIS.
     {
-        Vector3 light_point = light_sampler.sample(u_light);
-        Vector3 position = shading_ctx.get_ray_origin_using_control_point(light_point);
-
-        const Vector3 light_vec = light_point - position;
-        float distance_to_sample = light_vec.length();
-        Vector3 wi = light_vec / distance_to_sample;
-
-        float n_dot_wi = dot(shading_ctx.normal, wi);
-        bool scattering_possible = n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
-                                   n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
-
-        if (scattering_possible) {
-            ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
-
-            if (!f.is_black()) {
-                Ray light_visibility_ray{position, wi};
-                bool occluded = scene_ctx.kdtree_data.scene_kdtree.intersect_any(light_visibility_ray, distance_to_sample * (1.f - 1e-5f));
-
-                if (!occluded) {
-                    float light_pdf = light_sampler.cone_sampling_pdf;
-                    float bsdf_pdf = shading_ctx.bsdf->pdf(shading_ctx.wo, wi);
-                    float mis_weight = mis_power_heuristic(light_pdf, bsdf_pdf);
-
-                    L += (light_sampler.light.emitted_radiance * f) * (mis_weight * std::abs(n_dot_wi) / light_pdf);
-                }
-            }
-        }
+        Light_Sample sample;
+        if (sample_sphere_light(shading_ctx, light_sampler, u_light, &sample) && !is_light_sample_occluded(scene_ctx, sample))
+            L += sample.L;
     }
     // BSDF sampling part of MIS.
     {
@@ -245,6 +353,7 @@ static ColorRGB direct_lighting_from_sphere_light(
                 Ray light_visibility_ray{position, wi};
 
                 Intersection isect;
+                RAY_STATS(shadow_ray_count++);
                 bool found_isect = scene_ctx.kdtree_data.scene_kdtree.intersect(light_visibility_ray, isect);
 
                 if (found_isect && isect.scene_object->area_light == light_handle) {
@@ -270,32 +379,9 @@ static ColorRGB direct_lighting_from_triangle_mesh_light(
     ColorRGB L;
     // Light sampling part of MIS.
     {
-        float light_pdf;
-        Vector3 light_point = sampler.sample(u_light, shading_ctx.position, &light_pdf);
-        if (light_pdf != 0.f) {
-            Vector3 position = shading_ctx.get_ray_origin_using_control_point(light_point);
-
-            const Vector3 light_vec = light_point - position;
-            float distance_to_sample = light_vec.length();
-            Vector3 wi = light_vec / distance_to_sample;
-
-            float n_dot_wi = dot(shading_ctx.normal, wi);
-            bool scattering_possible = n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
-                n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
-
-            if (scattering_possible) {
-                ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
-                if (!f.is_black()) {
-                    Ray light_visibility_ray{ position, wi };
-                    bool occluded = scene_ctx.kdtree_data.scene_kdtree.intersect_any(light_visibility_ray, distance_to_sample * (1.f - 1e-5f));
-                    if (!occluded) {
-                        float bsdf_pdf = shading_ctx.bsdf->pdf(shading_ctx.wo, wi);
-                        float mis_weight = mis_power_heuristic(light_pdf, bsdf_pdf);
-                        L += (sampler.light->emitted_radiance * f) * (mis_weight * std::abs(n_dot_wi) / light_pdf);
-                    }
-                }
-            }
-        }
+        Light_Sample sample;
+        if (sample_triangle_mesh_light(shading_ctx, sampler, u_light, &sample) && !is_light_sample_occluded(scene_ctx, sample))
+            L += sample.L;
     }
     // BSDF sampling part of MIS.
     {
@@ -309,6 +395,7 @@ static ColorRGB direct_lighting_from_triangle_mesh_light(
             Ray light_visibility_ray{position, wi};
 
             Intersection isect;
+            RAY_STATS(shadow_ray_count++);
             bool found_isect = scene_ctx.kdtree_data.scene_kdtree.intersect(light_visibility_ray, isect);
 
             if (found_isect && isect.scene_object->area_light == light_handle) {
@@ -328,30 +415,9 @@ static ColorRGB direct_lighting_from_environment_light(
     ColorRGB L;
     // Light sampling part of MIS.
     {
-        Vector3 wi;
-        float light_pdf;
-        ColorRGB Le = scene_ctx.environment_light_sampler.sample(u_light, &wi, &light_pdf);
-
-        float n_dot_wi = dot(shading_ctx.normal, wi);
-        bool scattering_possible = n_dot_wi > 0.f && shading_ctx.bsdf->reflection_scattering ||
-                                   n_dot_wi < 0.f && shading_ctx.bsdf->transmission_scattering;
-
-        if (scattering_possible) {
-            ColorRGB f = shading_ctx.bsdf->evaluate(shading_ctx.wo, wi);
-
-            if (!f.is_black()) {
-                Vector3 position = shading_ctx.get_ray_origin_using_control_direction(wi);
-                Ray light_visibility_ray{position, wi};
-                bool occluded = scene_ctx.kdtree_data.scene_kdtree.intersect_any(light_visibility_ray, Infinity);
-
-                if (!occluded) {
-                    float bsdf_pdf = shading_ctx.bsdf->pdf(shading_ctx.wo, wi);
-                    float mis_weight = mis_power_heuristic(light_pdf, bsdf_pdf);
-
-                    L += (Le * f) * (mis_weight * std::abs(n_dot_wi) / light_pdf);
-                }
-            }
-        }
+        Light_Sample sample;
+        if (sample_environment_light(shading_ctx, scene_ctx.environment_light_sampler, u_light, &sample) && !is_light_sample_occluded(scene_ctx, sample))
+            L += sample.L;
     }
     // BSDF sampling part of MIS.
     {
@@ -369,6 +435,7 @@ static ColorRGB direct_lighting_from_environment_light(
             if (!Le.is_black()) {
                 Vector3 position = shading_ctx.get_ray_origin_using_control_direction(wi);
                 Ray light_visibility_ray{position, wi};
+                RAY_STATS(shadow_ray_count++);
                 bool occluded = scene_ctx.kdtree_data.scene_kdtree.intersect_any(light_visibility_ray, Infinity);
 
                 if (!occluded) {
@@ -519,60 +586,218 @@ ColorRGB estimate_direct_lighting(Thread_Context& thread_ctx, const Ray& ray, co
     return L;
 }
 
-ColorRGB estimate_direct_lighting_from_single_sample(const Thread_Context& thread_ctx,
-    float u_light_selector, Vector2 u_light, Vector2 u_bsdf, float u_scattering_type)
+static ColorRGB direct_lighting_from_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
+    Light_Handle light_handle, Vector2 u_light, Vector2 u_bsdf, float u_scattering_type)
 {
-    const Scene_Context& scene_ctx = thread_ctx.scene_context;
-    const Shading_Context& shading_ctx = thread_ctx.shading_context;
+    const Lights& lights = scene_ctx.lights;
+    switch (light_handle.type) {
+    case Light_Type::point:
+        return direct_lighting_from_point_light(scene_ctx, shading_ctx, lights.point_lights[light_handle.index]);
+
+    case Light_Type::spot:
+        return direct_lighting_from_spot_light(scene_ctx, shading_ctx, lights.spot_lights[light_handle.index]);
 
-    int light_index = int(u_light_selector * scene_ctx.lights.total_light_count);
-    ASSERT(light_index < scene_ctx.lights.total_light_count);
+    case Light_Type::directional:
+        return direct_lighting_from_directional_light(scene_ctx, shading_ctx, lights.directional_lights[light_handle.index]);
 
-    if (light_index < scene_ctx.lights.point_lights.size()) {
-        const Point_Light& light = scene_ctx.lights.point_lights[light_index];
-        return (float)scene_ctx.lights.total_light_count * direct_lighting_from_point_light(scene_ctx, shading_ctx, light);
+    case Light_Type::diffuse_rectangular:
+        return direct_lighting_from_rectangular_light(scene_ctx, shading_ctx, light_handle,
+            lights.diffuse_rectangular_lights[light_handle.index], u_light, u_bsdf, u_scattering_type);
+
+    case Light_Type::diffuse_sphere: {
+        Diffuse_Sphere_Light_Sampler sampler(lights.diffuse_sphere_lights[light_handle.index], shading_ctx.position);
+        return direct_lighting_from_sphere_light(scene_ctx, shading_ctx, light_handle, sampler, u_light, u_bsdf, u_scattering_type);
     }
-    light_index -= (int)scene_ctx.lights.point_lights.size();
+    case Light_Type::diffuse_triangle_mesh:
+        return direct_lighting_from_triangle_mesh_light(scene_ctx, shading_ctx, light_handle,
+            lights.diffuse_triangle_mesh_lights[light_handle.index], u_light, u_bsdf, u_scattering_type);
+
+    case Light_Type::environment_map:
+        ASSERT(scene_ctx.environment_light_sampler.initialized());
+        return direct_lighting_from_environment_light(scene_ctx, shading_ctx, u_light, u_bsdf, u_scattering_type);
 
-    if (light_index < scene_ctx.lights.spot_lights.size()) {
-        const Spot_Light& light = scene_ctx.lights.spot_lights[light_index];
-        return (float)scene_ctx.lights.total_light_count * direct_lighting_from_spot_light(scene_ctx, shading_ctx, light);
+    default:
+        ASSERT(false);
+        return Color_Black;
     }
-    light_index -= (int)scene_ctx.lights.spot_lights.size();
+}
+
+static bool sample_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
+    Light_Handle light_handle, Vector2 u_light, Light_Sample* sample)
+{
+    const Lights& lights = scene_ctx.lights;
+    switch (light_handle.type) {
+    case Light_Type::point:
+        return sample_point_light(shading_ctx, lights.point_lights[light_handle.index], sample);
+
+    case Light_Type::spot:
+        return sample_spot_light(shading_ctx, lights.spot_lights[light_handle.index], sample);
+
+    case Light_Type::directional:
+        return sample_directional_light(shading_ctx, lights.directional_lights[light_handle.index], sample);
+
+    case Light_Type::diffuse_rectangular:
+        return sample_rectangular_light(shading_ctx, lights.diffuse_rectangular_lights[light_handle.index], u_light, sample);
 
-    if (light_index < scene_ctx.lights.directional_lights.size()) {
-        const Directional_Light& light = scene_ctx.lights.directional_lights[light_index];
-        return (float)scene_ctx.lights.total_light_count * direct_lighting_from_directional_light(scene_ctx, shading_ctx, light);
+    case Light_Type::diffuse_sphere: {
+        Diffuse_Sphere_Light_Sampler sampler(lights.diffuse_sphere_lights[light_handle.index], shading_ctx.position);
+        return sample_sphere_light(shading_ctx, sampler, u_light, sample);
     }
-    light_index -= (int)scene_ctx.lights.directional_lights.size();
+    case Light_Type::diffuse_triangle_mesh:
+        return sample_triangle_mesh_light(shading_ctx, scene_ctx.triangle_mesh_light_samplers[light_handle.index], u_light, sample);
 
-    if (light_index < scene_ctx.lights.diffuse_rectangular_lights.size()) {
-        Light_Handle light_handle = {Light_Type::diffuse_rectangular, light_index};
-        const Diffuse_Rectangular_Light& light = scene_ctx.lights.diffuse_rectangular_lights[light_index];
-        ColorRGB L = direct_lighting_from_rectangular_light(scene_ctx, shading_ctx, light_handle, light, u_light, u_bsdf, u_scattering_type);
-        return (float)scene_ctx.lights.total_light_count * L;
+    case Light_Type::environment_map:
+        ASSERT(scene_ctx.environment_light_sampler.initialized());
+        return sample_environment_light(shading_ctx, scene_ctx.environment_light_sampler, u_light, sample);
+
+    default:
+        ASSERT(false);
+        return false;
     }
-    light_index -= (int)scene_ctx.lights.diffuse_rectangular_lights.size();
+}
+
+// BSDF sampling part of MIS for all the lights at once. The emitted radiance is taken from
+// the light that is hit by the sampled direction. The MIS weights are computed in the same way
+// as in direct_lighting_from_[light type] functions, so together with their light sampling parts
+// the weights of each light sum to one.
+static ColorRGB estimate_direct_lighting_from_bsdf_sample(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx,
+    Vector2 u_bsdf, float u_scattering_type)
+{
+    Vector3 wi;
+    float bsdf_pdf;
+    ColorRGB f = shading_ctx.bsdf->sample(u_bsdf, u_scattering_type, shading_ctx.wo, &wi, &bsdf_pdf);
+    if (f.is_black())
+        return Color_Black;
+    ASSERT(bsdf_pdf > 0.f);
 
-    if (light_index < scene_ctx.lights.diffuse_sphere_lights.size()) {
-        Light_Handle light_handle = {Light_Type::diffuse_sphere, light_index};
-        Diffuse_Sphere_Light_Sampler sampler(scene_ctx.lights.diffuse_sphere_lights[light_index], shading_ctx.position);
-        ColorRGB L = direct_lighting_from_sphere_light(scene_ctx, shading_ctx, light_handle, sampler, u_light, u_bsdf, u_scattering_type);
-        return (float)scene_ctx.lights.total_light_count * L;
+    Vector3 position = shading_ctx.get_ray_origin_using_control_direction(wi);
+    Ray light_visibility_ray{position, wi};
+
+    Intersection isect;
+    RAY_STATS(shadow_ray_count++);
+    bool found_isect = scene_ctx.kdtree_data.scene_kdtree.intersect(light_visibility_ray, isect);
+
+    ColorRGB Le;
+    float light_pdf = 0.f;
+    if (!found_isect) {
+        if (!scene_ctx.environment_light_sampler.initialized())
+            return Color_Black;
+        // Unfiltered radiance, see direct_lighting_from_environment_light.
+        Le = scene_ctx.environment_light_sampler.get_unfiltered_radiance_for_direction(wi);
+        light_pdf = scene_ctx.environment_light_sampler.pdf(wi);
+    }
+    else {
+        const Light_Handle light_handle = isect.scene_object->area_light;
+        const Lights& lights = scene_ctx.lights;
+
+        if (light_handle.type == Light_Type::diffuse_rectangular) {
+            const Diffuse_Rectangular_Light& light = lights.diffuse_rectangular_lights[light_handle.index];
+            float light_n_dot_wi = dot(light.light_to_world_transform.get_column(2), -wi);
+            if (light_n_dot_wi <= 1e-4f)
+                return Color_Black;
+            Le = light.emitted_radiance;
+            light_pdf = (isect.t * isect.t) / (light.size.x * light.size.y * light_n_dot_wi);
+        }
+        else if (light_handle.type == Light_Type::diffuse_sphere) {
+            Diffuse_Sphere_Light_Sampler sampler(lights.diffuse_sphere_lights[light_handle.index], shading_ctx.position);
+            Le = sampler.light.emitted_radiance;
+            light_pdf = sampler.cone_sampling_pdf;
+        }
+        else if (light_handle.type == Light_Type::diffuse_triangle_mesh) {
+            const Diffuse_Triangle_Mesh_Light_Sampler& sampler = scene_ctx.triangle_mesh_light_samplers[light_handle.index];
+            light_pdf = sampler.pdf(position, wi, isect);
+            if (light_pdf == 0.f)
+                return Color_Black; // back side of the light
+            Le = sampler.light->emitted_radiance;
+        }
+        else {
+            return Color_Black; // not an area light
+        }
     }
-    light_index -= (int)scene_ctx.lights.diffuse_sphere_lights.size();
 
-    if (light_index < scene_ctx.lights.diffuse_triangle_mesh_lights.size()) {
-        Light_Handle light_handle = {Light_Type::diffuse_triangle_mesh, light_index};
-        const Diffuse_Triangle_Mesh_Light& light = scene_ctx.lights.diffuse_triangle_mesh_lights[light_index];
-        ColorRGB L = direct_lighting_from_triangle_mesh_light(scene_ctx, shading_ctx, light_handle, light, u_light, u_bsdf, u_scattering_type);
-        return (float)scene_ctx.lights.total_light_count * L;
+    float mis_weight = mis_power_heuristic(bsdf_pdf, light_pdf);
+    return (Le * f) * (mis_weight * std::abs(dot(shading_ctx.normal, wi)) / bsdf_pdf);
+}
+
+static Light_Handle select_light(const Scene_Context& scene_ctx, const Shading_Context& shading_ctx, float u, float* pmf)
+{
+    if (scene_ctx.raytracer_config.light_selection == Raytracer_Config::Light_Selection::light_tree) {
+        return scene_ctx.light_tree.sample(shading_ctx.position, shading_ctx.normal, u, pmf);
+    }
+    else if (scene_ctx.raytracer_config.light_selection == Raytracer_Config::Light_Selection::power) {
+        return scene_ctx.light_power_distribution.sample(scene_ctx.lights, u, pmf);
     }
-    light_index -= (int)scene_ctx.lights.diffuse_triangle_mesh_lights.size();
+    else {
+        int light_index = int(u * scene_ctx.lights.total_light_count);
+        *pmf = 1.f / float(scene_ctx.lights.total_light_count);
+        return scene_ctx.lights.get_light_handle(light_index);
+    }
+}
+
+// Resampled importance sampling (RIS) of the light sample. The candidate samples are generated by
+// the light selection strategy and the light samplers, the target function is the luminance of
+// the unshadowed contribution. Only the selected candidate is tested for visibility.
+static ColorRGB estimate_direct_lighting_with_light_resampling(Thread_Context& thread_ctx,
+    float u_light_selector, Vector2 u_light, Vector2 u_bsdf, float u_scattering_type)
+{
+    const Scene_Context& scene_ctx = thread_ctx.scene_context;
+    const Shading_Context& shading_ctx = thread_ctx.shading_context;
+    const int candidate_count = scene_ctx.raytracer_config.light_resampling_candidate_count;
+
+    Light_Sample selected_sample;
+    float selected_target = 0.f;
+    float weight_sum = 0.f;
+
+    for (int i = 0; i < candidate_count; i++) {
+        // The first candidate uses the pixel sampler values, the rest are random.
+        float u_selector = (i == 0) ? u_light_selector : thread_ctx.rng.get_float();
+        Vector2 u = (i == 0) ? u_light : thread_ctx.rng.get_vector2();
+
+        float light_selection_pmf;
+        Light_Handle light_handle = select_light(scene_ctx, shading_ctx, u_selector, &light_selection_pmf);
+        if (light_handle == Null_Light)
+            continue;
+
+        Light_Sample sample;
+        if (!sample_light(scene_ctx, shading_ctx, light_handle, u, &sample))
+            continue;
+
+        float target = sample.L.luminance();
+        if (target <= 0.f)
+            continue;
+
+        // Weighted reservoir sampling: the candidate is selected with probability weight / weight_sum.
+        float weight = target / light_selection_pmf;
+        weight_sum += weight;
+        if (thread_ctx.rng.get_float() * weight_sum < weight) {
+            selected_sample = sample;
+            selected_target = target;
+        }
+    }
+
+    ColorRGB L;
+    if (weight_sum > 0.f && !is_light_sample_occluded(scene_ctx, selected_sample)) {
+        L = selected_sample.L * (weight_sum / (float(candidate_count) * selected_target));
+    }
+    L += estimate_direct_lighting_from_bsdf_sample(scene_ctx, shading_ctx, u_bsdf, u_scattering_type);
+    return L;
+}
+
+ColorRGB estimate_direct_lighting_from_single_sample(Thread_Context& thread_ctx,
+    float u_light_selector, Vector2 u_light, Vector2 u_bsdf, float u_scattering_type)
+{
+    const Scene_Context& scene_ctx = thread_ctx.scene_context;
+    const Shading_Context& shading_ctx = thread_ctx.shading_context;
+
+    if (scene_ctx.raytracer_config.light_resampling_candidate_count > 0) {
+        return estimate_direct_lighting_with_light_resampling(thread_ctx, u_light_selector, u_light, u_bsdf, u_scattering_type);
+    }
+
+    float light_selection_pmf;
+    Light_Handle light_handle = select_light(scene_ctx, shading_ctx, u_light_selector, &light_selection_pmf);
+    if (light_handle == Null_Light)
+        return Color_Black;
 
-    // the only light left is environment light
-    ASSERT(light_index == 0);
-    ASSERT(scene_ctx.environment_light_sampler.initialized());
-    ColorRGB L = direct_lighting_from_environment_light(scene_ctx, shading_ctx, u_light, u_bsdf, u_scattering_type);
-    return (float)scene_ctx.lights.total_light_count * L;
+    ColorRGB L = direct_lighting_from_light(scene_ctx, shading_ctx, light_handle, u_light, u_bsdf, u_scattering_type);
+    return L / light_selection_pmf;
 }
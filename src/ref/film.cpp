@@ -18,12 +18,153 @@ static Film_Pixel& get_film_pixel(Film& film, Vector2i p) {
     return film.pixels[offset];
 }
 
+//
+// Filters.
+// All supported filters can be expressed in terms of separable x/y terms, so the y term
+// is computed once per row of the filter footprint.
+//
+namespace {
+struct Box_Filter {
+    float axis_term(float d) const { return 1.f; }
+    float combine(float x_term, float y_term) const { return 1.f; }
+};
+
+struct Gaussian_Filter {
+    float alpha;
+    float zero_level;
+
+    // exp(-alpha*(x^2 + y^2)) = exp(-alpha*x^2) * exp(-alpha*y^2)
+    float axis_term(float d) const { return std::exp(-alpha * d * d); }
+    float combine(float x_term, float y_term) const { return std::max(0.f, x_term * y_term - zero_level); }
+};
+
+struct Triangle_Filter {
+    float radius;
+
+    float axis_term(float d) const { return std::max(0.f, radius - std::abs(d)); }
+    float combine(float x_term, float y_term) const { return x_term * y_term; }
+};
+}
+
+template <typename Filter>
+static void add_filtered_sample(Film_Tile& tile, const Filter& filter, const Bounds2i& region, Vector2 film_pos, ColorRGB color) {
+    for (int y = region.p0.y; y < region.p1.y; y++) {
+        float y_term = filter.axis_term(film_pos.y - (y + 0.5f));
+
+        int offset = (y - tile.pixel_bounds.p0.y) * tile.pixel_bounds.size().x + (region.p0.x - tile.pixel_bounds.p0.x);
+        Film_Pixel* pixel = &tile.pixels[offset];
+
+        for (int x = region.p0.x; x < region.p1.x; x++, pixel++) {
+            float x_term = filter.axis_term(film_pos.x - (x + 0.5f));
+            float weight = filter.combine(x_term, y_term);
+
+            pixel->color_sum += weight * color;
+            pixel->weight_sum += weight;
+        }
+    }
+}
+
+// Samples offset from [-radius, radius] according to the 1D tent function: max(0, radius - |x|).
+static float sample_tent(float u, float radius) {
+    if (u < 0.5f)
+        return -radius + radius * std::sqrt(2.f * u);
+    else
+        return radius - radius * std::sqrt(2.f - 2.f * u);
+}
+
+float Film_Filter::evaluate(Vector2 p) const {
+    switch (type) {
+    case Film_Filter_Type::box:
+        return 1.f;
+    case Film_Filter_Type::gaussian:
+        return std::max(0.f, std::exp(-alpha * p.length_squared()) - zero_level);
+    case Film_Filter_Type::triangle:
+        return std::max(0.f, radius - std::abs(p.x)) * std::max(0.f, radius - std::abs(p.y));
+    default:
+        ASSERT(false);
+        return 0.f;
+    }
+}
+
+Vector2 Film_Filter::sample(Vector2 u, float* weight) const {
+    switch (type) {
+    case Film_Filter_Type::box:
+        *weight = 1.f;
+        return Vector2{ (2.f * u.x - 1.f) * radius, (2.f * u.y - 1.f) * radius };
+    case Film_Filter_Type::gaussian: {
+        // The tabulated distribution only approximates the filter, so the weight is not constant.
+        float pdf_uv;
+        Vector2 uv = gaussian_distribution.sample(u, &pdf_uv);
+        Vector2 p{ (2.f * uv.x - 1.f) * radius, (2.f * uv.y - 1.f) * radius };
+        float pdf = pdf_uv / (4.f * radius * radius);
+        *weight = evaluate(p) / pdf;
+        return p;
+    }
+    case Film_Filter_Type::triangle:
+        // The sampling is exact, the weight is the same for all samples.
+        *weight = 1.f;
+        return Vector2{ sample_tent(u.x, radius), sample_tent(u.y, radius) };
+    default:
+        ASSERT(false);
+        *weight = 0.f;
+        return Vector2{};
+    }
+}
+
+Film_Filter get_box_filter(float radius) {
+    Film_Filter filter;
+    filter.type = Film_Filter_Type::box;
+    filter.radius = radius;
+    return filter;
+}
+
+Film_Filter get_gaussian_filter(float radius, float alpha, bool filter_importance_sampling) {
+    Film_Filter filter;
+    filter.type = Film_Filter_Type::gaussian;
+    filter.radius = radius;
+    filter.alpha = alpha;
+    filter.zero_level = std::exp(-alpha * radius * radius);
+
+    if (filter_importance_sampling) {
+        // The same resolution as pbrt-v4 uses: 32 values per unit of filter radius.
+        const int n = std::max(1, int(32.f * radius));
+        std::vector<float> values(n * n);
+        float max_value = filter.evaluate(Vector2{});
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                Vector2 p{ ((x + 0.5f) / n * 2.f - 1.f) * radius, ((y + 0.5f) / n * 2.f - 1.f) * radius };
+                // Small non-zero value in the corners (outside of the filter radius) ensures that each
+                // cell has non-zero pdf. The samples from the corners get zero weight.
+                values[y * n + x] = std::max(filter.evaluate(p), 1e-6f * max_value);
+            }
+        }
+        filter.gaussian_distribution.initialize(values.data(), n, n);
+    }
+    return filter;
+}
+
+Film_Filter get_triangle_filter(float radius) {
+    Film_Filter filter;
+    filter.type = Film_Filter_Type::triangle;
+    filter.radius = radius;
+    return filter;
+}
+
+//
+// Film.
+//
 Film_Tile::Film_Tile(Bounds2i pixel_bounds) {
     this->pixel_bounds = pixel_bounds;
     pixels.resize(pixel_bounds.area());
     memset(pixels.data(), 0, pixels.size() * sizeof(Film_Pixel));
 }
 
+void Film_Tile::add_pixel_sample(Vector2i pixel, ColorRGB color, float weight) {
+    Film_Pixel& film_pixel = get_tile_pixel(*this, pixel);
+    film_pixel.color_sum += weight * color;
+    film_pixel.weight_sum += weight;
+}
+
 void Film_Tile::add_sample(const Film_Filter& filter, Vector2 film_pos, ColorRGB color) {
     // find pixels that are affected by the sample
     Bounds2i region;
@@ -33,41 +174,80 @@ void Film_Tile::add_sample(const Film_Filter& filter, Vector2 film_pos, ColorRGB
     region.p1.y = (int)std::floor(film_pos.y + filter.radius - 0.5f) + 1;
 
     region = intersect_bounds(region, pixel_bounds);
+    if (region.p0.x >= region.p1.x || region.p0.y >= region.p1.y)
+        return;
 
     // add sample contribution to each pixel
-    for (int y = region.p0.y; y < region.p1.y; y++) {
-        for (int x = region.p0.x; x < region.p1.x; x++) {
-            Vector2 pixel_pos { x + 0.5f, y + 0.5f };
-            Vector2 filter_point = film_pos - pixel_pos;
+    switch (filter.type) {
+    case Film_Filter_Type::box:
+        add_filtered_sample(*this, Box_Filter{}, region, film_pos, color);
+        break;
+    case Film_Filter_Type::gaussian:
+        add_filtered_sample(*this, Gaussian_Filter{ filter.alpha, filter.zero_level }, region, film_pos, color);
+        break;
+    case Film_Filter_Type::triangle:
+        add_filtered_sample(*this, Triangle_Filter{ filter.radius }, region, film_pos, color);
+        break;
+    default:
+        ASSERT(false);
+    }
+}
 
-            float weight = filter.func(filter_point);
+void Film_Tile::allocate_aov_pixels(Bounds2i aov_bounds) {
+    this->aov_bounds = aov_bounds;
+    aov_pixels.resize(aov_bounds.area());
+}
 
-            Film_Pixel& pixel = get_tile_pixel(*this, Vector2i{x, y});
-            pixel.color_sum += weight * color;
-            pixel.weight_sum += weight;
-        }
-    }
+Film_AOV_Pixel& Film_Tile::get_aov_pixel(Vector2i p) {
+    ASSERT(is_inside_bounds(aov_bounds, p));
+    int offset = (p.y - aov_bounds.p0.y) * aov_bounds.size().x + (p.x - aov_bounds.p0.x);
+    ASSERT(offset < aov_pixels.size());
+    return aov_pixels[offset];
 }
 
-Film::Film(Bounds2i render_region, Film_Filter filter) {
+static ColorRGB resolve_film_pixel(const Film_Pixel& film_pixel) {
+    ColorRGB resolved_color = (film_pixel.weight_sum == 0.f) ?
+        Color_Black : film_pixel.color_sum / film_pixel.weight_sum;
+
+    // handle out-of-gamut values
+    resolved_color.r = std::max(0.f, resolved_color.r);
+    resolved_color.g = std::max(0.f, resolved_color.g);
+    resolved_color.b = std::max(0.f, resolved_color.b);
+    return resolved_color;
+}
+
+Film::Film(Bounds2i render_region, Film_Filter filter, bool filter_importance_sampling, bool allocate_pixels) {
     this->render_region = render_region;
     this->filter = filter;
+    this->filter_importance_sampling = filter_importance_sampling;
 
-    sample_region = Bounds2i {
-        Vector2i {
-            (int32_t)std::floor(render_region.p0.x + 0.5f - filter.radius),
-            (int32_t)std::floor(render_region.p0.y + 0.5f - filter.radius)
-        },
-        Vector2i {
-            (int32_t)std::ceil(render_region.p1.x-1 + 0.5f + filter.radius),
-            (int32_t)std::ceil(render_region.p1.y-1 + 0.5f + filter.radius)
-        }
-    };
+    // In filter importance sampling mode each pixel gets only its own samples.
+    if (filter_importance_sampling) {
+        sample_region = render_region;
+    }
+    else {
+        sample_region = Bounds2i {
+            Vector2i {
+                (int32_t)std::floor(render_region.p0.x + 0.5f - filter.radius),
+                (int32_t)std::floor(render_region.p0.y + 0.5f - filter.radius)
+            },
+            Vector2i {
+                (int32_t)std::ceil(render_region.p1.x-1 + 0.5f + filter.radius),
+                (int32_t)std::ceil(render_region.p1.y-1 + 0.5f + filter.radius)
+            }
+        };
+    }
 
     tile_grid_size = (sample_region.size() + (Tile_Size - 1)) / Tile_Size;
 
-    pixels.resize(render_region.area());
-    memset(pixels.data(), 0, pixels.size() * sizeof(Film_Pixel));
+    if (allocate_pixels) {
+        pixels.resize(render_region.area());
+        memset(pixels.data(), 0, pixels.size() * sizeof(Film_Pixel));
+    }
+}
+
+void Film::allocate_aov_pixels() {
+    aov_pixels.resize(render_region.area());
 }
 
 void Film::get_tile_bounds(int tile_index, Bounds2i& tile_sample_bounds, Bounds2i& tile_pixel_bounds) const {
@@ -79,6 +259,10 @@ void Film::get_tile_bounds(int tile_index, Bounds2i& tile_sample_bounds, Bounds2
     tile_sample_bounds.p1.x = std::min(tile_sample_bounds.p0.x + Tile_Size, sample_region.p1.x);
     tile_sample_bounds.p1.y = std::min(tile_sample_bounds.p0.y + Tile_Size, sample_region.p1.y);
 
+    if (filter_importance_sampling) {
+        tile_pixel_bounds = tile_sample_bounds;
+        return;
+    }
     tile_pixel_bounds.p0.x = std::max((int)std::ceil(tile_sample_bounds.p0.x - filter.radius - 0.5f), render_region.p0.x);
     tile_pixel_bounds.p0.y = std::max((int)std::ceil(tile_sample_bounds.p0.y - filter.radius - 0.5f), render_region.p0.y);
     tile_pixel_bounds.p1.x = std::min((int)std::floor(tile_sample_bounds.p1.x + filter.radius - 0.5f) + 1, render_region.p1.x);
@@ -86,6 +270,7 @@ void Film::get_tile_bounds(int tile_index, Bounds2i& tile_sample_bounds, Bounds2
 }
 
 void Film::merge_tile(const Film_Tile& tile) {
+    ASSERT(!pixels.empty());
     for (int y = tile.pixel_bounds.p0.y; y < tile.pixel_bounds.p1.y; y++) {
         for (int x = tile.pixel_bounds.p0.x; x < tile.pixel_bounds.p1.x; x++) {
             Vector2i p {x, y};
@@ -97,6 +282,60 @@ void Film::merge_tile(const Film_Tile& tile) {
             film_pixel.weight_sum += tile_pixel.weight_sum;
         }
     }
+
+    // AOV data of the tiles does not overlap.
+    if (has_aovs() && !tile.aov_pixels.empty()) {
+        for (int y = tile.aov_bounds.p0.y; y < tile.aov_bounds.p1.y; y++) {
+            for (int x = tile.aov_bounds.p0.x; x < tile.aov_bounds.p1.x; x++) {
+                Vector2i p{ x, y };
+                int offset = (p.y - render_region.p0.y) * render_region.size().x + (p.x - render_region.p0.x);
+                aov_pixels[offset] = const_cast<Film_Tile&>(tile).get_aov_pixel(p);
+            }
+        }
+    }
+}
+
+// Distance and normal are averaged over the samples that hit the surface,
+// for the pixels without hits they are zero. Albedo is averaged over all samples.
+static std::vector<Image_Channel> resolve_aov_channels(const std::vector<Film_AOV_Pixel>& aov_pixels) {
+    const char* channel_names[] = {
+        "Z", "N.X", "N.Y", "N.Z", "albedo.R", "albedo.G", "albedo.B", "sample_count", "variance", "time",
+        "material.type", "material.index"
+    };
+    std::vector<Image_Channel> channels(std::size(channel_names));
+    for (auto [i, channel] : enumerate(channels)) {
+        channel.name = channel_names[i];
+        channel.data.resize(aov_pixels.size());
+    }
+    for (size_t i = 0; i < aov_pixels.size(); i++) {
+        const Film_AOV_Pixel& aov_pixel = aov_pixels[i];
+
+        float distance = 0.f;
+        Vector3 normal;
+        if (aov_pixel.hit_count > 0) {
+            distance = aov_pixel.distance_sum / float(aov_pixel.hit_count);
+            if (aov_pixel.normal_sum.length_squared() > 0.f)
+                normal = aov_pixel.normal_sum.normalized();
+        }
+        ColorRGB albedo;
+        if (aov_pixel.sample_count > 0)
+            albedo = aov_pixel.albedo_sum / float(aov_pixel.sample_count);
+
+        channels[0].data[i] = distance;
+        channels[1].data[i] = normal.x;
+        channels[2].data[i] = normal.y;
+        channels[3].data[i] = normal.z;
+        channels[4].data[i] = albedo.r;
+        channels[5].data[i] = albedo.g;
+        channels[6].data[i] = albedo.b;
+        channels[7].data[i] = float(aov_pixel.sample_count);
+        channels[8].data[i] = aov_pixel.variance;
+        channels[9].data[i] = aov_pixel.time;
+        // -1 if there is no material (background or light source).
+        channels[10].data[i] = aov_pixel.material == Null_Material ? -1.f : float(aov_pixel.material.type);
+        channels[11].data[i] = float(aov_pixel.material.index);
+    }
+    return channels;
 }
 
 Image Film::get_image() const {
@@ -104,39 +343,89 @@ Image Film::get_image() const {
     ColorRGB* image_pixel = image.data.data();
 
     for (const Film_Pixel& film_pixel : pixels) {
-        ColorRGB resolved_color = (film_pixel.weight_sum == 0.f) ?
-            Color_Black : film_pixel.color_sum / film_pixel.weight_sum;
-
-        // handle out-of-gamut values
-        resolved_color.r = std::max(0.f, resolved_color.r);
-        resolved_color.g = std::max(0.f, resolved_color.g);
-        resolved_color.b = std::max(0.f, resolved_color.b);
-
-        *image_pixel++ = resolved_color;
+        *image_pixel++ = resolve_film_pixel(film_pixel);
+    }
+    if (has_aovs()) {
+        image.extra_channels = resolve_aov_channels(aov_pixels);
     }
     return image;
 }
 
-//
-// Filters.
-//
-Film_Filter get_box_filter(float radius) {
-    auto box_filter = [](Vector2 p) { return 1.f; };
-    return Film_Filter{ box_filter, radius };
+Film_Row_Streamer::Film_Row_Streamer(const Film& film, Write_Rows_Func write_rows, bool flip_horizontally)
+    : film(film)
+    , write_rows(write_rows)
+    , flip_horizontally(flip_horizontally)
+{
+    tiles.resize(film.get_tile_count());
+    finished_tiles.resize(film.get_tile_count(), false);
+    next_row = film.render_region.p0.y;
 }
 
-Film_Filter get_gaussian_filter(float radius, float alpha) {
-    float zero_level = std::exp(-alpha*radius*radius);
-    
-    auto gaussian_filter = [alpha, zero_level](Vector2 p) {
-        return std::max(0.f, std::exp(-alpha * p.length_squared()) - zero_level);
-    };
-    return Film_Filter{ gaussian_filter, radius };
+void Film_Row_Streamer::add_tile(int tile_index, Film_Tile&& tile) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT(!finished_tiles[tile_index]);
+    tiles[tile_index] = std::move(tile);
+    finished_tiles[tile_index] = true;
+
+    if (tile_index != first_unfinished_tile)
+        return;
+
+    while (first_unfinished_tile < film.get_tile_count() && finished_tiles[first_unfinished_tile])
+        first_unfinished_tile++;
+
+    // Tile pixel bounds do not decrease with the tile index, so the rows above the first
+    // unfinished tile are not affected by the tiles that are still rendered.
+    int end_row = film.render_region.p1.y;
+    if (first_unfinished_tile < film.get_tile_count()) {
+        Bounds2i sample_bounds, pixel_bounds;
+        film.get_tile_bounds(first_unfinished_tile, sample_bounds, pixel_bounds);
+        end_row = pixel_bounds.p0.y;
+    }
+    if (end_row > next_row)
+        write_ready_rows(end_row);
 }
 
-Film_Filter get_triangle_filter(float radius) {
-    auto triangle_filter = [radius](Vector2 p) {
-        return std::max(0.f, radius - std::abs(p.x)) * std::max(0.f, radius - std::abs(p.y));
-    };
-    return Film_Filter{ triangle_filter, radius };
+void Film_Row_Streamer::write_ready_rows(int end_row) {
+    const int width = film.render_region.size().x;
+    const int row_count = end_row - next_row;
+
+    row_pixels.resize(size_t(row_count) * width);
+    memset(row_pixels.data(), 0, row_pixels.size() * sizeof(Film_Pixel));
+
+    // The tiles are accumulated in tile index order, the same way as Film::merge_tile
+    // is called for the full film. It gives bit-identical result.
+    for (int tile_index = first_unreleased_tile; tile_index < first_unfinished_tile; tile_index++) {
+        const Film_Tile& tile = tiles[tile_index];
+        int y0 = std::max(tile.pixel_bounds.p0.y, next_row);
+        int y1 = std::min(tile.pixel_bounds.p1.y, end_row);
+        for (int y = y0; y < y1; y++) {
+            for (int x = tile.pixel_bounds.p0.x; x < tile.pixel_bounds.p1.x; x++) {
+                Vector2i p{ x, y };
+                Film_Pixel& row_pixel = row_pixels[size_t(y - next_row) * width + (x - film.render_region.p0.x)];
+                const Film_Pixel& tile_pixel = get_tile_pixel(const_cast<Film_Tile&>(tile), p);
+                row_pixel.color_sum += tile_pixel.color_sum;
+                row_pixel.weight_sum += tile_pixel.weight_sum;
+            }
+        }
+    }
+
+    row_colors.resize(row_pixels.size());
+    for (size_t i = 0; i < row_pixels.size(); i++) {
+        row_colors[i] = resolve_film_pixel(row_pixels[i]);
+    }
+    if (flip_horizontally) {
+        for (int y = 0; y < row_count; y++) {
+            ColorRGB* row = &row_colors[size_t(y) * width];
+            std::reverse(row, row + width);
+        }
+    }
+    write_rows(row_colors.data(), row_count);
+    next_row = end_row;
+
+    // Release the tiles that do not overlap the remaining rows.
+    while (first_unreleased_tile < first_unfinished_tile && tiles[first_unreleased_tile].pixel_bounds.p1.y <= next_row) {
+        tiles[first_unreleased_tile] = Film_Tile{};
+        first_unreleased_tile++;
+    }
 }
+
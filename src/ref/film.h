@@ -1,8 +1,11 @@
 #pragma once
 
+#include "sampling.h"
+
 #include "lib/bounding_box.h"
 #include "lib/color.h"
 #include "lib/image.h"
+#include "lib/material.h"
 #include "lib/vector.h"
 
 // ---- Difference between film tiles and sample tiles ----
@@ -17,10 +20,49 @@
 // Also it means that Film_Tiles can overlap. In order to have deterministic
 // rendering we need to merge Film_Tiles into the Film in deterministic order.
 // (we order tiles according to tile index value).
+//
+// ---- Filter importance sampling ----
+//
+// In filter importance sampling mode the image plane samples are distributed
+// according to the filter function and each sample contributes only to the pixel
+// it was generated for. In this mode sample tiles and film tiles are the same,
+// they do not overlap and can be merged into the film in any order.
+//
+// ---- AOVs ----
+//
+// Arbitrary output variables are auxiliary per-pixel values (depth, normal, albedo, etc) that are
+// written as additional channels of the output image. They are not filtered, each pixel stores
+// only the data of the samples generated inside the pixel. The AOV bounds of the tile are the
+// tile's sample bounds clipped by the render region, so AOV data of the tiles does not overlap.
+//
+// ---- Streaming output ----
+//
+// Film_Row_Streamer does not keep the full film in memory. The image rows are
+// resolved as soon as all film tiles that overlap them are finished and then
+// the tiles that do not contribute to the remaining rows are released.
 
+enum class Film_Filter_Type {
+    box,
+    gaussian,
+    triangle
+};
+
+// The filter type is checked once per sample, the weights for the pixels under
+// the filter footprint are computed by the filter specific code (see film.cpp).
 struct Film_Filter {
-    std::function<float(Vector2)> func;
+    Film_Filter_Type type = Film_Filter_Type::box;
     float radius = 0.f;
+    float alpha = 0.f; // gaussian filter falloff
+    float zero_level = 0.f; // gaussian filter value at radius distance
+
+    // Tabulated filter function for filter importance sampling of the gaussian filter.
+    Distribution_2D gaussian_distribution;
+
+    float evaluate(Vector2 p) const;
+
+    // Returns offset from the pixel center distributed according to the filter function.
+    // 'weight' output parameter is filter_value/pdf ratio for the sampled offset.
+    Vector2 sample(Vector2 u, float* weight) const;
 };
 
 struct Film_Pixel {
@@ -28,31 +70,89 @@ struct Film_Pixel {
     float weight_sum = 0.f; // sum(Weight)
 };
 
+struct Film_AOV_Pixel {
+    float distance_sum = 0.f; // sum of the distances to the first hit
+    Vector3 normal_sum; // sum of the first hit shading normals
+    ColorRGB albedo_sum;
+    Material_Handle material; // first hit material of the first sample that hits the surface
+    int hit_count = 0; // the number of samples that hit the surface
+    int sample_count = 0;
+    float variance = 0.f; // variance estimate of the pixel's luminance
+    float time = 0.f; // pixel rendering time in seconds
+};
+
 struct Film_Tile {
     Bounds2i pixel_bounds;
     std::vector<Film_Pixel> pixels;
 
+    Bounds2i aov_bounds;
+    std::vector<Film_AOV_Pixel> aov_pixels; // empty if AOVs are disabled
+
     Film_Tile() = default;
     Film_Tile(Bounds2i pixel_bounds);
     void add_sample(const Film_Filter& filter, Vector2 film_pos, ColorRGB color);
+
+    // Used in filter importance sampling mode. The sample contributes only to the given pixel.
+    void add_pixel_sample(Vector2i pixel, ColorRGB color, float weight);
+
+    void allocate_aov_pixels(Bounds2i aov_bounds);
+    Film_AOV_Pixel& get_aov_pixel(Vector2i pixel);
 };
 
 struct Film {
     Bounds2i render_region;
     Film_Filter filter;
+    bool filter_importance_sampling = false;
 
     Bounds2i sample_region;
     Vector2i tile_grid_size;
 
-    std::vector<Film_Pixel> pixels; // has render_region dimensions
+    std::vector<Film_Pixel> pixels; // has render_region dimensions, empty if pixels are not allocated
+    std::vector<Film_AOV_Pixel> aov_pixels; // has render_region dimensions, empty if AOVs are disabled
 
-    Film(Bounds2i render_region, Film_Filter filter);
+    Film(Bounds2i render_region, Film_Filter filter, bool filter_importance_sampling, bool allocate_pixels = true);
+    void allocate_aov_pixels();
+    bool has_aovs() const { return !aov_pixels.empty(); }
     int get_tile_count() const { return tile_grid_size.x * tile_grid_size.y; }
     void get_tile_bounds(int tile_index, Bounds2i& tile_sample_bounds, Bounds2i& tile_pixel_bounds) const;
+    // Film tiles can overlap only when the samples are splatted to all pixels under the filter footprint.
+    bool do_tiles_overlap() const { return !filter_importance_sampling; }
+
     void merge_tile(const Film_Tile& tile);
+
+    // If AOVs are enabled then they are returned as extra channels of the image.
     Image get_image() const;
 };
 
+struct Film_Row_Streamer {
+    // Receives resolved image rows from top to bottom. 'pixels' contains row_count * render_region.size().x pixels.
+    using Write_Rows_Func = std::function<void (const ColorRGB* pixels, int row_count)>;
+
+    Film_Row_Streamer(const Film& film, Write_Rows_Func write_rows, bool flip_horizontally);
+
+    // Thread-safe. The ready rows are written by the thread that calls this function.
+    void add_tile(int tile_index, Film_Tile&& tile);
+
+    bool are_all_rows_written() const { return next_row == film.render_region.p1.y; }
+
+private:
+    void write_ready_rows(int end_row);
+
+    const Film& film;
+    Write_Rows_Func write_rows;
+    bool flip_horizontally = false;
+
+    std::mutex mutex;
+    std::vector<Film_Tile> tiles;
+    std::vector<bool> finished_tiles;
+    int first_unfinished_tile = 0;
+    int first_unreleased_tile = 0;
+    int next_row = 0; // the first row that is not written yet
+
+    std::vector<Film_Pixel> row_pixels;
+    std::vector<ColorRGB> row_colors;
+};
+
 Film_Filter get_box_filter(float radius);
-Film_Filter get_gaussian_filter(float radius, float alpha);
+Film_Filter get_gaussian_filter(float radius, float alpha, bool filter_importance_sampling);
 Film_Filter get_triangle_filter(float radius);
@@ -2,6 +2,8 @@
 #include "lib/common.h"
 #include "image_texture.h"
 
+#include "texture_cache.h"
+
 #include "lib/math.h"
 #include "lib/vector.h"
 
@@ -299,6 +301,70 @@ void Image_Texture::initialize_from_constant_value(const ColorRGB& color)
     mips[0].init_from_constant_value(1, 1, color);
 }
 
+void Image_Texture::initialize_on_demand(const std::string& image_path, const Init_Params& params, const fs::path& cache_directory)
+{
+    cached_texture = std::make_shared<Cached_Texture>();
+    cached_texture->image_path = image_path;
+    cached_texture->init_params = params;
+    cached_texture->cache_file = get_texture_cache_file(cache_directory, image_path, params);
+}
+
+int Image_Texture::get_mip_count() const
+{
+    if (cached_texture) {
+        cached_texture->load();
+        return int(cached_texture->mips.size());
+    }
+    return int(mips.size());
+}
+
+Vector2i Image_Texture::get_mip_resolution(int mip_level) const
+{
+    ASSERT(mip_level >= 0 && mip_level < get_mip_count());
+    if (cached_texture) {
+        const Cached_Mip_Level& level = cached_texture->mips[mip_level];
+        return Vector2i{ level.width, level.height };
+    }
+    return Vector2i{ mips[mip_level].width, mips[mip_level].height };
+}
+
+// Provides access to the texels of the mip level. The texels are stored either in
+// the resident mip image or in the tiles managed by the texture cache.
+struct Image_Texture::Mip_Level {
+    const Image* image = nullptr;
+    const Cached_Texture* cached_texture = nullptr;
+    int level = 0;
+    int width = 0;
+    int height = 0;
+
+    ColorRGB get_texel(int x, int y) const {
+        if (image)
+            return image->data[y * width + x];
+        else
+            return cached_texture->get_texel(level, x, y);
+    }
+};
+
+Image_Texture::Mip_Level Image_Texture::get_mip_level(int mip_level) const
+{
+    Mip_Level result;
+    result.level = mip_level;
+    if (cached_texture) {
+        cached_texture->load();
+        ASSERT(mip_level >= 0 && mip_level < int(cached_texture->mips.size()));
+        result.cached_texture = cached_texture.get();
+        result.width = cached_texture->mips[mip_level].width;
+        result.height = cached_texture->mips[mip_level].height;
+    }
+    else {
+        ASSERT(mip_level >= 0 && mip_level < int(mips.size()));
+        result.image = &mips[mip_level];
+        result.width = mips[mip_level].width;
+        result.height = mips[mip_level].height;
+    }
+    return result;
+}
+
 void Image_Texture::upsample_base_level_to_power_of_two_resolution(bool is_hdr_image) {
     struct Resample_Weight {
         int first_pixel;
@@ -384,7 +450,8 @@ void Image_Texture::generate_mips(Filter_Type filter, bool is_hdr_image) {
     }
 }
 
-inline ColorRGB get_texel_repeat(const Image& image, int x, int y) {
+template <typename Texel_Source>
+inline ColorRGB get_texel_repeat(const Texel_Source& image, int x, int y) {
     ASSERT(is_power_of_2(image.width));
     ASSERT(is_power_of_2(image.height));
 
@@ -411,18 +478,18 @@ inline ColorRGB get_texel_repeat(const Image& image, int x, int y) {
         y %= image.height;
         y += (y >> 31) & image.height;
     }
-    return image.data[y * image.width + x];
+    return image.get_texel(x, y);
 }
 
-inline ColorRGB get_texel_clamp(const Image& image, int x, int y) {
+template <typename Texel_Source>
+inline ColorRGB get_texel_clamp(const Texel_Source& image, int x, int y) {
     x = std::clamp(x, 0, image.width - 1);
     y = std::clamp(y, 0, image.height - 1);
-    return image.data[y * image.width + x];
+    return image.get_texel(x, y);
 }
 
 ColorRGB Image_Texture::sample_nearest(const Vector2& uv, int mip_level, Wrap_Mode wrap_mode) const {
-    ASSERT(mip_level >= 0 && mip_level < mips.size());
-    const Image& image = mips[mip_level];
+    const Mip_Level image = get_mip_level(mip_level);
 
     int x = int(uv[0] * float(image.width));
     int y = int(uv[1] * float(image.height));
@@ -439,8 +506,7 @@ ColorRGB Image_Texture::sample_nearest(const Vector2& uv, int mip_level, Wrap_Mo
 }
 
 ColorRGB Image_Texture::sample_bilinear(const Vector2& uv, int mip_level, Wrap_Mode wrap_mode) const {
-    ASSERT(mip_level >= 0 && mip_level < mips.size());
-    const Image& image = mips[mip_level];
+    const Mip_Level image = get_mip_level(mip_level);
 
     float x = uv.x * float(image.width) - 0.5f;
     float y = uv.y * float(image.height) - 0.5f;
@@ -481,13 +547,14 @@ ColorRGB Image_Texture::sample_bilinear(const Vector2& uv, int mip_level, Wrap_M
 }
 
 ColorRGB Image_Texture::sample_trilinear(const Vector2& uv, float lod, Wrap_Mode wrap_mode) const {
-    lod = std::clamp(lod, 0.f, float(mips.size() - 1));
+    const int mip_count = get_mip_count();
+    lod = std::clamp(lod, 0.f, float(mip_count - 1));
 
     float lod_floor;
     float t = std::modf(lod, &lod_floor);
 
     int level0 = int(lod_floor);
-    int level1 = std::min(level0 + 1, int(mips.size() - 1));
+    int level1 = std::min(level0 + 1, mip_count - 1);
 
     ColorRGB mip0_sample = sample_bilinear(uv, level0, wrap_mode);
     ColorRGB mip1_sample = sample_bilinear(uv, level1, wrap_mode);
@@ -498,7 +565,8 @@ ColorRGB Image_Texture::sample_trilinear(const Vector2& uv, float lod, Wrap_Mode
 // The theory and the algorithm for EWA filter is provided in:
 // "Fundamentals of Texture Mapping and Image Warping", thesis by Paul S. Heckbert, 1989
 // PBRT book also implements this algorithm.
-static ColorRGB do_EWA(const Image& image, Vector2 uv, Vector2 uv_axis1, Vector2 uv_axis2, Wrap_Mode wrap_mode)
+template <typename Texel_Source>
+static ColorRGB do_EWA(const Texel_Source& image, Vector2 uv, Vector2 uv_axis1, Vector2 uv_axis2, Wrap_Mode wrap_mode)
 {
     static std::vector<float> EWA_filter_weights = []() {
         const int table_size = 256;
@@ -598,18 +666,19 @@ ColorRGB Image_Texture::sample_EWA(Vector2 uv, Vector2 uv_axis1, Vector2 uv_axis
         uv_axis2 *= scale;
     }
 
-    const float lod = std::max(0.f, int(mips.size()) - 1 + std::log2(minor_length));
+    const int mip_count = get_mip_count();
+    const float lod = std::max(0.f, mip_count - 1 + std::log2(minor_length));
     float lod_floor;
     float t = std::modf(lod, &lod_floor);
 
     int level0 = int(lod_floor);
     int level1 = level0 + 1;
 
-    if (level0 >= int(mips.size()) - 1)
-        return mips.back().data[0];
+    if (level0 >= mip_count - 1)
+        return get_mip_level(mip_count - 1).get_texel(0, 0);
 
-    ColorRGB mip0_sample = do_EWA(mips[level0], uv, uv_axis1, uv_axis2, wrap_mode);
-    ColorRGB mip1_sample = do_EWA(mips[level1], uv, uv_axis1, uv_axis2, wrap_mode);
+    ColorRGB mip0_sample = do_EWA(get_mip_level(level0), uv, uv_axis1, uv_axis2, wrap_mode);
+    ColorRGB mip1_sample = do_EWA(get_mip_level(level1), uv, uv_axis1, uv_axis2, wrap_mode);
     ColorRGB final_sample = lerp(mip0_sample, mip1_sample, t);
     return final_sample;
 }
@@ -3,7 +3,9 @@
 #include "lib/color.h"
 #include "lib/image.h"
 
+struct Cached_Texture;
 struct Vector2;
+struct Vector2i;
 
 enum class Wrap_Mode {
     repeat,
@@ -31,17 +33,30 @@ public:
     void initialize_from_file(const std::string& image_path, const Init_Params& params);
     void initialize_from_constant_value(const ColorRGB& color);
 
+    // The texture is loaded on first access and its data is managed by the texture cache
+    // (texture_cache.h). Sampling functions of such texture can be called only inside
+    // Texture_Cache_Access_Scope.
+    void initialize_on_demand(const std::string& image_path, const Init_Params& params, const fs::path& cache_directory);
+
+    // Available only for the textures that are not managed by the texture cache.
     const std::vector<Image>& get_mips() const { return mips; }
 
+    int get_mip_count() const;
+    Vector2i get_mip_resolution(int mip_level) const;
+
     ColorRGB sample_nearest(const Vector2& uv, int mip_level, Wrap_Mode wrap_mode) const;
     ColorRGB sample_bilinear(const Vector2& uv, int mip_level, Wrap_Mode wrap_mode) const;
     ColorRGB sample_trilinear(const Vector2& uv, float lod, Wrap_Mode wrap_mode) const;
     ColorRGB sample_EWA(Vector2 uv, Vector2 uv_axis1, Vector2 uv_axis2, Wrap_Mode wrap_mode, float max_anisotropy) const;
 
 private:
+    struct Mip_Level; // defined in image_texture.cpp
+    Mip_Level get_mip_level(int mip_level) const;
+
     void upsample_base_level_to_power_of_two_resolution(bool is_hdr_image);
     void generate_mips(Filter_Type filter, bool is_hdr_image);
 
 private:
     std::vector<Image> mips;
+    std::shared_ptr<Cached_Texture> cached_texture;
 };
@@ -4,11 +4,39 @@
 
 #include "image_texture.h"
 #include "intersection.h"
+#include "ray_stats.h"
 
 #include "lib/scene_object.h"
 
 constexpr int max_traversal_depth = 40;
 
+#if ENABLE_RAY_STATS
+namespace {
+// Counts traversal statistics of a single kdtree query in local variables
+// and adds them to the thread's ray stats when the query is finished.
+struct Traversal_Stats_Scope {
+    bool triangle_mesh_kdtree = false;
+    int step_count = 0;
+    int primitive_test_count = 0;
+
+    ~Traversal_Stats_Scope() {
+        if (thread_ray_stats) {
+            thread_ray_stats->traversal_step_count += step_count;
+            if (triangle_mesh_kdtree)
+                thread_ray_stats->triangle_test_count += primitive_test_count;
+        }
+    }
+};
+}
+#define TRAVERSAL_STATS_SCOPE(triangle_mesh_kdtree) Traversal_Stats_Scope traversal_stats{ triangle_mesh_kdtree }
+#define COUNT_TRAVERSAL_STEP() traversal_stats.step_count++
+#define COUNT_PRIMITIVE_TEST() traversal_stats.primitive_test_count++
+#else
+#define TRAVERSAL_STATS_SCOPE(triangle_mesh_kdtree)
+#define COUNT_TRAVERSAL_STEP()
+#define COUNT_PRIMITIVE_TEST()
+#endif
+
 static void intersect_triangle_mesh_geometry_data(const Ray& ray, const void* geometry_data, uint32_t primitive_index, Intersection& intersection)
 {
     auto data = static_cast<const Triangle_Mesh_Geometry_Data*>(geometry_data);
@@ -32,6 +60,7 @@ static void intersect_triangle_mesh_geometry_data(const Ray& ray, const void* ge
         if (data->alpha_texture != nullptr) {
             ASSERT(!data->mesh->uvs.empty());
             Vector2 uv = data->mesh->get_uv(primitive_index, b);
+            RAY_STATS(alpha_test_count++);
             ColorRGB alpha = data->alpha_texture->sample_bilinear(uv, 0, Wrap_Mode::repeat);
             if (alpha.r == 0.f)
                 return; // skip this triangle
@@ -70,6 +99,7 @@ static bool intersect_any_triangle_mesh_geometry_data(const Ray& ray, const void
     if (data->alpha_texture != nullptr) {
         ASSERT(!data->mesh->uvs.empty());
         Vector2 uv = data->mesh->get_uv(primitive_index, b);
+        RAY_STATS(alpha_test_count++);
         ColorRGB alpha = data->alpha_texture->sample_bilinear(uv, 0, Wrap_Mode::repeat);
         if (alpha.r == 0.f) {
             return false; // skip this triangle
@@ -242,6 +272,7 @@ bool KdTree::intersect(const Ray& ray, Intersection& intersection) const
 #endif
 
     const Vector3 inv_direction = Vector3(1.f) / ray.direction;
+    TRAVERSAL_STATS_SCOPE(intersector == &intersect_triangle_mesh_geometry_data);
 
     struct Traversal_Info {
         const KdNode* node;
@@ -255,6 +286,7 @@ bool KdTree::intersect(const Ray& ray, Intersection& intersection) const
 
     while (intersection.t > t_min) {
         if (!node->is_leaf()) {
+            COUNT_TRAVERSAL_STEP();
             const int axis = node->get_split_axis();
             const float distance_to_split_plane = node->get_split_position() - ray.origin[axis];
 
@@ -309,6 +341,7 @@ bool KdTree::intersect(const Ray& ray, Intersection& intersection) const
             const uint32_t primitive_count = node->get_primitive_count();
 
             for (uint32_t i = 0; i < primitive_count; i++) {
+                COUNT_PRIMITIVE_TEST();
                 intersector(ray, geometry_data, primitive_array[i], intersection);
             }
 
@@ -353,6 +386,7 @@ bool KdTree::intersect_any(const Ray& ray, float ray_tmax) const
 #endif
 
     const Vector3 inv_direction = Vector3(1.f) / ray.direction;
+    TRAVERSAL_STATS_SCOPE(any_intersector == &intersect_any_triangle_mesh_geometry_data);
 
     struct Traversal_Info {
         const KdNode* node;
@@ -365,6 +399,7 @@ bool KdTree::intersect_any(const Ray& ray, float ray_tmax) const
 
     while (ray_tmax > t_min) {
         if (!node->is_leaf()) {
+            COUNT_TRAVERSAL_STEP();
             const int axis = node->get_split_axis();
             const float distance_to_split_plane = node->get_split_position() - ray.origin[axis];
 
@@ -419,6 +454,7 @@ bool KdTree::intersect_any(const Ray& ray, float ray_tmax) const
             const uint32_t primitive_count = node->get_primitive_count();
 
             for (uint32_t i = 0; i < primitive_count; i++) {
+                COUNT_PRIMITIVE_TEST();
                 if (any_intersector(ray, geometry_data, primitive_array[i], ray_tmax)) {
                     return true;
                 }
@@ -4,6 +4,7 @@
 
 #include "image_texture.h"
 #include "intersection.h"
+#include "scene_context.h"
 #include "shading_context.h"
 
 #include "lib/light.h"
@@ -123,24 +124,61 @@ bool Diffuse_Sphere_Light_Sampler::is_direction_inside_light_cone(const Vector3&
 //
 // Diffuse_Triangle_Mesh_Light_Sampler
 //
+void Diffuse_Triangle_Mesh_Light_Sampler::initialize(const Diffuse_Triangle_Mesh_Light& light, const Triangle_Mesh& mesh)
+{
+    this->light = &light;
+    this->mesh = &mesh;
+
+    const Matrix3x4& light_to_world = light.light_to_world_transform;
+    const Matrix3x4 world_to_light = get_inverse_transform(light_to_world);
+    Matrix3x4 light_to_world_normal = Matrix3x4::zero;
+    for (int i = 0; i < 3; i++)
+        for (int k = 0; k < 3; k++)
+            light_to_world_normal.a[i][k] = world_to_light.a[k][i];
+
+    const int triangle_count = mesh.get_triangle_count();
+    triangle_vertices.resize(triangle_count * 3);
+    triangle_geometric_normals.resize(triangle_count);
+    triangle_areas.resize(triangle_count);
+    if (!mesh.normals.empty()) {
+        triangle_shading_normals.resize(triangle_count * 3);
+    }
+
+    mesh_area = 0.f;
+    for (int i = 0; i < triangle_count; i++) {
+        Vector3* p = &triangle_vertices[i * 3];
+        mesh.get_positions(i, p);
+        for (int k = 0; k < 3; k++) {
+            p[k] = transform_point(light_to_world, p[k]);
+        }
+        triangle_geometric_normals[i] = transform_vector(light_to_world_normal, mesh.get_geometric_normal(i)).normalized();
+        triangle_areas[i] = cross(p[1] - p[0], p[2] - p[0]).length() * 0.5f;
+        mesh_area += triangle_areas[i];
+
+        if (!mesh.normals.empty()) {
+            Vector3* n = &triangle_shading_normals[i * 3];
+            mesh.get_normals(i, n);
+            for (int k = 0; k < 3; k++) {
+                n[k] = transform_vector(light_to_world_normal, n[k]).normalized();
+            }
+        }
+    }
+    triangle_distribution.initialize(triangle_areas.data(), triangle_count);
+}
+
 Vector3 Diffuse_Triangle_Mesh_Light_Sampler::sample(Vector2 u, const Vector3& shading_pos, float* pdf) const
 {
+    const uint32_t triangle_count = (uint32_t)triangle_areas.size();
+
     float remapped_u0;
     float s = triangle_distribution.sample(u[0], nullptr, &remapped_u0);
-    uint32_t triangle_index = std::min(uint32_t(s * mesh->get_triangle_count()), (uint32_t)mesh->get_triangle_count() - 1);
+    uint32_t triangle_index = std::min(uint32_t(s * triangle_count), triangle_count - 1);
     u[0] = remapped_u0;
 
     Vector3 b = uniform_sample_triangle_baricentrics(u);
 
-    Vector3 light_p = mesh->get_position(triangle_index, b);
-
-    Vector3 light_n;
-    if (!mesh->normals.empty()) {
-        light_n = mesh->get_normal(triangle_index, b);
-    }
-    else {
-        light_n = mesh->get_geometric_normal(triangle_index);
-    }
+    Vector3 light_p = barycentric_interpolate(&triangle_vertices[triangle_index * 3], b);
+    Vector3 light_n = get_normal(triangle_index, b);
 
     const Vector3 light_vec = light_p - shading_pos;
     float distance_to_light_sq = light_vec.length_squared();
@@ -165,13 +203,7 @@ float Diffuse_Triangle_Mesh_Light_Sampler::pdf(const Vector3& shading_pos, const
     const Triangle_Intersection& isect = light_intersection.triangle_intersection;
     ASSERT(mesh == isect.mesh);
 
-    Vector3 light_n;
-    if (!mesh->normals.empty()) {
-        light_n = mesh->get_normal(isect.triangle_index, isect.barycentrics);
-    }
-    else {
-        light_n = mesh->get_geometric_normal(isect.triangle_index);
-    }
+    Vector3 light_n = get_normal(isect.triangle_index, isect.barycentrics);
 
     float light_n_dot_wi = dot(light_n, -wi);
     if (light_n_dot_wi <= 0.f) {
@@ -182,3 +214,83 @@ float Diffuse_Triangle_Mesh_Light_Sampler::pdf(const Vector3& shading_pos, const
         return distance_to_light_sq / (light_n_dot_wi * mesh_area);
     }
 }
+
+Vector3 Diffuse_Triangle_Mesh_Light_Sampler::get_normal(uint32_t triangle_index, const Vector3& barycentrics) const
+{
+    if (!triangle_shading_normals.empty()) {
+        return barycentric_interpolate(&triangle_shading_normals[triangle_index * 3], barycentrics);
+    }
+    return triangle_geometric_normals[triangle_index];
+}
+
+//
+// Light power
+//
+float get_light_power(const Scene_Context& scene_ctx, Light_Handle light)
+{
+    const Lights& lights = scene_ctx.lights;
+
+    auto get_scene_radius = [&scene_ctx]() {
+        const Bounding_Box& bounds = scene_ctx.kdtree_data.scene_kdtree.bounds;
+        float radius = (bounds.max_p - bounds.min_p).length() * 0.5f;
+        return is_finite(radius) ? radius : 1.f;
+    };
+
+    switch (light.type) {
+    case Light_Type::point:
+        return 4.f * Pi * lights.point_lights[light.index].intensity.luminance();
+
+    case Light_Type::spot:
+        return 4.f * Pi * lights.spot_lights[light.index].intensity.luminance();
+
+    case Light_Type::directional: {
+        float radius = get_scene_radius();
+        return Pi * radius * radius * lights.directional_lights[light.index].irradiance.luminance();
+    }
+    case Light_Type::diffuse_rectangular: {
+        const Diffuse_Rectangular_Light& rectangular_light = lights.diffuse_rectangular_lights[light.index];
+        return Pi * rectangular_light.size.x * rectangular_light.size.y * rectangular_light.emitted_radiance.luminance();
+    }
+    case Light_Type::diffuse_sphere: {
+        const Diffuse_Sphere_Light& sphere_light = lights.diffuse_sphere_lights[light.index];
+        float area = 4.f * Pi * sphere_light.radius * sphere_light.radius;
+        return Pi * area * sphere_light.emitted_radiance.luminance();
+    }
+    case Light_Type::diffuse_triangle_mesh: {
+        const Diffuse_Triangle_Mesh_Light_Sampler& sampler = scene_ctx.triangle_mesh_light_samplers[light.index];
+        return Pi * sampler.mesh_area * sampler.light->emitted_radiance.luminance();
+    }
+    case Light_Type::environment_map: {
+        float radius = get_scene_radius();
+        return 4.f * Pi * Pi * radius * radius * scene_ctx.environment_light_sampler.average_radiance.luminance();
+    }
+    default:
+        ASSERT(false);
+        return 0.f;
+    }
+}
+
+void Light_Power_Distribution::initialize(const Scene_Context& scene_ctx)
+{
+    const int light_count = scene_ctx.lights.total_light_count;
+    if (light_count == 0)
+        return;
+
+    std::vector<float> powers(light_count);
+    float total_power = 0.f;
+    for (int i = 0; i < light_count; i++) {
+        powers[i] = get_light_power(scene_ctx, scene_ctx.lights.get_light_handle(i));
+        total_power += powers[i];
+    }
+    // Fallback to uniform selection if the power can't be estimated.
+    if (total_power == 0.f || !is_finite(total_power))
+        std::fill(powers.begin(), powers.end(), 1.f);
+
+    alias_table.initialize(powers.data(), light_count);
+}
+
+Light_Handle Light_Power_Distribution::sample(const Lights& lights, float u, float* pmf) const
+{
+    int light_index = alias_table.sample(u, pmf);
+    return lights.get_light_handle(light_index);
+}
@@ -8,12 +8,14 @@ struct Environment_Light;
 struct Diffuse_Sphere_Light;
 struct Diffuse_Triangle_Mesh_Light;
 struct Intersection;
+struct Scene_Context;
 class Image_Texture;
 
 struct Environment_Light_Sampler {
     const Environment_Light* light = nullptr;
     const Image_Texture* environment_map = nullptr;
-    Distribution_2D radiance_distribution;
+    Hierarchical_Distribution_2D radiance_distribution;
+    ColorRGB average_radiance; // includes light's scale
 
     bool initialized() const { return light != nullptr; }
     ColorRGB sample(Vector2 u, Vector3* wi, float* pdf) const;
@@ -48,12 +50,38 @@ struct Diffuse_Sphere_Light_Sampler {
 struct Diffuse_Triangle_Mesh_Light_Sampler {
     const Diffuse_Triangle_Mesh_Light* light = nullptr;
     const Triangle_Mesh* mesh = nullptr;
-    float mesh_area = 0.f;
-    Distribution_1D triangle_distribution; // this pdf is proportional to triangle area
+    float mesh_area = 0.f; // world space area
+    Alias_Distribution_1D triangle_distribution; // this pdf is proportional to triangle area
+
+    // Per-triangle data in world space (light_to_world_transform is applied during initialization),
+    // so sampling does not have to go through the mesh index buffer and to transform the results.
+    std::vector<Vector3> triangle_vertices; // 3 vertices per triangle
+    std::vector<Vector3> triangle_shading_normals; // 3 normals per triangle, empty if the mesh has no normals
+    std::vector<Vector3> triangle_geometric_normals;
+    std::vector<float> triangle_areas;
+
+    void initialize(const Diffuse_Triangle_Mesh_Light& light, const Triangle_Mesh& mesh);
 
     // Samples point on the light source and returns it.
     // The pdf is computed with regard to solid angle measure.
     Vector3 sample(Vector2 u, const Vector3& shading_pos, float* pdf) const;
 
     float pdf(const Vector3& shading_pos, const Vector3& wi, const Intersection& light_intersection) const;
+
+    // The normal that defines the emission side of the light.
+    Vector3 get_normal(uint32_t triangle_index, const Vector3& barycentrics) const;
+};
+
+// Returns luminance of the power (flux) emitted by the light. The power of the lights that
+// are infinitely far away (directional and environment) is estimated as the power that
+// reaches the scene's bounding sphere.
+float get_light_power(const Scene_Context& scene_ctx, Light_Handle light);
+
+// Selects the lights with the probability proportional to their power.
+struct Light_Power_Distribution {
+    // The elements are all scene lights in the order defined by Lights::get_light_handle.
+    Alias_Table alias_table;
+
+    void initialize(const Scene_Context& scene_ctx);
+    Light_Handle sample(const Lights& lights, float u, float* pmf) const;
 };
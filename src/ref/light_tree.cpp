@@ -0,0 +1,378 @@
+#include "std.h"
+#include "lib/common.h"
+#include "light_tree.h"
+
+#include "light_sampling.h"
+#include "scene_context.h"
+
+namespace {
+struct Light_Cone {
+    Vector3 direction;
+    float cos_theta = -1.f;
+};
+
+struct Build_Light {
+    Light_Handle light;
+    Light_Bounds light_bounds;
+    Vector3 centroid;
+};
+}
+
+constexpr int Split_Bucket_Count = 12;
+
+static float safe_acos(float x)
+{
+    return std::acos(std::clamp(x, -1.f, 1.f));
+}
+
+static float safe_sqrt(float x)
+{
+    return std::sqrt(std::max(0.f, x));
+}
+
+// cos(max(0, a - b))
+static float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+    if (cos_a > cos_b)
+        return 1.f;
+    return cos_a * cos_b + sin_a * sin_b;
+}
+
+// sin(max(0, a - b))
+static float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+    if (cos_a > cos_b)
+        return 0.f;
+    return sin_a * cos_b - cos_a * sin_b;
+}
+
+static float get_angle_between(const Vector3& a, const Vector3& b)
+{
+    // Numerically stable version of acos(dot(a, b)).
+    if (dot(a, b) < 0.f)
+        return Pi - 2.f * std::asin(std::min(1.f, (a + b).length() * 0.5f));
+    return 2.f * std::asin(std::min(1.f, (b - a).length() * 0.5f));
+}
+
+// Returns the cone that contains both cones.
+static Light_Cone get_cone_union(const Light_Cone& a, const Light_Cone& b)
+{
+    const float theta_a = safe_acos(a.cos_theta);
+    const float theta_b = safe_acos(b.cos_theta);
+    const float theta_d = get_angle_between(a.direction, b.direction);
+
+    if (std::min(theta_d + theta_b, Pi) <= theta_a)
+        return a;
+    if (std::min(theta_d + theta_a, Pi) <= theta_b)
+        return b;
+
+    const float theta_o = (theta_a + theta_d + theta_b) * 0.5f;
+    const Light_Cone entire_sphere{ a.direction, -1.f };
+    if (theta_o >= Pi)
+        return entire_sphere;
+
+    // Rotate a.direction towards b.direction.
+    const Vector3 rotation_axis = cross(a.direction, b.direction);
+    if (rotation_axis.length_squared() == 0.f)
+        return entire_sphere;
+    const float theta_r = theta_o - theta_a;
+    const Vector3 k = rotation_axis.normalized();
+    const Vector3 direction = a.direction * std::cos(theta_r) + cross(k, a.direction) * std::sin(theta_r);
+    return Light_Cone{ direction.normalized(), std::cos(theta_o) };
+}
+
+static Light_Bounds get_light_bounds_union(const Light_Bounds& a, const Light_Bounds& b)
+{
+    if (a.power == 0.f)
+        return b;
+    if (b.power == 0.f)
+        return a;
+
+    Light_Cone cone = get_cone_union(Light_Cone{ a.direction, a.cos_theta_o }, Light_Cone{ b.direction, b.cos_theta_o });
+
+    Light_Bounds result;
+    result.bounds = Bounding_Box::compute_union(a.bounds, b.bounds);
+    result.power = a.power + b.power;
+    result.direction = cone.direction;
+    result.cos_theta_o = cone.cos_theta;
+    result.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    return result;
+}
+
+float Light_Bounds::get_importance(const Vector3& point, const Vector3& normal) const
+{
+    const Vector3 center = (bounds.min_p + bounds.max_p) * 0.5f;
+    const Vector3 diagonal = bounds.max_p - bounds.min_p;
+    const float diagonal_length = diagonal.length();
+
+    // Prevent the importance from going to infinity when the point approaches the light.
+    const float d2 = std::max({ (point - center).length_squared(), diagonal_length * 0.5f, 1e-8f });
+
+    // The lights can emit in any direction towards the point that is inside the bounding sphere
+    // (the cone of directions to the sphere is the entire sphere of directions).
+    const float radius = diagonal_length * 0.5f;
+    if (bounds.contains(point) || (point - center).length_squared() < radius * radius)
+        return power / d2;
+
+    const Vector3 wi = (point - center).normalized(); // direction from the light to the point
+    const float cos_theta_w = dot(direction, wi);
+    const float sin_theta_w = safe_sqrt(1.f - cos_theta_w * cos_theta_w);
+
+    // The cone of directions from the point to the bounding sphere of the lights.
+    const float cos_theta_b = safe_sqrt(1.f - (radius * radius) / (point - center).length_squared());
+    const float sin_theta_b = safe_sqrt(1.f - cos_theta_b * cos_theta_b);
+
+    // The smallest angle between the direction to the point and the emitters normals.
+    const float sin_theta_o = safe_sqrt(1.f - cos_theta_o * cos_theta_o);
+    const float cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    const float sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    const float cos_theta_prime = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+
+    // The strict comparison keeps the lights with theta_e == 0 (spot lights).
+    if (cos_theta_prime < cos_theta_e)
+        return 0.f;
+
+    float importance = power * cos_theta_prime / d2;
+
+    if (normal != Vector3_Zero) {
+        const float cos_theta_i = std::abs(dot(wi, normal));
+        const float sin_theta_i = safe_sqrt(1.f - cos_theta_i * cos_theta_i);
+        importance *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    }
+    return std::max(importance, 0.f);
+}
+
+static Light_Bounds get_triangle_mesh_light_bounds(const Diffuse_Triangle_Mesh_Light_Sampler& sampler)
+{
+    Light_Bounds light_bounds;
+    for (const Vector3& p : sampler.triangle_vertices)
+        light_bounds.bounds.add_point(p);
+
+    // The emission side is defined by the shading normals if they are present.
+    const bool has_shading_normals = !sampler.triangle_shading_normals.empty();
+    const std::vector<Vector3>& normals = has_shading_normals ? sampler.triangle_shading_normals : sampler.triangle_geometric_normals;
+
+    Vector3 normal_sum;
+    for (const Vector3& n : normals)
+        normal_sum += n;
+
+    if (normal_sum.length_squared() < 1e-6f)
+        return light_bounds; // the normals are not bounded
+
+    light_bounds.direction = normal_sum.normalized();
+    light_bounds.cos_theta_o = 1.f;
+    for (const Vector3& n : normals)
+        light_bounds.cos_theta_o = std::min(light_bounds.cos_theta_o, dot(light_bounds.direction, n.normalized()));
+
+    // The interpolated shading normal is inside the cone of the vertex normals only if the cone is convex.
+    if (has_shading_normals && light_bounds.cos_theta_o < 0.f)
+        light_bounds.cos_theta_o = -1.f;
+    return light_bounds;
+}
+
+// The cost of the node with the given light bounds (pbrt-v4 light BVH surface area orientation heuristic).
+static float get_split_cost(const Light_Bounds& light_bounds, const Vector3& parent_diagonal, int split_dim)
+{
+    const float theta_o = safe_acos(light_bounds.cos_theta_o);
+    const float theta_e = safe_acos(light_bounds.cos_theta_e);
+    const float theta_w = std::min(theta_o + theta_e, Pi);
+    const float sin_theta_o = safe_sqrt(1.f - light_bounds.cos_theta_o * light_bounds.cos_theta_o);
+    const float solid_angle_measure = Pi2 * (1.f - light_bounds.cos_theta_o) +
+        Pi / 2.f * (2.f * theta_w * sin_theta_o - std::cos(theta_o - 2.f * theta_w) -
+            2.f * theta_o * sin_theta_o + light_bounds.cos_theta_o);
+
+    // Penalize thin nodes.
+    const float max_extent = std::max({ parent_diagonal.x, parent_diagonal.y, parent_diagonal.z });
+    const float aspect_ratio_factor = max_extent / parent_diagonal[split_dim];
+
+    const Vector3 d = light_bounds.bounds.max_p - light_bounds.bounds.min_p;
+    const float surface_area = 2.f * (d.x * d.y + d.x * d.z + d.y * d.z);
+    return light_bounds.power * solid_angle_measure * aspect_ratio_factor * surface_area;
+}
+
+static int build_light_tree_node(std::vector<Light_Tree_Node>& nodes, std::span<Build_Light> lights)
+{
+    ASSERT(!lights.empty());
+    const int node_index = (int)nodes.size();
+    nodes.emplace_back();
+
+    if (lights.size() == 1) {
+        nodes[node_index].light_bounds = lights[0].light_bounds;
+        nodes[node_index].light = lights[0].light;
+        return node_index;
+    }
+
+    Light_Bounds node_bounds;
+    Bounding_Box centroid_bounds;
+    for (const Build_Light& light : lights) {
+        node_bounds = get_light_bounds_union(node_bounds, light.light_bounds);
+        centroid_bounds.add_point(light.centroid);
+    }
+    const Vector3 diagonal = node_bounds.bounds.max_p - node_bounds.bounds.min_p;
+
+    auto get_bucket = [&centroid_bounds](const Build_Light& light, int dim) {
+        float extent = centroid_bounds.max_p[dim] - centroid_bounds.min_p[dim];
+        int bucket = int(Split_Bucket_Count * (light.centroid[dim] - centroid_bounds.min_p[dim]) / extent);
+        return std::clamp(bucket, 0, Split_Bucket_Count - 1);
+    };
+
+    // Find the split with the lowest cost. The split is between the buckets of the centroids.
+    float min_cost = Infinity;
+    int min_cost_dim = -1;
+    int min_cost_bucket = -1;
+    for (int dim = 0; dim < 3; dim++) {
+        if (centroid_bounds.max_p[dim] == centroid_bounds.min_p[dim])
+            continue;
+
+        Light_Bounds buckets[Split_Bucket_Count];
+        for (const Build_Light& light : lights) {
+            int b = get_bucket(light, dim);
+            buckets[b] = get_light_bounds_union(buckets[b], light.light_bounds);
+        }
+
+        Light_Bounds above_bounds[Split_Bucket_Count];
+        for (int i = Split_Bucket_Count - 1; i > 0; i--) {
+            above_bounds[i] = (i == Split_Bucket_Count - 1) ? buckets[i] : get_light_bounds_union(buckets[i], above_bounds[i + 1]);
+        }
+        Light_Bounds below_bounds;
+        for (int i = 0; i < Split_Bucket_Count - 1; i++) {
+            below_bounds = get_light_bounds_union(below_bounds, buckets[i]);
+            if (below_bounds.power == 0.f || above_bounds[i + 1].power == 0.f)
+                continue;
+            float cost = get_split_cost(below_bounds, diagonal, dim) + get_split_cost(above_bounds[i + 1], diagonal, dim);
+            if (cost < min_cost) {
+                min_cost = cost;
+                min_cost_dim = dim;
+                min_cost_bucket = i;
+            }
+        }
+    }
+
+    size_t middle = lights.size() / 2;
+    if (min_cost_dim != -1) {
+        auto it = std::partition(lights.begin(), lights.end(), [&](const Build_Light& light) {
+            return get_bucket(light, min_cost_dim) <= min_cost_bucket;
+        });
+        middle = it - lights.begin();
+        ASSERT(middle > 0 && middle < lights.size());
+    }
+
+    build_light_tree_node(nodes, lights.subspan(0, middle));
+    const int second_child_index = build_light_tree_node(nodes, lights.subspan(middle));
+
+    nodes[node_index].light_bounds = node_bounds;
+    nodes[node_index].second_child_index = second_child_index;
+    return node_index;
+}
+
+void Light_Tree::build(const Scene_Context& scene_ctx)
+{
+    const Lights& lights = scene_ctx.lights;
+    std::vector<Build_Light> build_lights;
+
+    auto add_light = [&build_lights, &scene_ctx](Light_Type type, int index, Light_Bounds light_bounds) {
+        light_bounds.power = get_light_power(scene_ctx, Light_Handle{ type, index });
+        if (light_bounds.power > 0.f) {
+            Build_Light& build_light = build_lights.emplace_back();
+            build_light.light = Light_Handle{ type, index };
+            build_light.light_bounds = light_bounds;
+            build_light.centroid = (light_bounds.bounds.min_p + light_bounds.bounds.max_p) * 0.5f;
+        }
+    };
+
+    for (auto [i, light] : enumerate(lights.point_lights)) {
+        Light_Bounds light_bounds;
+        light_bounds.bounds = Bounding_Box(light.position);
+        add_light(Light_Type::point, (int)i, light_bounds);
+    }
+    for (auto [i, light] : enumerate(lights.spot_lights)) {
+        Light_Bounds light_bounds;
+        light_bounds.bounds = Bounding_Box(light.position);
+        light_bounds.direction = light.direction;
+        light_bounds.cos_theta_o = std::cos(light.cone_angle);
+        light_bounds.cos_theta_e = 1.f;
+        add_light(Light_Type::spot, (int)i, light_bounds);
+    }
+    for (auto [i, light] : enumerate(lights.diffuse_rectangular_lights)) {
+        Light_Bounds light_bounds;
+        for (float x : {-0.5f, 0.5f}) {
+            for (float y : {-0.5f, 0.5f}) {
+                Vector3 local_corner = Vector3(x * light.size.x, y * light.size.y, 0.f);
+                light_bounds.bounds.add_point(transform_point(light.light_to_world_transform, local_corner));
+            }
+        }
+        light_bounds.direction = light.light_to_world_transform.get_column(2).normalized();
+        light_bounds.cos_theta_o = 1.f;
+        add_light(Light_Type::diffuse_rectangular, (int)i, light_bounds);
+    }
+    for (auto [i, light] : enumerate(lights.diffuse_sphere_lights)) {
+        Light_Bounds light_bounds;
+        light_bounds.bounds = Bounding_Box(light.position - Vector3(light.radius), light.position + Vector3(light.radius));
+        add_light(Light_Type::diffuse_sphere, (int)i, light_bounds);
+    }
+    for (int i = 0; i < (int)lights.diffuse_triangle_mesh_lights.size(); i++) {
+        add_light(Light_Type::diffuse_triangle_mesh, i, get_triangle_mesh_light_bounds(scene_ctx.triangle_mesh_light_samplers[i]));
+    }
+
+    infinite_lights.clear();
+    for (int i = 0; i < (int)lights.directional_lights.size(); i++) {
+        infinite_lights.push_back(Light_Handle{ Light_Type::directional, i });
+    }
+    if (lights.has_environment_light) {
+        infinite_lights.push_back(Light_Handle{ Light_Type::environment_map, 0 });
+    }
+
+    nodes.clear();
+    if (!build_lights.empty()) {
+        nodes.reserve(2 * build_lights.size() - 1);
+        build_light_tree_node(nodes, build_lights);
+    }
+}
+
+Light_Handle Light_Tree::sample(const Vector3& point, const Vector3& normal, float u, float* pmf) const
+{
+    *pmf = 0.f;
+
+    // Select between the infinite lights and the tree.
+    const int infinite_light_count = (int)infinite_lights.size();
+    const float infinite_light_probability = float(infinite_light_count) / float(infinite_light_count + (nodes.empty() ? 0 : 1));
+    if (u < infinite_light_probability) {
+        int index = std::min(int(u / infinite_light_probability * infinite_light_count), infinite_light_count - 1);
+        *pmf = infinite_light_probability / float(infinite_light_count);
+        return infinite_lights[index];
+    }
+    if (nodes.empty())
+        return Null_Light;
+
+    u = std::min((u - infinite_light_probability) / (1.f - infinite_light_probability), One_Minus_Epsilon);
+    float node_pmf = 1.f - infinite_light_probability;
+
+    int node_index = 0;
+    while (true) {
+        const Light_Tree_Node& node = nodes[node_index];
+        if (node.is_leaf()) {
+            // For the tree with a single light the root importance is not checked during traversal.
+            if (node_index == 0 && node.light_bounds.get_importance(point, normal) == 0.f)
+                return Null_Light;
+            *pmf = node_pmf;
+            return node.light;
+        }
+
+        const float importance0 = nodes[node_index + 1].light_bounds.get_importance(point, normal);
+        const float importance1 = nodes[node.second_child_index].light_bounds.get_importance(point, normal);
+        if (importance0 == 0.f && importance1 == 0.f)
+            return Null_Light;
+
+        const float p0 = importance0 / (importance0 + importance1);
+        if (u < p0) {
+            node_index = node_index + 1;
+            u = std::min(u / p0, One_Minus_Epsilon);
+            node_pmf *= p0;
+        }
+        else {
+            node_index = node.second_child_index;
+            u = std::min((u - p0) / (1.f - p0), One_Minus_Epsilon);
+            node_pmf *= 1.f - p0;
+        }
+    }
+}
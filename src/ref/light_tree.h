@@ -0,0 +1,53 @@
+#pragma once
+
+#include "lib/bounding_box.h"
+#include "lib/light.h"
+
+struct Scene_Context;
+
+// Conservative bounds of the light emitted by one or more light sources.
+struct Light_Bounds {
+    Bounding_Box bounds;
+    float power = 0.f; // luminance of the emitted flux
+
+    // The surface normals of the emitters are inside the cone with the given axis and the half-angle theta_o.
+    // The light is emitted in directions that are not further than theta_e from the surface normal.
+    Vector3 direction = Vector3(0, 0, 1);
+    float cos_theta_o = -1.f;
+    float cos_theta_e = 0.f;
+
+    // Estimate of the contribution to the point with the given normal. It can be larger than the actual
+    // contribution but it is zero only if the lights can't illuminate the point. The zero normal means
+    // that the receiver's orientation is not taken into account.
+    float get_importance(const Vector3& point, const Vector3& normal) const;
+};
+
+struct Light_Tree_Node {
+    Light_Bounds light_bounds;
+
+    // Interior node: the first child immediately follows the node, this is the index of the second child.
+    int second_child_index = -1;
+
+    // Leaf node: the light.
+    Light_Handle light = Null_Light;
+
+    bool is_leaf() const { return light != Null_Light; }
+};
+
+// Bounding volume hierarchy over the lights. It is used to select the light for the shading point
+// with the probability that is proportional to the light importance (power, distance and orientation).
+// The tree is traversed from the root, at each interior node the child is chosen according to the
+// importance of its light bounds.
+//
+// The lights that are infinitely far away (directional and environment lights) can't be bounded
+// spatially and they are not in the tree. The tree as a whole is selected with the same probability
+// as each of the infinite lights.
+struct Light_Tree {
+    std::vector<Light_Tree_Node> nodes;
+    std::vector<Light_Handle> infinite_lights;
+
+    void build(const Scene_Context& scene_ctx);
+
+    // Returns Null_Light if none of the lights can illuminate the point.
+    Light_Handle sample(const Vector3& point, const Vector3& normal, float u, float* pmf) const;
+};
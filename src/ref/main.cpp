@@ -1,9 +1,16 @@
 #include "std.h"
 #include "lib/common.h"
+#include "benchmark.h"
+#include "denoiser.h"
 #include "reference_renderer.h"
+#include "render_profile.h"
+#include "render_server.h"
 #include "scene_context.h"
+#include "scene_load_pipeline.h"
 #include "test.h"
+#include "texture_cache.h"
 
+#include "lib/job_system.h"
 #include "lib/scene_loader.h"
 
 #include "getopt/getopt.h"
@@ -20,11 +27,18 @@ struct Command_Line_Options {
     // reproduces desired behavior.
     int rng_seed_offset = 0;
 
+    // Generate the stratified samples only with the scalar per-pixel RNG streams (as the previous
+    // versions did) instead of 8x SIMD streams. Reproduces the images rendered by the previous versions.
+    bool scalar_rng = false;
+
     // Can be used to match output of the renderer that uses left-handed coordinate system.
     bool flip_image_horizontally = false;
 
     bool force_rebuild_kdtree_cache = false;
 
+    // Memory budget in bytes for the texture cache tiles, 0 means unlimited.
+    uint64_t texture_cache_size = 0;
+
     // This option enables openexr attributes that vary between render sessions.
     // Examples of varying attributes: timing metrics, machine parameters.
     // Examples of non-varying attributes: output file name, per pixel sample count,
@@ -37,9 +51,35 @@ struct Command_Line_Options {
     // Enables OpenEXR feature to store image data in compressed form (zip)
     bool openexr_enable_compression = false;
 
+    // Write image rows to the output file as soon as they are rendered instead of keeping the full film in memory.
+    bool stream_output = false;
+
+    // Write per-pixel auxiliary data (depth, normal, albedo, sample count, variance, time, material) as additional channels.
+    bool output_aovs = false;
+
+    // Write denoised image in addition to the raw image. The denoiser uses AOVs as feature buffers.
+    bool denoise = false;
+
+    // Write per-pixel time heatmap and print the most expensive tiles and materials.
+    bool time_heatmap = false;
+
     std::string output_directory;
     std::string output_filename_suffix;
     std::string checkpoint_directory;
+    bool checkpoint_compression = false;
+
+    // Distributed rendering: render only a subset of the tiles to the checkpoint directory.
+    Tile_Subset tile_subset;
+    // Input files are checkpoint directories to merge into the output image.
+    bool merge_checkpoints = false;
+
+    // Run render server that listens on this socket instead of rendering input files.
+    std::string server_socket_path;
+
+    // Benchmark mode: each input file is loaded and rendered benchmark_run_count times,
+    // output images are not written. The timings are written to benchmark_output_file (.json or .csv).
+    int benchmark_run_count = 0;
+    std::string benchmark_output_file;
 
     int samples_per_pixel = 0; // overrides project settings
     Vector2i film_resolution; // overrides project settings
@@ -47,6 +87,19 @@ struct Command_Line_Options {
     bool override_rendering_algorithm = false;
     Raytracer_Config::Rendering_Algorithm rendering_algorithm;
 
+    bool override_light_selection = false;
+    Raytracer_Config::Light_Selection light_selection;
+
+    int light_resampling_candidate_count = 0;
+
+    int path_guiding_training_pass_count = 0;
+    int path_guiding_memory_budget = 0;
+
+    bool override_pixel_sampler_type = false;
+    Raytracer_Config::Pixel_Sampler_Type pixel_sampler_type;
+
+    bool filter_importance_sampling = false;
+
     // Might affect computations to produce output that is more similar to 
     // pbrt for comparison/development purposes. For example, pbrt3 does
     // roughness remapping in a different way (not square root). Please note,
@@ -77,18 +130,37 @@ enum Options {
     OPT_RENDER_REGION_H,
     OPT_DO_NOT_CROP_IMAGE_BY_RENDER_REGION,
     OPT_RNG_SEED_OFFSET,
+    OPT_SCALAR_RNG,
     OPT_FLIP_HORIZONTALLY,
     OPT_FORCE_REBUILD_KDTREE_CACHE,
+    OPT_TEXTURE_CACHE_SIZE,
     OPT_OUTPUT_DIRECTORY,
     OPT_OUTPUT_FILENAME_SUFFIX,
     OPT_OPENEXR_ENABLE_VARYING_ATTRIBUTES,
     OPT_OPENEXR_DUMP_ATTRIBUTES,
     OPT_OPENEXR_COMPRESS,
+    OPT_STREAM_OUTPUT,
+    OPT_AOV,
+    OPT_DENOISE,
+    OPT_TIME_HEATMAP,
     OPT_SAMPLES_PER_PIXEL,
     OPT_FILM_RESOLUTION,
     OPT_CHECKPOINT,
+    OPT_CHECKPOINT_COMPRESS,
+    OPT_TILES,
+    OPT_SHARD,
+    OPT_MERGE,
+    OPT_SERVER,
+    OPT_BENCHMARK,
+    OPT_BENCHMARK_OUTPUT,
     OPT_PATH_TRACING,
     OPT_DIRECT_LIGHTING,
+    OPT_LIGHT_SELECTION,
+    OPT_LIGHT_RESAMPLING,
+    OPT_PATH_GUIDING,
+    OPT_PATH_GUIDING_MEMORY,
+    OPT_PIXEL_SAMPLER,
+    OPT_FILTER_IMPORTANCE_SAMPLING,
     OPT_PBRT_COMPATIBILITY,
 };
 
@@ -121,9 +193,15 @@ static const getopt_option_t option_list[] =
     { "seedoffset", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_RNG_SEED_OFFSET,
         "this value is added to per-pixel RNG seed", "integer_number" },
 
+    { "scalar-rng", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_SCALAR_RNG,
+        "generate stratified samples with scalar RNG (reproduces images of the previous versions)" },
+
     { "force-rebuild-kdtree-cache", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_FORCE_REBUILD_KDTREE_CACHE,
         "force rebuild of kdtree cache for current scene" },
 
+    { "texture-cache-size", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_TEXTURE_CACHE_SIZE,
+        "memory budget of the texture cache (unlimited by default)", "megabytes" },
+
     { "directory", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_OUTPUT_DIRECTORY,
         "location where to store output images", "directory_path" },
 
@@ -133,6 +211,27 @@ static const getopt_option_t option_list[] =
     { "checkpoint", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_CHECKPOINT,
         "start or resume multi-session rendering", "checkpoint_directory_path" },
 
+    { "checkpoint-compress", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_CHECKPOINT_COMPRESS,
+        "compress film tiles stored in the checkpoint" },
+
+    { "tiles", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_TILES,
+        "render only the range of tiles to the checkpoint directory", "first:end" },
+
+    { "shard", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_SHARD,
+        "render only the i-th of n parts of tiles to the checkpoint directory", "i/n" },
+
+    { "merge", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_MERGE,
+        "merge checkpoint directories (input files) into the output image" },
+
+    { "server", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_SERVER,
+        "run render server that accepts render jobs on the local socket", "socket_path" },
+
+    { "benchmark", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_BENCHMARK,
+        "load and render each input file the given number of times without writing output images", "run_count" },
+
+    { "benchmark-output", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_BENCHMARK_OUTPUT,
+        "write benchmark results to the file (.json or .csv)", "file_path" },
+
     { "openexr-enable-varying-attributes", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_OPENEXR_ENABLE_VARYING_ATTRIBUTES,
         "write OpenEXR attributes that might vary between render sessions" },
 
@@ -142,6 +241,18 @@ static const getopt_option_t option_list[] =
     { "openexr-compress", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_OPENEXR_COMPRESS,
         "enable OpenEXR zip compression of image data" },
 
+    { "stream-output", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_STREAM_OUTPUT,
+        "write image rows to the output file during rendering (reduces memory usage)" },
+
+    { "aov", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_AOV,
+        "write depth, normal, albedo, sample count, variance, time and material per pixel as additional OpenEXR channels" },
+
+    { "denoise", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_DENOISE,
+        "write denoised image (with _denoised suffix) in addition to the raw image" },
+
+    { "time-heatmap", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_TIME_HEATMAP,
+        "write per-pixel render time heatmap (with _time suffix) and print the most expensive tiles and materials" },
+
     { "spp", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_SAMPLES_PER_PIXEL,
         "set samples per pixel value (overrides project settings)",
         "positive_integer_number" },
@@ -156,6 +267,26 @@ static const getopt_option_t option_list[] =
     { "direct", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_DIRECT_LIGHTING,
         "force direct lighting rendering algorithm" },
 
+    { "light-selection", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_LIGHT_SELECTION,
+        "light selection strategy of the path tracer", "uniform|power|tree" },
+
+    { "light-resampling", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_LIGHT_RESAMPLING,
+        "select the light sample of the path tracer from the given number of candidates (resampled importance sampling)",
+        "candidate_count" },
+
+    { "path-guiding", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_PATH_GUIDING,
+        "guide the path tracer with the directional distributions learned during the given number of training passes",
+        "training_pass_count" },
+
+    { "path-guiding-memory", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_PATH_GUIDING_MEMORY,
+        "memory budget of the path guiding data structures (default is 64 MB)", "megabytes" },
+
+    { "sampler", 0, GETOPT_OPTION_TYPE_REQUIRED, nullptr, OPT_PIXEL_SAMPLER,
+        "pixel sampler of the path tracer (sobol supports any spp value)", "stratified|sobol" },
+
+    { "filter-sampling", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_FILTER_IMPORTANCE_SAMPLING,
+        "distribute image plane samples according to the pixel filter" },
+
     { "pbrt", 0, GETOPT_OPTION_TYPE_NO_ARG, nullptr, OPT_PBRT_COMPATIBILITY,
         "enable pbrt compatibility mode" },
 
@@ -164,7 +295,7 @@ static const getopt_option_t option_list[] =
 
 static void print_help_string(getopt_context_t* ctx)
 {
-    char buffer[4096];
+    char buffer[8192];
     printf("Usage: RAY.exe <pbrt_file or yar_file> [options...]\n");
     printf("Options:\n%s\n", getopt_create_help_string(ctx, buffer, sizeof(buffer)));
 }
@@ -270,12 +401,23 @@ static Parsed_Command_Line parse_command_line(int argc, char** argv)
         else if (opt == OPT_RNG_SEED_OFFSET) {
             options.rng_seed_offset = atoi(ctx.current_opt_arg);
         }
+        else if (opt == OPT_SCALAR_RNG) {
+            options.scalar_rng = true;
+        }
         else if (opt == OPT_FLIP_HORIZONTALLY) {
             options.flip_image_horizontally = true;
         }
         else if (opt == OPT_FORCE_REBUILD_KDTREE_CACHE) {
             options.force_rebuild_kdtree_cache = true;
         }
+        else if (opt == OPT_TEXTURE_CACHE_SIZE) {
+            int size_in_megabytes = atoi(ctx.current_opt_arg);
+            if (size_in_megabytes <= 0) {
+                printf("Invalid argument for --texture-cache-size option: %s. Example: --texture-cache-size 512\n", ctx.current_opt_arg);
+                return 1;
+            }
+            options.texture_cache_size = uint64_t(size_in_megabytes) * 1024 * 1024;
+        }
         else if (opt == OPT_OPENEXR_ENABLE_VARYING_ATTRIBUTES) {
             options.openexr_enable_varying_attributes = true;
         }
@@ -285,6 +427,18 @@ static Parsed_Command_Line parse_command_line(int argc, char** argv)
         else if (opt == OPT_OPENEXR_COMPRESS) {
             options.openexr_enable_compression = true;
         }
+        else if (opt == OPT_STREAM_OUTPUT) {
+            options.stream_output = true;
+        }
+        else if (opt == OPT_AOV) {
+            options.output_aovs = true;
+        }
+        else if (opt == OPT_DENOISE) {
+            options.denoise = true;
+        }
+        else if (opt == OPT_TIME_HEATMAP) {
+            options.time_heatmap = true;
+        }
         else if (opt == OPT_OUTPUT_DIRECTORY) {
             options.output_directory = ctx.current_opt_arg;
         }
@@ -294,6 +448,43 @@ static Parsed_Command_Line parse_command_line(int argc, char** argv)
         else if (opt == OPT_CHECKPOINT) {
             options.checkpoint_directory = ctx.current_opt_arg;
         }
+        else if (opt == OPT_CHECKPOINT_COMPRESS) {
+            options.checkpoint_compression = true;
+        }
+        else if (opt == OPT_TILES) {
+            int first, end;
+            if (sscanf(ctx.current_opt_arg, "%d:%d", &first, &end) != 2 || first < 0 || end <= first) {
+                printf("Invalid argument for --tiles option: %s. Example: --tiles 0:100\n", ctx.current_opt_arg);
+                return 1;
+            }
+            options.tile_subset.first_tile = first;
+            options.tile_subset.end_tile = end;
+        }
+        else if (opt == OPT_SHARD) {
+            int index, count;
+            if (sscanf(ctx.current_opt_arg, "%d/%d", &index, &count) != 2 || count <= 0 || index < 0 || index >= count) {
+                printf("Invalid argument for --shard option: %s. Example: --shard 2/8\n", ctx.current_opt_arg);
+                return 1;
+            }
+            options.tile_subset.shard_index = index;
+            options.tile_subset.shard_count = count;
+        }
+        else if (opt == OPT_MERGE) {
+            options.merge_checkpoints = true;
+        }
+        else if (opt == OPT_SERVER) {
+            options.server_socket_path = ctx.current_opt_arg;
+        }
+        else if (opt == OPT_BENCHMARK) {
+            options.benchmark_run_count = atoi(ctx.current_opt_arg);
+            if (options.benchmark_run_count <= 0) {
+                printf("Invalid argument for --benchmark option: %s. Example: --benchmark 3\n", ctx.current_opt_arg);
+                return 1;
+            }
+        }
+        else if (opt == OPT_BENCHMARK_OUTPUT) {
+            options.benchmark_output_file = ctx.current_opt_arg;
+        }
         else if (opt == OPT_SAMPLES_PER_PIXEL) {
             options.samples_per_pixel = atoi(ctx.current_opt_arg);
             ASSERT(options.samples_per_pixel > 0);
@@ -333,6 +524,61 @@ static Parsed_Command_Line parse_command_line(int argc, char** argv)
             options.override_rendering_algorithm = true;
             options.rendering_algorithm = Raytracer_Config::Rendering_Algorithm::direct_lighting;
         }
+        else if (opt == OPT_LIGHT_SELECTION) {
+            std::string s = to_lower(ctx.current_opt_arg);
+            if (s == "uniform") {
+                options.light_selection = Raytracer_Config::Light_Selection::uniform;
+            }
+            else if (s == "power") {
+                options.light_selection = Raytracer_Config::Light_Selection::power;
+            }
+            else if (s == "tree") {
+                options.light_selection = Raytracer_Config::Light_Selection::light_tree;
+            }
+            else {
+                printf("Unsupported argument for --light-selection option: %s. Supported values: uniform, power, tree\n", ctx.current_opt_arg);
+                return 1;
+            }
+            options.override_light_selection = true;
+        }
+        else if (opt == OPT_LIGHT_RESAMPLING) {
+            options.light_resampling_candidate_count = atoi(ctx.current_opt_arg);
+            if (options.light_resampling_candidate_count <= 0) {
+                printf("Invalid argument for --light-resampling option: %s. Example: --light-resampling 8\n", ctx.current_opt_arg);
+                return 1;
+            }
+        }
+        else if (opt == OPT_PATH_GUIDING) {
+            options.path_guiding_training_pass_count = atoi(ctx.current_opt_arg);
+            if (options.path_guiding_training_pass_count <= 0 || options.path_guiding_training_pass_count > 16) {
+                printf("Invalid argument for --path-guiding option: %s. Expected value in [1, 16]. Example: --path-guiding 6\n", ctx.current_opt_arg);
+                return 1;
+            }
+        }
+        else if (opt == OPT_PATH_GUIDING_MEMORY) {
+            options.path_guiding_memory_budget = atoi(ctx.current_opt_arg);
+            if (options.path_guiding_memory_budget <= 0) {
+                printf("Invalid argument for --path-guiding-memory option: %s. Example: --path-guiding-memory 256\n", ctx.current_opt_arg);
+                return 1;
+            }
+        }
+        else if (opt == OPT_PIXEL_SAMPLER) {
+            std::string s = to_lower(ctx.current_opt_arg);
+            if (s == "stratified") {
+                options.pixel_sampler_type = Raytracer_Config::Pixel_Sampler_Type::stratified;
+            }
+            else if (s == "sobol") {
+                options.pixel_sampler_type = Raytracer_Config::Pixel_Sampler_Type::sobol;
+            }
+            else {
+                printf("Unsupported argument for --sampler option: %s. Supported values: stratified, sobol\n", ctx.current_opt_arg);
+                return 1;
+            }
+            options.override_pixel_sampler_type = true;
+        }
+        else if (opt == OPT_FILTER_IMPORTANCE_SAMPLING) {
+            options.filter_importance_sampling = true;
+        }
         else if (opt == OPT_PBRT_COMPATIBILITY) {
             options.pbrt_compatibility = true;
         }
@@ -341,11 +587,55 @@ static Parsed_Command_Line parse_command_line(int argc, char** argv)
         }
     }
 
-    if (files.empty()) {
+    if (files.empty() && options.server_socket_path.empty()) {
         printf("input file(s) is not specified\n");
         print_help_string(&ctx);
         return 1;
     }
+    if (options.tile_subset.is_specified() && options.checkpoint_directory.empty()) {
+        printf("--tiles and --shard options require --checkpoint directory\n");
+        return 1;
+    }
+    if (options.stream_output && !options.crop_image_by_render_region) {
+        printf("--stream-output option can't be used together with --nocrop\n");
+        return 1;
+    }
+    // AOVs are accumulated only in memory, they are not stored in the checkpoint and are not streamed.
+    if ((options.output_aovs || options.denoise || options.time_heatmap) &&
+        (options.stream_output || !options.checkpoint_directory.empty() || options.merge_checkpoints))
+    {
+        printf("--aov, --denoise and --time-heatmap options can't be used together with --stream-output, --checkpoint or --merge\n");
+        return 1;
+    }
+    // The render server writes only the rendered image.
+    if (!options.server_socket_path.empty() && (options.denoise || options.time_heatmap)) {
+        printf("--denoise and --time-heatmap options can't be used together with --server\n");
+        return 1;
+    }
+    // The checkpoint does not identify the camera and render region of the job, so the jobs
+    // that render the same scene can't share it.
+    if (!options.server_socket_path.empty() && (!options.checkpoint_directory.empty() || options.tile_subset.is_specified())) {
+        printf("--checkpoint, --tiles and --shard options can't be used together with --server\n");
+        return 1;
+    }
+    if (options.benchmark_run_count > 0 &&
+        (options.stream_output || !options.checkpoint_directory.empty() || options.merge_checkpoints ||
+            !options.server_socket_path.empty() || options.denoise || options.time_heatmap))
+    {
+        printf("--benchmark option can't be used together with --stream-output, --checkpoint, --merge, --server, --denoise or --time-heatmap\n");
+        return 1;
+    }
+    if (!options.benchmark_output_file.empty()) {
+        if (options.benchmark_run_count == 0) {
+            printf("--benchmark-output option requires --benchmark option\n");
+            return 1;
+        }
+        std::string extension = get_extension(options.benchmark_output_file);
+        if (extension != ".json" && extension != ".csv") {
+            printf("Unsupported benchmark output file extension: %s. Use .json or .csv\n", options.benchmark_output_file.c_str());
+            return 1;
+        }
+    }
     if (is_render_region_specified) {
         options.render_region.p0 = render_region_position;
         options.render_region.p1 = render_region_position + render_region_size;
@@ -361,108 +651,286 @@ static Parsed_Command_Line parse_command_line(int argc, char** argv)
     return cmdline;
 }
 
-static void process_input_file(const std::string& input_file, const Command_Line_Options& options)
+static Reference_Renderer_Config get_reference_renderer_config(const Command_Line_Options& options)
 {
-    Timestamp t_start;
-    printf("Loading: %s\n", input_file.c_str());
+    Reference_Renderer_Config config;
+    config.thread_count = options.thread_count;
+    if (!config.thread_count) {
+        config.thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    config.checkpoint_directory = options.checkpoint_directory;
+    config.checkpoint_compression = options.checkpoint_compression;
+    config.output_aovs = options.output_aovs || options.denoise || options.time_heatmap;
+    config.rebuild_kdtree_cache = options.force_rebuild_kdtree_cache;
+    config.texture_cache_size = options.texture_cache_size;
+    config.rng_seed_offset = options.rng_seed_offset;
+    config.scalar_rng = options.scalar_rng;
+    config.pbrt_compatibility = options.pbrt_compatibility;
+    return config;
+}
 
-    //
-    // Load scene.
-    //
-    Timestamp t_project;
-    Scene scene = load_scene(input_file);
-    float project_load_time = elapsed_seconds(t_project);
-    printf("%-*s %.3f seconds\n", time_category_field_width, "Parse project", project_load_time);
+static std::string get_output_image_path(std::string image_filename, const Command_Line_Options& options)
+{
+    if (!options.output_directory.empty()) {
+        image_filename = (fs::path(options.output_directory) / fs::path(image_filename)).string();
+    }
+    image_filename += options.output_filename_suffix;
+    image_filename += ".exr"; // output is OpenEXR image
+    return image_filename;
+}
 
-    //
-    // Override requested parts of the scene.
-    //
+static EXR_Write_Params get_exr_write_params(const EXR_Attributes& attributes, const Command_Line_Options& options)
+{
+    EXR_Write_Params write_params;
+    write_params.enable_varying_attributes = options.openexr_enable_varying_attributes;
+    write_params.enable_compression = options.openexr_enable_compression;
+    write_params.dump_attributes = options.openexr_dump_attributes;
+    write_params.attributes = attributes;
+    return write_params;
+}
+
+static void write_output_image(const Image& image, const std::string& image_filename,
+    const EXR_Attributes& attributes, const Command_Line_Options& options)
+{
+    const std::string image_path = get_output_image_path(image_filename, options);
+    if (!write_openexr_image(image_path, image, get_exr_write_params(attributes, options))) {
+        error("Failed to save rendered image: %s", image_path.c_str());
+    }
+    printf("Saved output image to %s\n\n", image_path.c_str());
+}
+
+static void print_texture_cache_stats()
+{
+    Texture_Cache_Stats texture_cache_stats = get_texture_cache_stats();
+    if (texture_cache_stats.tile_load_count > 0) {
+        printf("Texture cache: %.1f MB peak memory, %llu tile loads, %llu tile evictions\n",
+            double(texture_cache_stats.peak_used_memory) / (1024.0 * 1024.0),
+            (unsigned long long)texture_cache_stats.tile_load_count,
+            (unsigned long long)texture_cache_stats.tile_eviction_count);
+    }
+}
+
+// Overrides the parts of the scene that are specified on the command line.
+static void apply_command_line_overrides(Scene& scene, const Command_Line_Options& options)
+{
     if (options.film_resolution != Vector2i{}) {
         scene.film_resolution = options.film_resolution;
     }
     if (options.render_region != Bounds2i{}) {
         scene.render_region = options.render_region;
     }
-    if (options.samples_per_pixel > 0) {
-        int k = (int)std::ceil(std::sqrt(options.samples_per_pixel));
-        scene.raytracer_config.x_pixel_sample_count = k;
-        scene.raytracer_config.y_pixel_sample_count = k;
+    if (options.override_pixel_sampler_type) {
+        scene.raytracer_config.pixel_sampler_type = options.pixel_sampler_type;
     }
     if (options.override_rendering_algorithm) {
         scene.raytracer_config.rendering_algorithm = options.rendering_algorithm;
     }
-    int thread_count = options.thread_count;
-    if (!thread_count) {
-        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    // The grid of samples depends on the sampler type and on the rendering algorithm.
+    if (options.samples_per_pixel > 0) {
+        scene.raytracer_config.set_samples_per_pixel(options.samples_per_pixel);
+    }
+    if (options.override_light_selection) {
+        scene.raytracer_config.light_selection = options.light_selection;
+    }
+    if (options.light_resampling_candidate_count > 0) {
+        scene.raytracer_config.light_resampling_candidate_count = options.light_resampling_candidate_count;
+    }
+    if (options.path_guiding_training_pass_count > 0) {
+        scene.raytracer_config.path_guiding_training_pass_count = options.path_guiding_training_pass_count;
+    }
+    if (options.path_guiding_memory_budget > 0) {
+        scene.raytracer_config.path_guiding_memory_budget = options.path_guiding_memory_budget;
+    }
+    if (options.filter_importance_sampling) {
+        scene.raytracer_config.filter_importance_sampling = true;
     }
+}
+
+static void process_input_file(const std::string& input_file, const Command_Line_Options& options)
+{
+    Timestamp t_start;
+    printf("Loading: %s\n", input_file.c_str());
+
+    const Reference_Renderer_Config config = get_reference_renderer_config(options);
+    initialize_job_system(config.thread_count);
 
     //
-    // Render scene.
+    // Load scene. Kdtree building starts while the scene is being loaded.
     //
-    Reference_Renderer_Config config;
-    config.thread_count = thread_count;
-    config.checkpoint_directory = options.checkpoint_directory;
-    config.rebuild_kdtree_cache = options.force_rebuild_kdtree_cache;
-    config.rng_seed_offset = options.rng_seed_offset;
-    config.pbrt_compatibility = options.pbrt_compatibility;
+    Timestamp t_project;
+    Scene_Load_Pipeline load_pipeline;
+    load_pipeline.rebuild_kdtree_cache = options.force_rebuild_kdtree_cache;
+    Scene_Load_Callbacks load_callbacks = load_pipeline.get_scene_load_callbacks();
+    Scene scene = load_scene(input_file, &load_callbacks);
+    float project_load_time = elapsed_seconds(t_project);
+    printf("%-*s %.3f seconds\n", time_category_field_width, "Parse project", project_load_time);
+
+    apply_command_line_overrides(scene, options);
 
+    //
+    // Render scene.
+    //
     Scene_Context scene_ctx;
-    init_scene_context(scene_ctx, scene, config);
+    init_scene_context(scene_ctx, scene, config, {}, &load_pipeline);
     float load_time = elapsed_seconds(t_start);
     printf("%-*s %.3f seconds\n\n", time_category_field_width, "Total loading time", load_time);
 
+    std::string image_filename;
+    if (!scene.output_filename.empty()) {
+        image_filename = fs::path(scene.output_filename).replace_extension().string();
+    }
+    else {
+        image_filename = fs::path(input_file).stem().string();
+    }
+
+    EXR_Attributes attributes {
+        .input_file = input_file,
+        .spp = scene_ctx.pixel_sampler_config.get_samples_per_pixel(),
+        .load_time = load_time,
+    };
     double variance_estimate = 0.0;
     float render_time = 0.f;
-    Image image = render_scene(scene_ctx, &variance_estimate, &render_time);
+
+    // --stream-output
+    // The image is written to the output file during rendering.
+    if (options.stream_output && !options.tile_subset.is_specified()) {
+        const std::string image_path = get_output_image_path(image_filename, options);
+        if (!render_scene_to_openexr_file(scene_ctx, image_path, get_exr_write_params(attributes, options),
+            options.flip_image_horizontally, &variance_estimate, &render_time))
+        {
+            error("Failed to save rendered image: %s", image_path.c_str());
+        }
+        printf("%-*s %.3f seconds\n", 12, "Render time", render_time);
+        printf("%-*s %.6f\n", 12, "Variance", variance_estimate);
+        printf("%-*s %.6f\n", 12, "StdDev", std::sqrt(variance_estimate));
+        print_texture_cache_stats();
+#if ENABLE_RAY_STATS
+        print_ray_stats(get_ray_stats(), render_time);
+#endif
+        printf("Saved output image to %s\n\n", image_path.c_str());
+        return;
+    }
+
+    Image image = render_scene(scene_ctx, &variance_estimate, &render_time, options.tile_subset);
 
     printf("%-*s %.3f seconds\n", 12, "Render time", render_time);
+    if (options.tile_subset.is_specified()) {
+        printf("Rendered tiles are stored in checkpoint %s\n\n", options.checkpoint_directory.c_str());
+        return;
+    }
     printf("%-*s %.6f\n", 12, "Variance", variance_estimate);
     printf("%-*s %.6f\n", 12, "StdDev", std::sqrt(variance_estimate));
+    print_texture_cache_stats();
+#if ENABLE_RAY_STATS
+    print_ray_stats(get_ray_stats(), render_time);
+#endif
+
+    // --denoise
+    Image denoised_image;
+    if (options.denoise) {
+        Timestamp t_denoise;
+        denoised_image = denoise_image(image);
+        printf("%-*s %.3f seconds\n", 12, "Denoise time", elapsed_seconds(t_denoise));
+    }
+    // --time-heatmap
+    Image time_heatmap;
+    if (options.time_heatmap) {
+        print_render_time_profile(image);
+        time_heatmap = create_time_heatmap(image);
+    }
+    // AOVs were collected only for the denoiser or the time profile.
+    if (!options.output_aovs) {
+        image.extra_channels.clear();
+    }
 
     //
     // Save image
     //
-    // --nocrop
-    if (!options.crop_image_by_render_region) {
-        ASSERT(Vector2i(image.width, image.height) == scene.render_region.size());
-        if (scene.render_region != Bounds2i{ {0, 0}, scene.film_resolution }) {
-            image.extend_to_region(scene.film_resolution, scene.render_region.p0);
+    auto prepare_output_image = [&scene, &options](Image& output_image) {
+        // --nocrop
+        if (!options.crop_image_by_render_region) {
+            ASSERT(Vector2i(output_image.width, output_image.height) == scene.render_region.size());
+            if (scene.render_region != Bounds2i{ {0, 0}, scene.film_resolution }) {
+                output_image.extend_to_region(scene.film_resolution, scene.render_region.p0);
+            }
+        }
+        // --flip
+        if (options.flip_image_horizontally) {
+            output_image.flip_horizontally();
         }
+    };
+    prepare_output_image(image);
+
+    attributes.variance = (float)variance_estimate;
+    attributes.render_time = render_time;
+#if ENABLE_RAY_STATS
+    attributes.ray_stats = get_ray_stats();
+#endif
+    write_output_image(image, image_filename, attributes, options);
+
+    if (options.denoise) {
+        prepare_output_image(denoised_image);
+        write_output_image(denoised_image, image_filename + "_denoised", attributes, options);
     }
-    // --flip
-    if (options.flip_image_horizontally) {
-        image.flip_horizontally();
+    if (options.time_heatmap) {
+        prepare_output_image(time_heatmap);
+        write_output_image(time_heatmap, image_filename + "_time", attributes, options);
     }
+}
 
-    std::string image_filename;
-    if (!scene.output_filename.empty()) {
-        image_filename = fs::path(scene.output_filename).replace_extension().string();
-    }
-    else {
-        image_filename = fs::path(input_file).stem().string();
-    }
-    if (!options.output_directory.empty()) {
-        image_filename = (fs::path(options.output_directory) / fs::path(image_filename)).string();
-    }
-    image_filename += options.output_filename_suffix;
-    image_filename += ".exr"; // output is OpenEXR image
+// --benchmark
+// The first run of the scene can include kdtree cache and texture cache creation.
+static Benchmark_Run benchmark_input_file(const std::string& input_file, int run_index, const Command_Line_Options& options)
+{
+    printf("Benchmark run %d/%d: %s\n", run_index + 1, options.benchmark_run_count, input_file.c_str());
+    const Texture_Cache_Stats initial_texture_cache_stats = get_texture_cache_stats();
 
-    EXR_Write_Params write_params;
-    write_params.enable_varying_attributes = options.openexr_enable_varying_attributes;
-    write_params.enable_compression = options.openexr_enable_compression;
-    write_params.dump_attributes = options.openexr_dump_attributes;
-    write_params.attributes = EXR_Attributes {
-        .input_file = input_file,
-        .spp = scene_ctx.pixel_sampler_config.get_samples_per_pixel(),
-        .variance = (float)variance_estimate,
-        .load_time = load_time,
-        .render_time = render_time,
-    };
+    Timestamp t_start;
+    const Reference_Renderer_Config config = get_reference_renderer_config(options);
+    initialize_job_system(config.thread_count);
 
-    if (!write_openexr_image(image_filename, image, write_params)) {
-        error("Failed to save rendered image: %s", image_filename.c_str());
+    Scene_Load_Pipeline load_pipeline;
+    load_pipeline.rebuild_kdtree_cache = options.force_rebuild_kdtree_cache && run_index == 0;
+    Scene_Load_Callbacks load_callbacks = load_pipeline.get_scene_load_callbacks();
+    Scene scene = load_scene(input_file, &load_callbacks);
+    apply_command_line_overrides(scene, options);
+
+    Scene_Context scene_ctx;
+    init_scene_context(scene_ctx, scene, config, {}, &load_pipeline);
+
+    Benchmark_Run run;
+    run.scene = input_file;
+    run.run_index = run_index;
+    run.load_time = elapsed_seconds(t_start);
+    run.kdtree_time = load_pipeline.kdtree_wait_time + scene_ctx.kdtree_data.scene_kdtree_build_time;
+
+    double variance_estimate = 0.0;
+    render_scene(scene_ctx, &variance_estimate, &run.render_time);
+    run.total_time = elapsed_seconds(t_start);
+
+    run.texture_time = float(get_texture_cache_stats().load_time - initial_texture_cache_stats.load_time);
+#if ENABLE_RAY_STATS
+    run.ray_count = get_ray_stats().get_ray_count();
+#endif
+    run.peak_memory_usage = get_peak_memory_usage();
+
+    printf("%-*s %.3f seconds\n", 12, "Render time", run.render_time);
+    printf("%-*s %.3f seconds\n\n", 12, "Total time", run.total_time);
+    return run;
+}
+
+static void merge_checkpoints(const std::vector<std::string>& checkpoint_directories, const Command_Line_Options& options)
+{
+    printf("Merging %d checkpoint directories\n", (int)checkpoint_directories.size());
+    EXR_Attributes attributes;
+    Image image = merge_checkpoint_directories(checkpoint_directories, &attributes);
+
+    // --flip
+    if (options.flip_image_horizontally) {
+        image.flip_horizontally();
     }
-    printf("Saved output image to %s\n\n", image_filename.c_str());
+    std::string image_filename = fs::path(attributes.input_file).stem().string();
+    write_output_image(image, image_filename, attributes, options);
 }
 
 int main(int argc, char** argv)
@@ -473,6 +941,30 @@ int main(int argc, char** argv)
         return cmdline.exit_code;
     }
 
+    if (!cmdline.options.server_socket_path.empty()) {
+        const Command_Line_Options& options = cmdline.options;
+        run_render_server(options.server_socket_path, get_reference_renderer_config(options),
+            [&options](Scene& scene) { apply_command_line_overrides(scene, options); });
+        return 0;
+    }
+    if (cmdline.options.merge_checkpoints) {
+        merge_checkpoints(cmdline.files, cmdline.options);
+        return 0;
+    }
+    if (cmdline.options.benchmark_run_count > 0) {
+        std::vector<Benchmark_Run> runs;
+        for (const std::string& input_file : cmdline.files) {
+            for (int i = 0; i < cmdline.options.benchmark_run_count; i++) {
+                runs.push_back(benchmark_input_file(input_file, i, cmdline.options));
+            }
+        }
+        print_benchmark_summary(runs);
+        if (!cmdline.options.benchmark_output_file.empty()) {
+            write_benchmark_results(cmdline.options.benchmark_output_file, runs);
+            printf("Saved benchmark results to %s\n", cmdline.options.benchmark_output_file.c_str());
+        }
+        return 0;
+    }
     for (const std::string& input_file : cmdline.files) {
         process_input_file(input_file, cmdline.options);
     }
@@ -0,0 +1,331 @@
+#include "std.h"
+#include "lib/common.h"
+#include "path_guiding.h"
+
+#include "lib/math.h"
+
+// The values from the paper.
+constexpr float quadtree_subdivision_threshold = 0.01f; // fraction of the total energy
+constexpr int quadtree_max_depth = 20;
+constexpr float spatial_split_factor = 12000.f; // the region is split if it has more than factor * sqrt(2^pass) samples
+
+// The recorded values are converted to fixed point with this scale. The values are clamped, so the sum
+// of many samples does not overflow.
+constexpr double recorded_value_scale = double(1 << 20);
+constexpr float max_recorded_value = 1e6f;
+
+static Vector2 direction_to_square(const Vector3& direction)
+{
+    float cos_theta = std::clamp(direction.z, -1.f, 1.f);
+    float phi = std::atan2(direction.y, direction.x);
+    if (phi < 0.f)
+        phi += Pi2;
+    return Vector2(std::min((cos_theta + 1.f) * 0.5f, One_Minus_Epsilon), std::min(phi * Pi2_Inv, One_Minus_Epsilon));
+}
+
+static Vector3 square_to_direction(Vector2 p)
+{
+    float cos_theta = 2.f * p.x - 1.f;
+    float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+    float phi = Pi2 * p.y;
+    return Vector3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+// Selects one of the two halves with the probability p0 for the first half and remaps u to [0, 1).
+static int select_half(float p0, float* u)
+{
+    if (*u < p0) {
+        *u = std::min(*u / p0, One_Minus_Epsilon);
+        return 0;
+    }
+    *u = std::min((*u - p0) / (1.f - p0), One_Minus_Epsilon);
+    return 1;
+}
+
+//
+// Guiding_Quadtree
+//
+Vector3 Guiding_Quadtree::sample(Vector2 u) const
+{
+    if (total_sum <= 0.f)
+        return square_to_direction(u);
+
+    Vector2 origin;
+    float size = 1.f;
+    int node_index = 0;
+    while (true) {
+        const float* sums = nodes[node_index].sums;
+        const float total = sums[0] + sums[1] + sums[2] + sums[3];
+
+        // Select the column of quadrants and then the quadrant in the column.
+        int x, y;
+        if (total > 0.f) {
+            x = select_half((sums[0] + sums[2]) / total, &u.x);
+            y = select_half(sums[x] / (sums[x] + sums[x + 2]), &u.y);
+        }
+        else {
+            x = select_half(0.5f, &u.x);
+            y = select_half(0.5f, &u.y);
+        }
+        size *= 0.5f;
+        origin = origin + Vector2(float(x), float(y)) * size;
+
+        const int child = nodes[node_index].children[x + 2 * y];
+        if (child == 0)
+            return square_to_direction(origin + u * size);
+        node_index = child;
+    }
+}
+
+float Guiding_Quadtree::pdf(const Vector3& direction) const
+{
+    constexpr float uniform_sphere_pdf = 1.f / (4.f * Pi);
+    if (total_sum <= 0.f)
+        return uniform_sphere_pdf;
+
+    Vector2 p = direction_to_square(direction);
+    float pdf = 1.f;
+    int node_index = 0;
+    while (true) {
+        const Guiding_Quadtree_Node& node = nodes[node_index];
+        const float total = node.sums[0] + node.sums[1] + node.sums[2] + node.sums[3];
+
+        const int x = p.x >= 0.5f;
+        const int y = p.y >= 0.5f;
+        const int quadrant = x + 2 * y;
+        if (total > 0.f)
+            pdf *= 4.f * node.sums[quadrant] / total;
+
+        if (node.children[quadrant] == 0)
+            break;
+        p = Vector2(2.f * p.x - float(x), 2.f * p.y - float(y));
+        node_index = node.children[quadrant];
+    }
+    // The area of the square is 1 and the mapping is equal-area.
+    return pdf * uniform_sphere_pdf;
+}
+
+// Builds the topology of the quadtree for the next training pass. The quadrant is subdivided
+// if it has more than quadtree_subdivision_threshold fraction of the learned energy.
+static void build_training_quadtree(const Guiding_Quadtree& learned, int max_node_count, Guiding_Quadtree* training)
+{
+    training->nodes.assign(1, Guiding_Quadtree_Node{});
+    training->total_sum = 0.f;
+    if (learned.total_sum <= 0.f)
+        return;
+
+    struct Item {
+        int node_index;
+        int learned_node_index; // -1 if the learned quadtree does not have the corresponding node
+        float sums[4];
+        int depth;
+    };
+    Item root{ 0, 0, {}, 1 };
+    std::copy_n(learned.nodes[0].sums, 4, root.sums);
+
+    // Breadth-first order, so the coarse levels are subdivided first when the node count is limited.
+    std::deque<Item> queue{ root };
+    while (!queue.empty()) {
+        const Item item = queue.front();
+        queue.pop_front();
+
+        for (int q = 0; q < 4; q++) {
+            if (item.sums[q] <= quadtree_subdivision_threshold * learned.total_sum ||
+                item.depth >= quadtree_max_depth || (int)training->nodes.size() >= max_node_count)
+            {
+                continue;
+            }
+            Item child;
+            child.node_index = (int)training->nodes.size();
+            child.depth = item.depth + 1;
+            training->nodes[item.node_index].children[q] = child.node_index;
+            training->nodes.emplace_back();
+
+            const int learned_child = (item.learned_node_index >= 0) ? learned.nodes[item.learned_node_index].children[q] : 0;
+            if (learned_child != 0) {
+                child.learned_node_index = learned_child;
+                std::copy_n(learned.nodes[learned_child].sums, 4, child.sums);
+            }
+            else {
+                child.learned_node_index = -1;
+                std::fill_n(child.sums, 4, item.sums[q] * 0.25f);
+            }
+            queue.push_back(child);
+        }
+    }
+}
+
+//
+// Path_Guiding
+//
+void Path_Guiding::initialize(const Bounding_Box& scene_bounds, size_t memory_budget)
+{
+    const Vector3 size = scene_bounds.max_p - scene_bounds.min_p;
+    const Vector3 center = (scene_bounds.min_p + scene_bounds.max_p) * 0.5f;
+    bounds_size = std::max(1.01f * std::max(size.x, std::max(size.y, size.z)), 1e-4f);
+    bounds_origin = center - Vector3(0.5f * bounds_size);
+
+    this->memory_budget = memory_budget;
+    finished_training_pass_count = 0;
+
+    spatial_nodes.assign(1, Guiding_Spatial_Node{});
+    spatial_nodes[0].region_index = 0;
+    regions.assign(1, Guiding_Region{});
+    allocate_recording_buffers();
+}
+
+void Path_Guiding::record(const Vector3& position, const Vector3& direction, float radiance)
+{
+    ASSERT(recorded_sums != nullptr);
+    const int region_index = find_region(position);
+    recorded_sample_counts[region_index].fetch_add(1, std::memory_order_relaxed);
+
+    if (!(radiance > 0.f))
+        return;
+    const uint64_t value = uint64_t(double(std::min(radiance, max_recorded_value)) * recorded_value_scale);
+    if (value == 0)
+        return;
+
+    const Guiding_Region& region = regions[region_index];
+    std::atomic_uint64_t* sums = &recorded_sums[region.recorded_sums_offset];
+
+    Vector2 p = direction_to_square(direction);
+    int node_index = 0;
+    while (true) {
+        const int x = p.x >= 0.5f;
+        const int y = p.y >= 0.5f;
+        const int quadrant = x + 2 * y;
+        sums[node_index * 4 + quadrant].fetch_add(value, std::memory_order_relaxed);
+
+        const int child = region.training_quadtree.nodes[node_index].children[quadrant];
+        if (child == 0)
+            break;
+        p = Vector2(2.f * p.x - float(x), 2.f * p.y - float(y));
+        node_index = child;
+    }
+}
+
+void Path_Guiding::finish_training_pass(bool last_training_pass)
+{
+    // Learn the sampling distributions from the recorded energy.
+    for (Guiding_Region& region : regions) {
+        Guiding_Quadtree& quadtree = region.sampling_quadtree;
+        quadtree.nodes = region.training_quadtree.nodes;
+
+        const std::atomic_uint64_t* sums = &recorded_sums[region.recorded_sums_offset];
+        for (size_t i = 0; i < quadtree.nodes.size(); i++) {
+            for (int k = 0; k < 4; k++)
+                quadtree.nodes[i].sums[k] = float(double(sums[i * 4 + k].load(std::memory_order_relaxed)) / recorded_value_scale);
+        }
+        const float* root_sums = quadtree.nodes[0].sums;
+        quadtree.total_sum = root_sums[0] + root_sums[1] + root_sums[2] + root_sums[3];
+    }
+    finished_training_pass_count++;
+
+    // Only the sampling quadtrees are needed by the final render.
+    if (last_training_pass) {
+        for (Guiding_Region& region : regions)
+            region.training_quadtree.nodes = std::vector<Guiding_Quadtree_Node>();
+        recorded_sums.reset();
+        recorded_sample_counts.reset();
+        return;
+    }
+
+    // Split the regions that received many samples. Each training pass has twice as many
+    // samples as the previous one, the threshold grows slower, so the regions get smaller.
+    const float sample_count_threshold = spatial_split_factor * std::sqrt(std::exp2(float(finished_training_pass_count - 1)));
+    const int spatial_node_count = (int)spatial_nodes.size();
+    for (int i = 0; i < spatial_node_count; i++) {
+        if (spatial_nodes[i].is_leaf()) {
+            const uint32_t sample_count = recorded_sample_counts[spatial_nodes[i].region_index].load(std::memory_order_relaxed);
+            split_spatial_node(i, sample_count, sample_count_threshold);
+        }
+    }
+
+    // The memory that is left after the sampling quadtrees is distributed evenly between the training quadtrees.
+    size_t used_memory = spatial_nodes.size() * sizeof(Guiding_Spatial_Node) + regions.size() * sizeof(Guiding_Region);
+    for (const Guiding_Region& region : regions)
+        used_memory += region.sampling_quadtree.nodes.size() * sizeof(Guiding_Quadtree_Node);
+
+    const size_t training_node_size = sizeof(Guiding_Quadtree_Node) + 4 * sizeof(uint64_t);
+    const size_t available_memory = (memory_budget > used_memory) ? memory_budget - used_memory : 0;
+    const size_t max_node_count = std::max<size_t>(1, available_memory / (regions.size() * training_node_size));
+
+    for (Guiding_Region& region : regions)
+        build_training_quadtree(region.sampling_quadtree, (int)std::min<size_t>(max_node_count, std::numeric_limits<int>::max()), &region.training_quadtree);
+
+    allocate_recording_buffers();
+}
+
+const Guiding_Quadtree& Path_Guiding::get_sampling_quadtree(const Vector3& position) const
+{
+    return regions[find_region(position)].sampling_quadtree;
+}
+
+size_t Path_Guiding::get_memory_size() const
+{
+    size_t size = spatial_nodes.size() * sizeof(Guiding_Spatial_Node) + regions.size() * sizeof(Guiding_Region);
+    for (const Guiding_Region& region : regions) {
+        size += region.sampling_quadtree.nodes.size() * sizeof(Guiding_Quadtree_Node);
+        size += region.training_quadtree.nodes.size() * (sizeof(Guiding_Quadtree_Node) + 4 * sizeof(uint64_t));
+    }
+    return size;
+}
+
+int Path_Guiding::find_region(const Vector3& position) const
+{
+    // The position in the [0, 1) cube.
+    Vector3 p = (position - bounds_origin) / bounds_size;
+    for (int i = 0; i < 3; i++)
+        p[i] = std::clamp(p[i], 0.f, One_Minus_Epsilon);
+
+    int node_index = 0;
+    while (!spatial_nodes[node_index].is_leaf()) {
+        const Guiding_Spatial_Node& node = spatial_nodes[node_index];
+        const int child = p[node.axis] >= 0.5f;
+        p[node.axis] = 2.f * p[node.axis] - float(child);
+        node_index = node.children[child];
+    }
+    return spatial_nodes[node_index].region_index;
+}
+
+void Path_Guiding::split_spatial_node(int node_index, uint32_t sample_count, float sample_count_threshold)
+{
+    if (float(sample_count) <= sample_count_threshold)
+        return;
+
+    // Both children start with the distribution of the parent region.
+    const int region_index = spatial_nodes[node_index].region_index;
+    const size_t split_memory_size = 2 * sizeof(Guiding_Spatial_Node) + sizeof(Guiding_Region) +
+        2 * regions[region_index].sampling_quadtree.nodes.size() * sizeof(Guiding_Quadtree_Node);
+    if (get_memory_size() + split_memory_size > memory_budget)
+        return;
+
+    const int new_region_index = (int)regions.size();
+    regions.push_back(regions[region_index]);
+
+    const int axis = spatial_nodes[node_index].axis;
+    for (int i = 0; i < 2; i++) {
+        Guiding_Spatial_Node child;
+        child.axis = (axis + 1) % 3;
+        child.region_index = (i == 0) ? region_index : new_region_index;
+        spatial_nodes[node_index].children[i] = (int)spatial_nodes.size();
+        spatial_nodes.push_back(child);
+    }
+    spatial_nodes[node_index].region_index = -1;
+
+    // Assume that the samples are distributed evenly between the children.
+    for (int i = 0; i < 2; i++)
+        split_spatial_node(spatial_nodes[node_index].children[i], sample_count / 2, sample_count_threshold);
+}
+
+void Path_Guiding::allocate_recording_buffers()
+{
+    size_t offset = 0;
+    for (Guiding_Region& region : regions) {
+        region.recorded_sums_offset = offset;
+        offset += region.training_quadtree.nodes.size() * 4;
+    }
+    recorded_sums = std::make_unique<std::atomic_uint64_t[]>(offset);
+    recorded_sample_counts = std::make_unique<std::atomic_uint32_t[]>(regions.size());
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "lib/bounding_box.h"
+#include "lib/vector.h"
+
+// Path guiding with the spatial-directional tree (SD-tree) from "Practical Path Guiding for Efficient
+// Light-Transport Simulation" (Müller et al. 2017). The binary spatial tree subdivides the scene bounds
+// and each leaf (region) stores a directional quadtree that approximates the distribution of the incident
+// radiance. The tree is trained during the progressive training passes: the radiance recorded in the
+// current pass defines the distribution that is used for sampling in the next pass.
+//
+// The recorded radiance is accumulated in fixed point with integer atomics. The result does not depend
+// on the order in which the threads record the samples, so for the fixed training schedule the trained
+// tree is the same for any thread count.
+
+// The directions are mapped to the unit square with the cylindrical equal-area mapping, so the density
+// on the square is proportional to the solid angle density.
+struct Guiding_Quadtree_Node {
+    float sums[4] = {}; // energy of the quadrants, quadrant index is x + 2 * y (x, y are 0 or 1)
+    int children[4] = {}; // 0 if the quadrant is not subdivided (the root can't be a child)
+};
+
+struct Guiding_Quadtree {
+    std::vector<Guiding_Quadtree_Node> nodes = std::vector<Guiding_Quadtree_Node>(1);
+    float total_sum = 0.f;
+
+    // The directions are sampled uniformly if the quadtree has no energy.
+    Vector3 sample(Vector2 u) const;
+    float pdf(const Vector3& direction) const; // solid angle density
+};
+
+struct Guiding_Spatial_Node {
+    int axis = 0;
+    int children[2] = {}; // 0 for the leaf node (the root can't be a child)
+    int region_index = -1; // leaf node: index of the region
+
+    bool is_leaf() const { return children[0] == 0; }
+};
+
+struct Guiding_Region {
+    Guiding_Quadtree sampling_quadtree; // distribution learned during the previous training pass
+    Guiding_Quadtree training_quadtree; // topology for recording, the energy is in Path_Guiding::recorded_sums, empty after training
+    size_t recorded_sums_offset = 0;
+};
+
+struct Path_Guiding {
+    // The probability to sample the BSDF instead of the guiding distribution (one-sample MIS).
+    static constexpr float bsdf_sampling_fraction = 0.5f;
+
+    void initialize(const Bounding_Box& scene_bounds, size_t memory_budget);
+
+    // Thread-safe. The radiance is the estimate of the incident radiance divided by the pdf of the direction.
+    void record(const Vector3& position, const Vector3& direction, float radiance);
+
+    // Called after all samples of the training pass are recorded. Learns the sampling distributions
+    // from the recorded radiance and refines the tree for the next training pass. After the last
+    // training pass the recording data is released and record() can't be called.
+    void finish_training_pass(bool last_training_pass);
+
+    bool has_sampling_distribution() const { return finished_training_pass_count > 0; }
+    const Guiding_Quadtree& get_sampling_quadtree(const Vector3& position) const;
+
+    size_t get_memory_size() const;
+
+private:
+    int find_region(const Vector3& position) const;
+    void split_spatial_node(int node_index, uint32_t sample_count, float sample_count_threshold);
+    void allocate_recording_buffers();
+
+    Vector3 bounds_origin;
+    float bounds_size = 0.f; // the spatial tree subdivides the cube
+
+    size_t memory_budget = 0;
+    int finished_training_pass_count = 0;
+
+    std::vector<Guiding_Spatial_Node> spatial_nodes;
+    std::vector<Guiding_Region> regions;
+
+    std::unique_ptr<std::atomic_uint64_t[]> recorded_sums; // 4 values per node of the training quadtree
+    std::unique_ptr<std::atomic_uint32_t[]> recorded_sample_counts; // per region
+};
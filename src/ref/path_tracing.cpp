@@ -4,10 +4,64 @@
 
 #include "bsdf.h"
 #include "direct_lighting.h"
+#include "path_guiding.h"
 #include "scene_context.h"
 #include "shading_context.h"
 #include "thread_context.h"
 
+// Adds the contribution to the path radiance. During the path guiding training the contribution
+// is also added to the radiance that arrives to the previous guiding vertices.
+static void add_radiance(Thread_Context& thread_ctx, const ColorRGB& contribution, ColorRGB* L)
+{
+    *L += contribution;
+    for (Guiding_Vertex& vertex : thread_ctx.guiding_vertices) {
+        for (int i = 0; i < 3; i++) {
+            if (vertex.path_coeff[i] > 0.f)
+                vertex.incident_radiance[i] += contribution[i] / vertex.path_coeff[i];
+        }
+    }
+}
+
+// Samples the direction of the next path segment. With path guiding the direction is sampled either
+// from the BSDF or from the guiding distribution, and the returned pdf is the combined pdf of both
+// strategies (one-sample MIS with the balance heuristic).
+static ColorRGB sample_continuation_direction(const Thread_Context& thread_ctx,
+    float u_guiding, Vector2 u, float u_scattering_type, Vector3* wi, float* pdf)
+{
+    const Shading_Context& shading_ctx = thread_ctx.shading_context;
+    const BSDF* bsdf = shading_ctx.bsdf;
+
+    if (!thread_ctx.path_guiding || !thread_ctx.path_guiding->has_sampling_distribution())
+        return bsdf->sample(u, u_scattering_type, shading_ctx.wo, wi, pdf);
+
+    const Guiding_Quadtree& quadtree = thread_ctx.path_guiding->get_sampling_quadtree(shading_ctx.position);
+    const float bsdf_fraction = Path_Guiding::bsdf_sampling_fraction;
+
+    ColorRGB f;
+    float bsdf_pdf;
+    if (u_guiding < bsdf_fraction) {
+        f = bsdf->sample(u, u_scattering_type, shading_ctx.wo, wi, &bsdf_pdf);
+        if (f.is_black())
+            return Color_Black;
+    }
+    else {
+        *wi = quadtree.sample(u);
+
+        float n_dot_wi = dot(shading_ctx.normal, *wi);
+        bool scattering_possible = n_dot_wi > 0.f && bsdf->reflection_scattering ||
+                                   n_dot_wi < 0.f && bsdf->transmission_scattering;
+        if (!scattering_possible)
+            return Color_Black;
+
+        f = bsdf->evaluate(shading_ctx.wo, *wi);
+        if (f.is_black())
+            return Color_Black;
+        bsdf_pdf = bsdf->pdf(shading_ctx.wo, *wi);
+    }
+    *pdf = bsdf_fraction * bsdf_pdf + (1.f - bsdf_fraction) * quadtree.pdf(*wi);
+    return f;
+}
+
 ColorRGB trace_path(Thread_Context& thread_ctx, const Ray& ray, const Differential_Rays& differential_rays)
 {
     const Scene_Context& scene_ctx = thread_ctx.scene_context;
@@ -19,6 +73,9 @@ ColorRGB trace_path(Thread_Context& thread_ctx, const Ray& ray, const Differenti
     ColorRGB path_coeff = Color_White;
     bool ray_is_already_traced_by_delta_bounce = false;
 
+    std::vector<Guiding_Vertex>& guiding_vertices = thread_ctx.guiding_vertices;
+    guiding_vertices.clear();
+
     ColorRGB L;
     while (true) {
         if (!ray_is_already_traced_by_delta_bounce) {
@@ -49,24 +106,34 @@ ColorRGB trace_path(Thread_Context& thread_ctx, const Ray& ray, const Differenti
         Vector2 u_light = thread_ctx.pixel_sampler.get_next_2d_sample();
         Vector2 u_bsdf = thread_ctx.pixel_sampler.get_next_2d_sample();
         Vector2 u_bsdf_next_segment = thread_ctx.pixel_sampler.get_next_2d_sample();
+        float u_guiding = thread_ctx.path_guiding ? thread_ctx.pixel_sampler.get_next_1d_sample() : 0.f;
 
         thread_ctx.shading_context.initialize_scattering(thread_ctx, &u_scattering_type);
 
         if (!shading_ctx.delta_scattering_event) {
             ColorRGB direct_lighting = estimate_direct_lighting_from_single_sample(thread_ctx, u_light_index, u_light, u_bsdf, u_scattering_type);
-            L += path_coeff * direct_lighting;
+            add_radiance(thread_ctx, path_coeff * direct_lighting, &L);
 
             path_ctx.bounce_count++;
             if (path_ctx.bounce_count == rt_config.max_light_bounces)
                 break;
 
             Vector3 wi;
-            float bsdf_pdf;
-            ColorRGB f = shading_ctx.bsdf->sample(u_bsdf_next_segment, u_scattering_type_next_segment, shading_ctx.wo, &wi, &bsdf_pdf);
+            float pdf;
+            ColorRGB f = sample_continuation_direction(thread_ctx, u_guiding, u_bsdf_next_segment, u_scattering_type_next_segment, &wi, &pdf);
             if (f.is_black())
                 break;
 
-            path_coeff *= f * (std::abs(dot(shading_ctx.normal, wi)) / (bsdf_pdf * shading_ctx.bsdf_layer_selection_probability));
+            pdf *= shading_ctx.bsdf_layer_selection_probability;
+            path_coeff *= f * (std::abs(dot(shading_ctx.normal, wi)) / pdf);
+
+            if (thread_ctx.path_guiding_training) {
+                Guiding_Vertex& vertex = guiding_vertices.emplace_back();
+                vertex.position = shading_ctx.position;
+                vertex.direction = wi;
+                vertex.pdf = pdf;
+                vertex.path_coeff = path_coeff;
+            }
 
             current_ray.origin = shading_ctx.get_ray_origin_using_control_direction(wi);
             current_ray.direction = wi;
@@ -74,7 +141,7 @@ ColorRGB trace_path(Thread_Context& thread_ctx, const Ray& ray, const Differenti
         else {
             if (shading_ctx.bsdf) {
                 ColorRGB direct_lighting = estimate_direct_lighting_from_single_sample(thread_ctx, u_light_index, u_light, u_bsdf, u_scattering_type);
-                L += path_coeff * direct_lighting;
+                add_radiance(thread_ctx, path_coeff * direct_lighting, &L);
             }
 
             Delta_Scattering ds = shading_ctx.delta_scattering;
@@ -94,7 +161,7 @@ ColorRGB trace_path(Thread_Context& thread_ctx, const Ray& ray, const Differenti
                     shading_ctx.miss_ray.direction);
 
             path_coeff *= ds.attenuation;
-            L += path_coeff * emitted_radiance;
+            add_radiance(thread_ctx, path_coeff * emitted_radiance, &L);
 
             path_ctx.bounce_count++;
             if (path_ctx.bounce_count == rt_config.max_light_bounces)
@@ -129,5 +196,10 @@ ColorRGB trace_path(Thread_Context& thread_ctx, const Ray& ray, const Differenti
             }
         }
     }
+
+    if (thread_ctx.path_guiding_training) {
+        for (const Guiding_Vertex& vertex : guiding_vertices)
+            thread_ctx.path_guiding->record(vertex.position, vertex.direction, vertex.incident_radiance.luminance() / vertex.pdf);
+    }
     return L;
 }
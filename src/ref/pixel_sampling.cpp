@@ -17,6 +17,23 @@ void Stratified_Pixel_Sampler_Configuration::init(
     this->sample_vector_2d_size = sample_vector_2d_size;
 }
 
+void Stratified_Pixel_Sampler_Configuration::set_pixel_sample_counts(int x_pixel_sample_count, int y_pixel_sample_count)
+{
+    this->x_pixel_sample_count = x_pixel_sample_count;
+    this->y_pixel_sample_count = y_pixel_sample_count;
+
+    array2d_samples_per_pixel = 0;
+    for (Array2D_Info& info : array2d_infos) {
+        info.first_sample_offset = array2d_samples_per_pixel;
+        array2d_samples_per_pixel += (info.x_size * info.y_size) * (x_pixel_sample_count * y_pixel_sample_count);
+    }
+    array1d_samples_per_pixel = 0;
+    for (Array1D_Info& info : array1d_infos) {
+        info.first_sample_offset = array1d_samples_per_pixel;
+        array1d_samples_per_pixel += info.size * (x_pixel_sample_count * y_pixel_sample_count);
+    }
+}
+
 int Stratified_Pixel_Sampler_Configuration::register_array2d_samples(int x_size, int y_size)
 {
     Array2D_Info info;
@@ -38,61 +55,50 @@ int Stratified_Pixel_Sampler_Configuration::register_array1d_samples(int size)
     return (int)array1d_infos.size() - 1;
 }
 
-void Stratified_Pixel_Sampler::init(const Stratified_Pixel_Sampler_Configuration* config, RNG* rng)
+void Stratified_Pixel_Sampler::init(const Stratified_Pixel_Sampler_Configuration* config, RNG* rng, RNG_8x* rng_8x)
 {
     this->config = config;
     this->rng = rng;
+    this->rng_8x = rng_8x;
 
-    int pixel_sample_count = config->x_pixel_sample_count * config->y_pixel_sample_count;
+    pixel_sample_count = config->x_pixel_sample_count * config->y_pixel_sample_count;
     image_plane_samples.resize(pixel_sample_count);
     samples_1d.resize(config->sample_vector_1d_size * pixel_sample_count);
     samples_2d.resize(config->sample_vector_2d_size * pixel_sample_count);
     array2d_samples.resize(config->array2d_samples_per_pixel);
     array1d_samples.resize(config->array1d_samples_per_pixel);
+
+    int max_array2d_size = 0;
+    for (const auto& array_info : config->array2d_infos)
+        max_array2d_size = std::max(max_array2d_size, array_info.x_size * array_info.y_size);
+    array2d_stratified_grids.resize(max_array2d_size * pixel_sample_count);
+
+    int max_array1d_size = 0;
+    for (const auto& array_info : config->array1d_infos)
+        max_array1d_size = std::max(max_array1d_size, array_info.size);
+    array1d_stratified_grids.resize(max_array1d_size * pixel_sample_count);
 }
 
 void Stratified_Pixel_Sampler::next_pixel()
 {
     current_sample_vector = 0;
+    current_sample_1d = 0;
+    current_sample_2d = 0;
+    generated_1d_dimension_count = 0;
+    generated_2d_dimension_count = 0;
 
     // Generate film plane samples.
-    generate_stratified_sequence_2d(*rng, config->x_pixel_sample_count, config->y_pixel_sample_count, image_plane_samples.data());
-
-    int pixel_sample_count = config->x_pixel_sample_count * config->y_pixel_sample_count;
-
-    // Generate 1d samples.
-    {
-        std::vector<float> samples(pixel_sample_count);
-        for (int i = 0; i < config->sample_vector_1d_size; i++) {
-            generate_stratified_sequence_1d(*rng, pixel_sample_count, samples.data());
-            shuffle(samples.data(), pixel_sample_count, *rng);
-            for (int k = 0; k < pixel_sample_count; k++) {
-                samples_1d[k * config->sample_vector_1d_size + i] = samples[k];
-            }
-        }
-    }
-
-    // Generate 2d samples.
-    {
-        std::vector<Vector2> samples(pixel_sample_count);
-        for (int i = 0; i < config->sample_vector_2d_size; i++) {
-            generate_stratified_sequence_2d(*rng, config->x_pixel_sample_count, config->y_pixel_sample_count, samples.data());
-            shuffle(samples.data(), pixel_sample_count, *rng);
-            for (int k = 0; k < pixel_sample_count; k++) {
-                samples_2d[k * config->sample_vector_2d_size + i] = samples[k];
-            }
-        }
-    }
+    generate_stratified_sequence_2d(image_plane_samples.data());
 
     // Generate 2d array samples.
     for (const auto& array_info : config->array2d_infos) {
         int array_sample_count = array_info.x_size * array_info.y_size;
 
         // sequence of array_sample_count grids of stratified samples of size (x_pixel_samples, y_pixel_samples)
-        std::vector<Vector2> stratified_grids(array_sample_count * pixel_sample_count);
+        Vector2* stratified_grids = array2d_stratified_grids.data();
         for (int i = 0; i < array_sample_count; i++) {
             Vector2* grid = &stratified_grids[i * pixel_sample_count];
-            generate_stratified_sequence_2d(*rng, config->x_pixel_sample_count, config->y_pixel_sample_count, grid);
+            generate_stratified_sequence_2d(grid);
             shuffle(grid, pixel_sample_count, *rng);
         }
         float dx_array = 1.f / float(array_info.x_size);
@@ -122,10 +128,10 @@ void Stratified_Pixel_Sampler::next_pixel()
     // Generate 1d array samples (computations are analogous to 2d array case).
     for (const auto& array_info : config->array1d_infos) {
         // sequence of array_info.size grids of stratified samples  of size (x_pixel_samples, y_pixel_samples)
-        std::vector<float> stratified_grids(array_info.size * pixel_sample_count);
+        float* stratified_grids = array1d_stratified_grids.data();
         for (int i = 0; i < array_info.size; i++) {
             float* grid = &stratified_grids[i * pixel_sample_count];
-            generate_stratified_sequence_1d(*rng, pixel_sample_count, grid);
+            generate_stratified_sequence_1d(grid);
             shuffle(grid, pixel_sample_count, *rng);
         }
         float dx_array = 1.f / float(array_info.size);
@@ -142,7 +148,6 @@ void Stratified_Pixel_Sampler::next_pixel()
 
 bool Stratified_Pixel_Sampler::next_sample_vector()
 {
-    int pixel_sample_count = config->x_pixel_sample_count * config->y_pixel_sample_count;
     if (current_sample_vector < pixel_sample_count) {
         current_sample_vector++;
         current_sample_1d = 0;
@@ -158,20 +163,52 @@ Vector2 Stratified_Pixel_Sampler::get_image_plane_sample() const
 
 float Stratified_Pixel_Sampler::get_next_1d_sample()
 {
-    if (current_sample_1d < config->sample_vector_1d_size)
-        return samples_1d[current_sample_vector * config->sample_vector_1d_size + current_sample_1d++];
+    if (current_sample_1d < config->sample_vector_1d_size) {
+        // All sample vectors request the dimensions in the same order, so the dimension
+        // that is not generated yet is always the next one after the generated dimensions.
+        if (current_sample_1d == generated_1d_dimension_count) {
+            float* samples = &samples_1d[generated_1d_dimension_count * pixel_sample_count];
+            generate_stratified_sequence_1d(samples);
+            shuffle(samples, pixel_sample_count, *rng);
+            generated_1d_dimension_count++;
+        }
+        return samples_1d[current_sample_1d++ * pixel_sample_count + current_sample_vector];
+    }
     else
         return rng->get_float();
 }
 
 Vector2 Stratified_Pixel_Sampler::get_next_2d_sample()
 {
-    if (current_sample_2d < config->sample_vector_2d_size)
-        return samples_2d[current_sample_vector * config->sample_vector_2d_size + current_sample_2d++];
+    if (current_sample_2d < config->sample_vector_2d_size) {
+        if (current_sample_2d == generated_2d_dimension_count) {
+            Vector2* samples = &samples_2d[generated_2d_dimension_count * pixel_sample_count];
+            generate_stratified_sequence_2d(samples);
+            shuffle(samples, pixel_sample_count, *rng);
+            generated_2d_dimension_count++;
+        }
+        return samples_2d[current_sample_2d++ * pixel_sample_count + current_sample_vector];
+    }
     else
         return rng->get_vector2();
 }
 
+void Stratified_Pixel_Sampler::generate_stratified_sequence_1d(float* result)
+{
+    if (rng_8x)
+        ::generate_stratified_sequence_1d(*rng_8x, pixel_sample_count, result);
+    else
+        ::generate_stratified_sequence_1d(*rng, pixel_sample_count, result);
+}
+
+void Stratified_Pixel_Sampler::generate_stratified_sequence_2d(Vector2* result)
+{
+    if (rng_8x)
+        ::generate_stratified_sequence_2d(*rng_8x, config->x_pixel_sample_count, config->y_pixel_sample_count, result);
+    else
+        ::generate_stratified_sequence_2d(*rng, config->x_pixel_sample_count, config->y_pixel_sample_count, result);
+}
+
 const Vector2* Stratified_Pixel_Sampler::get_array2d(int array2d_id) const
 {
     ASSERT(array2d_id >= 0);
@@ -185,3 +222,121 @@ const float* Stratified_Pixel_Sampler::get_array1d(int array1d_id) const
     const auto& info = config->array1d_infos[array1d_id];
     return &array1d_samples[info.first_sample_offset + current_sample_vector * info.size];
 }
+
+// Reverses the bits of a 32-bit integer.
+static uint32_t reverse_bits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Integer hash with good avalanche properties (lowbias32 by Chris Wellons).
+static uint32_t hash_uint32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Each output bit depends only on the input bits of lower or equal significance.
+static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen scrambling of the fixed point number from [0, 1): each bit is flipped depending
+// on the seed and on the bits of higher significance.
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    x = reverse_bits(x);
+    x = laine_karras_permutation(x, seed);
+    x = reverse_bits(x);
+    return x;
+}
+
+// The second dimension of the Sobol sequence. The first dimension is reverse_bits(index).
+static uint32_t sobol_dimension1(uint32_t index)
+{
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1)
+            result ^= v;
+    }
+    return result;
+}
+
+static float fixed_point_to_float(uint32_t x)
+{
+    return std::min(float(x) * 0x1p-32f, One_Minus_Epsilon);
+}
+
+static Vector2 get_sobol_2d_sample(uint32_t sample_index, uint32_t seed)
+{
+    uint32_t index = nested_uniform_scramble(sample_index, seed);
+    uint32_t x = nested_uniform_scramble(reverse_bits(index), hash_uint32(seed ^ 0x1u));
+    uint32_t y = nested_uniform_scramble(sobol_dimension1(index), hash_uint32(seed ^ 0x2u));
+    return Vector2(fixed_point_to_float(x), fixed_point_to_float(y));
+}
+
+void Sobol_Pixel_Sampler::next_pixel(uint32_t pixel_seed, int first_sample_index, int sample_count)
+{
+    this->pixel_seed = hash_uint32(pixel_seed);
+    this->first_sample_index = first_sample_index;
+    this->sample_count = sample_count;
+    current_sample_vector = 0;
+    current_dimension = 1; // dimension 0 is the image plane sample
+}
+
+bool Sobol_Pixel_Sampler::next_sample_vector()
+{
+    if (current_sample_vector < sample_count) {
+        current_sample_vector++;
+        current_dimension = 1;
+    }
+    return current_sample_vector < sample_count;
+}
+
+Vector2 Sobol_Pixel_Sampler::get_image_plane_sample() const
+{
+    return get_sobol_2d_sample(uint32_t(first_sample_index + current_sample_vector), pixel_seed);
+}
+
+float Sobol_Pixel_Sampler::get_next_1d_sample()
+{
+    uint32_t seed = hash_uint32(pixel_seed ^ (0x9e3779b9u * uint32_t(current_dimension++)));
+    uint32_t index = nested_uniform_scramble(uint32_t(first_sample_index + current_sample_vector), seed);
+    uint32_t x = nested_uniform_scramble(reverse_bits(index), hash_uint32(seed ^ 0x1u));
+    return fixed_point_to_float(x);
+}
+
+Vector2 Sobol_Pixel_Sampler::get_next_2d_sample()
+{
+    uint32_t seed = hash_uint32(pixel_seed ^ (0x9e3779b9u * uint32_t(current_dimension++)));
+    return get_sobol_2d_sample(uint32_t(first_sample_index + current_sample_vector), seed);
+}
+
+void Pixel_Sampler::init(const Stratified_Pixel_Sampler_Configuration* config, RNG* rng, RNG_8x* rng_8x)
+{
+    this->config = config;
+    stratified_sampler.init(config, rng, rng_8x);
+}
+
+void Pixel_Sampler::next_pixel(uint32_t pixel_seed, int first_sample_index)
+{
+    if (is_sobol())
+        sobol_sampler.next_pixel(pixel_seed, first_sample_index, config->get_samples_per_pixel());
+    else
+        stratified_sampler.next_pixel();
+}
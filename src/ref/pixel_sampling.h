@@ -13,12 +13,17 @@
 // The samples from corresponding arrays are well distributed within a single pixel.
 // This is used by the basic direct lighting renderer (and not used by the path tracing).
 
+#include "lib/raytracer_config.h"
 #include "lib/vector.h"
 
 struct RNG;
+struct RNG_8x;
 
 // Data shared between all Stratified_Pixel_Sampler instances.
 struct Stratified_Pixel_Sampler_Configuration {
+    // Pixel_Sampler uses this sampler to generate the sample vectors.
+    Raytracer_Config::Pixel_Sampler_Type sampler_type = Raytracer_Config::Pixel_Sampler_Type::stratified;
+
     int x_pixel_sample_count = 0;
     int y_pixel_sample_count = 0;
     int sample_vector_1d_size = 0;
@@ -27,6 +32,9 @@ struct Stratified_Pixel_Sampler_Configuration {
     void init(int x_pixel_sample_count, int y_pixel_sample_count, int sample_vector_1d_size, int sample_vector_2d_size);
     int get_samples_per_pixel() const { return x_pixel_sample_count * y_pixel_sample_count; }
 
+    // Changes the number of pixel samples. Registered arrays are preserved (array ids do not change).
+    void set_pixel_sample_counts(int x_pixel_sample_count, int y_pixel_sample_count);
+
     //
     // Arrays of samples for basic direct lighting renderer.
     //
@@ -59,21 +67,34 @@ struct Stratified_Pixel_Sampler_Configuration {
 };
 
 // Generates a set of samples for entire pixel.
+//
+// The dimensions of the sample vectors are generated lazily. The first request of the dimension
+// generates it for all sample vectors of the pixel. If none of the paths reaches some bounce
+// (for example, due to russian roulette) then the corresponding dimensions are not generated.
+// All buffers are allocated in init(), next_pixel() does not allocate memory.
 struct Stratified_Pixel_Sampler {
     const Stratified_Pixel_Sampler_Configuration* config = nullptr;
     RNG* rng = nullptr;
+    RNG_8x* rng_8x = nullptr; // if not null then it is used to generate stratified sequences (rng is used for shuffling)
+    int pixel_sample_count = 0;
     int current_sample_vector = 0;
 
     // Generated samples.
     std::vector<Vector2> image_plane_samples;
 
+    // The samples of the same dimension for all sample vectors are stored together:
+    // samples_1d[dimension * pixel_sample_count + sample_vector].
     std::vector<float>  samples_1d;
+    int generated_1d_dimension_count = 0;
     int current_sample_1d = 0;
 
     std::vector<Vector2> samples_2d;
+    int generated_2d_dimension_count = 0;
     int current_sample_2d = 0;
 
-    void init(const Stratified_Pixel_Sampler_Configuration* config, RNG* rng);
+    // 'rng_8x' is optional. When it is null, the sampler reproduces the sample sequences
+    // of the versions that used only scalar RNG.
+    void init(const Stratified_Pixel_Sampler_Configuration* config, RNG* rng, RNG_8x* rng_8x = nullptr);
 
     // Generates samples for the next pixel and makes the first sample vector active.
     void next_pixel();
@@ -92,4 +113,72 @@ struct Stratified_Pixel_Sampler {
     std::vector<float> array1d_samples; // [0..1) samples for all registered 1d arrays for all pixel samples
     const Vector2* get_array2d(int array2d_id) const;
     const float* get_array1d(int array1d_id) const;
+
+    // Scratch buffers for arrays generation.
+    std::vector<Vector2> array2d_stratified_grids;
+    std::vector<float> array1d_stratified_grids;
+
+    void generate_stratified_sequence_1d(float* result);
+    void generate_stratified_sequence_2d(Vector2* result);
+};
+
+// Owen-scrambled Sobol sampler.
+// "Practical Hash-based Owen Scrambling", Brent Burley, 2020: https://jcgt.org/published/0009/04/01/paper.pdf
+//
+// Each dimension of the sample vector (1d or 2d) is a copy of the first two dimensions of the Sobol sequence
+// that is scrambled independently from other dimensions. The sample index is also shuffled per dimension
+// to decorrelate the dimensions. This provides unlimited number of dimensions and any number of samples
+// per pixel. The samples depend only on the sample index, so the pixel can be extended progressively with
+// more samples (for example, when rendering is resumed from the checkpoint).
+struct Sobol_Pixel_Sampler {
+    uint32_t pixel_seed = 0;
+    int first_sample_index = 0;
+    int sample_count = 0;
+    int current_sample_vector = 0;
+    int current_dimension = 0;
+
+    void next_pixel(uint32_t pixel_seed, int first_sample_index, int sample_count);
+    bool next_sample_vector();
+
+    Vector2 get_image_plane_sample() const;
+    float get_next_1d_sample();
+    Vector2 get_next_2d_sample();
+};
+
+// The pixel sampler used by the renderer. It forwards the calls to the sampler selected by config->sampler_type.
+// The arrays of samples are provided only by the stratified sampler.
+struct Pixel_Sampler {
+    const Stratified_Pixel_Sampler_Configuration* config = nullptr;
+    Stratified_Pixel_Sampler stratified_sampler;
+    Sobol_Pixel_Sampler sobol_sampler;
+
+    void init(const Stratified_Pixel_Sampler_Configuration* config, RNG* rng, RNG_8x* rng_8x = nullptr);
+
+    // Generates samples for the next pixel and makes the first sample vector active.
+    // 'pixel_seed' - decorrelates the samples of different pixels (used by the sobol sampler, the stratified sampler uses RNG).
+    // 'first_sample_index' - the number of pixel samples that were rendered previously for this pixel.
+    void next_pixel(uint32_t pixel_seed, int first_sample_index);
+
+    bool is_sobol() const { return config->sampler_type == Raytracer_Config::Pixel_Sampler_Type::sobol; }
+
+    bool next_sample_vector() {
+        return is_sobol() ? sobol_sampler.next_sample_vector() : stratified_sampler.next_sample_vector();
+    }
+    Vector2 get_image_plane_sample() const {
+        return is_sobol() ? sobol_sampler.get_image_plane_sample() : stratified_sampler.get_image_plane_sample();
+    }
+    float get_next_1d_sample() {
+        return is_sobol() ? sobol_sampler.get_next_1d_sample() : stratified_sampler.get_next_1d_sample();
+    }
+    Vector2 get_next_2d_sample() {
+        return is_sobol() ? sobol_sampler.get_next_2d_sample() : stratified_sampler.get_next_2d_sample();
+    }
+    const Vector2* get_array2d(int array2d_id) const {
+        ASSERT(!is_sobol());
+        return stratified_sampler.get_array2d(array2d_id);
+    }
+    const float* get_array1d(int array1d_id) const {
+        ASSERT(!is_sobol());
+        return stratified_sampler.get_array1d(array1d_id);
+    }
 };
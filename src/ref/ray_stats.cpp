@@ -0,0 +1,77 @@
+#include "std.h"
+#include "lib/common.h"
+#include "ray_stats.h"
+
+#if ENABLE_RAY_STATS
+thread_local Ray_Stats* thread_ray_stats = nullptr;
+#endif
+
+static std::mutex accumulated_stats_mutex;
+static Ray_Stats accumulated_stats;
+
+void Ray_Stats::add(const Ray_Stats& other)
+{
+    primary_ray_count += other.primary_ray_count;
+    indirect_ray_count += other.indirect_ray_count;
+    shadow_ray_count += other.shadow_ray_count;
+    traversal_step_count += other.traversal_step_count;
+    triangle_test_count += other.triangle_test_count;
+    alpha_test_count += other.alpha_test_count;
+    for (int i = 0; i < Path_Length_Histogram_Size; i++)
+        path_length_histogram[i] += other.path_length_histogram[i];
+}
+
+void Ray_Stats::add_path_length(int bounce_count)
+{
+    path_length_histogram[std::min(bounce_count, Path_Length_Histogram_Size - 1)]++;
+}
+
+void reset_ray_stats()
+{
+    std::lock_guard<std::mutex> lock(accumulated_stats_mutex);
+    accumulated_stats = Ray_Stats{};
+}
+
+void add_ray_stats(const Ray_Stats& ray_stats)
+{
+    std::lock_guard<std::mutex> lock(accumulated_stats_mutex);
+    accumulated_stats.add(ray_stats);
+}
+
+Ray_Stats get_ray_stats()
+{
+    std::lock_guard<std::mutex> lock(accumulated_stats_mutex);
+    return accumulated_stats;
+}
+
+void print_ray_stats(const Ray_Stats& ray_stats, float render_time)
+{
+    const uint64_t ray_count = ray_stats.get_ray_count();
+    if (ray_count == 0)
+        return;
+
+    const double million = 1e6;
+    printf("Ray stats:\n");
+    printf("  %-*s %.3f M (primary %.3f M, indirect %.3f M, shadow %.3f M)\n", 20, "Rays",
+        ray_count / million, ray_stats.primary_ray_count / million,
+        ray_stats.indirect_ray_count / million, ray_stats.shadow_ray_count / million);
+    if (render_time > 0.f)
+        printf("  %-*s %.3f M/sec\n", 20, "Ray throughput", ray_count / million / render_time);
+    printf("  %-*s %.2f per ray\n", 20, "Traversal steps", double(ray_stats.traversal_step_count) / ray_count);
+    printf("  %-*s %.2f per ray\n", 20, "Triangle tests", double(ray_stats.triangle_test_count) / ray_count);
+    printf("  %-*s %.3f M\n", 20, "Alpha tests", ray_stats.alpha_test_count / million);
+
+    uint64_t path_count = 0;
+    for (uint64_t count : ray_stats.path_length_histogram)
+        path_count += count;
+    if (path_count > 0) {
+        printf("  Path length histogram (bounces: %%):");
+        for (int i = 0; i < Ray_Stats::Path_Length_Histogram_Size; i++) {
+            if (ray_stats.path_length_histogram[i] == 0)
+                continue;
+            const bool last_bin = i == Ray_Stats::Path_Length_Histogram_Size - 1;
+            printf(" %d%s: %.1f", i, last_bin ? "+" : "", 100.0 * ray_stats.path_length_histogram[i] / path_count);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Ray tracing statistics. The counters are collected per thread (Thread_Context::ray_stats)
+// and are merged when the rendering jobs finish. ENABLE_RAY_STATS (lib/common.h) compiles out
+// all the counting code.
+struct Ray_Stats {
+    // The last bin counts the paths with Path_Length_Histogram_Size-1 or more bounces.
+    static constexpr int Path_Length_Histogram_Size = 17;
+
+    uint64_t primary_ray_count = 0;
+    uint64_t indirect_ray_count = 0;
+    uint64_t shadow_ray_count = 0; // light visibility rays
+    uint64_t traversal_step_count = 0; // visited kdtree interior nodes (scene and mesh kdtrees)
+    uint64_t triangle_test_count = 0;
+    uint64_t alpha_test_count = 0; // alpha texture lookups
+    uint64_t path_length_histogram[Path_Length_Histogram_Size] = {};
+
+    void add(const Ray_Stats& other);
+    void add_path_length(int bounce_count);
+    uint64_t get_ray_count() const { return primary_ray_count + indirect_ray_count + shadow_ray_count; }
+};
+
+#if ENABLE_RAY_STATS
+// Stats of the thread that runs the rendering job. Used by the code that does
+// not have access to Thread_Context (kdtree traversal). Null for other threads.
+extern thread_local Ray_Stats* thread_ray_stats;
+
+#define RAY_STATS(expression) if (thread_ray_stats) { thread_ray_stats->expression; }
+#else
+#define RAY_STATS(expression)
+#endif
+
+// The accumulated stats of the rendering jobs since the last reset.
+void reset_ray_stats();
+void add_ray_stats(const Ray_Stats& ray_stats);
+Ray_Stats get_ray_stats();
+
+void print_ray_stats(const Ray_Stats& ray_stats, float render_time);
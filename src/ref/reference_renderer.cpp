@@ -3,13 +3,18 @@
 #include "reference_renderer.h"
 
 #include "camera.h"
+#include "checkpoint.h"
 #include "direct_lighting.h"
 #include "film.h"
+#include "path_guiding.h"
 #include "path_tracing.h"
 #include "scene_context.h"
+#include "scene_load_pipeline.h"
 #include "shading_context.h"
+#include "texture_cache.h"
 #include "thread_context.h"
 
+#include "lib/job_system.h"
 #include "lib/math.h"
 #include "lib/random.h"
 #include "lib/scene_loader.h"
@@ -19,60 +24,11 @@
 
 constexpr int time_category_field_width = 21; // for printf 'width' specifier
 
-static void init_textures(const Scene& scene, Scene_Context& scene_ctx)
-{
-    // Load textures.
-    if (!scene.texture_descriptors.empty()) {
-        std::atomic_int texture_counter{ 0 };
-        scene_ctx.textures.resize(scene.texture_descriptors.size());
-
-        auto load_texture_thread_func = [
-            &scene,
-            &scene_ctx,
-            &texture_counter
-        ]
-        {
-            initialize_fp_state();
-            int index = texture_counter.fetch_add(1);
-            while (index < scene.texture_descriptors.size()) {
-                const Texture_Descriptor& texture_desc = scene.texture_descriptors[index];
-                Image_Texture texture;
-
-                if (!texture_desc.file_name.empty()) {
-                    std::string path = scene.get_resource_absolute_path(texture_desc.file_name);
-                    Image_Texture::Init_Params init_params;
-                    init_params.generate_mips = true;
-                    init_params.decode_srgb = texture_desc.decode_srgb;
-                    init_params.scale = texture_desc.scale;
-                    texture.initialize_from_file(path, init_params);
-                }
-                else if (texture_desc.is_constant_texture) {
-                    texture.initialize_from_constant_value(texture_desc.constant_value);
-                }
-                else {
-                    ASSERT(false);
-                }
-                scene_ctx.textures[index] = std::move(texture);
-                index = texture_counter.fetch_add(1);
-            }
-        };
+// Larger environment maps are downsampled to build the sampling distribution.
+constexpr int environment_importance_map_max_width = 2048;
 
-        // Start loading threads.
-        {
-            int thread_count = std::max(1, (int)std::thread::hardware_concurrency());
-            thread_count = std::min(thread_count, (int)scene.texture_descriptors.size());
-
-            std::vector<std::jthread> threads;
-            threads.reserve(thread_count - 1);
-
-            for (int i = 0; i < thread_count - 1; i++) {
-                threads.push_back(std::jthread(load_texture_thread_func));
-            }
-            load_texture_thread_func();
-        }
-    }
-
-    // Init environment map sampling.
+static void init_environment_light_sampler(const Scene& scene, Scene_Context& scene_ctx)
+{
     if (scene.lights.has_environment_light) {
         const Environment_Light& light = scene.lights.environment_light;
         ASSERT(light.environment_map_index != -1);
@@ -80,7 +36,22 @@ static void init_textures(const Scene& scene, Scene_Context& scene_ctx)
 
         scene_ctx.environment_light_sampler.light = &light;
         scene_ctx.environment_light_sampler.environment_map = &environment_map;
-        scene_ctx.environment_light_sampler.radiance_distribution.initialize_from_latitude_longitude_radiance_map(environment_map);
+
+        Texture_Cache_Access_Scope texture_access;
+        scene_ctx.environment_light_sampler.radiance_distribution.initialize_from_latitude_longitude_radiance_map(
+            environment_map, environment_importance_map_max_width);
+
+        // The average of the coarsest mip level.
+        const int mip_level = environment_map.get_mip_count() - 1;
+        const Vector2i resolution = environment_map.get_mip_resolution(mip_level);
+        ColorRGB radiance_sum;
+        for (int y = 0; y < resolution.y; y++) {
+            for (int x = 0; x < resolution.x; x++) {
+                Vector2 uv = Vector2((x + 0.5f) / resolution.x, (y + 0.5f) / resolution.y);
+                radiance_sum += environment_map.sample_nearest(uv, mip_level, Wrap_Mode::clamp);
+            }
+        }
+        scene_ctx.environment_light_sampler.average_radiance = radiance_sum * light.scale / float(resolution.x * resolution.y);
     }
 }
 
@@ -97,6 +68,7 @@ static void init_pixel_sampler_config(Stratified_Pixel_Sampler_Configuration& pi
         sample_2d_count = std::min(10, rt_config.max_light_bounces) * sample_2d_count_per_bounce;
     }
     pixel_sampler_config.init(rt_config.x_pixel_sample_count, rt_config.y_pixel_sample_count, sample_1d_count, sample_2d_count);
+    pixel_sampler_config.sampler_type = rt_config.get_pixel_sampler_type();
 
     if (rt_config.rendering_algorithm == Raytracer_Config::Rendering_Algorithm::direct_lighting) {
         scene_ctx.array2d_registry.rectangular_light_arrays.reserve(scene_ctx.lights.diffuse_rectangular_lights.size());
@@ -133,202 +105,22 @@ static void init_triangle_mesh_light_samplers(const Scene& scene, Scene_Context&
     if (scene.lights.diffuse_triangle_mesh_lights.empty()) {
         return;
     }
-    std::vector<float> areas;
     scene_ctx.triangle_mesh_light_samplers.reserve(scene.lights.diffuse_triangle_mesh_lights.size());
     for (const auto& light : scene.lights.diffuse_triangle_mesh_lights) {
-        Diffuse_Triangle_Mesh_Light_Sampler& sampler = scene_ctx.triangle_mesh_light_samplers.emplace_back();
-        sampler.light = &light;
-
         const Triangle_Mesh& mesh = scene.geometries.triangle_meshes[light.triangle_mesh_index];
-        sampler.mesh = &mesh;
-        sampler.mesh_area = mesh.get_area();
-
-        const int triangle_count = mesh.get_triangle_count();
-        areas.resize(triangle_count);
-        for (int i = 0; i < triangle_count; i++) {
-            areas[i] = mesh.get_triangle_area(i);
-        }
-        sampler.triangle_distribution.initialize(areas.data(), (int)areas.size());
+        scene_ctx.triangle_mesh_light_samplers.emplace_back().initialize(light, mesh);
     }
 }
 
-static std::string format_tile_index(int tile_index)
-{
-    std::string s = std::to_string(tile_index);
-    s.insert(0, s.length() <= 4 ? 4 - s.length() : 0, '0');
-    return s;
-}
-
-namespace {
-struct Checkpoint_Info {
-    std::string input_filename;
-    int total_tile_count = 0;
-    int samples_per_pixel = 0;
-};
-
-struct Checkpoint_Tile_Data {
-    Film_Tile tile;
-    double tile_variance_accumulator = 0.0;
-};
-
-struct Checkpoint {
-    std::map<int, Checkpoint_Tile_Data> finished_tiles; // tile_index -> tile
-    float previous_sessions_time = 0.f;
-};
-}
-
-Checkpoint start_or_resume_checkpoint(const std::string& checkpoint_directory, const Checkpoint_Info& info)
-{
-    const char* func_name = "start_or_resume_from_checkpoint_directory";
-    fs::path metadata_file_path = fs::path(checkpoint_directory) / "checkpoint";
-
-    // If checkpoint directory does not exist or it is an empty directory then perform
-    // initialization of the checkpoint by creating checkpoint metadata file.
-    if (!fs_exists(checkpoint_directory)) {
-        if (!fs_create_directories(checkpoint_directory))
-            error("%s: failed to create checkpoint directory: %s",
-                func_name, checkpoint_directory.c_str());
-    }
-    if (fs_is_empty(checkpoint_directory)) {
-        std::ofstream metadata_file(metadata_file_path, std::ofstream::out);
-        if (!metadata_file)
-            error("%s: failed to create checkpoint file: %s",
-                func_name, metadata_file_path.string().c_str());
-
-        metadata_file << "input_filename " << info.input_filename << "\n";
-        metadata_file << "total_tile_count " << info.total_tile_count << "\n";
-        metadata_file << "samples_per_pixer " << info.samples_per_pixel << "\n";
-        // default checkpoint object describes that no tiles were finished yet
-        return Checkpoint{};
-    }
-
-    // Check that we have a valid checkpoint and that metadata matches current project settings.
-    if (!fs_exists(metadata_file_path))
-        error("%s: %s is not a checkpoint directory: 'checkpoint' file is missing",
-            func_name, checkpoint_directory.c_str());
-
-    std::ifstream metadata_file(metadata_file_path);
-    if (!metadata_file)
-        error("%s: failed to open checkpoint metadata file: %s",
-            func_name, metadata_file_path.string().c_str());
-
-    auto str_to_int = [](const std::string& s) {
-        int result = 0;
-        auto conv_result = std::from_chars(&*s.begin(), &*s.end(), result);
-        ASSERT(conv_result.ptr == &*s.end());
-        return result;
-    };
-
-    std::string tag_name;
-    std::string stored_input_filename;
-    std::string total_tile_count_str;
-    std::string samples_per_pixel_str;
-
-    metadata_file >> tag_name; metadata_file >> stored_input_filename;
-    metadata_file >> tag_name; metadata_file >> total_tile_count_str;
-    metadata_file >> tag_name; metadata_file >> samples_per_pixel_str;
-
-    if (!metadata_file)
-        error("%s: failed to read all the required fields from the metadata file: %s",
-            func_name, metadata_file_path.string().c_str());
-
-    if (stored_input_filename != info.input_filename)
-        error("%s: can not resume rendering because input_filename is changed.\n"
-            "Checkpoint: %s, current project: %s",
-            func_name, stored_input_filename.c_str(), info.input_filename.c_str());
-
-    int stored_total_tile_count = str_to_int(total_tile_count_str);
-    if (stored_total_tile_count != info.total_tile_count)
-        error("%s: can not resume rendering because total_tile_count is changed.\n"
-            "Checkpoint: %d, current project: %d",
-            func_name, stored_total_tile_count, info.total_tile_count);
-
-    int stored_samples_per_pixel = str_to_int(samples_per_pixel_str);
-    if (stored_samples_per_pixel != info.samples_per_pixel)
-        error("%s: can not resume rendering because samples_per_pixer is changed.\n"
-            "Checkpoint: %d, current project: %d",
-            func_name, stored_samples_per_pixel, info.samples_per_pixel);
-
-    // Scan checkpoint directory for already finished tiles.
-    Checkpoint checkpoint;
-    for (const auto& entry : fs::directory_iterator(checkpoint_directory)) {
-        std::string filename = entry.path().stem().string();
-        if (!filename.starts_with("tile_"))
-            continue;
-
-        int tile_index = str_to_int(filename.substr(5));
-        Checkpoint_Tile_Data& tile_data = checkpoint.finished_tiles[tile_index];
-
-        std::vector<uint8_t> content = read_binary_file(entry.path().string());
-        int offset = 0;
-
-        float time;
-        memcpy(&time, content.data() + offset, sizeof(float));
-        offset += sizeof(float);
-        checkpoint.previous_sessions_time = std::max(checkpoint.previous_sessions_time, time);
-
-        memcpy(&tile_data.tile_variance_accumulator, content.data() + offset, sizeof(double));
-        offset += sizeof(double);
-
-        memcpy(&tile_data.tile.pixel_bounds, content.data() + offset, sizeof(Bounds2i));
-        offset += sizeof(Bounds2i);
-
-        int pixel_count = tile_data.tile.pixel_bounds.area();
-        tile_data.tile.pixels.resize(pixel_count);
-        memcpy(tile_data.tile.pixels.data(), content.data() + offset, pixel_count * sizeof(Film_Pixel));
-    }
-    return checkpoint;
-}
-
-static void write_tile_to_checkpoint_directory(const std::string& checkpoint_directory,
-    const Film_Tile& tile, int tile_index, float current_render_time, double tile_variance_accumulator)
-{
-    const char* func_name = "write_tile_to_checkpoint_directory";
-
-    // The first step, is to write a tile to a temporary file. If the program terminates
-    // during write operation then the checpoint directory will stay in consistent state.
-    fs::path temp_file_path = fs::path(checkpoint_directory) / ("temp_tile_" + format_tile_index(tile_index));
-    std::ofstream temp_file(temp_file_path, std::ofstream::out | std::ofstream::binary);
-    if (!temp_file)
-        error("%s: failed to create file: %s", func_name, temp_file_path.string().c_str());
-
-    // just to check we don't have padded bytes inside the structure and
-    // we can serialize entire structure with a single write.
-    static_assert(sizeof(Bounds2i) == 16);
-    static_assert(sizeof(Film_Pixel) == 16);
-
-    const char* data_ptr;
-
-    data_ptr = reinterpret_cast<const char*>(&current_render_time);
-    temp_file.write(data_ptr, sizeof(float));
-
-    data_ptr = reinterpret_cast<const char*>(&tile_variance_accumulator);
-    temp_file.write(data_ptr, sizeof(double));
-
-    data_ptr = reinterpret_cast<const char*>(&tile.pixel_bounds);
-    temp_file.write(data_ptr, sizeof(Bounds2i));
-
-    data_ptr = reinterpret_cast<const char*>(tile.pixels.data());
-    temp_file.write(data_ptr, tile.pixels.size() * sizeof(Film_Pixel));
-
-    if (temp_file.fail())
-        error("%s: failed to write to file: %s", func_name, temp_file_path.string().c_str());
-    temp_file.close();
-
-    // Rename temporary tile file. The assumption is that std::filesystem::rename is atomic.
-    fs::path file_path = fs::path(checkpoint_directory) / ("tile_" + format_tile_index(tile_index));
-    if (fs_exists(file_path))
-        error("%s: tile file already exists: %s", func_name, file_path.string().c_str());
-    if (!fs_rename(temp_file_path, file_path))
-        error("%s: failed to rename temp file to: %s", func_name, file_path.string().c_str());
-}
-
 struct Rendering_Progress {
     std::mutex progress_update_mutex;
+    int total_tile_count = 0;
     int finished_tile_count = 0;
 };
 
-static Film_Tile render_tile(Thread_Context& thread_ctx, const Film& film, int tile_index,
+// previous_sample_count is the number of pixel samples that were already rendered for this tile
+// (in the previous render sessions). It selects different random sequence for the new samples.
+static Film_Tile render_tile(Thread_Context& thread_ctx, const Film& film, int tile_index, int previous_sample_count,
     double* tile_variance_accumulator, Rendering_Progress* progress)
 {
     const Scene_Context& scene_ctx = thread_ctx.scene_context;
@@ -339,6 +131,10 @@ static Film_Tile render_tile(Thread_Context& thread_ctx, const Film& film, int t
 
     Film_Tile tile(pixel_bounds);
 
+    const bool collect_aovs = film.has_aovs();
+    if (collect_aovs)
+        tile.allocate_aov_pixels(intersect_bounds(sample_bounds, film.render_region));
+
     ASSERT((sample_bounds.p1 <= Vector2i{0xffff + 1, 0xffff + 1}));
     ASSERT((sample_bounds.size() <= Vector2i{0xffff, 0xffff}));
     uint64_t debug_counter = 0; // can be used in conditional breakpoint to get to problematic pixel+sample
@@ -347,10 +143,21 @@ static Film_Tile render_tile(Thread_Context& thread_ctx, const Film& film, int t
         for (int x = sample_bounds.p0.x; x < sample_bounds.p1.x; x++) {
             uint32_t stream_id = ((uint32_t)x & 0xffffu) | ((uint32_t)y << 16);
             stream_id += (uint32_t)scene_ctx.rng_seed_offset;
-            thread_ctx.rng.init(0, stream_id);
-            thread_ctx.pixel_sampler.next_pixel();
+            thread_ctx.rng.init((uint64_t)previous_sample_count, stream_id);
+            if (!scene_ctx.scalar_rng)
+                thread_ctx.rng_8x.init((uint64_t)previous_sample_count, stream_id);
+            thread_ctx.pixel_sampler.next_pixel(stream_id, previous_sample_count);
+
+            // The scope is per pixel (not per tile) to allow the texture cache to release evicted tiles.
+            Texture_Cache_Access_Scope texture_access;
             thread_ctx.shading_context = Shading_Context{};
 
+            // The samples outside of the render region affect the image only through the filter, they have no AOV data.
+            Film_AOV_Pixel* aov_pixel = nullptr;
+            if (collect_aovs && is_inside_bounds(tile.aov_bounds, Vector2i{x, y}))
+                aov_pixel = &tile.get_aov_pixel(Vector2i{x, y});
+            Timestamp pixel_start_timestamp;
+
             // variance estimation
             double luminance_sum = 0.0;
             double luminance_sq_sum = 0.0;
@@ -359,8 +166,17 @@ static Film_Tile render_tile(Thread_Context& thread_ctx, const Film& film, int t
                 thread_ctx.memory_pool.reset();
                 thread_ctx.current_dielectric_material = Null_Material; // TODO: should be part of path context
                 thread_ctx.path_context = Path_Context{};
+                thread_ctx.first_hit_info = First_Hit_Info{};
 
-                Vector2 film_pos = Vector2((float)x, (float)y) + thread_ctx.pixel_sampler.get_image_plane_sample();
+                Vector2 film_pos;
+                float filter_weight = 1.f;
+                if (film.filter_importance_sampling) {
+                    Vector2 offset = film.filter.sample(thread_ctx.pixel_sampler.get_image_plane_sample(), &filter_weight);
+                    film_pos = Vector2(x + 0.5f, y + 0.5f) + offset;
+                }
+                else {
+                    film_pos = Vector2((float)x, (float)y) + thread_ctx.pixel_sampler.get_image_plane_sample();
+                }
 
                 Ray ray = scene_ctx.camera.generate_ray(film_pos);
 
@@ -370,8 +186,11 @@ static Film_Tile render_tile(Thread_Context& thread_ctx, const Film& film, int t
                 // The above differential rays are generated with one pixel offset which means they estimate footprint
                 // of the entire pixel. When we have many samples per pixel then we need to estimate footprint
                 // that corresponds to a single sample (more precisely the area of influence of the sample).
+                // The path guiding training passes use their own sample count, so they do not depend on the final one.
                 {
-                    float scale = 1.f / std::sqrt((float)scene_ctx.pixel_sampler_config.get_samples_per_pixel());
+                    const int spp = thread_ctx.path_guiding_training ? thread_ctx.pixel_sampler.config->get_samples_per_pixel()
+                                                                     : scene_ctx.pixel_sampler_config.get_samples_per_pixel();
+                    float scale = 1.f / std::sqrt((float)spp);
                     differential_rays.dx_ray.direction = ray.direction + (differential_rays.dx_ray.direction - ray.direction) * scale;
                     differential_rays.dx_ray.direction.normalize();
                     differential_rays.dy_ray.direction = ray.direction + (differential_rays.dy_ray.direction - ray.direction) * scale;
@@ -392,7 +211,26 @@ static Film_Tile render_tile(Thread_Context& thread_ctx, const Film& film, int t
                 if (scene_ctx.raytracer_config.film_radiance_scale != 1.f)
                     radiance *= scene_ctx.raytracer_config.film_radiance_scale;
 
-                tile.add_sample(film.filter, film_pos, radiance);
+                if (film.filter_importance_sampling)
+                    tile.add_pixel_sample(Vector2i{x, y}, radiance, filter_weight);
+                else
+                    tile.add_sample(film.filter, film_pos, radiance);
+
+#if ENABLE_RAY_STATS
+                thread_ctx.ray_stats.add_path_length(thread_ctx.path_context.bounce_count);
+#endif
+                if (aov_pixel) {
+                    const First_Hit_Info& first_hit = thread_ctx.first_hit_info;
+                    if (first_hit.hit_found) {
+                        if (aov_pixel->hit_count == 0)
+                            aov_pixel->material = first_hit.material;
+                        aov_pixel->distance_sum += first_hit.distance;
+                        aov_pixel->normal_sum += first_hit.normal;
+                        aov_pixel->hit_count++;
+                    }
+                    aov_pixel->albedo_sum += first_hit.albedo;
+                    aov_pixel->sample_count++;
+                }
 
                 float luminance = radiance.luminance();
                 luminance_sum += luminance;
@@ -406,15 +244,19 @@ static Film_Tile render_tile(Thread_Context& thread_ctx, const Film& film, int t
                 // rounding errors might introduce negative values, strictly mathematically tile_variance can't be negative
                 pixel_variance = std::max(0.0, pixel_variance);
                 *tile_variance_accumulator += pixel_variance;
+                if (aov_pixel)
+                    aov_pixel->variance = (float)pixel_variance;
             }
+            if (aov_pixel)
+                aov_pixel->time = elapsed_seconds(pixel_start_timestamp);
         }
     }
 
     // Update rendering progress.
-    {
+    if (progress) {
         std::lock_guard<std::mutex> lock(progress->progress_update_mutex);
 
-        const int all_tile_count = film.get_tile_count();
+        const int all_tile_count = progress->total_tile_count;
         const int finished_tile_count = ++progress->finished_tile_count;
 
         int previous_percentage = 100 * (finished_tile_count - 1) / all_tile_count;
@@ -434,7 +276,7 @@ static Film_Filter create_film_filter(const Raytracer_Config& cfg)
         return get_box_filter(cfg.pixel_filter_radius);
 
     if (cfg.pixel_filter_type == Raytracer_Config::Pixel_Filter_Type::gaussian)
-        return get_gaussian_filter(cfg.pixel_filter_radius, cfg.pixel_filter_alpha);
+        return get_gaussian_filter(cfg.pixel_filter_radius, cfg.pixel_filter_alpha, cfg.filter_importance_sampling);
 
     if (cfg.pixel_filter_type == Raytracer_Config::Pixel_Filter_Type::triangle)
         return get_triangle_filter(cfg.pixel_filter_radius);
@@ -443,27 +285,64 @@ static Film_Filter create_film_filter(const Raytracer_Config& cfg)
     return Film_Filter{};
 }
 
-static std::vector<int> load_checkpoint(const std::string& checkpoint_directory, const Checkpoint_Info& info,
-    std::vector<Film_Tile>* tiles, std::vector<double>* tile_variance_accumulators, float* previous_sessions_time)
+using Tile_Finished_Func = std::function<void (int tile_index, Film_Tile&& tile)>;
+
+namespace {
+struct Tile_Render_Task {
+    int tile_index = -1;
+
+    // The tile from the checkpoint that has less samples than requested.
+    // The missing samples are rendered and added to this tile.
+    int previous_sample_count = 0;
+    Film_Tile previous_tile;
+    double previous_variance_accumulator = 0.0;
+};
+}
+
+static std::vector<Tile_Render_Task> load_checkpoint(const std::string& checkpoint_directory, const Checkpoint_Info& info,
+    const Film& film, const Tile_Finished_Func& tile_finished, std::vector<double>* tile_variance_accumulators, float* previous_sessions_time)
 {
     Checkpoint checkpoint = start_or_resume_checkpoint(checkpoint_directory, info);
 
-    std::vector<int> tiles_to_render;
-    tiles_to_render.reserve(info.total_tile_count - checkpoint.finished_tiles.size());
+    std::vector<Tile_Render_Task> tiles_to_render;
+    tiles_to_render.reserve(info.total_tile_count);
+    int finished_tile_count = 0;
     for (int tile_index = 0; tile_index < info.total_tile_count; tile_index++) {
         auto it = checkpoint.finished_tiles.find(tile_index);
         if (it == checkpoint.finished_tiles.end()) {
-            tiles_to_render.push_back(tile_index);
+            tiles_to_render.push_back(Tile_Render_Task{ .tile_index = tile_index });
+            continue;
+        }
+        Checkpoint_Tile_Data& tile_data = it->second;
+
+        // Tile layout depends on the pixel filter and on filter importance sampling mode.
+        Bounds2i sample_bounds, pixel_bounds;
+        film.get_tile_bounds(tile_index, sample_bounds, pixel_bounds);
+        if (tile_data.tile.pixel_bounds != pixel_bounds)
+            error("load_checkpoint: can not resume rendering because film tile layout is changed (tile %d)", tile_index);
+
+        if (tile_data.samples_per_pixel > info.samples_per_pixel)
+            error("load_checkpoint: tile %d has more samples per pixel (%d) than requested (%d)",
+                tile_index, tile_data.samples_per_pixel, info.samples_per_pixel);
+
+        if (tile_data.samples_per_pixel < info.samples_per_pixel) {
+            tiles_to_render.push_back(Tile_Render_Task{
+                .tile_index = tile_index,
+                .previous_sample_count = tile_data.samples_per_pixel,
+                .previous_tile = std::move(tile_data.tile),
+                .previous_variance_accumulator = tile_data.tile_variance_accumulator
+            });
         }
         else {
-            (*tiles)[tile_index] = std::move(it->second.tile);
-            (*tile_variance_accumulators)[tile_index] = it->second.tile_variance_accumulator;
+            tile_finished(tile_index, std::move(tile_data.tile));
+            (*tile_variance_accumulators)[tile_index] = tile_data.tile_variance_accumulator;
+            finished_tile_count++;
         }
     }
     *previous_sessions_time = checkpoint.previous_sessions_time;
 
     if (!checkpoint.finished_tiles.empty()) {
-        int checkpoint_progress_percentage = 100 * (int)checkpoint.finished_tiles.size() / info.total_tile_count;
+        int checkpoint_progress_percentage = 100 * finished_tile_count / info.total_tile_count;
         printf("Resuming rendering from checkpoint %s\n", checkpoint_directory.c_str());
         printf("Time spent in previous sessions: %.3f seconds\n", checkpoint.previous_sessions_time);
         printf("Rendering progress: %d%%", checkpoint_progress_percentage);
@@ -476,98 +355,236 @@ static std::vector<int> load_checkpoint(const std::string& checkpoint_directory,
     return tiles_to_render;
 }
 
-Image render_scene(const Scene_Context& scene_ctx, double* variance_estimate, float* render_time)
+// Sampler configuration to render the samples that are missing in the checkpoint tile.
+// The stratified grid of the missing samples is chosen to be as close to a square as possible.
+static Stratified_Pixel_Sampler_Configuration get_missing_samples_sampler_config(
+    const Stratified_Pixel_Sampler_Configuration& config, int previous_sample_count)
+{
+    const int sample_count = config.get_samples_per_pixel() - previous_sample_count;
+    ASSERT(sample_count > 0);
+    int y_count = (int)std::sqrt((double)sample_count);
+    while (sample_count % y_count != 0)
+        y_count--;
+
+    Stratified_Pixel_Sampler_Configuration missing_samples_config = config;
+    missing_samples_config.set_pixel_sample_counts(sample_count / y_count, y_count);
+    return missing_samples_config;
+}
+
+// Adds the samples from the checkpoint tile to the tile with the missing samples.
+static void add_previous_samples(const Tile_Render_Task& task, int new_sample_count,
+    Film_Tile& tile, double* tile_variance_accumulator)
+{
+    ASSERT(tile.pixel_bounds == task.previous_tile.pixel_bounds);
+    for (size_t i = 0; i < tile.pixels.size(); i++) {
+        tile.pixels[i].color_sum += task.previous_tile.pixels[i].color_sum;
+        tile.pixels[i].weight_sum += task.previous_tile.pixels[i].weight_sum;
+    }
+    // The variance of the mean of (n1 + n2) samples computed from the variances of
+    // the means of n1 and n2 samples: (n1^2 * v1 + n2^2 * v2) / (n1 + n2)^2
+    double n1 = task.previous_sample_count;
+    double n2 = new_sample_count;
+    *tile_variance_accumulator = (n1 * n1 * task.previous_variance_accumulator + n2 * n2 * (*tile_variance_accumulator)) / ((n1 + n2) * (n1 + n2));
+}
+
+void Tile_Subset::get_tile_range(int tile_count, int* begin, int* end) const
+{
+    if (shard_count > 0) {
+        ASSERT(shard_index >= 0 && shard_index < shard_count);
+        *begin = int(int64_t(tile_count) * shard_index / shard_count);
+        *end = int(int64_t(tile_count) * (shard_index + 1) / shard_count);
+    }
+    else {
+        *begin = std::min(first_tile, tile_count);
+        *end = (end_tile == -1) ? tile_count : std::min(end_tile, tile_count);
+    }
+}
+
+// Trains the path guiding distributions. Training pass i renders the film with 2^i samples per pixel
+// and the distributions learned during the pass are used for sampling in the next pass. The images
+// of the training passes are discarded.
+static void train_path_guiding(const Scene_Context& scene_ctx, const Film& film, Path_Guiding* path_guiding)
+{
+    const Raytracer_Config& rt_config = scene_ctx.raytracer_config;
+    path_guiding->initialize(scene_ctx.kdtree_data.scene_kdtree.bounds,
+        size_t(rt_config.path_guiding_memory_budget) * 1024 * 1024);
+
+    // AOVs are not collected and the pixels are not allocated.
+    const Film training_film(film.render_region, film.filter, film.filter_importance_sampling, false /*allocate_pixels*/);
+
+    for (int pass = 0; pass < rt_config.path_guiding_training_pass_count; pass++) {
+        Stratified_Pixel_Sampler_Configuration sampler_config = scene_ctx.pixel_sampler_config;
+        sampler_config.set_pixel_sample_counts(1 << ((pass + 1) / 2), 1 << (pass / 2));
+
+        // The training samples do not overlap the samples of the final render and they do not depend
+        // on its sample count, so the training is the same when the checkpoint is resumed with more samples.
+        // The pass i uses the sample indices [2^30 + 2^i, 2^30 + 2^(i+1)).
+        const int previous_sample_count = (1 << 30) + (1 << pass);
+
+        std::atomic_int tile_counter{0};
+        auto training_job_func = [&scene_ctx, &training_film, &sampler_config, &tile_counter,
+            path_guiding, previous_sample_count] (int /*job_index*/)
+        {
+            Thread_Context thread_ctx(scene_ctx);
+            thread_ctx.memory_pool.allocate_pool_memory(1 * 1024 * 1024);
+            thread_ctx.pixel_sampler.init(&sampler_config, &thread_ctx.rng, scene_ctx.scalar_rng ? nullptr : &thread_ctx.rng_8x);
+            thread_ctx.path_guiding = path_guiding;
+            thread_ctx.path_guiding_training = true;
+
+            double tile_variance_accumulator = 0.0;
+            int tile_index = tile_counter.fetch_add(1);
+            while (tile_index < training_film.get_tile_count()) {
+                render_tile(thread_ctx, training_film, tile_index, previous_sample_count, &tile_variance_accumulator, nullptr);
+                tile_index = tile_counter.fetch_add(1);
+            }
+            thread_ctx.memory_pool.deallocate_pool_memory();
+        };
+        parallel_for(std::min(get_job_system_thread_count(), training_film.get_tile_count()), training_job_func);
+
+        path_guiding->finish_training_pass(pass + 1 == rt_config.path_guiding_training_pass_count);
+    }
+    printf("Path guiding: %d training passes, %.1f MB\n", rt_config.path_guiding_training_pass_count,
+        double(path_guiding->get_memory_size()) / (1024.0 * 1024.0));
+}
+
+// Renders the tiles of the film. tile_finished is called for each rendered tile and also for the
+// tiles restored from the checkpoint. It is called concurrently by the rendering jobs.
+static void render_film_tiles(const Scene_Context& scene_ctx, const Film& film, const Tile_Subset& tile_subset,
+    const Tile_Finished_Func& tile_finished, double* variance_estimate, float* render_time)
 {
     Timestamp render_start_timestamp;
+    reset_ray_stats();
 
-    Film film(scene_ctx.render_region, create_film_filter(scene_ctx.raytracer_config));
+    // The training is repeated when the rendering is resumed from the checkpoint. It is deterministic and
+    // does not depend on the final sample count, so the resumed tiles are rendered with the same distributions
+    // also when the checkpoint is resumed with more samples.
+    Path_Guiding path_guiding;
+    const bool use_path_guiding = scene_ctx.raytracer_config.rendering_algorithm == Raytracer_Config::Rendering_Algorithm::path_tracer &&
+        scene_ctx.raytracer_config.path_guiding_training_pass_count > 0;
+    if (use_path_guiding)
+        train_path_guiding(scene_ctx, film, &path_guiding);
 
-    std::vector<Film_Tile> tiles(film.get_tile_count());
     std::vector<double> tile_variance_accumulators(film.get_tile_count(), 0.0);
     float previous_sessions_time = 0.f;
 
-    std::vector<int> tiles_to_render;
+    std::vector<Tile_Render_Task> tiles_to_render;
+    Checkpoint_Journal checkpoint_journal;
     if (!scene_ctx.checkpoint_directory.empty()) {
         Checkpoint_Info info;
         info.input_filename = scene_ctx.input_filename;
         info.total_tile_count = film.get_tile_count();
         info.samples_per_pixel = scene_ctx.pixel_sampler_config.get_samples_per_pixel();
+        info.sample_region_area = film.sample_region.area();
 
         tiles_to_render = load_checkpoint(scene_ctx.checkpoint_directory, info,
-            &tiles, &tile_variance_accumulators, &previous_sessions_time);
+            film, tile_finished, &tile_variance_accumulators, &previous_sessions_time);
+        checkpoint_journal.open(scene_ctx.checkpoint_directory, scene_ctx.checkpoint_compression);
     }
     else {
         tiles_to_render.resize(film.get_tile_count());
         for (int i = 0; i < film.get_tile_count(); i++)
-            tiles_to_render[i] = i;
+            tiles_to_render[i].tile_index = i;
+    }
+
+    int first_tile = 0;
+    int end_tile = film.get_tile_count();
+    if (tile_subset.is_specified()) {
+        ASSERT(!scene_ctx.checkpoint_directory.empty());
+        tile_subset.get_tile_range(film.get_tile_count(), &first_tile, &end_tile);
+        std::erase_if(tiles_to_render, [first_tile, end_tile](const Tile_Render_Task& task) {
+            return task.tile_index < first_tile || task.tile_index >= end_tile;
+        });
+        printf("Rendering tiles %d-%d of %d\n", first_tile, end_tile - 1, film.get_tile_count());
     }
 
     Rendering_Progress progress;
-    progress.finished_tile_count = film.get_tile_count() - (int)tiles_to_render.size();
+    progress.total_tile_count = end_tile - first_tile;
+    progress.finished_tile_count = progress.total_tile_count - (int)tiles_to_render.size();
+
+    // Sampler configurations for the checkpoint tiles that have less samples than requested.
+    std::map<int, Stratified_Pixel_Sampler_Configuration> missing_samples_sampler_configs; // previous_sample_count -> config
+    for (const Tile_Render_Task& task : tiles_to_render) {
+        if (task.previous_sample_count > 0 && !missing_samples_sampler_configs.contains(task.previous_sample_count)) {
+            missing_samples_sampler_configs[task.previous_sample_count] =
+                get_missing_samples_sampler_config(scene_ctx.pixel_sampler_config, task.previous_sample_count);
+        }
+    }
 
     std::atomic_int tile_counter{0};
 
-    // Each rendering thread runs this function.
+    // Each rendering job runs this function.
     // The function runs the loop where it grabs index of the next tile and renders it.
-    auto render_tile_thread_func = [
+    auto render_tiles_job_func = [
             &scene_ctx,
             &tile_counter,
             &tiles_to_render,
-            &tiles,
+            &tile_finished,
+            &checkpoint_journal,
+            &missing_samples_sampler_configs,
             &tile_variance_accumulators,
             &film,
             &progress,
+            &path_guiding,
+            use_path_guiding,
             previous_sessions_time,
             &render_start_timestamp
-    ] {
-        initialize_fp_state();
-
+    ] (int /*job_index*/) {
         Thread_Context thread_ctx(scene_ctx);
+        thread_ctx.collect_first_hit_info = film.has_aovs();
+        if (use_path_guiding)
+            thread_ctx.path_guiding = &path_guiding;
         thread_ctx.memory_pool.allocate_pool_memory(1 * 1024 * 1024);
-        thread_ctx.pixel_sampler.init(&scene_ctx.pixel_sampler_config, &thread_ctx.rng);
+        thread_ctx.pixel_sampler.init(&scene_ctx.pixel_sampler_config, &thread_ctx.rng, scene_ctx.scalar_rng ? nullptr : &thread_ctx.rng_8x);
+#if ENABLE_RAY_STATS
+        thread_ray_stats = &thread_ctx.ray_stats;
+#endif
 
         int index = tile_counter.fetch_add(1);
 
         while (index < tiles_to_render.size()) {
-            int tile_index = tiles_to_render[index];
-            Film_Tile& tile = tiles[tile_index];
+            const Tile_Render_Task& task = tiles_to_render[index];
+            const int tile_index = task.tile_index;
             double& tile_variance_accumulator = tile_variance_accumulators[tile_index];
 
-            tile = render_tile(thread_ctx, film, tile_index, &tile_variance_accumulator, &progress);
+            const Stratified_Pixel_Sampler_Configuration* sampler_config = &scene_ctx.pixel_sampler_config;
+            if (task.previous_sample_count > 0)
+                sampler_config = &missing_samples_sampler_configs.at(task.previous_sample_count);
+            if (thread_ctx.pixel_sampler.config != sampler_config)
+                thread_ctx.pixel_sampler.init(sampler_config, &thread_ctx.rng, scene_ctx.scalar_rng ? nullptr : &thread_ctx.rng_8x);
+
+            Film_Tile tile = render_tile(thread_ctx, film, tile_index, task.previous_sample_count,
+                &tile_variance_accumulator, &progress);
+
+            if (task.previous_sample_count > 0)
+                add_previous_samples(task, sampler_config->get_samples_per_pixel(), tile, &tile_variance_accumulator);
 
             if (!scene_ctx.checkpoint_directory.empty()) {
                 float current_render_time = previous_sessions_time + elapsed_seconds(render_start_timestamp);
-                write_tile_to_checkpoint_directory(scene_ctx.checkpoint_directory, tile, tile_index,
+                checkpoint_journal.write_tile(tile_index, tile, scene_ctx.pixel_sampler_config.get_samples_per_pixel(),
                     current_render_time, tile_variance_accumulator);
             }
+            tile_finished(tile_index, std::move(tile));
+
             index = tile_counter.fetch_add(1);
         }
         thread_ctx.memory_pool.deallocate_pool_memory();
+#if ENABLE_RAY_STATS
+        thread_ray_stats = nullptr;
+        add_ray_stats(thread_ctx.ray_stats);
+#endif
     };
 
     //
-    // Render tiles. The main (this) thread also runs rendering job.
+    // Render tiles. One rendering job per job system thread. The main (this) thread also runs rendering job.
     //
-    const int thread_count = std::min(scene_ctx.thread_count, (int)tiles_to_render.size());
-    if (thread_count > 0) {
-        std::vector<std::jthread> threads;
-        threads.reserve(thread_count - 1);
+    const int job_count = std::min(get_job_system_thread_count(), (int)tiles_to_render.size());
+    parallel_for(job_count, render_tiles_job_func);
 
-        for (int i = 0; i < thread_count - 1; i++)
-            threads.push_back(std::jthread(render_tile_thread_func));
-
-        render_tile_thread_func();
-    }
+    if (!scene_ctx.checkpoint_directory.empty())
+        checkpoint_journal.close();
 
-    //
-    // Merge tiles to create final image.
-    //
-    for (const Film_Tile& tile : tiles)
-        film.merge_tile(tile);
-
-    Image image = film.get_image();
-
-    if (scene_ctx.pixel_sampler_config.get_samples_per_pixel() > 1) {
+    *variance_estimate = 0.0;
+    if (!tile_subset.is_specified() && scene_ctx.pixel_sampler_config.get_samples_per_pixel() > 1) {
         double variance_accumulator = 0.0;
         int64_t variance_count = 0;
         for (int i = 0; i < film.get_tile_count(); i++) {
@@ -580,44 +597,175 @@ Image render_scene(const Scene_Context& scene_ctx, double* variance_estimate, fl
         *variance_estimate = variance_accumulator / variance_count;
     }
     *render_time = previous_sessions_time + elapsed_seconds(render_start_timestamp);
-    return image;
 }
 
-void init_scene_context(Scene_Context& scene_ctx,
-    const Scene& scene,
-    const Reference_Renderer_Config& config,
-    const Scene_Overrides& overrides)
+Image render_scene(const Scene_Context& scene_ctx, double* variance_estimate, float* render_time,
+    const Tile_Subset& tile_subset)
 {
-    scene_ctx.input_filename = scene.path;
-    scene_ctx.checkpoint_directory = config.checkpoint_directory;
-    scene_ctx.thread_count = config.thread_count;
-    scene_ctx.render_region = scene.render_region;
+    const Raytracer_Config& rt_config = scene_ctx.raytracer_config;
+    Film film(scene_ctx.render_region, create_film_filter(rt_config), rt_config.filter_importance_sampling);
+    if (scene_ctx.output_aovs) {
+        // AOVs are not stored in the checkpoint.
+        ASSERT(scene_ctx.checkpoint_directory.empty());
+        film.allocate_aov_pixels();
+    }
+
+    // Non-overlapping tiles can be merged in any order. Otherwise keep the tile
+    // for deterministic merge when all tiles are rendered.
+    std::vector<Film_Tile> tiles(film.get_tile_count());
+    auto tile_finished = [&film, &tiles](int tile_index, Film_Tile&& tile) {
+        if (film.do_tiles_overlap())
+            tiles[tile_index] = std::move(tile);
+        else
+            film.merge_tile(tile);
+    };
+    render_film_tiles(scene_ctx, film, tile_subset, tile_finished, variance_estimate, render_time);
+
+    // The image is produced by merge_checkpoint_directories() when all tiles are rendered.
+    if (tile_subset.is_specified())
+        return Image{};
+
+    //
+    // Merge tiles to create final image. Only overlapping tiles are stored in the tiles array.
+    //
+    for (const Film_Tile& tile : tiles)
+        film.merge_tile(tile);
+
+    return film.get_image();
+}
+
+Image merge_checkpoint_directories(const std::vector<std::string>& checkpoint_directories, EXR_Attributes* attributes)
+{
+    const char* func_name = "merge_checkpoint_directories";
+    ASSERT(!checkpoint_directories.empty());
+
+    Checkpoint_Info info = read_checkpoint_info(checkpoint_directories[0]);
+    std::vector<Film_Tile> tiles(info.total_tile_count);
+    std::vector<double> tile_variance_accumulators(info.total_tile_count, 0.0);
+    std::vector<bool> tile_found(info.total_tile_count, false);
+    float render_time = 0.f;
+
+    for (const std::string& directory : checkpoint_directories) {
+        Checkpoint_Info shard_info = read_checkpoint_info(directory);
+        if (shard_info.input_filename != info.input_filename ||
+            shard_info.total_tile_count != info.total_tile_count ||
+            shard_info.samples_per_pixel != info.samples_per_pixel ||
+            shard_info.sample_region_area != info.sample_region_area)
+        {
+            error("%s: checkpoint %s was rendered with different settings than checkpoint %s",
+                func_name, directory.c_str(), checkpoint_directories[0].c_str());
+        }
+        Checkpoint checkpoint = read_checkpoint_tiles(directory);
+        for (auto& [tile_index, tile_data] : checkpoint.finished_tiles) {
+            if (tile_index >= info.total_tile_count)
+                error("%s: invalid tile index %d in checkpoint %s", func_name, tile_index, directory.c_str());
+            if (tile_found[tile_index])
+                error("%s: tile %d is found in more than one checkpoint", func_name, tile_index);
+            if (tile_data.samples_per_pixel != info.samples_per_pixel)
+                error("%s: tile %d has %d samples per pixel instead of %d, rendering of checkpoint %s is not finished",
+                    func_name, tile_index, tile_data.samples_per_pixel, info.samples_per_pixel, directory.c_str());
+            tile_found[tile_index] = true;
+            tiles[tile_index] = std::move(tile_data.tile);
+            tile_variance_accumulators[tile_index] = tile_data.tile_variance_accumulator;
+        }
+        // The shards are rendered in parallel, the sum of their times is the total time.
+        render_time += checkpoint.previous_sessions_time;
+    }
+    for (int i = 0; i < info.total_tile_count; i++) {
+        if (!tile_found[i])
+            error("%s: tile %d is not rendered", func_name, i);
+    }
+
+    // Tile pixel bounds are clipped by the render region, so they cover exactly the render region.
+    Bounds2i render_region = tiles[0].pixel_bounds;
+    for (const Film_Tile& tile : tiles) {
+        render_region.p0.x = std::min(render_region.p0.x, tile.pixel_bounds.p0.x);
+        render_region.p0.y = std::min(render_region.p0.y, tile.pixel_bounds.p0.y);
+        render_region.p1.x = std::max(render_region.p1.x, tile.pixel_bounds.p1.x);
+        render_region.p1.y = std::max(render_region.p1.y, tile.pixel_bounds.p1.y);
+    }
+
+    // Film filter is not used, the tiles already contain filtered samples.
+    // The tiles are merged in the same order as in render_scene.
+    Film film(render_region, get_box_filter(0.5f), false);
+    for (const Film_Tile& tile : tiles)
+        film.merge_tile(tile);
+
+    double variance_estimate = 0.0;
+    if (info.samples_per_pixel > 1) {
+        double variance_accumulator = 0.0;
+        for (double tile_variance_accumulator : tile_variance_accumulators)
+            variance_accumulator += tile_variance_accumulator;
+        variance_estimate = variance_accumulator / info.sample_region_area;
+    }
+
+    *attributes = EXR_Attributes{
+        .input_file = info.input_filename,
+        .spp = info.samples_per_pixel,
+        .variance = (float)variance_estimate,
+        .render_time = render_time,
+    };
+    return film.get_image();
+}
 
+void set_scene_context_overrides(Scene_Context& scene_ctx, const Scene& scene, const Scene_Overrides& overrides)
+{
+    scene_ctx.render_region = overrides.render_region ? *overrides.render_region : scene.render_region;
     scene_ctx.raytracer_config = overrides.raytracer_config ? *overrides.raytracer_config : scene.raytracer_config;
 
     const Matrix3x4& camera_pose = overrides.camera_pose ? *overrides.camera_pose : scene.view_points[0];
     scene_ctx.camera = Camera(camera_pose, Vector2(scene.film_resolution), scene.camera_fov_y, scene.z_is_up);
 
-    // Textures should be initialized before kdtrees,
-    // kdtrees might store texture references for transparency testing
-    Timestamp t_textures;
-    init_textures(scene, scene_ctx);
-    printf("%-*s %.3f seconds\n", time_category_field_width, "Initialize textures", elapsed_seconds(t_textures));
+    // Sampler configuration depends on raytracer config and on the lights.
+    scene_ctx.pixel_sampler_config = Stratified_Pixel_Sampler_Configuration{};
+    scene_ctx.array2d_registry = Array2D_Registry{};
+    init_pixel_sampler_config(scene_ctx.pixel_sampler_config, scene_ctx);
+}
+
+void init_scene_context(Scene_Context& scene_ctx,
+    const Scene& scene,
+    const Reference_Renderer_Config& config,
+    const Scene_Overrides& overrides,
+    Scene_Load_Pipeline* load_pipeline)
+{
+    scene_ctx.input_filename = scene.path;
+    scene_ctx.checkpoint_directory = config.checkpoint_directory;
+    scene_ctx.checkpoint_compression = config.checkpoint_compression;
+    scene_ctx.output_aovs = config.output_aovs;
+
+    initialize_job_system(config.thread_count);
+    initialize_texture_cache(config.texture_cache_size);
+
+    // If the scene was loaded without the pipeline then start texture and
+    // kdtree initialization now.
+    Scene_Load_Pipeline local_load_pipeline;
+    if (!load_pipeline) {
+        local_load_pipeline.rebuild_kdtree_cache = config.rebuild_kdtree_cache;
+        local_load_pipeline.add_scene_resources(scene);
+        load_pipeline = &local_load_pipeline;
+    }
+    load_pipeline->finish(scene, scene_ctx);
+    init_environment_light_sampler(scene, scene_ctx);
 
-    scene_ctx.kdtree_data.initialize(scene, scene_ctx.textures, config.rebuild_kdtree_cache);
     scene_ctx.materials = scene.materials;
     scene_ctx.material_parameters = scene.material_parameters;
     scene_ctx.lights = scene.lights;
 
-    init_pixel_sampler_config(scene_ctx.pixel_sampler_config, scene_ctx);
+    set_scene_context_overrides(scene_ctx, scene, overrides);
     init_triangle_mesh_light_samplers(scene, scene_ctx);
 
+    // Light selection structures are initialized even if they are not used by the current
+    // raytracer config, since light selection can be changed by the scene overrides.
+    scene_ctx.light_power_distribution.initialize(scene_ctx);
+    scene_ctx.light_tree.build(scene_ctx);
+
     if (scene.type == Scene_Type::pbrt) {
         // TODO: we might need to distinguish between pbrt3/4.
         scene_ctx.pbrt3_scene = true;
     }
     scene_ctx.pbrt_compatibility = config.pbrt_compatibility;
     scene_ctx.rng_seed_offset = config.rng_seed_offset;
+    scene_ctx.scalar_rng = config.scalar_rng;
 }
 
 struct EXR_Attributes_Writer {
@@ -643,6 +791,14 @@ struct EXR_Attributes_Writer {
             fprintf(dump_file, "%s %d\n", name, value);
         }
     }
+    void add_double_attribute(const char* name, double value, bool add_to_image = true) {
+        if (add_to_image) {
+            add_attribute(name, "double", &value, sizeof(double));
+        }
+        if (dump_file) {
+            fprintf(dump_file, "%s %.0f\n", name, value);
+        }
+    }
     void add_float_attribute(const char* name, float value, bool add_to_image = true) {
         if (add_to_image) {
             add_attribute(name, "float", &value, sizeof(float));
@@ -670,17 +826,10 @@ private:
     }
 };
 
-bool write_openexr_image(const std::string& filename, const Image& image, const EXR_Write_Params& write_params)
+static void add_openexr_attributes(EXR_Attributes_Writer& attrib_writer, const EXR_Write_Params& write_params)
 {
-    EXR_Attributes_Writer attrib_writer;
-    if (write_params.dump_attributes) {
-        std::string dumpfile = fs::path(filename).replace_extension(".txt").string();
-        attrib_writer.dump_file = fopen(dumpfile.c_str(), "w");
-    }
-
     const EXR_Attributes& attribs = write_params.attributes;
 
-    // Add attributes.
     attrib_writer.add_string_attribute("yar_build_version", "0.0");
     attrib_writer.add_integer_attribute("yar_build_asserts", ENABLE_ASSERT);
     attrib_writer.add_string_attribute("yar_render_device", "cpu");
@@ -695,11 +844,89 @@ bool write_openexr_image(const std::string& filename, const Image& image, const
     attrib_writer.add_float_attribute("yar_load_time", attribs.load_time, write_params.enable_varying_attributes);
     attrib_writer.add_float_attribute("yar_render_time", attribs.render_time, write_params.enable_varying_attributes);
 
+    // The counters do not depend on the thread count, but they change when the kdtree or sampling changes.
+    if (attribs.ray_stats) {
+        const Ray_Stats& stats = *attribs.ray_stats;
+        attrib_writer.add_double_attribute("yar_primary_rays", (double)stats.primary_ray_count);
+        attrib_writer.add_double_attribute("yar_indirect_rays", (double)stats.indirect_ray_count);
+        attrib_writer.add_double_attribute("yar_shadow_rays", (double)stats.shadow_ray_count);
+        attrib_writer.add_double_attribute("yar_traversal_steps", (double)stats.traversal_step_count);
+        attrib_writer.add_double_attribute("yar_triangle_tests", (double)stats.triangle_test_count);
+        attrib_writer.add_double_attribute("yar_alpha_tests", (double)stats.alpha_test_count);
+
+        std::string histogram;
+        for (uint64_t count : stats.path_length_histogram)
+            histogram += (histogram.empty() ? "" : " ") + std::to_string(count);
+        attrib_writer.add_string_attribute("yar_path_length_histogram", histogram.c_str());
+    }
+}
+
+static void dump_openexr_attributes(const std::string& filename, const EXR_Write_Params& write_params)
+{
+    std::string dumpfile = fs::path(filename).replace_extension(".txt").string();
+    EXR_Attributes_Writer attrib_writer;
+    attrib_writer.dump_file = fopen(dumpfile.c_str(), "w");
     if (attrib_writer.dump_file) {
+        add_openexr_attributes(attrib_writer, write_params);
         fclose(attrib_writer.dump_file);
         attrib_writer.dump_file = nullptr;
     }
+}
+
+bool write_openexr_image(const std::string& filename, const Image& image, const EXR_Write_Params& write_params)
+{
+    if (write_params.dump_attributes) {
+        dump_openexr_attributes(filename, write_params);
+    }
+    EXR_Attributes_Writer attrib_writer;
+    add_openexr_attributes(attrib_writer, write_params);
 
     // Write file to disk.
     return image.write_exr(filename, write_params.enable_compression, attrib_writer.attributes);
 }
+
+bool render_scene_to_openexr_file(const Scene_Context& scene_ctx, const std::string& filename,
+    const EXR_Write_Params& write_params, bool flip_horizontally, double* variance_estimate, float* render_time)
+{
+    const Raytracer_Config& rt_config = scene_ctx.raytracer_config;
+    const Film film(scene_ctx.render_region, create_film_filter(rt_config), rt_config.filter_importance_sampling,
+        false /*allocate_pixels*/);
+
+    // Variance and render time are not known until the rendering is finished.
+    // Their values are updated in the file header when all rows are written.
+    EXR_Attributes_Writer attrib_writer;
+    add_openexr_attributes(attrib_writer, write_params);
+
+    EXR_Scanline_Writer exr_writer;
+    if (!exr_writer.open(filename, film.render_region.size().x, film.render_region.size().y,
+        write_params.enable_compression, attrib_writer.attributes))
+    {
+        return false;
+    }
+
+    bool write_failed = false;
+    auto write_rows = [&exr_writer, &write_failed](const ColorRGB* pixels, int row_count) {
+        write_failed |= !exr_writer.write_rows(pixels, row_count);
+    };
+    Film_Row_Streamer streamer(film, write_rows, flip_horizontally);
+    auto tile_finished = [&streamer](int tile_index, Film_Tile&& tile) {
+        streamer.add_tile(tile_index, std::move(tile));
+    };
+    render_film_tiles(scene_ctx, film, Tile_Subset{}, tile_finished, variance_estimate, render_time);
+    ASSERT(streamer.are_all_rows_written());
+
+    float variance = (float)*variance_estimate;
+    write_failed |= !exr_writer.update_attribute("yar_variance", &variance, sizeof(float));
+    if (write_params.enable_varying_attributes) {
+        write_failed |= !exr_writer.update_attribute("yar_render_time", render_time, sizeof(float));
+    }
+    write_failed |= !exr_writer.close();
+
+    if (write_params.dump_attributes) {
+        EXR_Write_Params final_params = write_params;
+        final_params.attributes.variance = variance;
+        final_params.attributes.render_time = *render_time;
+        dump_openexr_attributes(filename, final_params);
+    }
+    return !write_failed;
+}
@@ -1,22 +1,34 @@
 #pragma once
 
+#include "ray_stats.h"
+
+#include "lib/bounding_box.h"
 #include "lib/image.h"
 #include "lib/matrix.h"
 #include "lib/raytracer_config.h"
 
 struct Scene;
 struct Scene_Context;
+struct Scene_Load_Pipeline;
 
 struct Reference_Renderer_Config
 {
     int thread_count = 0;
     std::string checkpoint_directory;
+    bool checkpoint_compression = false; // compress film tiles stored in the checkpoint
     bool rebuild_kdtree_cache = false;
+    uint64_t texture_cache_size = 0; // in bytes, 0 means unlimited
+
+    // Write depth, normal, albedo, sample count, variance and time per pixel as additional image channels.
+    bool output_aovs = false;
 
     // Can be useful during debugging to vary random numbers and get configuration that
     // reproduces desired behavior.
     int rng_seed_offset = 0;
 
+    // Use only scalar RNG to generate pixel samples (reproduces the images of the previous versions).
+    bool scalar_rng = false;
+
     bool pbrt_compatibility = false;
 };
 
@@ -24,6 +36,7 @@ struct Scene_Overrides
 {
     std::optional<Raytracer_Config> raytracer_config;
     std::optional<Matrix3x4> camera_pose;
+    std::optional<Bounds2i> render_region;
 };
 
 struct EXR_Attributes
@@ -35,6 +48,26 @@ struct EXR_Attributes
     // The attributes that might vary between render sessions.
     float load_time = 0.f;
     float render_time = 0.f;
+
+    // Written when ray stats are enabled (ENABLE_RAY_STATS). Not available in streaming mode.
+    std::optional<Ray_Stats> ray_stats;
+};
+
+// Distributed rendering: each process renders a subset of the film tiles into its own checkpoint
+// directory, then merge_checkpoint_directories() combines the directories into the final image.
+struct Tile_Subset
+{
+    // Range of tile indices [first_tile, end_tile). -1 for end_tile means the last tile.
+    int first_tile = 0;
+    int end_tile = -1;
+
+    // Alternatively, the tiles are split into shard_count contiguous ranges and
+    // the range with shard_index index is rendered.
+    int shard_index = 0;
+    int shard_count = 0;
+
+    bool is_specified() const { return first_tile != 0 || end_tile != -1 || shard_count > 0; }
+    void get_tile_range(int tile_count, int* begin, int* end) const;
 };
 
 struct EXR_Write_Params
@@ -49,8 +82,30 @@ void init_scene_context(
     Scene_Context& scene_ctx,
     const Scene& scene,
     const Reference_Renderer_Config& config,
-    const Scene_Overrides& overrides = {}
+    const Scene_Overrides& overrides = {},
+    // Pipeline that was used to load the scene. If it's null then scene resources
+    // initialization starts only when this function is called.
+    Scene_Load_Pipeline* load_pipeline = nullptr
 );
 
-Image render_scene(const Scene_Context& scene_ctx, double* variance_estimate, float* render_time);
+// Updates the parts of initialized scene context that depend on the overrides.
+// It allows to render the scene with different settings without reinitialization of scene resources.
+void set_scene_context_overrides(Scene_Context& scene_ctx, const Scene& scene, const Scene_Overrides& overrides);
+
+// If the tile subset is specified then only these tiles are rendered to the checkpoint
+// directory and the function returns an empty image.
+Image render_scene(const Scene_Context& scene_ctx, double* variance_estimate, float* render_time,
+    const Tile_Subset& tile_subset = {});
+
+// Renders the scene and writes the image rows to the OpenEXR file as soon as all film tiles
+// that affect them are finished. The full film is not kept in memory, only the tiles that
+// are not written yet, so peak memory is bounded by the window of tiles being rendered.
+bool render_scene_to_openexr_file(const Scene_Context& scene_ctx, const std::string& filename,
+    const EXR_Write_Params& write_params, bool flip_horizontally, double* variance_estimate, float* render_time);
+
+// Merges the tiles from the checkpoint directories produced by distributed rendering.
+// Each tile must be present in exactly one directory. The result is the same image
+// that is produced by a single process rendering.
+Image merge_checkpoint_directories(const std::vector<std::string>& checkpoint_directories, EXR_Attributes* attributes);
+
 bool write_openexr_image(const std::string& filename, const Image& image, const EXR_Write_Params& write_params);
@@ -0,0 +1,154 @@
+#include "std.h"
+#include "lib/common.h"
+#include "render_profile.h"
+
+#include "lib/bounding_box.h"
+#include "lib/material.h"
+
+constexpr int Profile_Tile_Size = 64;
+
+static const char* get_material_type_name(int material_type)
+{
+    static const char* names[Material_Type_Count] = {
+        "perfect_reflector",
+        "perfect_refractor",
+        "diffuse",
+        "diffuse_transmission",
+        "metal",
+        "plastic",
+        "coated_diffuse",
+        "glass",
+        "mix",
+        "pbrt3_uber",
+        "pbrt3_translucent",
+        "pbrt3_fourier",
+    };
+    if (material_type < 0 || material_type >= Material_Type_Count)
+        return "no material";
+    return names[material_type];
+}
+
+static const Image_Channel& get_profile_channel(const Image& image, const char* name)
+{
+    const Image_Channel* channel = image.find_extra_channel(name);
+    if (!channel)
+        error("render profile: image does not have %s channel, AOVs should be enabled", name);
+    return *channel;
+}
+
+void print_render_time_profile(const Image& image, int max_entry_count)
+{
+    const Image_Channel& time = get_profile_channel(image, "time");
+    const Image_Channel& material_type = get_profile_channel(image, "material.type");
+    const Image_Channel& material_index = get_profile_channel(image, "material.index");
+
+    double total_time = 0.0;
+    for (float t : time.data)
+        total_time += t;
+    if (total_time == 0.0)
+        return;
+
+    //
+    // Tiles.
+    //
+    struct Tile_Time {
+        Bounds2i bounds;
+        double time = 0.0;
+    };
+    const int x_tile_count = (image.width + Profile_Tile_Size - 1) / Profile_Tile_Size;
+    const int y_tile_count = (image.height + Profile_Tile_Size - 1) / Profile_Tile_Size;
+    std::vector<Tile_Time> tiles(x_tile_count * y_tile_count);
+    for (int tile_y = 0; tile_y < y_tile_count; tile_y++) {
+        for (int tile_x = 0; tile_x < x_tile_count; tile_x++) {
+            Tile_Time& tile = tiles[tile_y * x_tile_count + tile_x];
+            tile.bounds.p0 = Vector2i{ tile_x * Profile_Tile_Size, tile_y * Profile_Tile_Size };
+            tile.bounds.p1.x = std::min(tile.bounds.p0.x + Profile_Tile_Size, image.width);
+            tile.bounds.p1.y = std::min(tile.bounds.p0.y + Profile_Tile_Size, image.height);
+        }
+    }
+    for (int y = 0; y < image.height; y++) {
+        for (int x = 0; x < image.width; x++) {
+            int tile_index = (y / Profile_Tile_Size) * x_tile_count + x / Profile_Tile_Size;
+            tiles[tile_index].time += time.data[y * image.width + x];
+        }
+    }
+    std::sort(tiles.begin(), tiles.end(), [](const Tile_Time& a, const Tile_Time& b) { return a.time > b.time; });
+
+    printf("Most expensive tiles (%dx%d pixels, image coordinates):\n", Profile_Tile_Size, Profile_Tile_Size);
+    for (int i = 0; i < std::min(max_entry_count, (int)tiles.size()); i++) {
+        const Tile_Time& tile = tiles[i];
+        printf("  [%4d, %4d] - [%4d, %4d] %10.3f ms %6.2f%%\n",
+            tile.bounds.p0.x, tile.bounds.p0.y, tile.bounds.p1.x, tile.bounds.p1.y,
+            tile.time * 1000.0, 100.0 * tile.time / total_time);
+    }
+
+    //
+    // Materials.
+    //
+    struct Material_Time {
+        int type = -1;
+        int index = -1;
+        double time = 0.0;
+        int pixel_count = 0;
+    };
+    std::map<std::pair<int, int>, Material_Time> material_times;
+    for (size_t i = 0; i < time.data.size(); i++) {
+        int type = (int)material_type.data[i];
+        int index = (int)material_index.data[i];
+        Material_Time& material_time = material_times[{type, index}];
+        material_time.type = type;
+        material_time.index = index;
+        material_time.time += time.data[i];
+        material_time.pixel_count++;
+    }
+    std::vector<Material_Time> materials;
+    materials.reserve(material_times.size());
+    for (const auto& [key, material_time] : material_times)
+        materials.push_back(material_time);
+    std::sort(materials.begin(), materials.end(), [](const Material_Time& a, const Material_Time& b) { return a.time > b.time; });
+
+    printf("Most expensive materials (pixel time is attributed to the first hit material):\n");
+    for (int i = 0; i < std::min(max_entry_count, (int)materials.size()); i++) {
+        const Material_Time& material = materials[i];
+        std::string name = get_material_type_name(material.type);
+        if (material.index >= 0)
+            name += " #" + std::to_string(material.index);
+        printf("  %-28s %10.3f ms %6.2f%% %8d pixels %10.3f us/pixel\n", name.c_str(),
+            material.time * 1000.0, 100.0 * material.time / total_time, material.pixel_count,
+            material.time * 1e6 / material.pixel_count);
+    }
+}
+
+// Piecewise linear blue-cyan-green-yellow-red color map, t is in [0, 1] range.
+static ColorRGB get_heatmap_color(float t)
+{
+    static const ColorRGB colors[5] = {
+        ColorRGB(0.f, 0.f, 1.f),
+        ColorRGB(0.f, 1.f, 1.f),
+        ColorRGB(0.f, 1.f, 0.f),
+        ColorRGB(1.f, 1.f, 0.f),
+        ColorRGB(1.f, 0.f, 0.f),
+    };
+    float x = std::clamp(t, 0.f, 1.f) * 4.f;
+    int i = std::min((int)x, 3);
+    float k = x - float(i);
+    return colors[i] * (1.f - k) + colors[i + 1] * k;
+}
+
+Image create_time_heatmap(const Image& image)
+{
+    const Image_Channel& time = get_profile_channel(image, "time");
+
+    std::vector<float> sorted_time = time.data;
+    std::sort(sorted_time.begin(), sorted_time.end());
+    float max_time = sorted_time.empty() ? 0.f : sorted_time[(sorted_time.size() - 1) * 99 / 100];
+    if (max_time == 0.f)
+        max_time = 1.f;
+
+    Image heatmap(image.width, image.height);
+    for (size_t i = 0; i < time.data.size(); i++)
+        heatmap.data[i] = get_heatmap_color(time.data[i] / max_time);
+
+    heatmap.extra_channels.push_back(time);
+    return heatmap;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "lib/image.h"
+
+// Render time profiling based on the AOV channels of the rendered image ("time" and "material.*").
+// The pixel time includes all the samples of the pixel, the pixel time is attributed to the
+// material of the first hit. The times are thread times, their sum is larger than the render
+// time when multiple threads are used.
+
+// Prints the most expensive image tiles and the materials that take the most rendering time.
+void print_render_time_profile(const Image& image, int max_entry_count = 10);
+
+// Returns false color visualization of per-pixel rendering time (blue - fast, red - slow).
+// The colors are normalized by the 99th percentile of the pixel time to reduce the influence
+// of the outliers. The exact time values are stored in the "time" channel of the heatmap image.
+Image create_time_heatmap(const Image& image);
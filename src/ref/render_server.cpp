@@ -0,0 +1,347 @@
+#include "std.h"
+#include "lib/common.h"
+#include "render_server.h"
+
+#include "reference_renderer.h"
+#include "scene_context.h"
+#include "scene_load_pipeline.h"
+
+#include "lib/scene.h"
+#include "lib/scene_loader.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+using Socket = SOCKET;
+static const Socket Invalid_Socket = INVALID_SOCKET;
+static void close_socket(Socket s) { closesocket(s); }
+#else
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+using Socket = int;
+static const Socket Invalid_Socket = -1;
+static void close_socket(Socket s) { close(s); }
+#endif
+
+namespace {
+struct Render_Job {
+    std::string scene_path;
+    std::string output_path;
+    int samples_per_pixel = 0;
+    std::optional<Bounds2i> render_region;
+    std::optional<Matrix3x4> camera_pose;
+};
+
+// The scene and its context are kept together because scene context references scene data.
+struct Resident_Scene {
+    Scene scene;
+    Scene_Context scene_ctx;
+    uint64_t last_job_index = 0; // used to unload the least recently used scene
+};
+}
+
+// The client that does not send the complete request during this time is disconnected,
+// so it can't block the server.
+constexpr int request_receive_timeout_seconds = 10;
+
+// When this limit is reached the least recently used scene is unloaded before loading a new one.
+constexpr size_t max_resident_scene_count = 4;
+
+static void set_receive_timeout(Socket connection, int seconds)
+{
+#ifdef _WIN32
+    DWORD timeout = DWORD(seconds) * 1000;
+#else
+    timeval timeout{};
+    timeout.tv_sec = seconds;
+#endif
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+
+// The request is read until the empty line or until the client closes its side of the connection.
+// Returns false if the receive timeout expires or the connection fails.
+static bool read_request(Socket connection, std::string* request)
+{
+    char buffer[4096];
+    while (request->find("\n\n") == std::string::npos) {
+        int n = (int)recv(connection, buffer, sizeof(buffer), 0);
+        if (n == 0)
+            break;
+        if (n < 0)
+            return false;
+        for (int i = 0; i < n; i++) {
+            if (buffer[i] != '\r')
+                request->push_back(buffer[i]);
+        }
+    }
+    return true;
+}
+
+static void send_reply(Socket connection, const std::string& reply)
+{
+    std::string line = reply + "\n";
+    size_t offset = 0;
+    while (offset < line.size()) {
+        int n = (int)send(connection, line.data() + offset, (int)(line.size() - offset), 0);
+        if (n <= 0)
+            break;
+        offset += n;
+    }
+}
+
+static bool parse_request(const std::string& request, Render_Job* job, std::string* error_message)
+{
+    std::istringstream request_stream(request);
+    std::string line;
+    while (std::getline(request_stream, line)) {
+        if (line.empty())
+            break;
+
+        std::istringstream line_stream(line);
+        std::string key;
+        line_stream >> key;
+
+        if (key == "scene" || key == "output") {
+            std::string path;
+            std::getline(line_stream >> std::ws, path);
+            (key == "scene" ? job->scene_path : job->output_path) = path;
+        }
+        else if (key == "spp") {
+            line_stream >> job->samples_per_pixel;
+            if (job->samples_per_pixel <= 0) {
+                *error_message = "spp should be a positive integer";
+                return false;
+            }
+        }
+        else if (key == "region") {
+            int x, y, w, h;
+            line_stream >> x >> y >> w >> h;
+            if (!line_stream || w <= 0 || h <= 0) {
+                *error_message = "region should be specified as: x y width height";
+                return false;
+            }
+            job->render_region = Bounds2i{ {x, y}, {x + w, y + h} };
+        }
+        else if (key == "camera") {
+            Matrix3x4 camera_pose;
+            for (int i = 0; i < 3; i++) {
+                for (int k = 0; k < 4; k++)
+                    line_stream >> camera_pose.a[i][k];
+            }
+            if (!line_stream) {
+                *error_message = "camera should be specified as 12 numbers (3x4 matrix, row-major)";
+                return false;
+            }
+            job->camera_pose = camera_pose;
+        }
+        else {
+            *error_message = "unknown request key: " + key;
+            return false;
+        }
+        if (line_stream.fail()) {
+            *error_message = "failed to parse line: " + line;
+            return false;
+        }
+    }
+    if (job->scene_path.empty() || job->output_path.empty()) {
+        *error_message = "scene and output should be specified";
+        return false;
+    }
+    return true;
+}
+
+// Returns nullptr if the scene can't be loaded, the server continues to run in this case.
+//
+// The scene is parsed without the load pipeline callbacks, so the parsing errors are reported
+// before any pipeline job references the scene data. The errors reported later by the pipeline
+// jobs or by the rendering still terminate the server.
+static std::unique_ptr<Resident_Scene> load_resident_scene(const std::string& scene_path,
+    const Reference_Renderer_Config& config, const Scene_Overrides_Func& apply_scene_overrides,
+    std::string* error_message)
+{
+    auto resident_scene = std::make_unique<Resident_Scene>();
+    try {
+        Error_Exception_Scope error_exception_scope;
+        resident_scene->scene = load_scene(scene_path);
+    }
+    catch (const Error_Exception& e) {
+        *error_message = e.message;
+        while (!error_message->empty() && error_message->back() == '\n')
+            error_message->pop_back();
+        return nullptr;
+    }
+    Scene& scene = resident_scene->scene;
+
+    // The image textures are loaded on first access during rendering.
+    for (const Texture_Descriptor& texture_desc : scene.texture_descriptors) {
+        if (!texture_desc.file_name.empty() && !fs_exists(scene.get_resource_absolute_path(texture_desc.file_name))) {
+            *error_message = "texture file does not exist: " + texture_desc.file_name;
+            return nullptr;
+        }
+    }
+
+    apply_scene_overrides(scene);
+
+    Scene_Load_Pipeline load_pipeline;
+    load_pipeline.rebuild_kdtree_cache = config.rebuild_kdtree_cache;
+    load_pipeline.add_scene_resources(scene);
+    init_scene_context(resident_scene->scene_ctx, scene, config, {}, &load_pipeline);
+    return resident_scene;
+}
+
+static void unload_least_recently_used_scene(std::map<std::string, std::unique_ptr<Resident_Scene>>& resident_scenes)
+{
+    auto lru = std::min_element(resident_scenes.begin(), resident_scenes.end(),
+        [](const auto& a, const auto& b) { return a.second->last_job_index < b.second->last_job_index; });
+    printf("Unloading: %s\n", lru->first.c_str());
+    resident_scenes.erase(lru);
+}
+
+static std::string run_render_job(const Render_Job& job, uint64_t job_index, const Reference_Renderer_Config& config,
+    const Scene_Overrides_Func& apply_scene_overrides, std::map<std::string, std::unique_ptr<Resident_Scene>>& resident_scenes)
+{
+    const std::string scene_key = fs::absolute(job.scene_path).lexically_normal().string();
+    if (!resident_scenes.contains(scene_key) && !fs_exists(job.scene_path))
+        return "error scene file does not exist: " + job.scene_path;
+
+    Timestamp t_load;
+    Resident_Scene* resident_scene = nullptr;
+    auto it = resident_scenes.find(scene_key);
+    if (it != resident_scenes.end()) {
+        resident_scene = it->second.get();
+        printf("Reusing loaded scene: %s\n", scene_key.c_str());
+    }
+    else {
+        if (resident_scenes.size() >= max_resident_scene_count)
+            unload_least_recently_used_scene(resident_scenes);
+
+        printf("Loading: %s\n", scene_key.c_str());
+        std::string error_message;
+        std::unique_ptr<Resident_Scene> loaded_scene = load_resident_scene(job.scene_path, config, apply_scene_overrides, &error_message);
+        if (!loaded_scene)
+            return "error failed to load scene: " + error_message;
+        resident_scene = loaded_scene.get();
+        resident_scenes[scene_key] = std::move(loaded_scene);
+    }
+    resident_scene->last_job_index = job_index;
+    const Scene& scene = resident_scene->scene;
+
+    Scene_Overrides overrides;
+    overrides.camera_pose = job.camera_pose;
+    overrides.render_region = job.render_region;
+    overrides.raytracer_config = scene.raytracer_config;
+
+    if (job.samples_per_pixel > 0)
+        overrides.raytracer_config->set_samples_per_pixel(job.samples_per_pixel);
+    if (job.render_region) {
+        const Bounds2i film_bounds{ {0, 0}, scene.film_resolution };
+        if (intersect_bounds(*job.render_region, film_bounds) != *job.render_region)
+            return "error render region is outside of the film";
+    }
+    set_scene_context_overrides(resident_scene->scene_ctx, scene, overrides);
+    float load_time = elapsed_seconds(t_load);
+
+    double variance_estimate = 0.0;
+    float render_time = 0.f;
+    Image image = render_scene(resident_scene->scene_ctx, &variance_estimate, &render_time);
+
+    EXR_Write_Params write_params;
+    write_params.attributes = EXR_Attributes {
+        .input_file = job.scene_path,
+        .spp = resident_scene->scene_ctx.pixel_sampler_config.get_samples_per_pixel(),
+        .variance = (float)variance_estimate,
+        .load_time = load_time,
+        .render_time = render_time,
+    };
+#if ENABLE_RAY_STATS
+    write_params.attributes.ray_stats = get_ray_stats();
+#endif
+    if (!write_openexr_image(job.output_path, image, write_params))
+        return "error failed to save rendered image: " + job.output_path;
+
+    printf("Saved output image to %s (render time %.3f seconds)\n\n", job.output_path.c_str(), render_time);
+    return "ok " + std::to_string(render_time);
+}
+
+void run_render_server(const std::string& socket_path, const Reference_Renderer_Config& config,
+    const Scene_Overrides_Func& apply_scene_overrides)
+{
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        error("run_render_server: failed to initialize Winsock");
+#endif
+#ifndef _WIN32
+    // The client can disconnect before it gets the reply (for example, during the long render).
+    // Writing to such connection should fail with an error instead of terminating the server.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    Socket listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_socket == Invalid_Socket)
+        error("run_render_server: failed to create socket");
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+        error("run_render_server: socket path is too long: %s", socket_path.c_str());
+    strcpy(address.sun_path, socket_path.c_str());
+
+    // Remove socket file left by the previous server session.
+    std::error_code ec;
+    fs::remove(socket_path, ec);
+
+    if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+        error("run_render_server: failed to bind socket: %s", socket_path.c_str());
+    if (listen(listen_socket, SOMAXCONN) != 0)
+        error("run_render_server: failed to listen on socket: %s", socket_path.c_str());
+
+    initialize_job_system(config.thread_count);
+    printf("Render server is listening on %s\n", socket_path.c_str());
+
+    std::map<std::string, std::unique_ptr<Resident_Scene>> resident_scenes;
+    uint64_t job_index = 0;
+    while (true) {
+        Socket connection = accept(listen_socket, nullptr, nullptr);
+        if (connection == Invalid_Socket)
+            continue;
+        set_receive_timeout(connection, request_receive_timeout_seconds);
+
+        std::string request;
+        if (!read_request(connection, &request)) {
+            printf("Failed to receive the request\n");
+            close_socket(connection);
+            continue;
+        }
+        if (request.starts_with("shutdown")) {
+            send_reply(connection, "ok");
+            close_socket(connection);
+            break;
+        }
+
+        std::string reply;
+        Render_Job job;
+        std::string error_message;
+        if (parse_request(request, &job, &error_message))
+            reply = run_render_job(job, ++job_index, config, apply_scene_overrides, resident_scenes);
+        else
+            reply = "error " + error_message;
+
+        send_reply(connection, reply);
+        close_socket(connection);
+    }
+
+    close_socket(listen_socket);
+    fs::remove(socket_path, ec);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    printf("Render server is stopped\n");
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+struct Reference_Renderer_Config;
+struct Scene;
+
+// Applies the command line overrides to the scene after it is loaded.
+using Scene_Overrides_Func = std::function<void (Scene& scene)>;
+
+// Render server keeps loaded scenes in memory and renders the jobs received over a local
+// (unix domain) socket. The jobs that reference already loaded scene reuse its Scene_Context,
+// so only the rendering time is spent.
+//
+// Each connection sends a single request as a list of "key value" lines terminated by an empty line:
+//  scene <path>                - scene file (required)
+//  output <path>               - output OpenEXR image (required)
+//  spp <n>                     - samples per pixel
+//  region <x> <y> <w> <h>      - render region
+//  camera <12 floats>          - camera pose, 3x4 matrix in row-major order
+//
+// The request should be sent within 10 seconds after connecting, otherwise the connection is closed.
+// The server replies with a single line: "ok <render_time>" or "error <message>".
+// The request that consists of a single "shutdown" line stops the server.
+//
+// The jobs are processed one by one in the order of connection, each job uses all job system threads.
+// The scene that fails to load is reported with the error reply. Up to 4 scenes are kept loaded.
+void run_render_server(const std::string& socket_path, const Reference_Renderer_Config& config,
+    const Scene_Overrides_Func& apply_scene_overrides);
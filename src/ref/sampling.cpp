@@ -76,25 +76,48 @@ Vector3 uniform_sample_triangle_baricentrics(Vector2 u)
     return b;
 }
 
-void generate_stratified_sequence_1d(RNG& rng, int n, float* result) {
+// The random values are generated in bulk and then transformed in place. The order of the random values
+// is the same as in the version that calls rng.get_float() for each coordinate.
+template <typename Random_Generator>
+static void generate_stratified_sequence_1d_impl(Random_Generator& rng, int n, float* result) {
+    rng.get_floats(result, n);
     float dx = 1.f / float(n);
     for (int x = 0; x < n; x++) {
-        *result++ = std::min((float(x) + rng.get_float()) * dx, One_Minus_Epsilon);
+        result[x] = std::min((float(x) + result[x]) * dx, One_Minus_Epsilon);
     }
 }
 
-void generate_stratified_sequence_2d(RNG& rng, int nx, int ny, Vector2* result) {
+template <typename Random_Generator>
+static void generate_stratified_sequence_2d_impl(Random_Generator& rng, int nx, int ny, Vector2* result) {
+    float* f = &result->x;
+    rng.get_floats(f, 2 * nx * ny);
     float dx = 1.f / float(nx);
     float dy = 1.f / float(ny);
-    float* f = &result->x;
     for (int y = 0; y < ny; y++) {
         for (int x = 0; x < nx; x++) {
-            *f++ = std::min((float(x) + rng.get_float()) * dx, One_Minus_Epsilon);
-            *f++ = std::min((float(y) + rng.get_float()) * dy, One_Minus_Epsilon);
+            f[0] = std::min((float(x) + f[0]) * dx, One_Minus_Epsilon);
+            f[1] = std::min((float(y) + f[1]) * dy, One_Minus_Epsilon);
+            f += 2;
         }
     }
 }
 
+void generate_stratified_sequence_1d(RNG& rng, int n, float* result) {
+    generate_stratified_sequence_1d_impl(rng, n, result);
+}
+
+void generate_stratified_sequence_1d(RNG_8x& rng, int n, float* result) {
+    generate_stratified_sequence_1d_impl(rng, n, result);
+}
+
+void generate_stratified_sequence_2d(RNG& rng, int nx, int ny, Vector2* result) {
+    generate_stratified_sequence_2d_impl(rng, nx, ny, result);
+}
+
+void generate_stratified_sequence_2d(RNG_8x& rng, int nx, int ny, Vector2* result) {
+    generate_stratified_sequence_2d_impl(rng, nx, ny, result);
+}
+
 float sample_from_CDF(float u, const float* cdf, int n, float interval_length, float* pdf, int* interval_index, float* remapped_u)
 {
     ASSERT(u >= 0.f && u < 1.f);
@@ -146,6 +169,81 @@ float sample_from_CDF(float u, const float* cdf, int n, float interval_length, f
     return std::min(x, One_Minus_Epsilon);
 }
 
+void Alias_Table::initialize(const float* values, int n)
+{
+    ASSERT(n >= 1);
+    bins.assign(n, Bin{});
+
+    double total_sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        ASSERT(values[i] >= 0.f);
+        total_sum += values[i];
+    }
+    ASSERT(total_sum > 0.0);
+
+    // Probabilities scaled by the element count. The elements with scaled probability
+    // less than one fill their bins partially, the rest of the bin is taken by the alias.
+    std::vector<double> scaled_probabilities(n);
+    std::vector<int> small;
+    std::vector<int> large;
+    for (int i = 0; i < n; i++) {
+        double p = values[i] / total_sum;
+        bins[i].pmf = float(p);
+        scaled_probabilities[i] = p * n;
+        if (scaled_probabilities[i] < 1.0)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        int s = small.back();
+        small.pop_back();
+        int l = large.back();
+        large.pop_back();
+
+        bins[s].threshold = float(scaled_probabilities[s]);
+        bins[s].alias = l;
+
+        scaled_probabilities[l] += scaled_probabilities[s] - 1.0;
+        if (scaled_probabilities[l] < 1.0)
+            small.push_back(l);
+        else
+            large.push_back(l);
+    }
+    // The remaining elements have scaled probability 1 (up to rounding errors), they fill the entire bin.
+    for (int i : small)
+        bins[i].threshold = 1.f;
+    for (int i : large)
+        bins[i].threshold = 1.f;
+}
+
+int Alias_Table::sample(float u, float* pmf, float* remapped_u) const
+{
+    ASSERT(u >= 0.f && u < 1.f);
+    const int n = (int)bins.size();
+
+    float x = u * float(n);
+    int bin_index = std::min(int(x), n - 1);
+    float u_bin = std::min(x - float(bin_index), One_Minus_Epsilon);
+
+    const Bin& bin = bins[bin_index];
+    int index;
+    if (u_bin < bin.threshold) {
+        index = bin_index;
+        if (remapped_u)
+            *remapped_u = std::min(u_bin / bin.threshold, One_Minus_Epsilon);
+    }
+    else {
+        ASSERT(bin.alias != -1);
+        index = bin.alias;
+        if (remapped_u)
+            *remapped_u = std::min((u_bin - bin.threshold) / (1.f - bin.threshold), One_Minus_Epsilon);
+    }
+    *pmf = bins[index].pmf;
+    return index;
+}
+
 void Distribution_1D::initialize(const float* values, int n)
 {
     this->n = n;
@@ -182,6 +280,31 @@ float Distribution_1D::pdf(float sample) const
     return pdf;
 }
 
+static std::vector<float> get_latitude_longitude_radiance_map_coeffs(const Image_Texture& env_map, Vector2i* resolution_ptr) {
+    const Vector2i resolution = env_map.get_mip_resolution(0);
+    *resolution_ptr = resolution;
+
+    std::vector<float> distribution_coeffs(resolution.x * resolution.y);
+    float* p = distribution_coeffs.data();
+
+    for (int y = 0; y < resolution.y; y++) {
+        float sin_theta = std::sin((y + 0.5f) / resolution.y * Pi);
+        float v = (y + 0.5f) / resolution.y;
+
+        for (int x = 0; x < resolution.x; x++, p++) {
+            float u = (x + 0.5f) / resolution.x;
+            ColorRGB radiance = env_map.sample_nearest({u, v}, 0, Wrap_Mode::clamp);
+            // Modify luminance-based pdf by multiplying by sin_theta to take into
+            // account that sphere slices have area that is proportional to sin_theta.
+            // Without this we will oversample when we move towards poles (still the result
+            // is correct but with larger variance).
+            *p = radiance.luminance() * sin_theta;
+        }
+    }
+
+    return distribution_coeffs;
+}
+
 void Distribution_2D::initialize(const float* values, int nx, int ny) {
     this->nx = nx;
     this->ny = ny;
@@ -234,28 +357,9 @@ void Distribution_2D::initialize(const float* values, int nx, int ny) {
 }
 
 void Distribution_2D::initialize_from_latitude_longitude_radiance_map(const Image_Texture& env_map) {
-    ASSERT(!env_map.get_mips().empty());
-    const Image& image = env_map.get_mips()[0];
-
-    std::vector<float> distribution_coeffs(image.width * image.height);
-    float* p = distribution_coeffs.data();
-
-    for (int y = 0; y < image.height; y++) {
-        float sin_theta = std::sin((y + 0.5f) / image.height * Pi);
-        float v = (y + 0.5f) / image.height;
-
-        for (int x = 0; x < image.width; x++, p++) {
-            float u = (x + 0.5f) / image.width;
-            ColorRGB radiance = env_map.sample_nearest({u, v}, 0, Wrap_Mode::clamp);
-            // Modify luminance-based pdf by multiplying by sin_theta to take into
-            // account that sphere slices have area that is proportional to sin_theta.
-            // Without this we will oversample when we move towards poles (still the result
-            // is correct but with larger variance).
-            *p = radiance.luminance() * sin_theta;
-        }
-    }
-
-    initialize(distribution_coeffs.data(), image.width, image.height);
+    Vector2i resolution;
+    std::vector<float> distribution_coeffs = get_latitude_longitude_radiance_map_coeffs(env_map, &resolution);
+    initialize(distribution_coeffs.data(), resolution.x, resolution.y);
 }
 
 Vector2 Distribution_2D::sample(Vector2 u, float* pdf_uv) const {
@@ -290,6 +394,194 @@ float Distribution_2D::pdf_uv(Vector2 sample) const {
     return pdf;
 }
 
+void Alias_Distribution_1D::initialize(const float* values, int n)
+{
+    alias_table.initialize(values, n);
+}
+
+float Alias_Distribution_1D::sample(float u, float* pdf, float* remapped_u) const
+{
+    const int n = alias_table.size();
+    float pmf;
+    float u_interval;
+    int index = alias_table.sample(u, &pmf, &u_interval);
+
+    if (pdf) {
+        *pdf = pmf * n;
+        ASSERT(*pdf > 0.f);
+    }
+    if (remapped_u) {
+        *remapped_u = u_interval;
+    }
+    return std::min((float(index) + u_interval) / float(n), One_Minus_Epsilon);
+}
+
+float Alias_Distribution_1D::pdf(float sample) const
+{
+    ASSERT(sample >= 0.f && sample < 1.f);
+    const int n = alias_table.size();
+    int index = std::min(int(sample * n), n - 1);
+    return alias_table.pmf(index) * n;
+}
+
+void Hierarchical_Distribution_2D::initialize(const float* values, int nx, int ny)
+{
+    ASSERT(is_power_of_2(nx) && is_power_of_2(ny));
+
+    levels.clear();
+    Level& base_level = levels.emplace_back();
+    base_level.nx = nx;
+    base_level.ny = ny;
+    base_level.values.assign(values, values + nx * ny);
+
+    double sum = 0.0;
+    for (float value : base_level.values) {
+        ASSERT(value >= 0.f);
+        sum += value;
+    }
+    total_sum = float(sum);
+    ASSERT(total_sum > 0.f);
+
+    while (levels.back().nx > 1 && levels.back().ny > 1) {
+        const Level& prev = levels.back();
+        Level level;
+        level.nx = prev.nx / 2;
+        level.ny = prev.ny / 2;
+        level.values.resize(level.nx * level.ny);
+        for (int y = 0; y < level.ny; y++) {
+            const float* row0 = &prev.values[(2 * y) * prev.nx];
+            const float* row1 = &prev.values[(2 * y + 1) * prev.nx];
+            for (int x = 0; x < level.nx; x++) {
+                level.values[y * level.nx + x] = row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1];
+            }
+        }
+        levels.push_back(std::move(level));
+    }
+}
+
+void Hierarchical_Distribution_2D::initialize_from_latitude_longitude_radiance_map(const Image_Texture& env_map, int max_width)
+{
+    const Vector2i base_resolution = env_map.get_mip_resolution(0);
+    int nx = base_resolution.x;
+    int ny = base_resolution.y;
+    while (nx > max_width && ny > 1) {
+        nx /= 2;
+        ny /= 2;
+    }
+
+    // The coarsest mip level that has enough resolution. Each value is a box-filtered average
+    // of the mip texels, so the small bright features are not lost.
+    int mip_level = 0;
+    while (mip_level + 1 < env_map.get_mip_count()) {
+        Vector2i resolution = env_map.get_mip_resolution(mip_level + 1);
+        if (resolution.x < nx || resolution.y < ny)
+            break;
+        mip_level++;
+    }
+    const Vector2i mip_resolution = env_map.get_mip_resolution(mip_level);
+    const int sx = (mip_resolution.x + nx - 1) / nx;
+    const int sy = (mip_resolution.y + ny - 1) / ny;
+
+    std::vector<float> distribution_coeffs(nx * ny);
+    float* p = distribution_coeffs.data();
+
+    for (int y = 0; y < ny; y++) {
+        for (int x = 0; x < nx; x++, p++) {
+            float sum = 0.f;
+            for (int j = 0; j < sy; j++) {
+                float v = (y + (j + 0.5f) / sy) / ny;
+                // See the comment in get_latitude_longitude_radiance_map_coeffs.
+                float sin_theta = std::sin(v * Pi);
+                for (int i = 0; i < sx; i++) {
+                    float u = (x + (i + 0.5f) / sx) / nx;
+                    ColorRGB radiance = env_map.sample_nearest({u, v}, mip_level, Wrap_Mode::clamp);
+                    sum += std::max(0.f, radiance.luminance()) * sin_theta;
+                }
+            }
+            *p = sum / float(sx * sy);
+        }
+    }
+
+    initialize(distribution_coeffs.data(), nx, ny);
+}
+
+Vector2 Hierarchical_Distribution_2D::sample(Vector2 u, float* pdf_uv) const
+{
+    ASSERT(u >= Vector2(0.f) && u < Vector2(1.f));
+
+    // Selects the first element with probability p and remaps u.
+    auto select_first = [](float& u, float p) {
+        if (u < p) {
+            u = std::min(u / p, One_Minus_Epsilon);
+            return true;
+        }
+        u = std::min((u - p) / (1.f - p), One_Minus_Epsilon);
+        return false;
+    };
+
+    // The top level is a single row or a single column, the element is selected by the linear search.
+    const Level& top_level = levels.back();
+    const int top_count = top_level.nx * top_level.ny;
+    float& u_top = (top_level.ny == 1) ? u.x : u.y;
+    float level_sum = 0.f;
+    for (float value : top_level.values)
+        level_sum += value;
+
+    // If none of the previous elements is selected due to rounding errors then the last non-zero element is used.
+    int last_index = top_count - 1;
+    while (top_level.values[last_index] == 0.f)
+        last_index--;
+
+    int index = 0;
+    for (; index < last_index; index++) {
+        float value = top_level.values[index];
+        if (value == 0.f)
+            continue;
+        if (select_first(u_top, value / level_sum))
+            break;
+        level_sum -= value;
+    }
+    int x = (top_level.ny == 1) ? index : 0;
+    int y = (top_level.ny == 1) ? 0 : index;
+
+    // Descend to the base level, at each level choose one of 2x2 children.
+    for (int i = int(levels.size()) - 2; i >= 0; i--) {
+        const Level& level = levels[i];
+        x *= 2;
+        y *= 2;
+        const float* row0 = &level.values[y * level.nx + x];
+        const float* row1 = row0 + level.nx;
+
+        float row0_sum = row0[0] + row0[1];
+        float row1_sum = row1[0] + row1[1];
+        const float* row = row0;
+        if (!select_first(u.y, row0_sum / (row0_sum + row1_sum))) {
+            row = row1;
+            y++;
+        }
+        if (!select_first(u.x, row[0] / (row[0] + row[1])))
+            x++;
+    }
+
+    const Level& base_level = levels[0];
+    float value = base_level.values[y * base_level.nx + x];
+    ASSERT(value > 0.f);
+    *pdf_uv = value * float(base_level.nx * base_level.ny) / total_sum;
+
+    float kx = std::min((float(x) + u.x) / float(base_level.nx), One_Minus_Epsilon);
+    float ky = std::min((float(y) + u.y) / float(base_level.ny), One_Minus_Epsilon);
+    return {kx, ky};
+}
+
+float Hierarchical_Distribution_2D::pdf_uv(Vector2 sample) const
+{
+    ASSERT(sample >= Vector2(0.f) && sample < Vector2(1.f));
+    const Level& base_level = levels[0];
+    int x = std::min(int(sample.x * base_level.nx), base_level.nx - 1);
+    int y = std::min(int(sample.y * base_level.ny), base_level.ny - 1);
+    return base_level.values[y * base_level.nx + x] * float(base_level.nx * base_level.ny) / total_sum;
+}
+
 // NO LONGER USED (renderer now samples the distribution of visible normals)
 Vector3 GGX_sample_microfacet_normal(Vector2 u, float alpha) {
     float theta = std::atan(alpha * std::sqrt(u[0] / (1 - u[0])));
@@ -4,6 +4,7 @@
 
 class Image_Texture;
 struct RNG;
+struct RNG_8x;
 
 float cosine_hemisphere_pdf(float theta_cos);
 
@@ -18,8 +19,10 @@ Vector3 uniform_sample_triangle_baricentrics(Vector2 u);
 
 // Generates n stratified samples over [0, 1) range.
 void generate_stratified_sequence_1d(RNG& rng, int n, float* result);
+void generate_stratified_sequence_1d(RNG_8x& rng, int n, float* result);
 // Generates nx*ny stratified samples over [0, 1)^2 range.
 void generate_stratified_sequence_2d(RNG& rng, int nx, int ny, Vector2* result);
+void generate_stratified_sequence_2d(RNG_8x& rng, int nx, int ny, Vector2* result);
 
 // The assumption that CDF is defined over [0, 1] and is a piecewise-linear function.
 // If we divide [0, 1] into 'n' intervals then 'cdf' array defines cdf values at the
@@ -38,6 +41,34 @@ void generate_stratified_sequence_2d(RNG& rng, int nx, int ny, Vector2* result);
 float sample_from_CDF(float u, const float* cdf, int n, float interval_length /* 1/n */, float* pdf,
     int* interval_index = nullptr, float* remapped_u = nullptr);
 
+// Alias method for sampling from the discrete distribution in O(1) time (Vose's algorithm).
+class Alias_Table {
+public:
+    // The probability of each element is proportional to the initialization value.
+    void initialize(const float* values, int n);
+
+    // Returns the index of the sampled element.
+    //
+    // 'u' - uniformly distributed random variable from [0..1).
+    //
+    // 'pmf' output parameter is a probability of the sampled element.
+    //
+    // 'remapped_u' output parameter is a uniformly distributed value from [0..1) that
+    // is independent from the selected element. It can be used to draw the next sample.
+    int sample(float u, float* pmf, float* remapped_u = nullptr) const;
+
+    float pmf(int index) const { return bins[index].pmf; }
+    int size() const { return (int)bins.size(); }
+
+private:
+    struct Bin {
+        float threshold = 1.f; // the bin's own element is selected if the bin's part of u is below the threshold
+        int alias = -1; // the element that is selected otherwise
+        float pmf = 0.f; // probability of the bin's own element
+    };
+    std::vector<Bin> bins;
+};
+
 // Distribution_1D represents PDF (probability density function) defined over [0..1].
 // The samples are drawn according to pdf and belong to [0..1).
 class Distribution_1D {
@@ -93,6 +124,54 @@ private:
     std::vector<float> CDFs_x; // cdf for each row: nx * ny elements
 };
 
+// Alias_Distribution_1D defines the same distribution as Distribution_1D and has the same interface.
+// It uses the alias method to select the interval in O(1) instead of the binary search over the CDF.
+// The price is that the mapping from 'u' to the sample is not monotonic anymore, so the stratification
+// of 'u' is not preserved. Also it uses 3x more memory (12 bytes per interval instead of 4 bytes).
+class Alias_Distribution_1D {
+public:
+    void initialize(const float* values, int n);
+
+    // 'remapped_u' output parameter is the position of the sample inside the selected interval
+    // and it is uniformly distributed over [0..1).
+    float sample(float u, float* pdf, float* remapped_u = nullptr) const;
+    float pdf(float sample) const;
+
+private:
+    Alias_Table alias_table;
+};
+
+// Hierarchical_Distribution_2D defines the same piecewise-constant pdf over [0..1]^2 as Distribution_2D.
+// The samples are generated by descending the pyramid of partial sums of the values: at each level one
+// of four children is selected and 'u' is remapped ("Wavelet Importance Sampling", Clarberg et al. 2005).
+// The pyramid needs 4/3 of the values memory and a sample touches only a few values per level.
+//
+// nx and ny must be powers of two.
+class Hierarchical_Distribution_2D {
+public:
+    void initialize(const float* values, int nx, int ny);
+
+    // The distribution is built from the downsampled radiance map if the map width is larger than max_width.
+    // The pdf is exact for the downsampled map.
+    void initialize_from_latitude_longitude_radiance_map(const Image_Texture& env_map, int max_width);
+
+    Vector2 sample(Vector2 u, float* pdf_uv) const;
+    float pdf_uv(Vector2 sample) const;
+
+    int get_width() const { return levels.empty() ? 0 : levels[0].nx; }
+    int get_height() const { return levels.empty() ? 0 : levels[0].ny; }
+
+private:
+    struct Level {
+        int nx = 0;
+        int ny = 0;
+        std::vector<float> values; // each value is the sum of 2x2 values of the previous level
+    };
+    // levels[0] contains the initialization values. The last level has a single row or a single column.
+    std::vector<Level> levels;
+    float total_sum = 0.f;
+};
+
 // Importance sampling of GGX microfacet distribution: D(wh) * dot(wh, N)
 // NOTE: This function is not used and is left here mostly as an example.
 //       The renderer switched to sampling distribution of visible normals.
@@ -4,6 +4,7 @@
 #include "kdtree.h"
 #include "image_texture.h"
 #include "light_sampling.h"
+#include "light_tree.h"
 #include "pixel_sampling.h"
 
 #include "lib/bounding_box.h"
@@ -19,8 +20,14 @@ struct KdTree_Data {
     std::vector<KdTree> geometry_kdtrees;
     Scene_Geometry_Data scene_geometry_data;
     KdTree scene_kdtree;
+    float scene_kdtree_build_time = 0.f; // seconds
 
-    void initialize(const Scene& scene, const std::vector<Image_Texture>& textures, bool rebuild_kdtree_cache);
+    // Takes ownership of the triangle mesh kdtrees and builds the scene kdtree.
+    void initialize(const Scene& scene, std::vector<KdTree>&& kdtrees);
+
+    // Sets references to the alpha textures. Can be called after the scene kdtree is built,
+    // since the textures are not accessed until the rendering starts.
+    void set_alpha_textures(const Scene& scene, const std::vector<Image_Texture>& textures);
 };
 
 struct MIS_Array_Info {
@@ -38,7 +45,8 @@ struct Array2D_Registry {
 struct Scene_Context {
     std::string input_filename;
     std::string checkpoint_directory;
-    int thread_count = 0;
+    bool checkpoint_compression = false;
+    bool output_aovs = false;
 
     Bounds2i render_region;
     Raytracer_Config raytracer_config;
@@ -55,6 +63,8 @@ struct Scene_Context {
     Lights lights;
     Environment_Light_Sampler environment_light_sampler;
     std::vector<Diffuse_Triangle_Mesh_Light_Sampler> triangle_mesh_light_samplers;
+    Light_Power_Distribution light_power_distribution;
+    Light_Tree light_tree;
 
     // Samplers
     Stratified_Pixel_Sampler_Configuration pixel_sampler_config;
@@ -68,4 +78,5 @@ struct Scene_Context {
     // Can be useful during debugging to vary random numbers and get configuration that
     // reproduces desired behavior.
     int rng_seed_offset = 0;
+    bool scalar_rng = false;
 };
@@ -0,0 +1,126 @@
+#include "std.h"
+#include "lib/common.h"
+#include "scene_load_pipeline.h"
+
+#include "kdtree_builder.h"
+#include "scene_context.h"
+
+#include "lib/scene.h"
+
+constexpr int time_category_field_width = 21; // for printf 'width' specifier
+
+Scene_Load_Callbacks Scene_Load_Pipeline::get_scene_load_callbacks()
+{
+    Scene_Load_Callbacks callbacks;
+    callbacks.texture_added = [this](const Scene& scene, int texture_index) {
+        add_texture(scene, texture_index);
+    };
+    callbacks.triangle_mesh_added = [this](const Scene& scene, int triangle_mesh_index) {
+        add_triangle_mesh(scene, triangle_mesh_index);
+    };
+    return callbacks;
+}
+
+void Scene_Load_Pipeline::add_scene_resources(const Scene& scene)
+{
+    ASSERT(textures.empty() && kdtrees.empty());
+    for (int i = 0; i < (int)scene.texture_descriptors.size(); i++) {
+        add_texture(scene, i);
+    }
+    for (int i = 0; i < (int)scene.geometries.triangle_meshes.size(); i++) {
+        add_triangle_mesh(scene, i);
+    }
+}
+
+void Scene_Load_Pipeline::add_texture(const Scene& scene, int texture_index)
+{
+    ASSERT(texture_index == (int)textures.size());
+    Image_Texture& texture = textures.emplace_back();
+    const Texture_Descriptor& texture_desc = scene.texture_descriptors[texture_index];
+
+    // Image textures are loaded by the texture cache on first access.
+    if (!texture_desc.file_name.empty()) {
+        if (texture_cache_directory.empty()) {
+            texture_cache_directory = get_data_directory() / "texture-cache" / get_project_unique_name(scene.path);
+            if (!fs_exists(texture_cache_directory) && !fs_create_directories(texture_cache_directory))
+                error("Failed to create texture cache directory: %s\n", texture_cache_directory.string().c_str());
+        }
+        std::string path = scene.get_resource_absolute_path(texture_desc.file_name);
+        Image_Texture::Init_Params init_params;
+        init_params.generate_mips = true;
+        init_params.decode_srgb = texture_desc.decode_srgb;
+        init_params.scale = texture_desc.scale;
+        texture.initialize_on_demand(path, init_params, texture_cache_directory);
+    }
+    else if (texture_desc.is_constant_texture) {
+        texture.initialize_from_constant_value(texture_desc.constant_value);
+    }
+    else {
+        ASSERT(false);
+    }
+}
+
+void Scene_Load_Pipeline::initialize_kdtree_cache(const Scene& scene)
+{
+    kdtree_cache_directory = get_data_directory() / "kdtree-cache" / get_project_unique_name(scene.path);
+    kdtree_cache_exists = fs_exists(kdtree_cache_directory);
+
+    // Check --force-rebuild-kdtree-cache command line option.
+    if (kdtree_cache_exists && rebuild_kdtree_cache) {
+        if (!fs_delete_directory(kdtree_cache_directory))
+            error("Failed to delete kdtree cache (%s) when handling --force-update-kdtree-cache command", kdtree_cache_directory.c_str());
+        kdtree_cache_exists = false;
+    }
+    if (!kdtree_cache_exists) {
+        printf("Kdtree cache was not found, building kdtree cache\n");
+        if (!fs_create_directories(kdtree_cache_directory))
+            error("Failed to create kdtree cache directory: %s\n", kdtree_cache_directory.string().c_str());
+    }
+    kdtree_cache_initialized = true;
+}
+
+void Scene_Load_Pipeline::add_triangle_mesh(const Scene& scene, int triangle_mesh_index)
+{
+    if (!kdtree_cache_initialized) {
+        initialize_kdtree_cache(scene);
+    }
+    ASSERT(triangle_mesh_index == (int)kdtrees.size());
+    KdTree* kdtree = &kdtrees.emplace_back();
+
+    // The mesh is not moved in memory after it was added to the scene (see add_scene_triangle_mesh).
+    const Triangle_Mesh* mesh = &scene.geometries.triangle_meshes[triangle_mesh_index];
+    fs::path kdtree_file = kdtree_cache_directory / (std::to_string(triangle_mesh_index) + ".kdtree");
+
+    if (kdtree_cache_exists) {
+        submit_job(&kdtree_jobs, [kdtree_file, kdtree] {
+            *kdtree = KdTree::load(kdtree_file.string());
+        });
+    }
+    else {
+        submit_job(&kdtree_jobs, [kdtree_file, mesh, kdtree] {
+            // Final geometry data is set by KdTree_Data::initialize.
+            Triangle_Mesh_Geometry_Data geometry_data;
+            geometry_data.mesh = mesh;
+            *kdtree = build_triangle_mesh_kdtree(&geometry_data);
+            kdtree->save(kdtree_file.string());
+        });
+    }
+}
+
+void Scene_Load_Pipeline::finish(const Scene& scene, Scene_Context& scene_ctx)
+{
+    Timestamp t_kdtrees;
+    wait_for_job_group(&kdtree_jobs);
+    ASSERT(kdtrees.size() == scene.geometries.triangle_meshes.size());
+    kdtree_wait_time = elapsed_seconds(t_kdtrees);
+    printf("%-*s %.3f seconds\n", time_category_field_width, "Wait for mesh kdtrees", kdtree_wait_time);
+
+    std::vector<KdTree> geometry_kdtrees(std::make_move_iterator(kdtrees.begin()), std::make_move_iterator(kdtrees.end()));
+    kdtrees.clear();
+    scene_ctx.kdtree_data.initialize(scene, std::move(geometry_kdtrees));
+
+    ASSERT(textures.size() == scene.texture_descriptors.size());
+    scene_ctx.textures.assign(std::make_move_iterator(textures.begin()), std::make_move_iterator(textures.end()));
+    textures.clear();
+    scene_ctx.kdtree_data.set_alpha_textures(scene, scene_ctx.textures);
+}
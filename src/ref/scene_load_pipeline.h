@@ -0,0 +1,48 @@
+#pragma once
+
+#include "image_texture.h"
+#include "kdtree.h"
+
+#include "lib/job_system.h"
+#include "lib/scene_loader.h"
+
+struct Scene_Context;
+
+// Initializes scene resources in parallel with scene loading. Kdtree building (or loading
+// from the kdtree cache) starts as soon as the scene loader adds the triangle mesh to the scene.
+// Image textures are not decoded here, they are loaded by the texture cache on first access.
+//
+// Kdtree building does not depend on textures. Alpha-tested meshes only store references
+// to their alpha textures, these references are set when the pipeline finishes.
+struct Scene_Load_Pipeline {
+    bool rebuild_kdtree_cache = false;
+
+    // Callbacks that should be passed to load_scene() to start processing of scene resources.
+    Scene_Load_Callbacks get_scene_load_callbacks();
+
+    // Starts processing of all resources of already loaded scene.
+    // It's used when the scene was loaded without pipeline callbacks.
+    void add_scene_resources(const Scene& scene);
+
+    // Waits for pipeline jobs and initializes textures and kdtrees of the scene context.
+    void finish(const Scene& scene, Scene_Context& scene_ctx);
+
+    void add_texture(const Scene& scene, int texture_index);
+    void add_triangle_mesh(const Scene& scene, int triangle_mesh_index);
+    void initialize_kdtree_cache(const Scene& scene);
+
+    Job_Group kdtree_jobs;
+
+    // std::deque does not move the elements on insertion, so the jobs can write the results
+    // while new elements are added.
+    std::deque<Image_Texture> textures;
+    std::deque<KdTree> kdtrees;
+
+    // Time spent in finish() waiting for the mesh kdtrees (seconds).
+    float kdtree_wait_time = 0.f;
+
+    bool kdtree_cache_initialized = false;
+    bool kdtree_cache_exists = false;
+    fs::path kdtree_cache_directory;
+    fs::path texture_cache_directory;
+};
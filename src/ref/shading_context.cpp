@@ -183,6 +183,30 @@ void Shading_Context::initialize_scattering(Thread_Context& thread_ctx, float* u
 
     if (bsdf_layer_selection_probability != 0.f)
         bsdf = create_bsdf(thread_ctx, material);
+
+    if (thread_ctx.collect_first_hit_info && !thread_ctx.first_hit_info.albedo_initialized)
+        init_first_hit_albedo(thread_ctx, *u_scattering_type);
+}
+
+// Estimates albedo as a scattering weight of the sampled direction (the same weight that is used by
+// the path tracer). The image plane sample is reused to sample the bsdf, so random sequences are not
+// affected and the rendered image does not change. The estimate converges to the bsdf albedo as
+// the number of pixel samples increases.
+void Shading_Context::init_first_hit_albedo(Thread_Context& thread_ctx, float u_scattering_type) const
+{
+    First_Hit_Info& first_hit = thread_ctx.first_hit_info;
+    first_hit.albedo_initialized = true;
+
+    if (delta_scattering_event) {
+        first_hit.albedo = delta_scattering.attenuation;
+    }
+    else if (bsdf) {
+        Vector3 wi;
+        float pdf = 0.f;
+        ColorRGB f = bsdf->sample(thread_ctx.pixel_sampler.get_image_plane_sample(), u_scattering_type, wo, &wi, &pdf);
+        if (!f.is_black() && pdf > 0.f)
+            first_hit.albedo = f * (std::abs(dot(normal, wi)) / (pdf * bsdf_layer_selection_probability));
+    }
 }
 
 void Shading_Context::init_from_triangle_mesh_intersection(const Triangle_Intersection& ti)
@@ -464,6 +488,17 @@ void Shading_Context::apply_bump_map(const Scene_Context& scene_ctx, Float_Param
 
 bool trace_ray(Thread_Context& thread_ctx, const Ray& ray, const Differential_Rays* differential_rays)
 {
+    First_Hit_Info& first_hit = thread_ctx.first_hit_info;
+    const bool camera_ray = !first_hit.ray_traced;
+    first_hit.ray_traced = true;
+
+#if ENABLE_RAY_STATS
+    if (camera_ray)
+        thread_ctx.ray_stats.primary_ray_count++;
+    else
+        thread_ctx.ray_stats.indirect_ray_count++;
+#endif
+
     Intersection isect;
     if (!thread_ctx.scene_context.kdtree_data.scene_kdtree.intersect(ray, isect)) {
         thread_ctx.shading_context = Shading_Context{};
@@ -471,5 +506,12 @@ bool trace_ray(Thread_Context& thread_ctx, const Ray& ray, const Differential_Ra
         return false;
     }
     thread_ctx.shading_context.initialize_local_geometry(thread_ctx, ray, differential_rays, isect);
+
+    if (thread_ctx.collect_first_hit_info && camera_ray) {
+        first_hit.hit_found = true;
+        first_hit.distance = (thread_ctx.shading_context.position - ray.origin).length();
+        first_hit.normal = thread_ctx.shading_context.normal;
+        first_hit.material = thread_ctx.shading_context.material;
+    }
     return true;
 }
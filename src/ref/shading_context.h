@@ -121,6 +121,7 @@ struct Shading_Context {
     void apply_bump_map(const Scene_Context& scene_ctx, Float_Parameter bump_map);
 
 private:
+    void init_first_hit_albedo(Thread_Context& thread_ctx, float u_scattering_type) const;
     void init_from_triangle_mesh_intersection(const Triangle_Intersection& ti);
 
     void calculate_dxdy_derivatives(const Differential_Rays& differential_rays);
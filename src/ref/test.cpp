@@ -3,6 +3,7 @@
 
 void test_random();
 void test_sampling();
+void test_film_filters();
 void test_triangle_intersection();
 void test_simd_triangle_intersection();
 void test_watertightness();
@@ -15,11 +16,15 @@ void run_tests(const std::string& test_name) {
     if (test_name.empty()) {
         test_random();
         test_sampling();
+        test_film_filters();
         test_triangle_intersection();
         test_simd_triangle_intersection();
         test_watertightness();
         test_kdtree();
     }
+    else if (test_name == "film") {
+        test_film_filters();
+    }
     else if (test_name == "intersection") {
         test_triangle_intersection();
     }
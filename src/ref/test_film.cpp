@@ -0,0 +1,68 @@
+#include "std.h"
+#include "lib/common.h"
+
+#include "film.h"
+
+#include "lib/random.h"
+
+// Compares the weights accumulated by Film_Tile::add_sample (separable evaluation of the filters)
+// with the radial formulas of the filters for the pixels under the filter footprint.
+static void test_film_filter(const char* name, const Film_Filter& filter, const std::function<float (Vector2)>& reference_filter) {
+    const Bounds2i pixel_bounds{ {0, 0}, {16, 16} };
+
+    const float tolerance = 1e-5f; // relative to the max filter value
+    float max_reference_weight = 0.f;
+    float max_error = 0.f;
+    int footprint_pixel_count = 0;
+
+    RNG rng;
+    rng.init(0, 0x12345);
+
+    for (int i = 0; i < 1000; i++) {
+        // The footprint is always inside the tile.
+        const Vector2 film_pos = Vector2(8.f) + rng.get_vector2();
+
+        Film_Tile tile(pixel_bounds);
+        tile.add_sample(filter, film_pos, Color_White);
+
+        for (int y = pixel_bounds.p0.y; y < pixel_bounds.p1.y; y++) {
+            for (int x = pixel_bounds.p0.x; x < pixel_bounds.p1.x; x++) {
+                Vector2 p = film_pos - Vector2(x + 0.5f, y + 0.5f);
+                bool inside_footprint = std::abs(p.x) <= filter.radius && std::abs(p.y) <= filter.radius;
+                float reference_weight = inside_footprint ? reference_filter(p) : 0.f;
+
+                float weight = tile.pixels[y * pixel_bounds.size().x + x].weight_sum;
+                max_reference_weight = std::max(max_reference_weight, reference_weight);
+                max_error = std::max(max_error, std::abs(weight - reference_weight));
+                footprint_pixel_count += inside_footprint;
+            }
+        }
+    }
+    const float relative_error = max_error / max_reference_weight;
+    printf("%s filter: footprint pixel count %d, max relative error %g\n", name, footprint_pixel_count, relative_error);
+    printf("%s\n\n", (footprint_pixel_count > 0 && relative_error < tolerance) ? "PASSED" : "FAILED");
+}
+
+void test_film_filters() {
+    printf("Testing film filters...\n");
+
+    test_film_filter("Box", get_box_filter(0.5f),
+        [](Vector2 p) { return 1.f; });
+
+    test_film_filter("Wide box", get_box_filter(1.5f),
+        [](Vector2 p) { return 1.f; });
+
+    const float gaussian_radius = 2.f;
+    const float alpha = 2.f;
+    const float zero_level = std::exp(-alpha * gaussian_radius * gaussian_radius);
+    test_film_filter("Gaussian", get_gaussian_filter(gaussian_radius, alpha, false),
+        [alpha, zero_level](Vector2 p) {
+            return std::max(0.f, std::exp(-alpha * p.length_squared()) - zero_level);
+        });
+
+    const float triangle_radius = 2.f;
+    test_film_filter("Triangle", get_triangle_filter(triangle_radius),
+        [triangle_radius](Vector2 p) {
+            return std::max(0.f, triangle_radius - std::abs(p.x)) * std::max(0.f, triangle_radius - std::abs(p.y));
+        });
+}
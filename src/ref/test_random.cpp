@@ -155,9 +155,85 @@ void test_random_float() {
     printf("%s\n\n", fail_percentage < fail_threshold ? "PASSED" : "FAILED");
 }
 
+void test_random_8x() {
+    const int n = 100'000'000;
+    const int batch_size = 1000; // not a multiple of 8 to test the partially used batches
+    const uint32_t bucket_count = 20'000;
+
+    const float error_tolerance_percentage = 0.05f;
+    const float fail_threshold = 0.01f;
+
+    printf("Testing 8x random float distribution...\n");
+    printf("Bucket count = %d\n", bucket_count);
+
+    // Each lane should produce the same sequence as the corresponding scalar stream.
+    bool lanes_match = true;
+    {
+        RNG_8x rng_8x;
+        rng_8x.init(5, 123);
+        std::vector<uint32_t> values(8 * 1000);
+        rng_8x.get_uints(values.data(), (int)values.size());
+        for (int lane = 0; lane < 8; lane++) {
+            RNG rng;
+            rng.init(5, RNG_8x::get_lane_stream_id(123, lane));
+            for (size_t i = lane; i < values.size(); i += 8)
+                lanes_match &= (values[i] == rng.get_uint());
+        }
+    }
+    printf("Lanes match scalar streams: %s\n", lanes_match ? "yes" : "no");
+
+    // The lanes should not repeat the scalar streams that are used with the same stream ids.
+    bool lanes_overlap_scalar_streams = false;
+    {
+        RNG_8x rng_8x;
+        rng_8x.init(5, 0);
+        std::vector<uint32_t> values(8 * 16);
+        rng_8x.get_uints(values.data(), (int)values.size());
+        for (int stream_id = 0; stream_id < 8 * 8; stream_id++) {
+            RNG rng;
+            rng.init(5, stream_id);
+            std::vector<uint32_t> scalar_values(16);
+            for (uint32_t& v : scalar_values)
+                v = rng.get_uint();
+            for (int lane = 0; lane < 8; lane++) {
+                bool same = true;
+                for (int i = 0; i < 16; i++)
+                    same &= (values[lane + 8 * i] == scalar_values[i]);
+                lanes_overlap_scalar_streams |= same;
+            }
+        }
+    }
+    printf("Lanes overlap scalar streams: %s\n", lanes_overlap_scalar_streams ? "yes" : "no");
+
+    std::vector<int> buckets(bucket_count, 0);
+    std::vector<float> batch(batch_size);
+    RNG_8x rng;
+    rng.init(0, 0);
+    for (int i = 0; i < n; i += batch_size) {
+        rng.get_floats(batch.data(), batch_size);
+        for (float f : batch) {
+            ASSERT(f >= 0 && f < 1.f);
+            int bucket_index = std::min(int(f * bucket_count), int(bucket_count - 1));
+            buckets[bucket_index]++;
+        }
+    }
+
+    const float estimated_bucket_item_count = float(n) / bucket_count;
+    int failed_estimate_count = 0;
+    for (int i = 0; i < bucket_count; i++) {
+        float error = std::abs(buckets[i] - estimated_bucket_item_count) /  estimated_bucket_item_count;
+        if (error > error_tolerance_percentage)
+            failed_estimate_count++;
+    }
+    float fail_percentage = (float)failed_estimate_count / bucket_count;
+    printf("Bucket count with failed estimation: %d (%.3f%%)\n", failed_estimate_count, fail_percentage * 100.f);
+    printf("%s\n\n", (lanes_match && !lanes_overlap_scalar_streams && fail_percentage < fail_threshold) ? "PASSED" : "FAILED");
+}
+
 void test_random() {
     test_random_uint32_distribution();
     test_random_uint32_distribution_multiple_streams();
     test_random_bounded_uint32_distribution();
     test_random_float();
+    test_random_8x();
 }
@@ -1,6 +1,7 @@
 #include "std.h"
 #include "lib/common.h"
 
+#include "path_guiding.h"
 #include "sampling.h"
 
 #include "lib/math.h"
@@ -403,6 +404,181 @@ void test_non_uniform_2d_distribution_sampling() {
     printf("%s\n\n", failures <= int(buckets.size() * fail_threshold) ? "PASSED" : "FAILED");
 }
 
+void test_alias_1d_distribution_sampling() {
+    printf("Testing alias 1D distribution sampling...\n");
+    const int N = 10;
+    std::vector<float> values(N);
+    float sum = 0.f;
+    for (int i = 0; i < N; i++) {
+        values[i] = (i % 3 == 1) ? 0.f : float(i + 1); // some intervals have zero probability
+        sum += values[i];
+    }
+
+    Alias_Distribution_1D sampler;
+    sampler.initialize(values.data(), N);
+
+    RNG rng;
+    rng.init(0, 0x12345);
+
+    std::vector<int> buckets(100, 0);
+    std::vector<int> remapped_u_buckets(10, 0);
+    const int Sample_Count = 1'000'000;
+    int pdf_mismatch_count = 0;
+
+    for (int i = 0; i < Sample_Count; i++) {
+        float pdf, remapped_u;
+        float s = sampler.sample(rng.get_float(), &pdf, &remapped_u);
+        ASSERT(s >= 0.f && s < 1.f);
+        ASSERT(remapped_u >= 0.f && remapped_u < 1.f);
+        if (pdf != sampler.pdf(s))
+            pdf_mismatch_count++;
+
+        int bucket_index = int(s * buckets.size());
+        ASSERT(bucket_index < (int)buckets.size());
+        buckets[bucket_index]++;
+        remapped_u_buckets[int(remapped_u * remapped_u_buckets.size())]++;
+    }
+
+    const float error_tolerance = 0.1f;
+    int failures = 0;
+    for (int i = 0; i < int(buckets.size()); i++) {
+        int pdf_interval_index = int(float(i) / buckets.size() * N);
+        int bucket_estimate = int(values[pdf_interval_index] / sum / (buckets.size() / N) * Sample_Count);
+        int bucket_max_deviation = int(bucket_estimate * error_tolerance);
+        if (std::abs(bucket_estimate - buckets[i]) > bucket_max_deviation)
+            failures++;
+    }
+    // remapped_u should be uniformly distributed.
+    for (int n : remapped_u_buckets) {
+        int bucket_estimate = int(Sample_Count / remapped_u_buckets.size());
+        if (std::abs(bucket_estimate - n) > int(bucket_estimate * error_tolerance))
+            failures++;
+    }
+
+    const float fail_threshold = 0.02f;
+
+    printf("Failure count: %d, pdf mismatch count: %d\n", failures, pdf_mismatch_count);
+    printf("%s\n\n", (failures <= int(buckets.size() * fail_threshold) && pdf_mismatch_count == 0) ? "PASSED" : "FAILED");
+}
+
+void test_hierarchical_2d_distribution_sampling() {
+    printf("Testing hierarchical 2D distribution sampling...\n");
+    const int nx = 8;
+    const int ny = 4;
+    std::vector<float> values(nx * ny);
+
+    float sum = 0.f;
+    for (int i = 0; i < nx*ny; i++) {
+        values[i] = (i / nx == 2 || i % 5 == 0) ? 0.f : float(i); // the row with index 2 and some values are zeroed
+        sum += values[i];
+    }
+
+    Hierarchical_Distribution_2D sampler;
+    sampler.initialize(values.data(), nx, ny);
+
+    std::vector<int> buckets(nx * ny, 0);
+    const int Sample_Count = 1'000'000;
+    int pdf_mismatch_count = 0;
+
+    RNG rng;
+    rng.init(0, 0x12345);
+
+    for (int i = 0; i < Sample_Count; i++) {
+        Vector2 u = rng.get_vector2();
+        float pdf;
+        Vector2 s = sampler.sample(u, &pdf);
+        if (std::abs(pdf - sampler.pdf_uv(s)) > 1e-5f * pdf)
+            pdf_mismatch_count++;
+
+        int x = int(s[0] * nx);
+        ASSERT(x < nx);
+        int y = int(s[1] * ny);
+        ASSERT(y < ny);
+        buckets[y*nx + x]++;
+    }
+
+    const float error_tolerance = 0.1f;
+    int failures = 0;
+    for (int i = 0; i < int(buckets.size()); i++) {
+        int bucket_estimate = int(values[i] / sum * Sample_Count);
+        int bucket_max_deviation = int(bucket_estimate * error_tolerance);
+        if (std::abs(bucket_estimate - buckets[i]) > bucket_max_deviation)
+            failures++;
+    }
+
+    const float fail_threshold = 0.02f;
+
+    printf("Failure count: %d, pdf mismatch count: %d\n", failures, pdf_mismatch_count);
+    printf("%s\n\n", (failures <= int(buckets.size() * fail_threshold) && pdf_mismatch_count == 0) ? "PASSED" : "FAILED");
+}
+
+void test_guiding_quadtree_sampling() {
+    printf("Testing path guiding quadtree sampling...\n");
+
+    // Three levels of nodes, some quadrants have no energy.
+    Guiding_Quadtree quadtree;
+    quadtree.nodes.resize(3);
+    quadtree.nodes[0] = Guiding_Quadtree_Node{ {1.f, 0.f, 2.f, 3.f}, {0, 0, 0, 1} };
+    quadtree.nodes[1] = Guiding_Quadtree_Node{ {0.f, 1.5f, 0.5f, 1.f}, {0, 2, 0, 0} };
+    quadtree.nodes[2] = Guiding_Quadtree_Node{ {1.f, 0.f, 0.f, 0.5f}, {0, 0, 0, 0} };
+    quadtree.total_sum = 6.f;
+
+    // The same cylindrical equal-area mapping as used by the quadtree. The grid cells match
+    // the deepest quadtree level, so the pdf is constant inside each cell.
+    const int grid_size = 8;
+    auto get_cell_index = [grid_size](const Vector3& d) {
+        float phi = std::atan2(d.y, d.x);
+        if (phi < 0.f)
+            phi += Pi2;
+        int x = std::min(int((std::clamp(d.z, -1.f, 1.f) + 1.f) * 0.5f * grid_size), grid_size - 1);
+        int y = std::min(int(phi / Pi2 * grid_size), grid_size - 1);
+        return y * grid_size + x;
+    };
+
+    std::vector<int> buckets(grid_size * grid_size, 0);
+    const int Sample_Count = 1'000'000;
+    int zero_pdf_sample_count = 0;
+    double pdf_integral = 0.0;
+
+    RNG rng;
+    rng.init(0, 0x12345);
+
+    for (int i = 0; i < Sample_Count; i++) {
+        Vector3 d = quadtree.sample(rng.get_vector2());
+        ASSERT(std::abs(d.length() - 1.f) < 1e-3f);
+        if (quadtree.pdf(d) == 0.f)
+            zero_pdf_sample_count++;
+        buckets[get_cell_index(d)]++;
+
+        // The pdf should integrate to 1 over the sphere.
+        pdf_integral += quadtree.pdf(sample_sphere_uniform(rng.get_vector2())) * (4.0 * Pi) / Sample_Count;
+    }
+
+    const float error_tolerance = 0.1f;
+    int failures = 0;
+    for (int y = 0; y < grid_size; y++) {
+        for (int x = 0; x < grid_size; x++) {
+            float cos_theta = 2.f * (x + 0.5f) / grid_size - 1.f;
+            float sin_theta = std::sqrt(1.f - cos_theta * cos_theta);
+            float phi = Pi2 * (y + 0.5f) / grid_size;
+            Vector3 cell_center(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+
+            // The cell area is 4Pi / cell_count (equal-area mapping).
+            float cell_probability = quadtree.pdf(cell_center) * (4.f * Pi) / float(grid_size * grid_size);
+            int bucket_estimate = int(cell_probability * Sample_Count);
+            int bucket_max_deviation = int(bucket_estimate * error_tolerance);
+            if (std::abs(bucket_estimate - buckets[y * grid_size + x]) > bucket_max_deviation)
+                failures++;
+        }
+    }
+
+    const float fail_threshold = 0.02f;
+    const bool pdf_integral_ok = std::abs(pdf_integral - 1.0) < 0.01;
+
+    printf("Failure count: %d, zero pdf sample count: %d, pdf integral: %.4f\n", failures, zero_pdf_sample_count, pdf_integral);
+    printf("%s\n\n", (failures <= int(buckets.size() * fail_threshold) && zero_pdf_sample_count == 0 && pdf_integral_ok) ? "PASSED" : "FAILED");
+}
+
 void test_sampling() {
     test_uniform_sphere_sampling();
     test_uniform_hemisphere_sampling();
@@ -411,4 +587,7 @@ void test_sampling() {
     test_non_uniform_cdf_sampling();
     test_uniform_2d_distribution_sampling();
     test_non_uniform_2d_distribution_sampling();
+    test_alias_1d_distribution_sampling();
+    test_hierarchical_2d_distribution_sampling();
+    test_guiding_quadtree_sampling();
 }
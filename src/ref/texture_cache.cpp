@@ -0,0 +1,408 @@
+#include "std.h"
+#include "lib/common.h"
+#include "texture_cache.h"
+
+#ifdef _WIN32
+#include <process.h>
+static int get_process_id() { return _getpid(); }
+#else
+#include <unistd.h>
+static int get_process_id() { return (int)getpid(); }
+#endif
+
+namespace {
+struct Resident_Tile {
+    const Cached_Texture* texture = nullptr;
+    int tile_index = -1;
+    Texture_Tile* tile = nullptr;
+    uint32_t age = 0; // initialized during eviction
+};
+
+struct Retired_Tile {
+    uint64_t retire_epoch = 0;
+    Texture_Tile* tile = nullptr;
+};
+
+constexpr int Max_Thread_Slots = 2048;
+constexpr int Max_Open_Cache_Files_Per_Thread = 4;
+
+struct Texture_Cache {
+    uint64_t memory_budget = 0;
+    std::atomic_uint64_t used_memory{ 0 };
+    uint64_t peak_used_memory = 0;
+    std::atomic_uint64_t tile_load_count{ 0 };
+    uint64_t tile_eviction_count = 0;
+    std::atomic_uint64_t load_time_ns{ 0 };
+
+    std::mutex mutex; // protects resident/retired tile lists and statistics
+    std::vector<Resident_Tile> resident_tiles;
+    std::vector<Retired_Tile> retired_tiles;
+
+    // Epoch based reclamation of evicted tiles. Each thread that is inside an access scope
+    // publishes the epoch when the scope was entered. The tile retired at epoch E can be
+    // released when all active threads have entered their scopes after E.
+    std::atomic_uint64_t epoch{ 1 };
+    std::atomic_uint64_t thread_epochs[Max_Thread_Slots]; // 0 - thread is not inside access scope
+    std::atomic_bool thread_slot_used[Max_Thread_Slots];
+};
+
+struct Thread_Slot {
+    int index = -1;
+    int scope_depth = 0;
+
+    ~Thread_Slot();
+};
+
+struct Open_Cache_File {
+    uint64_t texture_id = 0;
+    std::ifstream file;
+};
+}
+
+static Texture_Cache texture_cache;
+static thread_local Thread_Slot thread_slot;
+
+// Each thread keeps the recently used cache files open, so the tile loads do not reopen the files.
+// The most recently used file is the last one.
+static thread_local std::vector<Open_Cache_File> open_cache_files;
+static std::atomic_uint64_t texture_id_counter{ 0 };
+
+std::atomic_uint32_t texture_cache_access_time{ 0 };
+
+Thread_Slot::~Thread_Slot()
+{
+    if (index >= 0) {
+        texture_cache.thread_epochs[index].store(0);
+        texture_cache.thread_slot_used[index].store(false);
+    }
+}
+
+static int acquire_thread_slot()
+{
+    for (int i = 0; i < Max_Thread_Slots; i++) {
+        bool expected = false;
+        if (texture_cache.thread_slot_used[i].compare_exchange_strong(expected, true))
+            return i;
+    }
+    error("acquire_thread_slot: too many threads use texture cache");
+    return -1;
+}
+
+void initialize_texture_cache(uint64_t memory_budget)
+{
+    texture_cache.memory_budget = memory_budget;
+}
+
+Texture_Cache_Stats get_texture_cache_stats()
+{
+    std::lock_guard<std::mutex> lock(texture_cache.mutex);
+    Texture_Cache_Stats stats;
+    stats.memory_budget = texture_cache.memory_budget;
+    stats.peak_used_memory = texture_cache.peak_used_memory;
+    stats.tile_load_count = texture_cache.tile_load_count.load();
+    stats.tile_eviction_count = texture_cache.tile_eviction_count;
+    stats.load_time = double(texture_cache.load_time_ns.load()) * 1e-9;
+    return stats;
+}
+
+Texture_Cache_Access_Scope::Texture_Cache_Access_Scope()
+{
+    if (thread_slot.scope_depth++ == 0) {
+        if (thread_slot.index < 0) {
+            thread_slot.index = acquire_thread_slot();
+        }
+        texture_cache.thread_epochs[thread_slot.index].store(texture_cache.epoch.load());
+        // Tile pointers can't be read before the epoch is published.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+Texture_Cache_Access_Scope::~Texture_Cache_Access_Scope()
+{
+    ASSERT(thread_slot.scope_depth > 0);
+    if (--thread_slot.scope_depth == 0) {
+        texture_cache.thread_epochs[thread_slot.index].store(0, std::memory_order_release);
+    }
+}
+
+// Should be called with texture_cache.mutex locked.
+static void release_retired_tiles()
+{
+    uint64_t min_active_epoch = std::numeric_limits<uint64_t>::max();
+    for (const std::atomic_uint64_t& thread_epoch : texture_cache.thread_epochs) {
+        uint64_t e = thread_epoch.load();
+        if (e != 0)
+            min_active_epoch = std::min(min_active_epoch, e);
+    }
+    auto it = std::remove_if(texture_cache.retired_tiles.begin(), texture_cache.retired_tiles.end(),
+        [min_active_epoch](const Retired_Tile& retired_tile) {
+            if (retired_tile.retire_epoch < min_active_epoch) {
+                delete retired_tile.tile;
+                return true;
+            }
+            return false;
+        });
+    texture_cache.retired_tiles.erase(it, texture_cache.retired_tiles.end());
+}
+
+// Should be called with texture_cache.mutex locked.
+static void evict_least_recently_used_tiles()
+{
+    // Evict more than necessary, so eviction does not happen on each tile load.
+    const uint64_t target_memory = texture_cache.memory_budget - texture_cache.memory_budget / 10;
+
+    // The ages are computed once, the access times can be updated concurrently by other threads.
+    // Unsigned arithmetic handles time counter wrap-around.
+    const uint32_t current_time = texture_cache_access_time.fetch_add(1);
+    for (Resident_Tile& resident_tile : texture_cache.resident_tiles)
+        resident_tile.age = current_time - resident_tile.tile->last_access_time.load(std::memory_order_relaxed);
+
+    // Move the oldest tiles to the front without sorting all resident tiles. The number of tiles
+    // to evict is estimated assuming full size tiles, it's refined if the tiles are smaller.
+    const uint64_t full_tile_memory = Texture_Tile_Size * Texture_Tile_Size * sizeof(ColorRGB);
+    std::vector<Resident_Tile>& resident_tiles = texture_cache.resident_tiles;
+    size_t evicted_count = 0;
+    while (evicted_count < resident_tiles.size() && texture_cache.used_memory > target_memory) {
+        const uint64_t excess_memory = texture_cache.used_memory - target_memory;
+        const size_t count = std::min(resident_tiles.size() - evicted_count,
+            size_t((excess_memory + full_tile_memory - 1) / full_tile_memory));
+
+        std::nth_element(resident_tiles.begin() + evicted_count, resident_tiles.begin() + evicted_count + count - 1,
+            resident_tiles.end(), [](const Resident_Tile& a, const Resident_Tile& b) { return a.age > b.age; });
+
+        for (size_t i = evicted_count; i < evicted_count + count; i++) {
+            const Resident_Tile& resident_tile = resident_tiles[i];
+            resident_tile.texture->tiles[resident_tile.tile_index].store(nullptr, std::memory_order_relaxed);
+            texture_cache.used_memory -= resident_tile.tile->texels.size() * sizeof(ColorRGB);
+            texture_cache.retired_tiles.push_back(Retired_Tile{ 0, resident_tile.tile });
+        }
+        evicted_count += count;
+    }
+
+    // The threads that enter access scope after this point can't see evicted tiles.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const uint64_t retire_epoch = texture_cache.epoch.fetch_add(1);
+
+    for (size_t i = texture_cache.retired_tiles.size() - evicted_count; i < texture_cache.retired_tiles.size(); i++) {
+        texture_cache.retired_tiles[i].retire_epoch = retire_epoch;
+    }
+    texture_cache.resident_tiles.erase(texture_cache.resident_tiles.begin(), texture_cache.resident_tiles.begin() + evicted_count);
+    texture_cache.tile_eviction_count += evicted_count;
+
+    release_retired_tiles();
+}
+
+// Returns the cache file stream of the texture that is owned by the current thread.
+static std::ifstream& get_cache_file_stream(uint64_t texture_id, const fs::path& cache_file)
+{
+    for (size_t i = 0; i < open_cache_files.size(); i++) {
+        if (open_cache_files[i].texture_id == texture_id) {
+            std::rotate(open_cache_files.begin() + i, open_cache_files.begin() + i + 1, open_cache_files.end());
+            return open_cache_files.back().file;
+        }
+    }
+    if (open_cache_files.size() == Max_Open_Cache_Files_Per_Thread)
+        open_cache_files.erase(open_cache_files.begin());
+
+    Open_Cache_File& open_file = open_cache_files.emplace_back();
+    open_file.texture_id = texture_id;
+    open_file.file.open(cache_file, std::ios_base::in | std::ios_base::binary);
+    if (!open_file.file)
+        error("Cached_Texture::load_tile: failed to open file: %s", cache_file.string().c_str());
+    return open_file.file;
+}
+
+static void add_resident_tile(const Cached_Texture* texture, int tile_index, Texture_Tile* tile)
+{
+    std::lock_guard<std::mutex> lock(texture_cache.mutex);
+    texture_cache.resident_tiles.push_back(Resident_Tile{ texture, tile_index, tile });
+
+    uint64_t used_memory = (texture_cache.used_memory += tile->texels.size() * sizeof(ColorRGB));
+    texture_cache.peak_used_memory = std::max(texture_cache.peak_used_memory, used_memory);
+
+    if (texture_cache.memory_budget != 0 && used_memory > texture_cache.memory_budget) {
+        evict_least_recently_used_tiles();
+    }
+}
+
+//
+// Cache file format:
+// uint32_t mip_count
+// int32_t width, int32_t height - for each mip level
+// tiles of mip level 0 (rows of tiles, top to bottom), tiles of mip level 1, ...
+//
+// The same cache file can be created concurrently by several processes (distributed rendering)
+// or by several textures that reference the same image. Each writer uses its own temp file and
+// the failed rename is not an error if another writer has already created the complete file.
+static void write_texture_cache_file(const fs::path& cache_file, const std::vector<Image>& mips)
+{
+    static std::atomic_int temp_file_counter{ 0 };
+    fs::path temp_file = cache_file;
+    temp_file += "." + std::to_string(get_process_id()) + "-" + std::to_string(temp_file_counter++) + ".temp";
+
+    uint64_t file_size = sizeof(uint32_t) + mips.size() * 2 * sizeof(int32_t);
+    for (const Image& mip : mips)
+        file_size += uint64_t(mip.width) * mip.height * sizeof(ColorRGB);
+    {
+        std::ofstream file(temp_file, std::ios_base::out | std::ios_base::binary);
+        if (!file)
+            error("write_texture_cache_file: failed to open file for writing: %s", temp_file.string().c_str());
+
+        uint32_t mip_count = (uint32_t)mips.size();
+        file.write(reinterpret_cast<const char*>(&mip_count), sizeof(uint32_t));
+        for (const Image& mip : mips) {
+            file.write(reinterpret_cast<const char*>(&mip.width), sizeof(int32_t));
+            file.write(reinterpret_cast<const char*>(&mip.height), sizeof(int32_t));
+        }
+        for (const Image& mip : mips) {
+            for (int tile_y = 0; tile_y < mip.height; tile_y += Texture_Tile_Size) {
+                for (int tile_x = 0; tile_x < mip.width; tile_x += Texture_Tile_Size) {
+                    int tile_width = std::min(Texture_Tile_Size, mip.width - tile_x);
+                    int tile_height = std::min(Texture_Tile_Size, mip.height - tile_y);
+                    for (int y = tile_y; y < tile_y + tile_height; y++) {
+                        file.write(reinterpret_cast<const char*>(&mip.data[y * mip.width + tile_x]), tile_width * sizeof(ColorRGB));
+                    }
+                }
+            }
+        }
+        if (file.fail())
+            error("write_texture_cache_file: failed to write texture data: %s", temp_file.string().c_str());
+    }
+    if (!fs_rename(temp_file, cache_file)) {
+        std::error_code ec;
+        const bool cache_file_exists = fs::file_size(cache_file, ec) == file_size && !ec;
+        fs::remove(temp_file, ec);
+        if (!cache_file_exists)
+            error("write_texture_cache_file: failed to rename %s", temp_file.string().c_str());
+    }
+}
+
+fs::path get_texture_cache_file(const fs::path& cache_directory, const std::string& image_path,
+    const Image_Texture::Init_Params& params)
+{
+    std::error_code ec;
+    uint64_t file_size = fs::file_size(image_path, ec);
+    int64_t write_time = fs::last_write_time(image_path, ec).time_since_epoch().count();
+
+    size_t hash = 0;
+    hash_combine(hash, to_lower(image_path));
+    hash_combine(hash, file_size);
+    hash_combine(hash, write_time);
+    hash_combine(hash, params.generate_mips);
+    hash_combine(hash, static_cast<int>(params.mip_filter));
+    hash_combine(hash, params.decode_srgb);
+    hash_combine(hash, params.scale);
+
+    char hash_str[32];
+    snprintf(hash_str, sizeof(hash_str), "%016" PRIx64, (uint64_t)hash);
+    std::string file_name = std::string(hash_str) + "-" + fs::path(image_path).filename().string() + ".tiles";
+    return cache_directory / file_name;
+}
+
+Cached_Texture::~Cached_Texture()
+{
+    if (!tiles)
+        return;
+    std::lock_guard<std::mutex> lock(texture_cache.mutex);
+    auto it = std::remove_if(texture_cache.resident_tiles.begin(), texture_cache.resident_tiles.end(),
+        [this](const Resident_Tile& resident_tile) {
+            if (resident_tile.texture == this) {
+                texture_cache.used_memory -= resident_tile.tile->texels.size() * sizeof(ColorRGB);
+                delete resident_tile.tile;
+                return true;
+            }
+            return false;
+        });
+    texture_cache.resident_tiles.erase(it, texture_cache.resident_tiles.end());
+    release_retired_tiles();
+}
+
+void Cached_Texture::load()
+{
+    if (loaded.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> lock(load_mutex);
+    if (loaded.load(std::memory_order_relaxed))
+        return;
+
+    Timestamp t_load;
+    if (!fs_exists(cache_file)) {
+        Image_Texture texture;
+        texture.initialize_from_file(image_path, init_params);
+        write_texture_cache_file(cache_file, texture.get_mips());
+    }
+
+    std::ifstream file(cache_file, std::ios_base::in | std::ios_base::binary);
+    if (!file)
+        error("Cached_Texture::load: failed to open file: %s", cache_file.string().c_str());
+
+    uint32_t mip_count = 0;
+    file.read(reinterpret_cast<char*>(&mip_count), sizeof(uint32_t));
+    mips.resize(mip_count);
+
+    uint64_t offset = sizeof(uint32_t) + mip_count * 2 * sizeof(int32_t);
+    int tile_count = 0;
+    for (Cached_Mip_Level& level : mips) {
+        file.read(reinterpret_cast<char*>(&level.width), sizeof(int32_t));
+        file.read(reinterpret_cast<char*>(&level.height), sizeof(int32_t));
+        level.tile_count_x = (level.width + Texture_Tile_Size - 1) / Texture_Tile_Size;
+        level.tile_count_y = (level.height + Texture_Tile_Size - 1) / Texture_Tile_Size;
+        level.first_tile_index = tile_count;
+        tile_count += level.tile_count_x * level.tile_count_y;
+
+        for (int tile_y = 0; tile_y < level.tile_count_y; tile_y++) {
+            for (int tile_x = 0; tile_x < level.tile_count_x; tile_x++) {
+                int tile_width = std::min(Texture_Tile_Size, level.width - tile_x * Texture_Tile_Size);
+                int tile_height = std::min(Texture_Tile_Size, level.height - tile_y * Texture_Tile_Size);
+                tile_file_offsets.push_back(offset);
+                offset += tile_width * tile_height * sizeof(ColorRGB);
+            }
+        }
+    }
+    if (file.fail())
+        error("Cached_Texture::load: failed to read texture cache header: %s", cache_file.string().c_str());
+
+    tiles = std::make_unique<std::atomic<Texture_Tile*>[]>(tile_count);
+    id = ++texture_id_counter;
+    texture_cache.load_time_ns += elapsed_nanoseconds(t_load);
+    loaded.store(true, std::memory_order_release);
+}
+
+Texture_Tile* Cached_Texture::load_tile(int tile_index) const
+{
+    ASSERT(thread_slot.scope_depth > 0);
+
+    const Cached_Mip_Level* level = &mips[0];
+    while (level + 1 < mips.data() + mips.size() && tile_index >= (level + 1)->first_tile_index)
+        level++;
+
+    int local_tile_index = tile_index - level->first_tile_index;
+    int tile_x = local_tile_index % level->tile_count_x;
+    int tile_y = local_tile_index / level->tile_count_x;
+
+    Texture_Tile* tile = new Texture_Tile;
+    tile->width = std::min(Texture_Tile_Size, level->width - tile_x * Texture_Tile_Size);
+    tile->height = std::min(Texture_Tile_Size, level->height - tile_y * Texture_Tile_Size);
+    tile->last_access_time.store(texture_cache_access_time.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    tile->texels.resize(tile->width * tile->height);
+    {
+        Timestamp t_load;
+        std::ifstream& file = get_cache_file_stream(id, cache_file);
+        file.seekg(tile_file_offsets[tile_index]);
+        file.read(reinterpret_cast<char*>(tile->texels.data()), tile->texels.size() * sizeof(ColorRGB));
+        if (file.fail())
+            error("Cached_Texture::load_tile: failed to read tile data: %s", cache_file.string().c_str());
+        texture_cache.load_time_ns += elapsed_nanoseconds(t_load);
+    }
+
+    // Another thread could load the same tile concurrently.
+    Texture_Tile* expected = nullptr;
+    if (!tiles[tile_index].compare_exchange_strong(expected, tile, std::memory_order_acq_rel)) {
+        delete tile;
+        return expected;
+    }
+    texture_cache.tile_load_count++;
+    add_resident_tile(this, tile_index, tile);
+    return tile;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "image_texture.h"
+
+// Texture cache provides on-demand residency of texture data.
+//
+// The texture is not loaded until its texels are accessed for the first time. On first access
+// the image is decoded, mips are generated and the mip pyramid is stored in the tiled cache file
+// (the file is reused by the subsequent runs). After that the texture data is streamed from the
+// cache file with tile granularity. The tiles are shared by all threads. When the memory used by
+// the tiles exceeds the memory budget the least recently used tiles are evicted.
+//
+// The tile can be evicted while another thread is reading it, that's why the tiles are accessed
+// only inside Texture_Cache_Access_Scope and the evicted tiles are released only when all threads
+// that could reference them have left their access scopes.
+
+constexpr int Texture_Tile_Size_Log2 = 6;
+constexpr int Texture_Tile_Size = 1 << Texture_Tile_Size_Log2;
+
+// memory_budget: max memory size in bytes used by the tiles, 0 means unlimited.
+void initialize_texture_cache(uint64_t memory_budget);
+
+struct Texture_Cache_Stats {
+    uint64_t memory_budget = 0;
+    uint64_t peak_used_memory = 0;
+    uint64_t tile_load_count = 0;
+    uint64_t tile_eviction_count = 0;
+    // Time spent in texture decoding and tile loading, summed over all threads (seconds).
+    double load_time = 0.0;
+};
+Texture_Cache_Stats get_texture_cache_stats();
+
+// Logical time that is advanced by each eviction. Used to find the least recently used tiles.
+extern std::atomic_uint32_t texture_cache_access_time;
+
+struct Texture_Cache_Access_Scope {
+    Texture_Cache_Access_Scope();
+    ~Texture_Cache_Access_Scope();
+};
+
+struct Texture_Tile {
+    int width = 0;
+    int height = 0;
+    std::atomic_uint32_t last_access_time;
+    std::vector<ColorRGB> texels;
+};
+
+struct Cached_Mip_Level {
+    int width = 0;
+    int height = 0;
+    int tile_count_x = 0;
+    int tile_count_y = 0;
+    int first_tile_index = 0; // index of the first tile of this level in Cached_Texture::tiles
+};
+
+struct Cached_Texture {
+    std::string image_path;
+    Image_Texture::Init_Params init_params;
+    fs::path cache_file;
+
+    // The fields below are initialized on first access.
+    std::atomic_bool loaded{ false };
+    std::mutex load_mutex;
+    uint64_t id = 0; // unique among all cached textures, identifies the open cache files
+    std::vector<Cached_Mip_Level> mips;
+    std::vector<uint64_t> tile_file_offsets;
+    std::unique_ptr<std::atomic<Texture_Tile*>[]> tiles;
+
+    ~Cached_Texture();
+
+    void load();
+
+    // Can be called only inside Texture_Cache_Access_Scope.
+    ColorRGB get_texel(int mip_level, int x, int y) const {
+        ASSERT(loaded.load(std::memory_order_relaxed));
+        const Cached_Mip_Level& level = mips[mip_level];
+        ASSERT(x >= 0 && x < level.width);
+        ASSERT(y >= 0 && y < level.height);
+
+        int tile_x = x >> Texture_Tile_Size_Log2;
+        int tile_y = y >> Texture_Tile_Size_Log2;
+        int tile_index = level.first_tile_index + tile_y * level.tile_count_x + tile_x;
+
+        Texture_Tile* tile = tiles[tile_index].load(std::memory_order_acquire);
+        if (tile == nullptr) {
+            tile = load_tile(tile_index);
+        }
+        mark_tile_access(tile);
+
+        int local_x = x & (Texture_Tile_Size - 1);
+        int local_y = y & (Texture_Tile_Size - 1);
+        return tile->texels[local_y * tile->width + local_x];
+    }
+
+private:
+    Texture_Tile* load_tile(int tile_index) const;
+
+    static void mark_tile_access(Texture_Tile* tile) {
+        // Avoid writing to the shared cache line when the tile was already accessed during current time period.
+        uint32_t time = texture_cache_access_time.load(std::memory_order_relaxed);
+        if (tile->last_access_time.load(std::memory_order_relaxed) != time) {
+            tile->last_access_time.store(time, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Returns the path of the tiled cache file for the given texture.
+// The cache file name depends on the texture parameters and on the image file timestamp.
+fs::path get_texture_cache_file(const fs::path& cache_directory, const std::string& image_path,
+    const Image_Texture::Init_Params& params);
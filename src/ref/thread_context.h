@@ -1,6 +1,8 @@
 #pragma once
 
+#include "path_guiding.h"
 #include "pixel_sampling.h"
+#include "ray_stats.h"
 #include "shading_context.h"
 
 #include "lib/utils.h" // Memory_Pool
@@ -10,6 +12,28 @@ struct Path_Context {
     int perfect_specular_bounce_count = 0;
 };
 
+// The path vertex where the continuation direction was sampled. During the path guiding
+// training the radiance that arrives to the vertex from that direction is recorded.
+struct Guiding_Vertex {
+    Vector3 position;
+    Vector3 direction;
+    float pdf = 0.f;
+    ColorRGB path_coeff; // path coefficient after the vertex, the later contributions are divided by it
+    ColorRGB incident_radiance;
+};
+
+// Properties of the surface point hit by the camera ray. They are collected when
+// the film AOVs are enabled and do not require additional rays or random numbers.
+struct First_Hit_Info {
+    bool ray_traced = false; // true after the first trace_ray call of the sample (camera ray)
+    bool hit_found = false;
+    bool albedo_initialized = false;
+    float distance = 0.f; // distance from the camera ray origin
+    Vector3 normal; // shading normal
+    Material_Handle material;
+    ColorRGB albedo; // single sample estimate of the bsdf albedo
+};
+
 struct Thread_Context {
     Thread_Context(const Scene_Context& scene_context) : scene_context(scene_context) {}
 
@@ -17,10 +41,21 @@ struct Thread_Context {
 
     Memory_Pool memory_pool;
     RNG rng;
-    Stratified_Pixel_Sampler pixel_sampler;
+    RNG_8x rng_8x;
+    Pixel_Sampler pixel_sampler;
     Path_Context path_context;
     Shading_Context shading_context;
 
+    bool collect_first_hit_info = false;
+    First_Hit_Info first_hit_info; // reset for each pixel sample
+
+    Ray_Stats ray_stats;
+
+    // Not null if path guiding is enabled. The guiding vertices are collected only during the training.
+    Path_Guiding* path_guiding = nullptr;
+    bool path_guiding_training = false;
+    std::vector<Guiding_Vertex> guiding_vertices;
+
     // TODO: until we implement proper handling of nested dielectrics we make assumption
     // that we don't have nested dielectrics and after we start tracing inside dielectric
     // the only possible hit can be with the same dielectric material for exit event. Here